@@ -228,6 +228,18 @@ case "$1" in
             listunspent)
                 arnak_rpc zcbenchmark listunspent 10
                 ;;
+            rollingbloomfilter)
+                arnak_rpc zcbenchmark rollingbloomfilter 10 "${@:3}"
+                ;;
+            readblocks)
+                arnak_rpc zcbenchmark readblocks 10 "${@:3}"
+                ;;
+            decompressblocks)
+                arnak_rpc zcbenchmark decompressblocks 10 "${@:3}"
+                ;;
+            mempooladdressindex)
+                arnak_rpc zcbenchmark mempooladdressindex 10 "${@:3}"
+                ;;
             *)
                 arnakd_stop
                 echo "Bad arguments to time."
@@ -46,6 +46,8 @@ testScripts=(
     'mempool_reorg.py'
     'mempool_nu_activation.py'
     'mempool_tx_expiry.py'
+    'mempool_persist.py'
+    'txreconciliation.py'
     'httpbasics.py'
     'zapwallettxes.py'
     'proxy_test.py'
@@ -60,6 +62,7 @@ testScripts=(
     'addressindex.py'
     'spentindex.py'
     'timestampindex.py'
+    'insightindex.py'
     'decodescript.py'
     'blockchain.py'
     'disablewallet.py'
@@ -316,6 +316,51 @@ class AddressIndexTest(BitcoinTestFramework):
         block_hash = self.nodes[1].getblockhash(111)
         assert_equal(deltas_info['end']['hash'], block_hash)
 
+        # Page through the deltas and txids two at a time
+        paged_deltas = []
+        page = self.nodes[1].getaddressdeltas({'addresses': [addr1], 'limit': 2})
+        while True:
+            assert(len(page['deltas']) <= 2)
+            paged_deltas += page['deltas']
+            if 'cursor' not in page:
+                break
+            page = self.nodes[1].getaddressdeltas({
+                'addresses': [addr1],
+                'limit': 2,
+                'cursor': page['cursor'],
+            })
+        assert_equal(paged_deltas, deltas)
+
+        paged_txids = []
+        page = self.nodes[1].getaddresstxids({'addresses': [addr1], 'limit': 2})
+        paged_txids += page['txids']
+        while 'cursor' in page:
+            page = self.nodes[1].getaddresstxids({
+                'addresses': [addr1],
+                'limit': 2,
+                'cursor': page['cursor'],
+            })
+            paged_txids += page['txids']
+        assert_equal(paged_txids, self.nodes[1].getaddresstxids(addr1))
+
+        # Pages of several addresses follow the merged height order
+        addrs = [addr1, addr_p2sh, addr_p2pkh]
+        all_deltas = self.nodes[1].getaddressdeltas({'addresses': addrs})
+        heights = [d['height'] for d in all_deltas]
+        assert_equal(heights, sorted(heights))
+        paged_deltas = []
+        cursor = None
+        while True:
+            params = {'addresses': addrs, 'limit': 7}
+            if cursor is not None:
+                params['cursor'] = cursor
+            page = self.nodes[1].getaddressdeltas(params)
+            paged_deltas += page['deltas']
+            if 'cursor' not in page:
+                break
+            cursor = page['cursor']
+        assert_equal(paged_deltas, all_deltas)
+
         # Test getaddressutxos by comparing results with deltas
         utxos = self.nodes[1].getaddressutxos(addr1)
 
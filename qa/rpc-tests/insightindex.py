@@ -0,0 +1,85 @@
+#!/usr/bin/env python
+# Copyright (c) 2019 The Arnak developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+#
+# Test enabling insightexplorer on an existing database, which builds the
+# indexes in the background instead of requiring -reindex
+
+import sys; assert sys.version_info < (3,), ur"This script does not run under Python 3. Please use Python 2.7.x."
+
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+
+from test_framework.util import (
+    assert_equal,
+    initialize_chain_clean,
+    start_node,
+    start_nodes,
+    stop_node,
+    connect_nodes,
+)
+
+from test_framework.mininode import COIN
+
+
+class InsightIndexTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        # Node 1 starts without the insight indexes
+        self.nodes = start_nodes(2, self.options.tmpdir, [
+            ['-debug', '-txindex', '-experimentalfeatures', '-insightexplorer'],
+            ['-debug', '-txindex'],
+        ])
+        connect_nodes(self.nodes[0], 1)
+
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        self.nodes[0].generate(105)
+        self.sync_all()
+
+        addr1 = self.nodes[1].getnewaddress()
+        txid = self.nodes[0].sendtoaddress(addr1, 2)
+        self.sync_all()
+        self.nodes[0].generate(1)
+        self.sync_all()
+        assert('insightindex' not in self.nodes[1].getblockchaininfo())
+
+        # Enable the indexes without -reindex
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir,
+            ['-debug', '-txindex', '-experimentalfeatures', '-insightexplorer'])
+        connect_nodes(self.nodes[0], 1)
+        for i in range(100):
+            info = self.nodes[1].getblockchaininfo()['insightindex']
+            if info['ready']:
+                break
+            time.sleep(0.1)
+        assert_equal(info['ready'], True)
+        assert_equal(info['height'], 106)
+
+        # The built indexes match those of the node that always had them
+        for node in self.nodes:
+            assert_equal(node.getaddresstxids(addr1), [txid])
+            assert_equal(node.getaddressbalance(addr1)['balance'], 2 * COIN)
+        assert_equal(self.nodes[1].getaddressdeltas(addr1), self.nodes[0].getaddressdeltas(addr1))
+        assert_equal(self.nodes[1].getaddressutxos(addr1), self.nodes[0].getaddressutxos(addr1))
+
+        # New blocks are indexed by the node as they are connected
+        self.nodes[1].sendtoaddress(self.nodes[0].getnewaddress(), 1)
+        self.sync_all()
+        self.nodes[0].generate(1)
+        self.sync_all()
+        assert_equal(self.nodes[1].getaddressdeltas(addr1), self.nodes[0].getaddressdeltas(addr1))
+        assert_equal(self.nodes[1].getaddressutxos(addr1), self.nodes[0].getaddressutxos(addr1))
+
+
+if __name__ == '__main__':
+    InsightIndexTest().main()
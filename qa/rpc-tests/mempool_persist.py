@@ -0,0 +1,64 @@
+#!/usr/bin/env python
+# Copyright (c) 2019 The Arnak developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#
+# Test that the mempool is saved to mempool.dat on shutdown and
+# reloaded on startup, unless -persistmempool=0 is given.
+#
+# The transactions only involve node 0's wallet, so that node 1, whose
+# mempool is restarted, cannot recover them from its own wallet.
+#
+
+import sys; assert sys.version_info < (3,), ur"This script does not run under Python 3. Please use Python 2.7.x."
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, start_node, stop_node, \
+    connect_nodes_bi, wait_bitcoinds
+
+import time
+
+
+class MempoolPersistTest(BitcoinTestFramework):
+
+    def setup_network(self):
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir))
+        self.nodes.append(start_node(1, self.options.tmpdir))
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def wait_for_mempool_size(self, node, size, timeout=60):
+        deadline = time.time() + timeout
+        while len(node.getrawmempool()) != size and time.time() < deadline:
+            time.sleep(0.5)
+        assert_equal(len(node.getrawmempool()), size)
+
+    def run_test(self):
+        taddr = self.nodes[0].getnewaddress()
+        txids = [ self.nodes[0].sendtoaddress(taddr, 1) for _ in range(5) ]
+        self.sync_all()
+        assert_equal(set(self.nodes[1].getrawmempool()), set(txids))
+
+        # Restart node 1 without peers; its mempool is reloaded from disk.
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir)
+        self.wait_for_mempool_size(self.nodes[1], len(txids))
+        assert_equal(set(self.nodes[1].getrawmempool()), set(txids))
+
+        # With -persistmempool=0 nothing is loaded, and the existing
+        # mempool.dat is left untouched on shutdown.
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-persistmempool=0"])
+        time.sleep(5)
+        assert_equal(len(self.nodes[1].getrawmempool()), 0)
+
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir)
+        self.wait_for_mempool_size(self.nodes[1], len(txids))
+
+
+if __name__ == '__main__':
+    MempoolPersistTest().main()
@@ -0,0 +1,58 @@
+#!/usr/bin/env python
+# Copyright (c) 2019 The Arnak developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#
+# Test transaction relay by set reconciliation (-txreconciliation).
+#
+# Nodes 0 and 1 both enable reconciliation and relay to each other with
+# sketches; node 2 does not, so node 1 keeps announcing to it with inv.
+#
+
+import sys; assert sys.version_info < (3,), ur"This script does not run under Python 3. Please use Python 2.7.x."
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, start_node, connect_nodes_bi
+
+
+class TxReconciliationTest(BitcoinTestFramework):
+
+    def setup_network(self):
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-txreconciliation", "-debug=net"]))
+        self.nodes.append(start_node(1, self.options.tmpdir, ["-txreconciliation", "-debug=net"]))
+        self.nodes.append(start_node(2, self.options.tmpdir))
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 1, 2)
+        self.is_network_split = False
+        self.sync_all()
+
+    def reconciling_peers(self, node):
+        return len([ p for p in node.getpeerinfo() if p['txreconciliation'] ])
+
+    def run_test(self):
+        # Reconciliation is only used where both ends enabled it.
+        assert_equal(self.reconciling_peers(self.nodes[0]), 2)
+        assert_equal(self.reconciling_peers(self.nodes[1]), 2)
+        assert_equal(self.reconciling_peers(self.nodes[2]), 0)
+
+        # Transactions from a reconciling node reach the legacy node ...
+        taddr = self.nodes[0].getnewaddress()
+        txids = [ self.nodes[0].sendtoaddress(taddr, 1) for _ in range(5) ]
+        self.sync_all()
+        for node in self.nodes:
+            assert_equal(set(node.getrawmempool()), set(txids))
+
+        # ... and transactions from the legacy node reach node 0.
+        self.nodes[0].generate(1)
+        self.sync_all()
+        taddr = self.nodes[2].getnewaddress()
+        txids = [ self.nodes[2].sendtoaddress(taddr, 1) for _ in range(5) ]
+        self.sync_all()
+        for node in self.nodes:
+            assert_equal(set(node.getrawmempool()), set(txids))
+
+
+if __name__ == '__main__':
+    TxReconciliationTest().main()
@@ -149,6 +149,11 @@ struct CAddressIndexKey {
         spending = false;
     }
 
+    friend bool operator==(const CAddressIndexKey& a, const CAddressIndexKey& b) {
+        return a.type == b.type && a.hashBytes == b.hashBytes &&
+            a.blockHeight == b.blockHeight && a.txindex == b.txindex &&
+            a.txhash == b.txhash && a.index == b.index && a.spending == b.spending;
+    }
 };
 
 struct CAddressIndexIteratorKey {
@@ -182,6 +187,47 @@ struct CAddressIndexIteratorKey {
         type = 0;
         hashBytes.SetNull();
     }
+
+    // Same order as the keys in LevelDB
+    friend bool operator<(const CAddressIndexIteratorKey& a, const CAddressIndexIteratorKey& b) {
+        if (a.type != b.type)
+            return a.type < b.type;
+        return a.hashBytes < b.hashBytes;
+    }
+};
+
+// The running balance of an address, keyed by CAddressIndexIteratorKey.
+// It equals the sum of the address's CAddressIndexKey entries, so that
+// getaddressbalance doesn't have to read them all.
+struct CAddressBalanceValue {
+    CAmount balance;
+    CAmount received;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(balance);
+        READWRITE(received);
+    }
+
+    CAddressBalanceValue(CAmount balanceIn, CAmount receivedIn) {
+        balance = balanceIn;
+        received = receivedIn;
+    }
+
+    CAddressBalanceValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        balance = 0;
+        received = 0;
+    }
+
+    bool IsNull() const {
+        return balance == 0 && received == 0;
+    }
 };
 
 struct CAddressIndexIteratorHeightKey {
@@ -0,0 +1,161 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockcompression.h"
+
+#include <string.h>
+
+namespace {
+
+const int MIN_MATCH = 4;
+//! The last 5 bytes are always literals, and no match starts in the last 12.
+const size_t LAST_LITERALS = 5;
+const size_t MATCH_LIMIT = 12;
+const size_t MAX_OFFSET = 65535;
+const int HASH_BITS = 16;
+//! After 2^SKIP_BITS positions without a match the search step grows by one.
+const int SKIP_BITS = 6;
+
+inline uint32_t Read32(const unsigned char* p)
+{
+    uint32_t n;
+    memcpy(&n, p, sizeof(n));
+    return n;
+}
+
+inline uint32_t Hash4(uint32_t n)
+{
+    return (n * 2654435761U) >> (32 - HASH_BITS);
+}
+
+void WriteLength(std::vector<char>& vOut, size_t nLength)
+{
+    for (; nLength >= 255; nLength -= 255)
+        vOut.push_back((char)255);
+    vOut.push_back((char)nLength);
+}
+
+void WriteSequence(std::vector<char>& vOut, const unsigned char* pLiterals, size_t nLiterals, size_t nOffset, size_t nMatch)
+{
+    size_t nToken = vOut.size();
+    vOut.push_back((char)((nLiterals < 15 ? nLiterals : 15) << 4));
+    if (nLiterals >= 15)
+        WriteLength(vOut, nLiterals - 15);
+    vOut.insert(vOut.end(), (const char*)pLiterals, (const char*)pLiterals + nLiterals);
+    if (nMatch == 0)
+        return;
+
+    vOut.push_back((char)(nOffset & 0xff));
+    vOut.push_back((char)(nOffset >> 8));
+    nMatch -= MIN_MATCH;
+    vOut[nToken] |= (char)(nMatch < 15 ? nMatch : 15);
+    if (nMatch >= 15)
+        WriteLength(vOut, nMatch - 15);
+}
+
+bool ReadLength(const unsigned char*& p, const unsigned char* pend, size_t& nLength)
+{
+    unsigned char ch;
+    do {
+        if (p == pend)
+            return false;
+        ch = *p++;
+        nLength += ch;
+    } while (ch == 255);
+    return true;
+}
+
+} // anon namespace
+
+size_t MaxCompressedSize(size_t nSize)
+{
+    return nSize + nSize / 255 + 16;
+}
+
+void CompressBlockData(const char* pch, size_t nSize, std::vector<char>& vOut)
+{
+    const unsigned char* pbegin = (const unsigned char*)pch;
+    vOut.reserve(vOut.size() + MaxCompressedSize(nSize));
+    if (nSize <= MATCH_LIMIT) {
+        WriteSequence(vOut, pbegin, nSize, 0, 0);
+        return;
+    }
+
+    std::vector<uint32_t> vTable(1 << HASH_BITS, 0);
+    const size_t nMatchEnd = nSize - LAST_LITERALS;
+    const size_t nSearchEnd = nSize - MATCH_LIMIT;
+    size_t nAnchor = 0;
+    size_t nPos = 1;
+    size_t nMisses = 0;
+    while (nPos < nSearchEnd) {
+        uint32_t nHash = Hash4(Read32(pbegin + nPos));
+        size_t nRef = vTable[nHash];
+        vTable[nHash] = nPos;
+        if (nPos - nRef > MAX_OFFSET || Read32(pbegin + nRef) != Read32(pbegin + nPos)) {
+            nPos += 1 + (nMisses++ >> SKIP_BITS);
+            continue;
+        }
+
+        // Extend the match backwards into the pending literals, then forwards.
+        while (nPos > nAnchor && nRef > 0 && pbegin[nPos - 1] == pbegin[nRef - 1]) {
+            nPos--;
+            nRef--;
+        }
+        size_t nMatch = MIN_MATCH;
+        while (nPos + nMatch < nMatchEnd && pbegin[nRef + nMatch] == pbegin[nPos + nMatch])
+            nMatch++;
+
+        WriteSequence(vOut, pbegin + nAnchor, nPos - nAnchor, nPos - nRef, nMatch);
+        nPos += nMatch;
+        nAnchor = nPos;
+        nMisses = 0;
+        if (nPos < nSearchEnd)
+            vTable[Hash4(Read32(pbegin + nPos - 2))] = nPos - 2;
+    }
+    WriteSequence(vOut, pbegin + nAnchor, nSize - nAnchor, 0, 0);
+}
+
+bool DecompressBlockData(const char* pch, size_t nSize, size_t nOutSize, std::vector<char>& vOut)
+{
+    vOut.resize(nOutSize);
+    const unsigned char* p = (const unsigned char*)pch;
+    const unsigned char* pend = p + nSize;
+    unsigned char* pout = (unsigned char*)(nOutSize ? &vOut[0] : NULL);
+    size_t nOut = 0;
+
+    while (p < pend) {
+        unsigned char nToken = *p++;
+        size_t nLiterals = nToken >> 4;
+        if (nLiterals == 15 && !ReadLength(p, pend, nLiterals))
+            return false;
+        if (nLiterals > (size_t)(pend - p) || nLiterals > nOutSize - nOut)
+            return false;
+        if (nLiterals > 0)
+            memcpy(pout + nOut, p, nLiterals);
+        p += nLiterals;
+        nOut += nLiterals;
+        // The last sequence has no match.
+        if (p == pend)
+            break;
+
+        if (pend - p < 2)
+            return false;
+        size_t nOffset = p[0] | (p[1] << 8);
+        p += 2;
+        if (nOffset == 0 || nOffset > nOut)
+            return false;
+        size_t nMatch = nToken & 15;
+        if (nMatch == 15 && !ReadLength(p, pend, nMatch))
+            return false;
+        nMatch += MIN_MATCH;
+        if (nMatch > nOutSize - nOut)
+            return false;
+        // Matches may overlap the bytes they produce.
+        const unsigned char* pref = pout + nOut - nOffset;
+        for (size_t i = 0; i < nMatch; i++)
+            pout[nOut + i] = pref[i];
+        nOut += nMatch;
+    }
+    return nOut == nOutSize;
+}
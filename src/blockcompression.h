@@ -0,0 +1,41 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_BLOCKCOMPRESSION_H
+#define BITCOIN_BLOCKCOMPRESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Flag in the size field of the index header (network magic and size) that
+ * precedes each block in the block files. If it is set, the record is
+ * compressed: the remaining bits are the size stored on disk, and the data is
+ * the size of the serialized block (4 bytes, little endian) followed by the
+ * compressed block.
+ */
+static const uint32_t BLOCK_RECORD_COMPRESSED = 0x80000000;
+
+/** Largest size compressing nSize bytes can produce. */
+size_t MaxCompressedSize(size_t nSize);
+
+/**
+ * Compress data with a fast LZ77 codec in the LZ4 block format: literal runs
+ * and back references of at least 4 bytes within the last 64 KiB, found with a
+ * single hash table probe per position. Appends to vOut.
+ *
+ * Proofs, keys and ciphertexts in transactions do not compress, so the search
+ * skips ahead faster the longer it goes without finding a match.
+ */
+void CompressBlockData(const char* pch, size_t nSize, std::vector<char>& vOut);
+
+/**
+ * Decompress data from CompressBlockData, which must decompress to exactly
+ * nOutSize bytes. Replaces the contents of vOut. Returns false if the data is
+ * malformed.
+ */
+bool DecompressBlockData(const char* pch, size_t nSize, size_t nOutSize, std::vector<char>& vOut);
+
+#endif // BITCOIN_BLOCKCOMPRESSION_H
@@ -0,0 +1,99 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockdeltas.h"
+
+#include "key_io.h"
+#include "memusage.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "util.h"
+#include "version.h"
+
+#include <boost/thread/locks.hpp>
+
+CBlockDeltasCache blockDeltasCache;
+
+static std::string EncodeScriptAddress(const CScript& scriptPubKey)
+{
+    uint160 addrHash = scriptPubKey.AddressHash();
+    CTxDestination dest = DestFromAddressHash(scriptPubKey.GetType(), addrHash);
+    return IsValidDestination(dest) ? EncodeDestination(dest) : std::string();
+}
+
+size_t CBlockDeltas::DynamicMemoryUsage() const
+{
+    size_t nUsage = memusage::DynamicUsage(vtx);
+    for (const CTxDeltas& tx : vtx) {
+        nUsage += memusage::DynamicUsage(tx.vin) + memusage::DynamicUsage(tx.vout);
+        for (const CBlockDeltaInput& input : tx.vin)
+            nUsage += input.address.capacity();
+        for (const CBlockDeltaOutput& output : tx.vout)
+            nUsage += output.address.capacity();
+    }
+    return nUsage;
+}
+
+bool ComputeBlockDeltas(const CBlock& block, const CBlockUndo& blockundo, CBlockDeltas& deltas)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: undo data does not match block", __func__);
+
+    deltas.nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    deltas.vtx.resize(block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        CTxDeltas& txdeltas = deltas.vtx[i];
+        txdeltas.txid = tx.GetHash();
+
+        if (!tx.IsCoinBase()) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return error("%s: undo data does not match transaction %s", __func__, txdeltas.txid.ToString());
+            txdeltas.vin.resize(tx.vin.size());
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const CTxOut& prevout = txundo.vprevout[j].txout;
+                txdeltas.vin[j].address = EncodeScriptAddress(prevout.scriptPubKey);
+                txdeltas.vin[j].satoshis = -1 * prevout.nValue;
+                txdeltas.vin[j].prevout = tx.vin[j].prevout;
+            }
+        }
+
+        txdeltas.vout.resize(tx.vout.size());
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            txdeltas.vout[k].address = EncodeScriptAddress(tx.vout[k].scriptPubKey);
+            txdeltas.vout[k].satoshis = tx.vout[k].nValue;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<const CBlockDeltas> CBlockDeltasCache::Get(const uint256& hash)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    std::map<uint256, DeltasList::iterator>::iterator it = mapDeltas.find(hash);
+    if (it == mapDeltas.end())
+        return nullptr;
+    listDeltas.splice(listDeltas.begin(), listDeltas, it->second);
+    return it->second->second;
+}
+
+void CBlockDeltasCache::Insert(const uint256& hash, const std::shared_ptr<const CBlockDeltas>& deltas)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    if (mapDeltas.count(hash))
+        return;
+    listDeltas.push_front(std::make_pair(hash, deltas));
+    mapDeltas[hash] = listDeltas.begin();
+    nSize += deltas->DynamicMemoryUsage();
+
+    // Always keep the newest entry, even if it alone is over the limit.
+    while (nSize > nMaxSize && listDeltas.size() > 1) {
+        nSize -= listDeltas.back().second->DynamicMemoryUsage();
+        mapDeltas.erase(listDeltas.back().first);
+        listDeltas.pop_back();
+    }
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_BLOCKDELTAS_H
+#define BITCOIN_BLOCKDELTAS_H
+
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+class CBlock;
+class CBlockUndo;
+
+/** Memory the getblockdeltas cache may use. */
+static const size_t MAX_BLOCK_DELTAS_CACHE_SIZE = 64 << 20;
+
+/** A transparent input of a transaction, with the address and value of the output it spends. */
+struct CBlockDeltaInput
+{
+    std::string address; //!< empty if the spent script has no address
+    CAmount satoshis;    //!< negative of the spent value
+    COutPoint prevout;
+};
+
+/** A transparent output of a transaction. */
+struct CBlockDeltaOutput
+{
+    std::string address; //!< empty if the script has no address
+    CAmount satoshis;
+};
+
+struct CTxDeltas
+{
+    uint256 txid;
+    std::vector<CBlockDeltaInput> vin;
+    std::vector<CBlockDeltaOutput> vout;
+};
+
+/**
+ * The address deltas of a block, as getblockdeltas reports them. They depend
+ * only on the block and the outputs it spends, never on the active chain, so
+ * they can be computed once and kept for as long as the block exists.
+ */
+struct CBlockDeltas
+{
+    unsigned int nSize; //!< serialized size of the block
+    std::vector<CTxDeltas> vtx;
+
+    size_t DynamicMemoryUsage() const;
+};
+
+/** Compute the deltas of a block; its undo data supplies the outputs its inputs spent. */
+bool ComputeBlockDeltas(const CBlock& block, const CBlockUndo& blockundo, CBlockDeltas& deltas);
+
+/** The deltas of the most recently requested or connected blocks, by block hash. */
+class CBlockDeltasCache
+{
+private:
+    typedef std::list<std::pair<uint256, std::shared_ptr<const CBlockDeltas> > > DeltasList;
+
+    boost::mutex mutex;
+    DeltasList listDeltas;
+    std::map<uint256, DeltasList::iterator> mapDeltas;
+    size_t nMaxSize;
+    size_t nSize;
+
+public:
+    CBlockDeltasCache(size_t nMaxSizeIn = MAX_BLOCK_DELTAS_CACHE_SIZE) : nMaxSize(nMaxSizeIn), nSize(0) {}
+
+    /** Get the deltas of a block, or NULL if they are not cached. */
+    std::shared_ptr<const CBlockDeltas> Get(const uint256& hash);
+    /** Add the deltas of a block, evicting the least recently used ones beyond the size limit. */
+    void Insert(const uint256& hash, const std::shared_ptr<const CBlockDeltas>& deltas);
+};
+
+extern CBlockDeltasCache blockDeltasCache;
+
+#endif // BITCOIN_BLOCKDELTAS_H
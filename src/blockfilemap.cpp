@@ -0,0 +1,93 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockfilemap.h"
+
+#include "main.h"
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CBlockFileMapCache blockFileMaps;
+
+CBlockFileMapping::~CBlockFileMapping()
+{
+#ifndef WIN32
+    munmap((void*)pbegin, nSize);
+#endif
+}
+
+void CBlockFileMapping::WillNeed(const char* pch, const char* pend) const
+{
+#ifndef WIN32
+    // madvise wants a page aligned start.
+    static const uintptr_t nPageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t nStart = (uintptr_t)pch & ~(nPageSize - 1);
+    madvise((void*)nStart, (uintptr_t)pend - nStart, MADV_WILLNEED);
+#endif
+}
+
+std::shared_ptr<const CBlockFileMapping> CBlockFileMapCache::Get(BlockFileType type, int nFile, uint64_t nMinSize)
+{
+#ifdef WIN32
+    return nullptr;
+#else
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    MappingKey key(type, nFile);
+    std::map<MappingKey, MappingList::iterator>::iterator it = mapMappings.find(key);
+    if (it != mapMappings.end()) {
+        if (it->second->second->size() >= nMinSize) {
+            listMappings.splice(listMappings.begin(), listMappings, it->second);
+            return it->second->second;
+        }
+        // The file has grown since it was mapped.
+        listMappings.erase(it->second);
+        mapMappings.erase(it);
+    }
+
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), type == BLOCK_FILE_BLK ? "blk" : "rev");
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size < nMinSize) {
+        close(fd);
+        return nullptr;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrintf("%s: cannot map %s\n", __func__, path.string());
+        return nullptr;
+    }
+    // Blocks are read one at a time from anywhere in the file; readahead
+    // across block boundaries would mostly be wasted.
+    madvise(p, st.st_size, MADV_RANDOM);
+
+    std::shared_ptr<const CBlockFileMapping> mapping = std::make_shared<const CBlockFileMapping>((const char*)p, st.st_size);
+    listMappings.push_front(std::make_pair(key, mapping));
+    mapMappings[key] = listMappings.begin();
+    while (listMappings.size() > nMaxMappings) {
+        mapMappings.erase(listMappings.back().first);
+        listMappings.pop_back();
+    }
+    return mapping;
+#endif
+}
+
+void CBlockFileMapCache::Invalidate(BlockFileType type, int nFile)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    std::map<MappingKey, MappingList::iterator>::iterator it = mapMappings.find(MappingKey(type, nFile));
+    if (it != mapMappings.end()) {
+        listMappings.erase(it->second);
+        mapMappings.erase(it);
+    }
+}
@@ -0,0 +1,75 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "blockfilewriter.h"
+
+#include <list>
+#include <map>
+#include <memory>
+
+#include <boost/thread/mutex.hpp>
+
+/** Number of block and undo files kept memory mapped for reading. */
+static const size_t MAX_BLOCK_FILE_MAPPINGS = 32;
+
+/** A read-only memory mapping of a whole block or undo file. */
+class CBlockFileMapping
+{
+private:
+    const char* pbegin;
+    size_t nSize;
+
+    CBlockFileMapping(const CBlockFileMapping&);
+    CBlockFileMapping& operator=(const CBlockFileMapping&);
+
+public:
+    CBlockFileMapping(const char* pbeginIn, size_t nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) {}
+    ~CBlockFileMapping();
+
+    const char* begin() const { return pbegin; }
+    size_t size() const { return nSize; }
+
+    /** Tell the kernel the range [pch, pend) is about to be read. */
+    void WillNeed(const char* pch, const char* pend) const;
+};
+
+/**
+ * Memory mappings of the most recently read block and undo files, so blocks
+ * and undo data can be deserialized right from the page cache instead of going
+ * through fopen, fseek and stdio buffering on every read.
+ *
+ * Files are mapped whole, for random access; mappings are replaced by larger
+ * ones when a file has grown past its mapping. Readers keep the mapping they
+ * got alive while they use it, even if it is evicted meanwhile.
+ *
+ * Data that the block file writer has not written yet must not be read from a
+ * mapping, see CBlockFileWriter::GetPending. Mappings are not available on
+ * Windows; callers fall back to reading the file.
+ */
+class CBlockFileMapCache
+{
+private:
+    typedef std::pair<int, int> MappingKey;
+    typedef std::list<std::pair<MappingKey, std::shared_ptr<const CBlockFileMapping> > > MappingList;
+
+    boost::mutex mutex;
+    MappingList listMappings;
+    std::map<MappingKey, MappingList::iterator> mapMappings;
+    size_t nMaxMappings;
+
+public:
+    CBlockFileMapCache(size_t nMaxMappingsIn = MAX_BLOCK_FILE_MAPPINGS) : nMaxMappings(nMaxMappingsIn) {}
+
+    /** Get a mapping of the file covering at least its first nMinSize bytes, or NULL. */
+    std::shared_ptr<const CBlockFileMapping> Get(BlockFileType type, int nFile, uint64_t nMinSize);
+    /** Drop the mapping of a file that is truncated or deleted. */
+    void Invalidate(BlockFileType type, int nFile);
+};
+
+extern CBlockFileMapCache blockFileMaps;
+
+#endif // BITCOIN_BLOCKFILEMAP_H
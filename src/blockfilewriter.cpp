@@ -0,0 +1,213 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockfilewriter.h"
+
+#include "main.h"
+#include "util.h"
+
+#include <errno.h>
+#include <string.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include <boost/bind.hpp>
+
+CBlockFileWriter blockFileWriter;
+
+static const char* BlockFilePrefix(BlockFileType type)
+{
+    return type == BLOCK_FILE_BLK ? "blk" : "rev";
+}
+
+static FILE* OpenFile(BlockFileType type, int nFile)
+{
+    CDiskBlockPos pos(nFile, 0);
+    return type == BLOCK_FILE_BLK ? OpenBlockFile(pos) : OpenUndoFile(pos);
+}
+
+CBlockFileWriter::CBlockFileWriter() : nQueuedBytes(0), fRunning(false), fStop(false), fError(false)
+{
+}
+
+CBlockFileWriter::~CBlockFileWriter()
+{
+    Stop();
+}
+
+void CBlockFileWriter::Start()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fRunning)
+        return;
+    fStop = false;
+    fRunning = true;
+    thread = boost::thread(boost::bind(&CBlockFileWriter::ThreadMain, this));
+}
+
+void CBlockFileWriter::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning)
+            return;
+        fStop = true;
+        condWork.notify_all();
+    }
+    thread.join();
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fRunning = false;
+    }
+    Flush();
+}
+
+bool CBlockFileWriter::Process(const Job& job)
+{
+    boost::lock_guard<boost::mutex> lockFiles(mutexFiles);
+
+    std::pair<int, int> key(job.type, job.pos.nFile);
+    std::map<std::pair<int, int>, FILE*>::iterator it = mapFiles.find(key);
+    if (it == mapFiles.end()) {
+        FILE* file = OpenFile(job.type, job.pos.nFile);
+        if (!file)
+            return error("%s: cannot open %s%05u.dat", __func__, BlockFilePrefix(job.type), job.pos.nFile);
+        it = mapFiles.insert(std::make_pair(key, file)).first;
+    }
+    FILE* file = it->second;
+
+    if (!job.data) {
+        LogPrintf("Pre-allocating up to position 0x%x in %s%05u.dat\n", job.pos.nPos + job.nLength, BlockFilePrefix(job.type), job.pos.nFile);
+        AllocateFileRange(file, job.pos.nPos, job.nLength);
+        // The portable fallback of AllocateFileRange writes through stdio.
+        fflush(file);
+        return true;
+    }
+
+    const char* pch = &(*job.data)[0];
+    size_t nLeft = job.data->size();
+#ifdef WIN32
+    if (fseek(file, job.pos.nPos, SEEK_SET) != 0 || fwrite(pch, 1, nLeft, file) != nLeft || fflush(file) != 0)
+        return error("%s: write to %s%05u.dat failed", __func__, BlockFilePrefix(job.type), job.pos.nFile);
+#else
+    off_t nOffset = job.pos.nPos;
+    while (nLeft > 0) {
+        ssize_t nWritten = pwrite(fileno(file), pch, nLeft, nOffset);
+        if (nWritten < 0) {
+            if (errno == EINTR)
+                continue;
+            return error("%s: write to %s%05u.dat failed: %s", __func__, BlockFilePrefix(job.type), job.pos.nFile, strerror(errno));
+        }
+        pch += nWritten;
+        nLeft -= nWritten;
+        nOffset += nWritten;
+    }
+#endif
+    return true;
+}
+
+void CBlockFileWriter::Finish(const Job& job, bool fSuccess)
+{
+    // Requires mutex.
+    if (job.data) {
+        nQueuedBytes -= job.data->size();
+        mapPending[job.type].erase(std::make_pair(job.pos.nFile, job.pos.nPos));
+    }
+    if (!fSuccess)
+        fError = true;
+}
+
+void CBlockFileWriter::ThreadMain()
+{
+    RenameThread("arnak-blockwriter");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (queue.empty() && !fStop)
+            condWork.wait(lock);
+        if (queue.empty())
+            break;
+
+        // The job stays queued until it is written, so Flush waits for it.
+        Job job = queue.front();
+        lock.unlock();
+        bool fSuccess = Process(job);
+        lock.lock();
+        queue.pop_front();
+        Finish(job, fSuccess);
+        condDone.notify_all();
+    }
+}
+
+bool CBlockFileWriter::Write(BlockFileType type, const CDiskBlockPos& pos, const DataPtr& data)
+{
+    Job job = {type, pos, data, 0};
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fError)
+        return false;
+    if (!fRunning) {
+        lock.unlock();
+        bool fSuccess = Process(job);
+        lock.lock();
+        if (!fSuccess)
+            fError = true;
+        return fSuccess;
+    }
+
+    // Bound the memory held by the queue; validation only waits once the disk
+    // has fallen this far behind.
+    while (nQueuedBytes > MAX_BLOCK_WRITE_QUEUE_SIZE && !fError)
+        condDone.wait(lock);
+    if (fError)
+        return false;
+    queue.push_back(job);
+    nQueuedBytes += data->size();
+    mapPending[type][std::make_pair(pos.nFile, pos.nPos)] = data;
+    condWork.notify_one();
+    return true;
+}
+
+bool CBlockFileWriter::Allocate(BlockFileType type, const CDiskBlockPos& pos, unsigned int nLength)
+{
+    Job job = {type, pos, DataPtr(), nLength};
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fError)
+        return false;
+    if (!fRunning) {
+        lock.unlock();
+        return Process(job);
+    }
+    queue.push_back(job);
+    condWork.notify_one();
+    return true;
+}
+
+CBlockFileWriter::DataPtr CBlockFileWriter::GetPending(BlockFileType type, const CDiskBlockPos& pos)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    std::map<std::pair<int, unsigned int>, DataPtr>::const_iterator it = mapPending[type].find(std::make_pair(pos.nFile, pos.nPos));
+    if (it == mapPending[type].end())
+        return DataPtr();
+    return it->second;
+}
+
+bool CBlockFileWriter::Flush()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!queue.empty())
+            condDone.wait(lock);
+    }
+
+    // Group commit: one sync per file written since the last flush.
+    boost::lock_guard<boost::mutex> lockFiles(mutexFiles);
+    for (std::map<std::pair<int, int>, FILE*>::iterator it = mapFiles.begin(); it != mapFiles.end(); ++it) {
+        FileCommit(it->second);
+        fclose(it->second);
+    }
+    mapFiles.clear();
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return !fError;
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_BLOCKFILEWRITER_H
+#define BITCOIN_BLOCKFILEWRITER_H
+
+#include "chain.h"
+#include "streams.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdio.h>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+/** Size of block and undo data that may wait to be written before writing blocks has to wait as well. */
+static const size_t MAX_BLOCK_WRITE_QUEUE_SIZE = 64 * 1024 * 1024;
+
+enum BlockFileType {
+    BLOCK_FILE_BLK, //!< blk?????.dat, blocks
+    BLOCK_FILE_REV, //!< rev?????.dat, undo data
+};
+
+/**
+ * Writes block and undo files on a background thread, so that validation does
+ * not wait on the disk.
+ *
+ * Callers assign the position of the data in its file as before (FindBlockPos,
+ * FindUndoPos) and queue the serialized data, which is then written at that
+ * position with pwrite. Preallocation of the files is queued the same way.
+ * Until it has been written, data can be read back from memory with
+ * GetPending, so reads of blocks that were just accepted stay consistent.
+ * Nothing is synced after each write; Flush waits for the queue to drain and
+ * then commits all files written since the previous Flush with one fdatasync
+ * each, before the block index that refers to them is written.
+ *
+ * Without a running thread (e.g. in tests), writes happen when they are queued.
+ */
+class CBlockFileWriter
+{
+public:
+    typedef std::shared_ptr<const CDataStream> DataPtr;
+
+private:
+    friend class TEST_FRIEND_CBlockFileWriter;    // class for unit testing
+
+    struct Job {
+        BlockFileType type;
+        CDiskBlockPos pos;
+        DataPtr data;           //!< Data to write at pos, or NULL to preallocate
+        unsigned int nLength;   //!< Bytes to preallocate from pos
+    };
+
+    //! Protects everything below except mapFiles.
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condDone;
+    std::deque<Job> queue;
+    size_t nQueuedBytes;
+    std::map<std::pair<int, unsigned int>, DataPtr> mapPending[2];
+    bool fRunning;
+    bool fStop;
+    bool fError;
+    boost::thread thread;
+
+    //! Open files written since the last Flush, only used while holding mutexFiles.
+    boost::mutex mutexFiles;
+    std::map<std::pair<int, int>, FILE*> mapFiles;
+
+    bool Process(const Job& job);
+    void Finish(const Job& job, bool fSuccess);
+    void ThreadMain();
+
+public:
+    CBlockFileWriter();
+    ~CBlockFileWriter();
+
+    void Start();
+    /** Write out everything that is queued and stop the thread. */
+    void Stop();
+
+    /** Queue data to be written at pos. Returns false if an earlier write failed. */
+    bool Write(BlockFileType type, const CDiskBlockPos& pos, const DataPtr& data);
+    /** Queue preallocation of nLength bytes from pos. */
+    bool Allocate(BlockFileType type, const CDiskBlockPos& pos, unsigned int nLength);
+    /** Get the data queued to be written at pos, or NULL if there is none. */
+    DataPtr GetPending(BlockFileType type, const CDiskBlockPos& pos);
+    /** Wait for all queued writes and commit the files they went to. Returns false if any write failed. */
+    bool Flush();
+};
+
+extern CBlockFileWriter blockFileWriter;
+
+#endif // BITCOIN_BLOCKFILEWRITER_H
@@ -6,6 +6,7 @@
 
 #include "primitives/transaction.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
@@ -41,17 +42,6 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int
 {
 }
 
-// Private constructor used by CRollingBloomFilter
-CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweakIn) :
-    vData((unsigned int)(-1  / LN2SQUARED * nElements * log(nFPRate)) / 8),
-    isFull(false),
-    isEmpty(true),
-    nHashFuncs((unsigned int)(vData.size() * 8 / nElements * LN2)),
-    nTweak(nTweakIn),
-    nFlags(BLOOM_UPDATE_NONE)
-{
-}
-
 inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const
 {
     // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
@@ -133,6 +123,66 @@ bool CBloomFilter::IsWithinSizeConstraints() const
     return vData.size() <= MAX_BLOOM_FILTER_SIZE && nHashFuncs <= MAX_HASH_FUNCS;
 }
 
+CBloomTxElements::CBloomTxElements(const CTransaction& tx) : hash(tx.GetHash())
+{
+    vOutputPushes.resize(tx.vout.size());
+    vOutputP2PubKey.resize(tx.vout.size());
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        const CScript& script = tx.vout[i].scriptPubKey;
+        CScript::const_iterator pc = script.begin();
+        vector<unsigned char> data;
+        while (pc < script.end())
+        {
+            opcodetype opcode;
+            if (!script.GetOp(pc, opcode, data))
+                break;
+            if (data.size() != 0)
+                vOutputPushes[i].push_back(data);
+        }
+
+        txnouttype type;
+        vector<vector<unsigned char> > vSolutions;
+        vOutputP2PubKey[i] = Solver(script, type, vSolutions) && (type == TX_PUBKEY || type == TX_MULTISIG);
+    }
+
+    vPrevouts.reserve(tx.vin.size());
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << txin.prevout;
+        vPrevouts.push_back(vector<unsigned char>(stream.begin(), stream.end()));
+
+        CScript::const_iterator pc = txin.scriptSig.begin();
+        vector<unsigned char> data;
+        while (pc < txin.scriptSig.end())
+        {
+            opcodetype opcode;
+            if (!txin.scriptSig.GetOp(pc, opcode, data))
+                break;
+            if (data.size() != 0)
+                vInputPushes.push_back(data);
+        }
+    }
+}
+
+size_t CBloomTxElements::DynamicMemoryUsage() const
+{
+    size_t nUsage = memusage::DynamicUsage(vOutputPushes) + memusage::DynamicUsage(vOutputP2PubKey) +
+        memusage::DynamicUsage(vPrevouts) + memusage::DynamicUsage(vInputPushes);
+    BOOST_FOREACH(const vector<vector<unsigned char> >& vPushes, vOutputPushes)
+    {
+        nUsage += memusage::DynamicUsage(vPushes);
+        BOOST_FOREACH(const vector<unsigned char>& data, vPushes)
+            nUsage += memusage::DynamicUsage(data);
+    }
+    BOOST_FOREACH(const vector<unsigned char>& data, vPrevouts)
+        nUsage += memusage::DynamicUsage(data);
+    BOOST_FOREACH(const vector<unsigned char>& data, vInputPushes)
+        nUsage += memusage::DynamicUsage(data);
+    return nUsage;
+}
+
 bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
 {
     bool fFound = false;
@@ -203,6 +253,58 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
     return false;
 }
 
+bool CBloomFilter::IsRelevantAndUpdate(const CBloomTxElements& tx)
+{
+    bool fFound = false;
+    // Match if the filter contains the hash of tx
+    //  for finding tx when they appear in a block
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    if (contains(tx.hash))
+        fFound = true;
+
+    for (unsigned int i = 0; i < tx.vOutputPushes.size(); i++)
+    {
+        // Match if the filter contains any arbitrary script data element in any scriptPubKey in tx
+        // If this matches, also add the specific output that was matched.
+        // This means clients don't have to update the filter themselves when a new relevant tx 
+        // is discovered in order to find spending transactions, which avoids round-tripping and race conditions.
+        BOOST_FOREACH(const vector<unsigned char>& data, tx.vOutputPushes[i])
+        {
+            if (contains(data))
+            {
+                fFound = true;
+                if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL)
+                    insert(COutPoint(tx.hash, i));
+                else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY && tx.vOutputP2PubKey[i])
+                    insert(COutPoint(tx.hash, i));
+                break;
+            }
+        }
+    }
+
+    if (fFound)
+        return true;
+
+    // Match if the filter contains an outpoint tx spends
+    BOOST_FOREACH(const vector<unsigned char>& outpoint, tx.vPrevouts)
+    {
+        if (contains(outpoint))
+            return true;
+    }
+
+    // Match if the filter contains any arbitrary script data element in any scriptSig in tx
+    BOOST_FOREACH(const vector<unsigned char>& data, tx.vInputPushes)
+    {
+        if (contains(data))
+            return true;
+    }
+
+    return false;
+}
+
 void CBloomFilter::UpdateEmptyFull()
 {
     bool full = true;
@@ -216,8 +318,118 @@ void CBloomFilter::UpdateEmptyFull()
     isEmpty = empty;
 }
 
+static unsigned int BlockedBloomHashFuncs(unsigned int nElements, unsigned int nBlocks)
+{
+    double nHashFuncs = (double)nBlocks * CBlockedBloomFilter::BLOCK_BITS / nElements * LN2;
+    return max(1u, min((unsigned int)(nHashFuncs + 0.5), MAX_HASH_FUNCS));
+}
+
+CBlockedBloomFilter::CBlockedBloomFilter(unsigned int nElements, double nFPRate)
+{
+    nElements = max(nElements, 1u);
+    // Start from the size of an ideal bloom filter and grow it until the
+    // blocks, which do not fill up evenly, give the requested rate.
+    double nBits = -1 / LN2SQUARED * nElements * log(nFPRate);
+    nBlocks = max(1u, (unsigned int)ceil(nBits / BLOCK_BITS));
+    nHashFuncs = BlockedBloomHashFuncs(nElements, nBlocks);
+    while (FalsePositiveRate(nElements, nBlocks, nHashFuncs) > nFPRate) {
+        nBlocks += nBlocks / 16 + 1;
+        nHashFuncs = BlockedBloomHashFuncs(nElements, nBlocks);
+    }
+    Allocate();
+}
+
+CBlockedBloomFilter::CBlockedBloomFilter(const CBlockedBloomFilter& other) :
+    nBlocks(other.nBlocks), nHashFuncs(other.nHashFuncs)
+{
+    Allocate();
+    std::copy(other.vData.begin() + other.nOffset, other.vData.begin() + other.nOffset + nBlocks * BLOCK_WORDS,
+              vData.begin() + nOffset);
+}
+
+CBlockedBloomFilter& CBlockedBloomFilter::operator=(const CBlockedBloomFilter& other)
+{
+    if (this != &other) {
+        nBlocks = other.nBlocks;
+        nHashFuncs = other.nHashFuncs;
+        Allocate();
+        std::copy(other.vData.begin() + other.nOffset, other.vData.begin() + other.nOffset + nBlocks * BLOCK_WORDS,
+                  vData.begin() + nOffset);
+    }
+    return *this;
+}
+
+void CBlockedBloomFilter::Allocate()
+{
+    // One block of slack, so the blocks can start at a cache line boundary
+    // wherever the buffer is allocated.
+    std::vector<uint64_t>(nBlocks * BLOCK_WORDS + BLOCK_WORDS - 1, 0).swap(vData);
+    nOffset = ((64 - (size_t)&vData[0] % 64) % 64) / sizeof(uint64_t);
+}
+
+double CBlockedBloomFilter::FalsePositiveRate(double nElements, unsigned int nBlocks, unsigned int nHashFuncs)
+{
+    // The number of elements in a block is Poisson distributed; sum the
+    // false positive rate of a block over it.
+    const double lambda = nElements / nBlocks;
+    const double nMax = lambda + 10 * sqrt(lambda) + 10;
+    double nRate = 0;
+    for (unsigned int x = 0; x <= nMax; x++) {
+        double p = exp(-lambda + x * log(lambda) - lgamma(x + 1.0));
+        double nBitSet = 1 - pow(1 - 1.0 / BLOCK_BITS, (double)nHashFuncs * x);
+        nRate += p * pow(nBitSet, nHashFuncs);
+    }
+    return nRate;
+}
+
+inline size_t CBlockedBloomFilter::BlockIndex(uint64_t nHash) const
+{
+    // Map the upper half of the hash onto [0, nBlocks) without a division.
+    return nOffset + (size_t)(((nHash >> 32) * nBlocks) >> 32) * BLOCK_WORDS;
+}
+
+inline void CBlockedBloomFilter::BlockMask(uint64_t nHash, uint64_t mask[BLOCK_WORDS]) const
+{
+    // The bit positions are the top 9 bits of successive states of a 64-bit
+    // LCG seeded with the whole hash, so elements that share a block almost
+    // never share all of their bits.
+    for (unsigned int w = 0; w < BLOCK_WORDS; w++)
+        mask[w] = 0;
+    uint64_t x = nHash;
+    for (unsigned int i = 0; i < nHashFuncs; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned int nBit = x >> 55;
+        mask[nBit >> 6] |= (uint64_t)1 << (nBit & 63);
+    }
+}
+
+void CBlockedBloomFilter::insert(uint64_t nHash)
+{
+    uint64_t mask[BLOCK_WORDS];
+    BlockMask(nHash, mask);
+    uint64_t* pBlock = &vData[BlockIndex(nHash)];
+    for (unsigned int w = 0; w < BLOCK_WORDS; w++)
+        pBlock[w] |= mask[w];
+}
+
+bool CBlockedBloomFilter::contains(uint64_t nHash) const
+{
+    uint64_t mask[BLOCK_WORDS];
+    BlockMask(nHash, mask);
+    const uint64_t* pBlock = &vData[BlockIndex(nHash)];
+    uint64_t nMissing = 0;
+    for (unsigned int w = 0; w < BLOCK_WORDS; w++)
+        nMissing |= mask[w] & ~pBlock[w];
+    return nMissing == 0;
+}
+
+void CBlockedBloomFilter::clear()
+{
+    std::fill(vData.begin(), vData.end(), 0);
+}
+
 CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate) :
-    b1(nElements * 2, fpRate, 0), b2(nElements * 2, fpRate, 0)
+    b1(nElements * 2, fpRate), b2(nElements * 2, fpRate)
 {
     // Implemented using two bloom filters of 2 * nElements each.
     // We fill them up, and clear them, staggered, every nElements
@@ -229,44 +441,59 @@ CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
     reset();
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+uint64_t CRollingBloomFilter::Hash(const std::vector<unsigned char>& vKey) const
+{
+    return CSipHasher(k0, k1).Write(vKey.empty() ? NULL : &vKey[0], vKey.size()).Finalize();
+}
+
+void CRollingBloomFilter::insert(uint64_t nHash)
 {
     if (nInsertions == 0) {
         b1.clear();
     } else if (nInsertions == nBloomSize / 2) {
         b2.clear();
     }
-    b1.insert(vKey);
-    b2.insert(vKey);
+    b1.insert(nHash);
+    b2.insert(nHash);
     if (++nInsertions == nBloomSize) {
         nInsertions = 0;
     }
 }
 
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insert(Hash(vKey));
+}
+
 void CRollingBloomFilter::insert(const uint256& hash)
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    insert(SipHashUint256(k0, k1, hash));
 }
 
-bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+bool CRollingBloomFilter::contains(uint64_t nHash) const
 {
     if (nInsertions < nBloomSize / 2) {
-        return b2.contains(vKey);
+        return b2.contains(nHash);
     }
-    return b1.contains(vKey);
+    return b1.contains(nHash);
+}
+
+bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+{
+    return contains(Hash(vKey));
 }
 
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return contains(SipHashUint256(k0, k1, hash));
 }
 
 void CRollingBloomFilter::reset()
 {
-    unsigned int nNewTweak = GetRand(std::numeric_limits<unsigned int>::max());
-    b1.reset(nNewTweak);
-    b2.reset(nNewTweak);
+    // A new key makes false positives of the old contents unlikely to repeat.
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
+    b1.clear();
+    b2.clear();
     nInsertions = 0;
 }
@@ -6,12 +6,13 @@
 #define BITCOIN_BLOOM_H
 
 #include "serialize.h"
+#include "uint256.h"
 
+#include <stdint.h>
 #include <vector>
 
 class COutPoint;
 class CTransaction;
-class uint256;
 
 //! 20,000 items with fp rate < 0.1% or 10,000 items and <0.0001%
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
@@ -30,6 +31,30 @@ enum bloomflags
     BLOOM_UPDATE_MASK = 3,
 };
 
+/**
+ * The parts of a transaction a BIP37 filter is matched against: its hash,
+ * the data pushed by each output script, the serialized outpoints it spends
+ * and the data pushed by its input scripts. Extracting them once lets a
+ * transaction in a block be matched against the filters of many peers
+ * without parsing its scripts every time.
+ */
+struct CBloomTxElements
+{
+    uint256 hash;
+    //! Non-empty data pushes of each output script, up to the first invalid opcode
+    std::vector<std::vector<std::vector<unsigned char> > > vOutputPushes;
+    //! Whether each output pays to a pubkey or is a bare multisig (see BLOOM_UPDATE_P2PUBKEY_ONLY)
+    std::vector<bool> vOutputP2PubKey;
+    //! Serialized outpoints of the inputs
+    std::vector<std::vector<unsigned char> > vPrevouts;
+    //! Non-empty data pushes of all input scripts
+    std::vector<std::vector<unsigned char> > vInputPushes;
+
+    CBloomTxElements(const CTransaction& tx);
+
+    size_t DynamicMemoryUsage() const;
+};
+
 /**
  * BloomFilter is a probabilistic filter which SPV clients provide
  * so that we can filter the transactions we send them.
@@ -53,10 +78,6 @@ private:
 
     unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
 
-    // Private constructor for CRollingBloomFilter, no restrictions on size
-    CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
-    friend class CRollingBloomFilter;
-
 public:
     /**
      * Creates a new bloom filter which will provide the given fp rate when filled with the given number of elements
@@ -97,11 +118,54 @@ public:
 
     //! Also adds any outputs which match the filter to the filter (to match their spending txes)
     bool IsRelevantAndUpdate(const CTransaction& tx);
+    //! The same, for a transaction whose elements were extracted beforehand
+    bool IsRelevantAndUpdate(const CBloomTxElements& tx);
 
     //! Checks for empty and full filters to avoid wasting cpu
     void UpdateEmptyFull();
 };
 
+/**
+ * Blocked bloom filter over 64-bit hashes, for the node's internal filters.
+ * All bits of an element lie in one 512-bit block, so an insert or a lookup
+ * touches a single cache line, and the bits are set and tested a block at a
+ * time as eight 64-bit words instead of one scattered byte per hash function.
+ * The filter is sized for the given false positive rate taking the uneven
+ * fill of the blocks into account. Not BIP37 compatible; peers' filters are
+ * CBloomFilter.
+ */
+class CBlockedBloomFilter
+{
+public:
+    static const unsigned int BLOCK_WORDS = 8;
+    static const unsigned int BLOCK_BITS = BLOCK_WORDS * 64;
+
+    CBlockedBloomFilter(unsigned int nElements, double nFPRate);
+    //! Copies realign the blocks in their own buffer.
+    CBlockedBloomFilter(const CBlockedBloomFilter& other);
+    CBlockedBloomFilter& operator=(const CBlockedBloomFilter& other);
+
+    void insert(uint64_t nHash);
+    bool contains(uint64_t nHash) const;
+    void clear();
+
+    unsigned int GetBlocks() const { return nBlocks; }
+    unsigned int GetHashFuncs() const { return nHashFuncs; }
+
+    //! Expected false positive rate with nElements inserted
+    static double FalsePositiveRate(double nElements, unsigned int nBlocks, unsigned int nHashFuncs);
+
+private:
+    std::vector<uint64_t> vData;
+    size_t nOffset; // words before the first cache line aligned block in vData
+    unsigned int nBlocks;
+    unsigned int nHashFuncs;
+
+    void Allocate();
+    size_t BlockIndex(uint64_t nHash) const;
+    void BlockMask(uint64_t nHash, uint64_t mask[BLOCK_WORDS]) const;
+};
+
 /**
  * RollingBloomFilter is a probabilistic "keep track of most recently inserted" set.
  * Construct it with the number of items to keep track of, and a false-positive
@@ -131,7 +195,12 @@ public:
 private:
     unsigned int nBloomSize;
     unsigned int nInsertions;
-    CBloomFilter b1, b2;
+    uint64_t k0, k1;
+    CBlockedBloomFilter b1, b2;
+
+    uint64_t Hash(const std::vector<unsigned char>& vKey) const;
+    void insert(uint64_t nHash);
+    bool contains(uint64_t nHash) const;
 };
 
 
@@ -0,0 +1,37 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "compactshieldedblock.h"
+
+#include "primitives/block.h"
+
+#include <algorithm>
+
+void GetCompactShieldedBlock(const CBlock& block, int nHeight, CCompactShieldedBlock& compact)
+{
+    compact.nHeight = nHeight;
+    compact.hash = block.GetHash();
+    compact.hashPrevBlock = block.hashPrevBlock;
+    compact.nTime = block.nTime;
+    compact.vtx.clear();
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())
+            continue;
+        CCompactShieldedTx ctx;
+        ctx.index = i;
+        ctx.txid = tx.GetHash();
+        for (const SpendDescription& spend : tx.vShieldedSpend)
+            ctx.nullifiers.push_back(spend.nullifier);
+        for (const OutputDescription& output : tx.vShieldedOutput) {
+            CCompactSaplingOutput coutput;
+            coutput.cmu = output.cm;
+            coutput.epk = output.ephemeralKey;
+            std::copy(output.encCiphertext.begin(), output.encCiphertext.begin() + COMPACT_NOTE_CIPHERTEXT_SIZE,
+                      coutput.ciphertext.begin());
+            ctx.outputs.push_back(coutput);
+        }
+        compact.vtx.push_back(ctx);
+    }
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_COMPACTSHIELDEDBLOCK_H
+#define BITCOIN_COMPACTSHIELDEDBLOCK_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <array>
+#include <vector>
+
+class CBlock;
+
+/** Bytes of a Sapling note ciphertext a light client needs to trial-decrypt it */
+static const size_t COMPACT_NOTE_CIPHERTEXT_SIZE = 52;
+
+/** A Sapling output, without the parts only needed to verify or spend it. */
+struct CCompactSaplingOutput {
+    uint256 cmu;
+    uint256 epk;
+    //! The start of enc_ciphertext: the note plaintext up to the memo.
+    std::array<unsigned char, COMPACT_NOTE_CIPHERTEXT_SIZE> ciphertext;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(cmu);
+        READWRITE(epk);
+        READWRITE(ciphertext);
+    }
+};
+
+/** A transaction with Sapling spends or outputs. */
+struct CCompactShieldedTx {
+    uint32_t index;     //!< position of the transaction in its block
+    uint256 txid;
+    std::vector<uint256> nullifiers;
+    std::vector<CCompactSaplingOutput> outputs;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(index);
+        READWRITE(txid);
+        READWRITE(nullifiers);
+        READWRITE(outputs);
+    }
+
+    CCompactShieldedTx() {
+        index = 0;
+    }
+};
+
+/**
+ * What a light client needs of a block to find and track its notes: the
+ * Sapling nullifiers revealed, and the outputs it can trial-decrypt, without
+ * the proofs, signatures and transparent data of the full block.
+ */
+struct CCompactShieldedBlock {
+    int32_t nHeight;
+    uint256 hash;
+    uint256 hashPrevBlock;
+    uint32_t nTime;
+    std::vector<CCompactShieldedTx> vtx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nHeight);
+        READWRITE(hash);
+        READWRITE(hashPrevBlock);
+        READWRITE(nTime);
+        READWRITE(vtx);
+    }
+
+    CCompactShieldedBlock() {
+        nHeight = 0;
+        nTime = 0;
+    }
+};
+
+/** Get the compact form of a block at the given height. */
+void GetCompactShieldedBlock(const CBlock& block, int nHeight, CCompactShieldedBlock& compact);
+
+#endif // BITCOIN_COMPACTSHIELDEDBLOCK_H
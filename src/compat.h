@@ -93,6 +93,11 @@ typedef u_int SOCKET;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+// On Linux the socket handler waits on an epoll instance instead of select().
+#if defined(__linux__) && defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(SOCKET s) {
 #ifdef WIN32
     return true;
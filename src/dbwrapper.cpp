@@ -14,12 +14,15 @@
 #include <memenv.h>
 #include <stdint.h>
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, size_t nWriteBufferSize, int nBloomFilterBits)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    if (nWriteBufferSize == 0 || nWriteBufferSize > nCacheSize / 2)
+        nWriteBufferSize = nCacheSize / 4;
+    // up to two write buffers may be held in memory simultaneously, the rest is block cache
+    options.block_cache = leveldb::NewLRUCache(nCacheSize - 2 * nWriteBufferSize);
+    options.write_buffer_size = nWriteBufferSize;
+    options.filter_policy = leveldb::NewBloomFilterPolicy(nBloomFilterBits);
     options.compression = leveldb::kNoCompression;
     options.max_open_files = 64;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
@@ -30,14 +33,15 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe,
+                       size_t nWriteBufferSize, int nBloomFilterBits)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, nWriteBufferSize, nBloomFilterBits);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
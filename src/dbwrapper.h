@@ -172,8 +172,11 @@ public:
      * @param[in] nCacheSize  Configures various leveldb cache settings.
      * @param[in] fMemory     If true, use leveldb's memory environment.
      * @param[in] fWipe       If true, remove all existing data.
+     * @param[in] nWriteBufferSize  Size of the memtable, or 0 for a quarter of nCacheSize.
+     * @param[in] nBloomFilterBits  Bloom filter bits per key in each table.
      */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false,
+               size_t nWriteBufferSize = 0, int nBloomFilterBits = 10);
     ~CDBWrapper();
 
     template <typename K, typename V>
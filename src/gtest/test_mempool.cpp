@@ -4,8 +4,11 @@
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "key.h"
 #include "main.h"
 #include "primitives/transaction.h"
+#include "random.h"
+#include "script/standard.h"
 #include "txmempool.h"
 #include "policy/fees.h"
 #include "util.h"
@@ -317,3 +320,138 @@ TEST(Mempool, ExpiringSoonTxRejection) {
     // Revert to default
     UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
 }
+
+// insightexplorer
+// The mempool address index as it was kept in ordered maps, to check and
+// benchmark the hashed index against.
+class OrderedMempoolAddressIndex {
+public:
+    std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> mapAddress;
+    std::map<uint256, std::vector<CMempoolAddressDeltaKey>> mapAddressInserted;
+
+    void add(const CTransaction& tx, const CCoinsViewCache& view, int64_t nTime) {
+        uint256 txhash = tx.GetHash();
+        std::vector<CMempoolAddressDeltaKey> inserted;
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const CTxOut& prevout = view.GetOutputFor(tx.vin[j]);
+            CMempoolAddressDeltaKey key(prevout.scriptPubKey.GetType(), prevout.scriptPubKey.AddressHash(), txhash, j, 1);
+            mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(nTime, prevout.nValue * -1,
+                tx.vin[j].prevout.hash, tx.vin[j].prevout.n)));
+            inserted.push_back(key);
+        }
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& out = tx.vout[j];
+            CMempoolAddressDeltaKey key(out.scriptPubKey.GetType(), out.scriptPubKey.AddressHash(), txhash, j, 0);
+            mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(nTime, out.nValue)));
+            inserted.push_back(key);
+        }
+        mapAddressInserted.insert(std::make_pair(txhash, inserted));
+    }
+
+    void get(const std::vector<std::pair<uint160, int>>& addresses,
+             std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>>& results) {
+        for (const auto& it : addresses) {
+            auto ait = mapAddress.lower_bound(CMempoolAddressDeltaKey(it.second, it.first));
+            while (ait != mapAddress.end() && ait->first.addressBytes == it.first && ait->first.type == it.second) {
+                results.push_back(*ait);
+                ait++;
+            }
+        }
+    }
+
+    void remove(const uint256& txhash) {
+        auto it = mapAddressInserted.find(txhash);
+        if (it != mapAddressInserted.end()) {
+            for (const auto& key : it->second) {
+                mapAddress.erase(key);
+            }
+            mapAddressInserted.erase(it);
+        }
+    }
+};
+
+static uint160 AddressIndexTestHash(int n) {
+    uint160 hash;
+    hash.SetHex(strprintf("%x", n + 1));
+    return hash;
+}
+
+// A transaction from address n to address n + 1, with change to a P2SH address.
+static CTransaction AddressIndexTestTx(CCoinsViewCache& view, int n, int nAddresses) {
+    uint256 prevhash = GetRandHash();
+    view.ModifyCoins(prevhash)->vout[0] = CTxOut(1000 + n,
+        GetScriptForDestination(CKeyID(AddressIndexTestHash(n % nAddresses))));
+
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(prevhash, 0)));
+    mtx.vout.push_back(CTxOut(600 + n, GetScriptForDestination(CKeyID(AddressIndexTestHash((n + 1) % nAddresses)))));
+    mtx.vout.push_back(CTxOut(300, GetScriptForDestination(CScriptID(AddressIndexTestHash(n % nAddresses)))));
+    return mtx;
+}
+
+static void SortAddressDeltas(std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>>& deltas) {
+    std::sort(deltas.begin(), deltas.end(),
+        [](const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& a,
+           const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& b) {
+               return CMempoolAddressDeltaKeyCompare()(a.first, b.first);
+           });
+}
+
+static void ExpectSameAddressDeltas(CTxMemPool& pool, OrderedMempoolAddressIndex& ordered,
+                                    const std::vector<std::pair<uint160, int>>& addresses) {
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>> hashed, expected;
+    pool.getAddressIndex(addresses, hashed);
+    ordered.get(addresses, expected);
+    SortAddressDeltas(hashed);
+    SortAddressDeltas(expected);
+    ASSERT_EQ(hashed.size(), expected.size());
+    for (size_t i = 0; i < hashed.size(); i++) {
+        EXPECT_FALSE(CMempoolAddressDeltaKeyCompare()(hashed[i].first, expected[i].first));
+        EXPECT_FALSE(CMempoolAddressDeltaKeyCompare()(expected[i].first, hashed[i].first));
+        EXPECT_EQ(hashed[i].second.time, expected[i].second.time);
+        EXPECT_EQ(hashed[i].second.amount, expected[i].second.amount);
+        EXPECT_EQ(hashed[i].second.prevhash, expected[i].second.prevhash);
+        EXPECT_EQ(hashed[i].second.prevout, expected[i].second.prevout);
+    }
+}
+
+TEST(Mempool, AddressIndex) {
+    FakeCoinsViewDB fakeDB;
+    CCoinsViewCache view(&fakeDB);
+    CTxMemPool pool(CFeeRate(0));
+    OrderedMempoolAddressIndex ordered;
+
+    const int nAddresses = 10;
+    std::vector<std::pair<uint160, int>> addresses;
+    for (int n = 0; n < nAddresses; n++) {
+        addresses.push_back(std::make_pair(AddressIndexTestHash(n), (int)CScript::P2PKH));
+        addresses.push_back(std::make_pair(AddressIndexTestHash(n), (int)CScript::P2SH));
+    }
+
+    std::vector<CTransaction> txs;
+    for (int n = 0; n < 1000; n++) {
+        CTransaction tx = AddressIndexTestTx(view, n, nAddresses);
+        CTxMemPoolEntry entry(tx, 0, n, 0, 1, true, false, SPROUT_BRANCH_ID);
+        pool.addAddressIndex(entry, view);
+        ordered.add(tx, view, n);
+        txs.push_back(tx);
+    }
+    ExpectSameAddressDeltas(pool, ordered, addresses);
+    for (const auto& address : addresses) {
+        ExpectSameAddressDeltas(pool, ordered, {address});
+    }
+
+    // Removing entries moves others around in their buckets.
+    for (size_t i = 0; i < txs.size(); i += 3) {
+        pool.removeAddressIndex(txs[i].GetHash());
+        ordered.remove(txs[i].GetHash());
+    }
+    ExpectSameAddressDeltas(pool, ordered, addresses);
+
+    for (const CTransaction& tx : txs) {
+        pool.removeAddressIndex(tx.GetHash());
+    }
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>> results;
+    pool.getAddressIndex(addresses, results);
+    EXPECT_TRUE(results.empty());
+}
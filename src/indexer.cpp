@@ -0,0 +1,318 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "indexer.h"
+
+#include "chainparams.h"
+#include "main.h"
+#include "util.h"
+
+#include <boost/bind.hpp>
+
+CChainIndexer::CChainIndexer(const std::string& strNameIn) :
+    strName(strNameIn), fFollowing(false), fBusy(false), fRunning(false), fStop(false), fError(false),
+    pindexBest(NULL), nBestHeight(0)
+{
+}
+
+CChainIndexer::~CChainIndexer()
+{
+    Stop();
+}
+
+bool CChainIndexer::Start()
+{
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexIndexed = NULL;
+        if (!Init(pindexIndexed))
+            return error("%s: cannot load %s", __func__, strName);
+        SetBestBlock(pindexIndexed);
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fRunning)
+        return true;
+    fStop = false;
+    fRunning = true;
+    RegisterValidationInterface(this);
+    thread = boost::thread(boost::bind(&CChainIndexer::ThreadMain, this));
+    return true;
+}
+
+void CChainIndexer::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning)
+            return;
+        fStop = true;
+        condWork.notify_all();
+    }
+    UnregisterValidationInterface(this);
+    thread.join();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fRunning = false;
+    fFollowing = false;
+}
+
+bool CChainIndexer::Flush()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (fFollowing && (!queue.empty() || fBusy))
+        condDone.wait(lock);
+    return fFollowing;
+}
+
+bool CChainIndexer::IsFollowing()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return fFollowing;
+}
+
+bool CChainIndexer::GetProgress(int& nHeight)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nHeight = nBestHeight;
+    return fRunning && !fFollowing && !fError;
+}
+
+bool CChainIndexer::HasFailed()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return fError;
+}
+
+bool CChainIndexer::StopRequested()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return fStop;
+}
+
+void CChainIndexer::SetBestBlock(const CBlockIndex* pindex)
+{
+    pindexBest = pindex;
+    nBestHeight = pindex ? pindex->nHeight : 0;
+}
+
+void CChainIndexer::ChainTip(const CBlockIndex *pindex, const CBlock *pblock, SproutMerkleTree sproutTree,
+                             SaplingMerkleTree saplingTree, bool added)
+{
+    AssertLockHeld(cs_main);
+    boost::unique_lock<boost::mutex> lock(mutex);
+    // While catching up the blocks are read from disk instead.
+    if (!fFollowing)
+        return;
+    if (queue.size() >= MAX_INDEXER_QUEUE_SIZE) {
+        LogPrint("index", "%s: %s fell behind the chain, catching up\n", __func__, strName);
+        queue.clear();
+        fFollowing = false;
+        condWork.notify_all();
+        condDone.notify_all();
+        return;
+    }
+
+    // The positions are taken now; the blocks are read back on the indexer thread.
+    CNotification notification;
+    notification.pindex = pindex;
+    notification.pos = pindex->GetBlockPos();
+    notification.undoPos = pindex->GetUndoPos();
+    notification.fConnect = added;
+    queue.push_back(notification);
+    condWork.notify_one();
+}
+
+bool CChainIndexer::ReadBlock(const CBlockIndex* pindex, const CDiskBlockPos& pos, const CDiskBlockPos& undoPos,
+                              bool fConnect, CIndexerBlock& item)
+{
+    item.pindex = pindex;
+    item.pos = pos;
+    item.fConnect = fConnect;
+    if (!ReadBlockFromDisk(item.block, pos, Params().GetConsensus()) || item.block.GetHash() != pindex->GetBlockHash())
+        return false;
+    item.blockundo = CBlockUndo();
+    return !NeedsUndo() || UndoReadFromDisk(item.blockundo, undoPos, pindex->pprev->GetBlockHash());
+}
+
+bool CChainIndexer::ReadBlock(const CBlockIndex* pindex, bool fConnect, CIndexerBlock& item)
+{
+    for (int nAttempt = 0; nAttempt < 2; nAttempt++) {
+        CDiskBlockPos pos, undoPos;
+        {
+            LOCK(cs_main);
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (NeedsUndo() && !(pindex->nStatus & BLOCK_HAVE_UNDO)))
+                return error("%s: block %s is not available", __func__, pindex->GetBlockHash().ToString());
+            pos = pindex->GetBlockPos();
+            undoPos = pindex->GetUndoPos();
+        }
+        if (ReadBlock(pindex, pos, undoPos, fConnect, item))
+            return true;
+        // The block file compactor may have moved the block meanwhile.
+    }
+    return error("%s: cannot read block %s", __func__, pindex->GetBlockHash().ToString());
+}
+
+bool CChainIndexer::CatchUp(const CBlockIndex*& pindexIndexed, int nHeight)
+{
+    std::vector<CIndexerBlock> blocks;
+    int nIndexed = pindexIndexed->nHeight;
+    nHeight = std::min(nHeight, nIndexed + INDEXER_BATCH_BLOCKS);
+    blocks.reserve(nHeight - nIndexed);
+    const CBlockIndex* pindex = pindexIndexed;
+    while (pindex->nHeight < nHeight) {
+        {
+            LOCK(cs_main);
+            pindex = chainActive[pindex->nHeight + 1];
+        }
+        blocks.push_back(CIndexerBlock());
+        if (!ReadBlock(pindex, true, blocks.back()))
+            return false;
+    }
+    if (!WriteBlocks(blocks, pindex))
+        return false;
+    pindexIndexed = pindex;
+    return true;
+}
+
+bool CChainIndexer::CatchUpWithChain()
+{
+    LogPrintf("%s: catching up from height %d\n", strName, nBestHeight);
+    int64_t nStart = GetTimeMillis();
+    while (!StopRequested()) {
+        int nTarget;
+        {
+            LOCK(cs_main);
+            // The genesis block is never indexed.
+            if (!pindexBest && chainActive.Genesis()) {
+                SetBestBlock(chainActive.Genesis());
+                continue;
+            }
+            // Disconnect the blocks that left the active chain while the index was behind.
+            if (pindexBest && !chainActive.Contains(pindexBest)) {
+                std::vector<CIndexerBlock> blocks(1);
+                if (!ReadBlock(pindexBest, false, blocks[0]) || !WriteBlocks(blocks, pindexBest->pprev))
+                    return error("%s: cannot disconnect block %s", __func__, pindexBest->GetBlockHash().ToString());
+                SetBestBlock(pindexBest->pprev);
+                continue;
+            }
+            nTarget = chainActive.Height() - (int)MAX_REORG_LENGTH;
+        }
+
+        // Blocks more than MAX_REORG_LENGTH deep are not disconnected, so they
+        // are indexed without holding cs_main.
+        if (pindexBest && pindexBest->nHeight < nTarget) {
+            const CBlockIndex* pindex = pindexBest;
+            if (!CatchUp(pindex, nTarget))
+                return error("%s: cannot index blocks after height %d", __func__, pindexBest->nHeight);
+            SetBestBlock(pindex);
+            continue;
+        }
+
+        // Index the remaining blocks and follow the chain from here while no
+        // blocks are connected. Without a genesis block yet (e.g. while
+        // reindexing) the chain is followed from the start.
+        LOCK(cs_main);
+        if (pindexBest ? !chainActive.Contains(pindexBest) || pindexBest->nHeight < chainActive.Height() - (int)MAX_REORG_LENGTH
+                       : chainActive.Genesis() != NULL)
+            continue;
+        std::vector<CIndexerBlock> blocks;
+        for (const CBlockIndex* pindex = pindexBest ? chainActive.Next(pindexBest) : NULL; pindex; pindex = chainActive.Next(pindex)) {
+            blocks.push_back(CIndexerBlock());
+            if (!ReadBlock(pindex, true, blocks.back()))
+                return false;
+        }
+        if (!blocks.empty() && !WriteBlocks(blocks, chainActive.Tip()))
+            return error("%s: cannot index blocks after height %d", __func__, pindexBest->nHeight);
+        SetBestBlock(chainActive.Tip());
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fFollowing = true;
+        }
+        Synced();
+        LogPrintf("%s: caught up with the chain at height %d in %dms\n", strName, nBestHeight, GetTimeMillis() - nStart);
+        return true;
+    }
+    return true;
+}
+
+bool CChainIndexer::IndexNotifications(const std::deque<CNotification>& notifications)
+{
+    std::vector<CIndexerBlock> blocks;
+    blocks.reserve(notifications.size());
+    const CBlockIndex* pindex = pindexBest;
+    for (const CNotification& notification : notifications) {
+        if (notification.fConnect ? notification.pindex->pprev != pindex : notification.pindex != pindex)
+            return error("%s: block %s does not follow the indexed chain", __func__, notification.pindex->GetBlockHash().ToString());
+        if (notification.pindex->pprev) {
+            blocks.push_back(CIndexerBlock());
+            if (!ReadBlock(notification.pindex, notification.pos, notification.undoPos, notification.fConnect, blocks.back()))
+                return error("%s: cannot read block %s", __func__, notification.pindex->GetBlockHash().ToString());
+        }
+        pindex = notification.fConnect ? notification.pindex : notification.pindex->pprev;
+    }
+    if (!blocks.empty() && !WriteBlocks(blocks, pindex))
+        return false;
+    SetBestBlock(pindex);
+    return true;
+}
+
+bool CChainIndexer::Run()
+{
+    std::deque<CNotification> notifications;
+    while (true) {
+        bool fFollow;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Blocks queued before stopping are still indexed.
+            while (fFollowing && queue.empty() && !fStop)
+                condWork.wait(lock);
+            if (fStop && (!fFollowing || queue.empty()))
+                return true;
+            fFollow = fFollowing;
+            if (fFollow) {
+                notifications.clear();
+                notifications.swap(queue);
+                fBusy = true;
+            }
+        }
+
+        if (!fFollow) {
+            if (!CatchUpWithChain())
+                return false;
+            continue;
+        }
+
+        bool fIndexed = IndexNotifications(notifications);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fBusy = false;
+        if (!fIndexed) {
+            // Read the blocks again while catching up; the index has kept the last block it wrote.
+            LogPrintf("%s: cannot index the blocks queued, catching up with the chain\n", strName);
+            fFollowing = false;
+            queue.clear();
+        }
+        condDone.notify_all();
+    }
+}
+
+void CChainIndexer::ThreadMain()
+{
+    RenameThread(("arnak-" + strName).c_str());
+    bool fSuccess;
+    try {
+        fSuccess = Prepare() && Run();
+    } catch (const std::exception& e) {
+        fSuccess = error("%s: %s", strName, e.what());
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!fSuccess) {
+        LogPrintf("%s: %s failed and is no longer updated\n", __func__, strName);
+        fError = true;
+        fFollowing = false;
+        queue.clear();
+    }
+    fBusy = false;
+    condDone.notify_all();
+}
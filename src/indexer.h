@@ -0,0 +1,142 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_INDEXER_H
+#define BITCOIN_INDEXER_H
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "validationinterface.h"
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+/** Blocks that may wait to be indexed before an indexer stops following the chain and catches up instead. */
+static const size_t MAX_INDEXER_QUEUE_SIZE = 100;
+/** Blocks indexed per batch while an indexer catches up, unless it reads them itself. */
+static const int INDEXER_BATCH_BLOCKS = 100;
+
+/** A block to add to an index, or to remove from it. */
+struct CIndexerBlock
+{
+    const CBlockIndex* pindex;
+    CDiskBlockPos pos;       //!< where the block was read from
+    CBlock block;
+    CBlockUndo blockundo;    //!< only for indexers that need undo data
+    bool fConnect;
+};
+
+/**
+ * An index of the active chain that is kept up to date on its own thread,
+ * instead of by ConnectBlock and DisconnectBlock, so block validation never
+ * waits for it.
+ *
+ * An indexer starts out catching up: it disconnects the blocks it has that
+ * left the active chain, and indexes the blocks after the last one it has,
+ * reading them from disk. Once it has reached the tip, with cs_main held so no
+ * block is connected meanwhile, it follows the chain through ChainTip
+ * notifications, which queue the blocks connected and disconnected. If it falls
+ * MAX_INDEXER_QUEUE_SIZE blocks behind, the queue is dropped and it catches up
+ * again. An index records the last block it covers together with each write,
+ * so after a crash it catches up from there at startup.
+ *
+ * The genesis block is never indexed, as its outputs cannot be spent.
+ */
+class CChainIndexer : public CValidationInterface
+{
+private:
+    /** A block connected to or disconnected from the active chain. */
+    struct CNotification
+    {
+        const CBlockIndex* pindex;
+        CDiskBlockPos pos;
+        CDiskBlockPos undoPos;
+        bool fConnect;
+    };
+
+    const std::string strName;
+
+    //! Protects everything below.
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condDone;
+    std::deque<CNotification> queue;
+    bool fFollowing;    //!< set to true only with cs_main held
+    bool fBusy;         //!< indexing notifications taken off the queue
+    bool fRunning;
+    bool fStop;
+    bool fError;
+    boost::thread thread;
+
+    //! The last block indexed; used by the indexer thread only, once started.
+    const CBlockIndex* pindexBest;
+    std::atomic<int> nBestHeight;
+
+    void ThreadMain();
+    bool Run();
+    bool CatchUpWithChain();
+    bool IndexNotifications(const std::deque<CNotification>& notifications);
+    bool ReadBlock(const CBlockIndex* pindex, const CDiskBlockPos& pos, const CDiskBlockPos& undoPos,
+                   bool fConnect, CIndexerBlock& item);
+    void SetBestBlock(const CBlockIndex* pindex);
+    bool StopRequested();
+
+protected:
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, SproutMerkleTree sproutTree,
+                  SaplingMerkleTree saplingTree, bool added);
+
+    /** Find the last block the index covers, or NULL if it is empty. Called with cs_main held. */
+    virtual bool Init(const CBlockIndex*& pindexIndexed) = 0;
+    /** Work to do on the indexer thread before catching up, such as upgrading the database. */
+    virtual bool Prepare() { return true; }
+    /** Whether the blocks passed to WriteBlocks need their undo data. */
+    virtual bool NeedsUndo() const { return true; }
+    /**
+     * Add and remove the blocks, in order, in one write that also records
+     * pindexBest as the last block the index covers. Must not take cs_main.
+     */
+    virtual bool WriteBlocks(const std::vector<CIndexerBlock>& blocks, const CBlockIndex* pindexBest) = 0;
+    /**
+     * Index some of the blocks of the active chain after pindexIndexed, up to
+     * height nHeight, and move pindexIndexed forward. The blocks are more than
+     * MAX_REORG_LENGTH deep, so cs_main is not held. Indexers may override it
+     * to read blocks faster.
+     */
+    virtual bool CatchUp(const CBlockIndex*& pindexIndexed, int nHeight);
+    /** Called with cs_main held once the index has caught up with the active chain. */
+    virtual void Synced() {}
+
+    /** Read a block, and its undo data if needed, looking its position up under cs_main. */
+    bool ReadBlock(const CBlockIndex* pindex, bool fConnect, CIndexerBlock& item);
+
+public:
+    CChainIndexer(const std::string& strNameIn);
+    virtual ~CChainIndexer();
+
+    /** Load the index state and start following the chain, catching up first. */
+    bool Start();
+    /** Index the blocks queued so far and stop. */
+    void Stop();
+    /**
+     * Wait until the blocks connected so far are indexed. Returns false if the
+     * index is catching up with the chain instead, or has failed. May be called
+     * with cs_main held.
+     */
+    bool Flush();
+    /** Whether the index follows the chain through notifications. */
+    bool IsFollowing();
+    /** Whether the index is catching up, and the height it has reached. */
+    bool GetProgress(int& nHeight);
+    /** Whether the indexer stopped on an error, so the index is no longer updated. */
+    bool HasFailed();
+};
+
+#endif // BITCOIN_INDEXER_H
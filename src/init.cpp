@@ -11,12 +11,14 @@
 #include "crypto/common.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockfilewriter.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "insightindexer.h"
 #include "key.h"
 #ifdef ENABLE_MINING
 #include "key_io.h"
@@ -31,7 +33,9 @@
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "shieldedindexer.h"
 #include "txdb.h"
+#include "txindexer.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -107,6 +111,7 @@ enum BindFlags {
 };
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
+static bool fDumpMempoolLater = false;
 CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
 
 //////////////////////////////////////////////////////////////////////////////
@@ -210,6 +215,10 @@ void Shutdown()
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
 
+    if (fDumpMempoolLater && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        DumpMempool();
+    }
+
     if (fFeeEstimatesInitialized)
     {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -221,6 +230,23 @@ void Shutdown()
         fFeeEstimatesInitialized = false;
     }
 
+    // Index the blocks connected so far before the databases are closed.
+    if (ptxindexer) {
+        ptxindexer->Stop();
+        delete ptxindexer;
+        ptxindexer = NULL;
+    }
+    if (pinsightindexer) {
+        pinsightindexer->Stop();
+        delete pinsightindexer;
+        pinsightindexer = NULL;
+    }
+    if (pshieldedindexer) {
+        pshieldedindexer->Stop();
+        delete pshieldedindexer;
+        pshieldedindexer = NULL;
+    }
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
@@ -234,7 +260,12 @@ void Shutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete pinsightdb;
+        pinsightdb = NULL;
+        delete pshieldedindexdb;
+        pshieldedindexdb = NULL;
     }
+    blockFileWriter.Stop();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(true);
@@ -338,6 +369,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("This help message"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockcompression", strprintf(_("Store blocks compressed, and convert old block files in the background. "
+            "Warning: Block files written with this option can not be read by earlier versions (default: %u)"), DEFAULT_BLOCK_COMPRESSION));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3));
@@ -356,6 +389,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-mempooltxinputlimit=<n>", _("[DEPRECATED FROM OVERWINTER] Set the maximum number of transparent inputs in a transaction that the mempool will accept (default: 0 = no limit applied)"));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "arnakd.pid"));
 #endif
@@ -363,6 +397,7 @@ std::string HelpMessage(HelpMessageMode mode)
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files on startup"));
+    strUsage += HelpMessageOpt("-shieldedindex", strprintf(_("Maintain an index of shielded nullifiers and note commitments, used by the getnullifierinfo, getcommitmentinfo and getshieldedblockrange rpc calls (default: %u)"), 0));
 #if !defined(WIN32)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -373,6 +408,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-banscore=<n>", strprintf(_("Threshold for disconnecting misbehaving peers (default: %u)"), 100));
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), 86400));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
+    strUsage += HelpMessageOpt("-blockcompact", strprintf(_("Relay blocks to and from peers that support it as compact blocks, reconstructed from the mempool (default: %u)"), DEFAULT_BLOCKCOMPACT));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s)"));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP addresses (default: 1 when listening and no -externalip or -proxy)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)"));
@@ -384,6 +420,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Number of threads processing peer messages, blocks and headers are handled first (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-mempoolevictionmemoryminutes=<n>", strprintf(_("The number of minutes before allowing rejected transactions to re-enter the mempool. (default: %u)"), DEFAULT_MEMPOOL_EVICTION_MEMORY_MINUTES));
     strUsage += HelpMessageOpt("-mempooltxcostlimit=<n>",strprintf(_("An upper bound on the maximum size in bytes of all transactions in the mempool. (default: %s)"), DEFAULT_MEMPOOL_TOTAL_COST_LIMIT));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
@@ -399,6 +436,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
+    strUsage += HelpMessageOpt("-txreconciliation", strprintf(_("Relay transactions to peers that support it by set reconciliation instead of inv announcements (default: %u)"), DEFAULT_TXRECONCILIATION));
     strUsage += HelpMessageOpt("-whitebind=<addr>", _("Bind to given address and whitelist peers connecting to it. Use [host]:port notation for IPv6"));
     strUsage += HelpMessageOpt("-whitelist=<netmask>", _("Whitelist peers connecting from the given netmask or IP address. Can be specified multiple times.") +
         " " + _("Whitelisted peers cannot be DoS banned and their transactions are always relayed, even if they are already in the mempool, useful e.g. for a gateway"));
@@ -436,6 +474,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubcompactblock=<address>", _("Enable publish compact block of each connected block in <address>"));
 #endif
 
 #if ENABLE_PROTON
@@ -459,7 +498,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", 0));
         strUsage += HelpMessageOpt("-nuparams=hexBranchId:activationHeight", "Use given activation height for specified network upgrade (regtest-only)");
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, estimatefee, http, libevent, lock, mempool, net, partitioncheck, pow, proxy, prune, "
+    string debugCategories = "addrman, alert, bench, coindb, db, estimatefee, http, insightdb, libevent, lock, mempool, net, partitioncheck, pow, proxy, prune, "
                              "rand, reindex, rpc, selectcoins, tor, zmq, zrpc, zrpcunsafe (implies zrpc)"; // Don't translate these
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
         _("If <category> is not supplied or if <category> = 1, output all debugging information.") + " " + _("<category> can be:") + " " + debugCategories + ".");
@@ -612,18 +651,10 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     // -reindex
     if (fReindex) {
         CImportingNow imp;
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
-        }
+        // On failure the block index stays marked as being reindexed, so the
+        // reindex starts over next time.
+        if (!ReindexBlockFiles(chainparams))
+            return;
         pblocktree->WriteReindexing(false);
         fReindex = false;
         LogPrintf("Reindexing finished\n");
@@ -662,6 +693,11 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+        fDumpMempoolLater = !fRequestShutdown;
+    }
 }
 
 void ThreadNotifyRecentlyAdded()
@@ -920,6 +956,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
+    // Connecting to peers, and the socket handler when epoll is not available,
+    // still use select(), so keep every socket below FD_SETSIZE.
     nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
@@ -932,6 +970,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", false))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-shieldedindex", false))
+            return InitError(_("Prune mode is incompatible with -shieldedindex."));
 #ifdef ENABLE_WALLET
         if (!GetBoolArg("-disablewallet", false)) {
             if (SoftSetBoolArg("-disablewallet", true))
@@ -1010,6 +1050,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         fPruneMode = true;
     }
 
+    fBlockCompression = GetBoolArg("-blockcompression", DEFAULT_BLOCK_COMPRESSION);
+
     RegisterAllCoreRPCCommands(tableRPC);
 #ifdef ENABLE_WALLET
     bool fDisableWallet = GetBoolArg("-disablewallet", false);
@@ -1100,6 +1142,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     nMaxDatacarrierBytes = GetArg("-datacarriersize", nMaxDatacarrierBytes);
 
     fAlerts = GetBoolArg("-alerts", DEFAULT_ALERTS);
+    fTxReconciliation = GetBoolArg("-txreconciliation", DEFAULT_TXRECONCILIATION);
+    fBlockCompact = GetBoolArg("-blockcompact", DEFAULT_BLOCKCOMPACT);
 
     // Option to startup with mocktime set (used for regression testing):
     SetMockTime(GetArg("-mocktime", 0)); // SetMockTime(0) is a no-op
@@ -1224,6 +1268,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    // Write block and undo files in the background
+    blockFileWriter.Start();
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
@@ -1454,6 +1501,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greated than nMaxDbcache
     int64_t nBlockTreeDBCache = nTotalCache / 8;
+    int64_t nInsightIndexDBCache = 0;
     if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
         nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
 
@@ -1462,15 +1510,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         if (!GetBoolArg("-txindex", false)) {
             return InitError(_("-insightexplorer requires -txindex."));
         }
-        // increase cache if additional indices are needed
-        nBlockTreeDBCache = nTotalCache * 3 / 4;
+        // the insight indexes get their own database, with more cache than the block index
+        nInsightIndexDBCache = nTotalCache / 2;
+        nBlockTreeDBCache = nTotalCache / 4;
     }
-    nTotalCache -= nBlockTreeDBCache;
+    fShieldedIndex = GetBoolArg("-shieldedindex", false);
+    int64_t nShieldedIndexDBCache = fShieldedIndex ? nTotalCache / 8 : 0;
+    nTotalCache -= nBlockTreeDBCache + nInsightIndexDBCache + nShieldedIndexDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (nInsightIndexDBCache > 0)
+        LogPrintf("* Using %.1fMiB for insight index database\n", nInsightIndexDBCache * (1.0 / 1024 / 1024));
+    if (nShieldedIndexDBCache > 0)
+        LogPrintf("* Using %.1fMiB for shielded index database\n", nShieldedIndexDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
@@ -1491,8 +1546,29 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete pinsightdb;
+                pinsightdb = NULL;
+                delete pshieldedindexdb;
+                pshieldedindexdb = NULL;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
+                // insightexplorer: open the indexes if they are enabled, or were before so that
+                // disabling them can be detected. Reindexing without them removes them.
+                boost::filesystem::path pathInsightIndexes = GetDataDir() / "indexes";
+                if (GetBoolArg("-insightexplorer", false)) {
+                    pinsightdb = new CInsightIndexDB(std::max(nInsightIndexDBCache, (int64_t)nMinDbCache << 20), false, fReindex);
+                } else if (fReindex) {
+                    boost::filesystem::remove_all(pathInsightIndexes);
+                } else if (boost::filesystem::exists(pathInsightIndexes)) {
+                    pinsightdb = new CInsightIndexDB(nMinDbCache << 20, false, false);
+                }
+                // The shielded index catches up with the chain when it is
+                // enabled again, so it is only removed when reindexing.
+                if (fShieldedIndex) {
+                    pshieldedindexdb = new CShieldedIndexDB(std::max(nShieldedIndexDBCache, (int64_t)nMinDbCache << 20), false, fReindex);
+                } else if (fReindex) {
+                    boost::filesystem::remove_all(GetDataDir() / "shieldedindex");
+                }
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
@@ -1526,8 +1602,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
-                // Check for changed -insightexplorer state
-                if (fInsightExplorer != GetBoolArg("-insightexplorer", false)) {
+                // Check for changed -insightexplorer state; enabling it builds the indexes in the background
+                if (pinsightdb && !GetBoolArg("-insightexplorer", false)) {
                     strLoadError = _("You need to rebuild the database using -reindex to change -insightexplorer");
                     break;
                 }
@@ -1596,6 +1672,25 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // The transaction, insight and shielded indexes are kept up to date in the
+    // background, see indexer.h. They first catch up with the chain if they
+    // are behind, or have just been enabled.
+    if (fTxIndex) {
+        ptxindexer = new CTxIndexer();
+        if (!ptxindexer->Start())
+            return InitError(_("Error loading the transaction index, you need to rebuild the database using -reindex"));
+    }
+    if (GetBoolArg("-insightexplorer", false)) {
+        pinsightindexer = new CInsightIndexer();
+        if (!pinsightindexer->Start())
+            return InitError(_("Error loading the insight explorer indexes, you need to rebuild the database using -reindex"));
+    }
+    if (fShieldedIndex) {
+        pshieldedindexer = new CShieldedIndexer();
+        if (!pshieldedindexer->Start())
+            return InitError(_("Error loading the shielded index, you need to rebuild the database using -reindex"));
+    }
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1859,6 +1954,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // recently added to the mempool.
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "txnotify", &ThreadNotifyRecentlyAdded));
 
+    // Convert old block files to compressed storage.
+    if (fBlockCompression)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "compact", &ThreadCompactBlockFiles));
+
+    // insightexplorer: build the address balance index if the database predates it.
+    if (pinsightindexer && !pinsightindexer->HaveBalances())
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "addrbalance", &ThreadBuildAddressBalanceIndex));
+
     if (GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
         StartTorControl(threadGroup, scheduler);
 
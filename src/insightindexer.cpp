@@ -0,0 +1,344 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "insightindexer.h"
+
+#include "blockdeltas.h"
+#include "chainparams.h"
+#include "main.h"
+#include "util.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+CInsightIndexer* pinsightindexer = NULL;
+
+/**
+ * Get the insight index update of connecting a block, or of disconnecting it
+ * if fDisconnect. The outputs its inputs spent come from its undo data.
+ */
+static bool GetInsightIndexUpdate(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex,
+                                  bool fDisconnect, CInsightIndexUpdate& update)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: undo data does not match block", __func__);
+
+    update.fDisconnect = fDisconnect;
+    update.hashBlock = pindex->GetBlockHash();
+    update.hashPrevBlock = pindex->pprev->GetBlockHash();
+    update.nTime = pindex->nTime;
+    const int nHeight = pindex->nHeight;
+
+    // Disconnecting undoes the transactions in reverse order.
+    for (unsigned int n = 0; n < block.vtx.size(); n++) {
+        const unsigned int i = fDisconnect ? block.vtx.size() - 1 - n : n;
+        const CTransaction& tx = block.vtx[i];
+        const uint256 hash = tx.GetHash();
+
+        if (fDisconnect) {
+            for (unsigned int k = tx.vout.size(); k-- > 0;) {
+                const CTxOut& out = tx.vout[k];
+                CScript::ScriptType scriptType = out.scriptPubKey.GetType();
+                if (scriptType != CScript::UNKNOWN) {
+                    uint160 const addrHash = out.scriptPubKey.AddressHash();
+                    // undo receiving activity and the unspent index
+                    update.addressIndex.push_back(std::make_pair(
+                        CAddressIndexKey(scriptType, addrHash, nHeight, i, hash, k, false),
+                        out.nValue));
+                    update.addressUnspentIndex.push_back(std::make_pair(
+                        CAddressUnspentKey(scriptType, addrHash, hash, k),
+                        CAddressUnspentValue()));
+                }
+            }
+        }
+
+        if (!tx.IsCoinBase()) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return error("%s: undo data does not match transaction %s", __func__, hash.ToString());
+            for (unsigned int m = 0; m < tx.vin.size(); m++) {
+                const unsigned int j = fDisconnect ? tx.vin.size() - 1 - m : m;
+                const CTxIn& input = tx.vin[j];
+                const CTxInUndo& undo = txundo.vprevout[j];
+                const CTxOut& prevout = undo.txout;
+                CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
+                const uint160 addrHash = prevout.scriptPubKey.AddressHash();
+                if (scriptType != CScript::UNKNOWN) {
+                    update.addressIndex.push_back(std::make_pair(
+                        CAddressIndexKey(scriptType, addrHash, nHeight, i, hash, j, true),
+                        prevout.nValue * -1));
+                    // remove the output from the unspent index, or restore it
+                    update.addressUnspentIndex.push_back(std::make_pair(
+                        CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
+                        fDisconnect ? CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)
+                                    : CAddressUnspentValue()));
+                }
+                // Outputs with an unknown script type get a spent index entry
+                // too, with a script type of 0 and an address hash of zeroes.
+                update.spentIndex.push_back(std::make_pair(
+                    CSpentIndexKey(input.prevout.hash, input.prevout.n),
+                    fDisconnect ? CSpentIndexValue()
+                                : CSpentIndexValue(hash, j, nHeight, prevout.nValue, scriptType, addrHash)));
+            }
+        }
+
+        if (!fDisconnect) {
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut& out = tx.vout[k];
+                CScript::ScriptType scriptType = out.scriptPubKey.GetType();
+                if (scriptType != CScript::UNKNOWN) {
+                    uint160 const addrHash = out.scriptPubKey.AddressHash();
+                    // record receiving activity and the unspent output
+                    update.addressIndex.push_back(std::make_pair(
+                        CAddressIndexKey(scriptType, addrHash, nHeight, i, hash, k, false),
+                        out.nValue));
+                    update.addressUnspentIndex.push_back(std::make_pair(
+                        CAddressUnspentKey(scriptType, addrHash, hash, k),
+                        CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/** A block read while the insight indexes catch up. */
+struct CInsightIndexBlock {
+    const CBlockIndex* pindex;
+    CDiskBlockPos blockPos;
+    CDiskBlockPos undoPos;
+    CInsightIndexUpdate update;
+    bool fRead;
+};
+
+static void ReadInsightIndexBlocks(std::vector<CInsightIndexBlock>& vBlocks, size_t nFirst, size_t nStep)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    for (size_t i = nFirst; i < vBlocks.size(); i += nStep) {
+        CInsightIndexBlock& item = vBlocks[i];
+        CBlock block;
+        CBlockUndo blockundo;
+        item.fRead = ReadBlockFromDisk(block, item.blockPos, consensusParams) &&
+                     block.GetHash() == item.pindex->GetBlockHash() &&
+                     UndoReadFromDisk(blockundo, item.undoPos, item.pindex->pprev->GetBlockHash()) &&
+                     GetInsightIndexUpdate(block, blockundo, item.pindex, false, item.update);
+    }
+}
+
+bool CInsightIndexer::Init(const CBlockIndex*& pindexIndexed)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_balances);
+    // Balances are kept up to date while catching up if the balance index was complete.
+    fBalances = false;
+    pinsightdb->ReadFlag("addressbalanceindex", fBalances);
+
+    uint256 hashIndexed;
+    if (!pinsightdb->ReadBestBlock(hashIndexed))
+        return true;
+    BlockMap::iterator mi = mapBlockIndex.find(hashIndexed);
+    if (mi == mapBlockIndex.end())
+        return error("%s: the insight indexes were built for a different chain, use -reindex", __func__);
+    pindexIndexed = mi->second;
+    return true;
+}
+
+bool CInsightIndexer::Prepare()
+{
+    // Earlier versions kept the indexes in the block index database. Nothing
+    // writes them there anymore, so they are removed without holding cs_main.
+    bool fLegacyIndexes = false;
+    if (pblocktree->ReadFlag("insightexplorer", fLegacyIndexes) && fLegacyIndexes) {
+        LogPrintf("Removing insight explorer indexes from the block index database...\n");
+        if (!pblocktree->EraseInsightIndexes() ||
+            !pblocktree->WriteFlag("insightexplorer", false) ||
+            !pblocktree->WriteFlag("addressbalanceindex", false))
+            return error("%s: cannot remove insight indexes from the block index database", __func__);
+    }
+    return true;
+}
+
+/**
+ * Write the updates of a batch of blocks. While the balance index is built,
+ * only the balances of the addresses it has been built for are updated.
+ */
+bool CInsightIndexer::WriteUpdates(std::vector<CInsightIndexUpdate>& updates)
+{
+    LOCK(cs_balances);
+    for (CInsightIndexUpdate& update : updates) {
+        update.fAllBalances = fBalances;
+        update.balanceCursor = balanceCursor;
+    }
+    if (!pinsightdb->WriteUpdates(updates))
+        return error("%s: cannot write insight indexes", __func__);
+    return true;
+}
+
+bool CInsightIndexer::WriteBlocks(const std::vector<CIndexerBlock>& blocks, const CBlockIndex* pindexBest)
+{
+    // The entries come from the undo data, which holds the outputs the blocks spent.
+    std::vector<CInsightIndexUpdate> updates(blocks.size());
+    bool fFollowing = IsFollowing();
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const CIndexerBlock& item = blocks[i];
+        if (!GetInsightIndexUpdate(item.block, item.blockundo, item.pindex, !item.fConnect, updates[i]))
+            return false;
+
+        // Explorers ask for the deltas of every new block, so have them ready.
+        if (fFollowing && item.fConnect) {
+            std::shared_ptr<CBlockDeltas> deltas = std::make_shared<CBlockDeltas>();
+            if (ComputeBlockDeltas(item.block, item.blockundo, *deltas))
+                blockDeltasCache.Insert(item.pindex->GetBlockHash(), deltas);
+        }
+    }
+    return WriteUpdates(updates);
+}
+
+/**
+ * Add the blocks of the active chain after pindexIndexed to the indexes,
+ * reading them on several threads. cs_main is only taken to look the blocks up.
+ */
+bool CInsightIndexer::CatchUp(const CBlockIndex*& pindexIndexed, int nHeight)
+{
+    nHeight = std::min(nHeight, pindexIndexed->nHeight + INSIGHT_INDEX_BATCH_BLOCKS);
+    std::vector<CInsightIndexBlock> vBlocks;
+    for (int nAttempt = 0; ; nAttempt++) {
+        vBlocks.clear();
+        {
+            LOCK(cs_main);
+            if (!chainActive.Contains(pindexIndexed))
+                return error("%s: block %s is no longer in the active chain", __func__, pindexIndexed->GetBlockHash().ToString());
+            for (int h = pindexIndexed->nHeight + 1; h <= nHeight; h++) {
+                CInsightIndexBlock item;
+                item.pindex = chainActive[h];
+                if (!(item.pindex->nStatus & BLOCK_HAVE_DATA) || !(item.pindex->nStatus & BLOCK_HAVE_UNDO))
+                    return error("%s: block %s is not available", __func__, item.pindex->GetBlockHash().ToString());
+                item.blockPos = item.pindex->GetBlockPos();
+                item.undoPos = item.pindex->GetUndoPos();
+                item.fRead = false;
+                vBlocks.push_back(item);
+            }
+        }
+        if (vBlocks.empty())
+            return true;
+
+        int nThreads = std::min(MAX_INSIGHT_INDEX_THREADS, (int)vBlocks.size());
+        boost::thread_group threads;
+        for (int i = 1; i < nThreads; i++)
+            threads.create_thread(boost::bind(&ReadInsightIndexBlocks, boost::ref(vBlocks), i, nThreads));
+        try {
+            ReadInsightIndexBlocks(vBlocks, 0, nThreads);
+        } catch (...) {
+            threads.join_all();
+            throw;
+        }
+        threads.join_all();
+
+        bool fRead = true;
+        for (const CInsightIndexBlock& item : vBlocks)
+            fRead = fRead && item.fRead;
+        if (fRead)
+            break;
+        // The block file compactor may have moved the blocks meanwhile.
+        if (nAttempt > 0)
+            return error("%s: cannot read blocks", __func__);
+    }
+
+    std::vector<CInsightIndexUpdate> updates;
+    updates.reserve(vBlocks.size());
+    for (CInsightIndexBlock& item : vBlocks) {
+        updates.push_back(CInsightIndexUpdate());
+        std::swap(updates.back(), item.update);
+    }
+    if (!WriteUpdates(updates))
+        return false;
+    pindexIndexed = vBlocks.back().pindex;
+    return true;
+}
+
+void CInsightIndexer::Synced()
+{
+    AssertLockHeld(cs_main);
+    if (!fInsightExplorer) {
+        pinsightdb->WriteFlag("insightexplorer", true);
+        LogPrintf("Insight explorer indexes are ready\n");
+    }
+    fInsightExplorer = true;
+    fAddressIndex = true;
+    fSpentIndex = true;
+    fTimestampIndex = true;
+    LOCK(cs_balances);
+    fAddressBalanceIndex = fBalances;
+}
+
+bool CInsightIndexer::HaveBalances()
+{
+    LOCK(cs_balances);
+    return fBalances;
+}
+
+bool CInsightIndexer::EraseAddressBalances()
+{
+    // Nothing is updated while the cursor is at the start, so leftovers of an
+    // earlier attempt can be removed.
+    LOCK(cs_balances);
+    return pinsightdb->EraseAddressBalanceIndex();
+}
+
+bool CInsightIndexer::BuildAddressBalances(bool& fDone)
+{
+    // No blocks are written while a batch of addresses is done.
+    LOCK(cs_balances);
+    CAddressIndexIteratorKey cursor = balanceCursor;
+    if (!pinsightdb->BuildAddressBalanceIndex(cursor, ADDRESS_BALANCE_INDEX_BATCH_SIZE, fDone))
+        return false;
+    balanceCursor = cursor;
+    if (fDone) {
+        pinsightdb->WriteFlag("addressbalanceindex", true);
+        fBalances = true;
+    }
+    return true;
+}
+
+bool GetInsightIndexProgress(int& nHeight)
+{
+    return pinsightindexer && pinsightindexer->GetProgress(nHeight);
+}
+
+void ThreadBuildAddressBalanceIndex()
+{
+    if (pinsightindexer->HaveBalances())
+        return;
+    // The other indexes catch up with the chain first, so they are not slowed
+    // down by balance updates meanwhile.
+    while (!pinsightindexer->IsFollowing()) {
+        if (pinsightindexer->HasFailed()) {
+            LogPrintf("%s: insight indexer failed, not building address balance index\n", __func__);
+            return;
+        }
+        boost::this_thread::interruption_point();
+        MilliSleep(1000);
+    }
+
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("Building address balance index...\n");
+    if (!pinsightindexer->EraseAddressBalances()) {
+        LogPrintf("%s: cannot erase address balance index\n", __func__);
+        return;
+    }
+
+    bool fDone = false;
+    while (!fDone) {
+        boost::this_thread::interruption_point();
+        if (!pinsightindexer->BuildAddressBalances(fDone)) {
+            LogPrintf("%s: cannot build address balance index\n", __func__);
+            return;
+        }
+    }
+    {
+        LOCK(cs_main);
+        fAddressBalanceIndex = true;
+    }
+    LogPrintf("Built address balance index in %dms\n", GetTimeMillis() - nStart);
+}
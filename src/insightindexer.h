@@ -0,0 +1,66 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_INSIGHTINDEXER_H
+#define BITCOIN_INSIGHTINDEXER_H
+
+#include "addressindex.h"
+#include "indexer.h"
+#include "sync.h"
+#include "txdb.h"
+
+// Number of address index entries summed per batch while the address balance index is built
+static const size_t ADDRESS_BALANCE_INDEX_BATCH_SIZE = 100000;
+
+// Blocks indexed per batch while the insight indexes catch up with the chain
+static const int INSIGHT_INDEX_BATCH_BLOCKS = 1000;
+
+// Maximum number of threads reading blocks while the insight indexes catch up
+static const int MAX_INSIGHT_INDEX_THREADS = 4;
+
+/**
+ * Keeps the insight explorer indexes in CInsightIndexDB: the address, address
+ * unspent, spent and timestamp indexes, and the address balance index once it
+ * has been built. The indexes are enabled (fInsightExplorer) whenever they have
+ * caught up with the active chain.
+ */
+class CInsightIndexer : public CChainIndexer
+{
+private:
+    //! Held while balances are updated, so the balance index is built between writes.
+    CCriticalSection cs_balances;
+    //! The first address the balance index has not been built for yet, while it is built.
+    CAddressIndexIteratorKey balanceCursor;
+    //! Whether every balance is kept up to date.
+    bool fBalances;
+
+    bool WriteUpdates(std::vector<CInsightIndexUpdate>& updates);
+
+protected:
+    bool Init(const CBlockIndex*& pindexIndexed);
+    bool Prepare();
+    bool WriteBlocks(const std::vector<CIndexerBlock>& blocks, const CBlockIndex* pindexBest);
+    bool CatchUp(const CBlockIndex*& pindexIndexed, int nHeight);
+    void Synced();
+
+public:
+    CInsightIndexer() : CChainIndexer("insightindex"), fBalances(false) {}
+
+    /** Whether the address balance index is complete. */
+    bool HaveBalances();
+    /** Remove what an earlier attempt left of the balance index, before building it. */
+    bool EraseAddressBalances();
+    /** Build the balance index for the next batch of addresses; fDone once it is complete. */
+    bool BuildAddressBalances(bool& fDone);
+};
+
+/** The insight indexer, if -insightexplorer is set */
+extern CInsightIndexer* pinsightindexer;
+
+/** Get the height the insight indexes have reached, while they catch up with the chain. */
+bool GetInsightIndexProgress(int& nHeight);
+/** Build the address balance index from the address index, for databases that do not have it yet */
+void ThreadBuildAddressBalanceIndex();
+
+#endif // BITCOIN_INSIGHTINDEXER_H
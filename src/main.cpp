@@ -10,6 +10,11 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockcompression.h"
+#include "blockdeltas.h"
+#include "blockencodings.h"
+#include "blockfilemap.h"
+#include "blockfilewriter.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -17,11 +22,15 @@
 #include "consensus/validation.h"
 #include "deprecation.h"
 #include "init.h"
+#include "insightindexer.h"
 #include "merkleblock.h"
 #include "metrics.h"
 #include "net.h"
 #include "pow.h"
+#include "shieldedindexer.h"
+#include "txindexer.h"
 #include "txmempool.h"
+#include "txreconciliation.h"
 #include "ui_interface.h"
 #include "undo.h"
 #include "util.h"
@@ -66,12 +75,15 @@ bool fExperimentalMode = false;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fShieldedIndex = false;
 bool fInsightExplorer = false;  // insightexplorer
 bool fAddressIndex = false;     // insightexplorer
 bool fSpentIndex = false;       // insightexplorer
 bool fTimestampIndex = false;   // insightexplorer
+bool fAddressBalanceIndex = false; // insightexplorer
 bool fHavePruned = false;
 bool fPruneMode = false;
+bool fBlockCompression = DEFAULT_BLOCK_COMPRESSION;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = true;
@@ -79,6 +91,8 @@ bool fCoinbaseEnforcedProtectionEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
+bool fTxReconciliation = DEFAULT_TXRECONCILIATION;
+bool fBlockCompact = DEFAULT_BLOCKCOMPACT;
 /* If the tip is older than this (in seconds), the node is considered to be in initial block download.
  */
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -221,6 +235,7 @@ namespace {
         int64_t nTime;           //!< Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //!< Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //!< The timeout for this block request (for disconnecting a slow peer)
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for compact blocks.
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -230,11 +245,51 @@ namespace {
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
+    /** Requested blocks delivered in the last BLOCK_DOWNLOAD_RATE_PERIOD seconds: (time in microseconds, size). */
+    deque<pair<int64_t, unsigned int> > dequeBlocksDelivered;
+
     /** Dirty block index entries. */
     set<CBlockIndex*> setDirtyBlockIndex;
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** A block as stored on disk, with the checksum of a "block" message carrying it. */
+    struct CRawBlock {
+        std::vector<unsigned char> vData;
+        unsigned int nChecksum;
+    };
+
+    /**
+     * Blocks recently served to peers in serialized form, most recently used
+     * first, so that many peers fetching the same (tip) block cost one read
+     * and one checksum. Protected by cs_main.
+     */
+    typedef list<pair<uint256, std::shared_ptr<const CRawBlock> > > RawBlockList;
+    RawBlockList listRawBlockCache;
+    map<uint256, RawBlockList::iterator> mapRawBlockCache;
+    size_t nRawBlockCacheSize = 0;
+
+    /** A block with the data for building merkleblocks of it for any filter. */
+    struct CFilteredBlockSource {
+        CBlock block;
+        CMerkleBlockData merkleData;
+        size_t nUsage;
+
+        CFilteredBlockSource(const CBlock& blockIn) : block(blockIn), merkleData(block) {
+            nUsage = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) + merkleData.DynamicMemoryUsage();
+        }
+    };
+
+    /**
+     * Blocks recently requested as filtered blocks, most recently used first,
+     * so that light clients rescanning the same blocks do not each cost a
+     * read, txid and merkle tree hashing and script parsing. Protected by cs_main.
+     */
+    typedef list<pair<uint256, std::shared_ptr<const CFilteredBlockSource> > > FilteredBlockList;
+    FilteredBlockList listFilteredBlockCache;
+    map<uint256, FilteredBlockList::iterator> mapFilteredBlockCache;
+    size_t nFilteredBlockCacheSize = 0;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -282,6 +337,12 @@ struct CNodeState {
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! How many blocks may be in flight from this peer, see BlocksInTransitLimit.
+    int nBlocksInTransitLimit;
+    //! Moving average of the time (in microseconds) this peer took per requested block, or 0 if not measured yet.
+    int64_t nAvgBlockInterval;
+    //! When this peer last delivered a block we requested (in microseconds), or 0.
+    int64_t nLastBlockDelivered;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
 
@@ -296,6 +357,9 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlocksInTransitLimit = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        nAvgBlockInterval = 0;
+        nLastBlockDelivered = 0;
         fPreferredDownload = false;
     }
 };
@@ -361,10 +425,20 @@ void FinalizeNode(NodeId nodeid) {
 
 // Requires cs_main.
 // Returns a bool indicating whether we requested this block.
-bool MarkBlockAsReceived(const uint256& hash) {
+// If pblock is given, the block was actually delivered and counts towards the peer's throughput.
+bool MarkBlockAsReceived(const uint256& hash, const CBlock* pblock = NULL) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (pblock) {
+            // Time the peer spent on this block: since it was requested, or since the
+            // previous block it delivered if it was still busy with that one.
+            int64_t nNow = GetTimeMicros();
+            int64_t nInterval = nNow - std::max(itInFlight->second.second->nTime, state->nLastBlockDelivered);
+            state->nAvgBlockInterval = state->nAvgBlockInterval == 0 ? nInterval : (7 * state->nAvgBlockInterval + nInterval) / 8;
+            state->nLastBlockDelivered = nNow;
+            dequeBlocksDelivered.push_back(std::make_pair(nNow, (unsigned int)::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION)));
+        }
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
@@ -377,7 +451,8 @@ bool MarkBlockAsReceived(const uint256& hash) {
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
+// If pit is given, it is set to the new entry in the peer's in-flight list.
+void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL, list<QueuedBlock>::iterator **pit = NULL) {
     CNodeState *state = State(nodeid);
     assert(state != NULL);
 
@@ -386,12 +461,38 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
 
     int64_t nNow = GetTimeMicros();
     int nHeight = pindex != NULL ? pindex->nHeight : chainActive.Height(); // Help block timeout computation
-    QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams, nHeight)};
+    QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams, nHeight), NULL};
     nQueuedValidatedHeaders += newentry.fValidatedHeaders;
     list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += newentry.fValidatedHeaders;
     mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
+    if (pit)
+        *pit = &mapBlocksInFlight[hash].second;
+}
+
+/** How many blocks may be in flight from a peer: enough to keep it busy for a round trip
+ *  plus BLOCK_DOWNLOAD_TARGET_TIME seconds at the rate it has been delivering them. */
+int BlocksInTransitLimit(const CNodeState* state, int64_t nPingUsecTime) {
+    if (state->nAvgBlockInterval == 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nRoundTrip = nPingUsecTime == std::numeric_limits<int64_t>::max() ? 0 : nPingUsecTime;
+    int64_t nLimit = (nRoundTrip + 1000000 * (int64_t)BLOCK_DOWNLOAD_TARGET_TIME) / std::max<int64_t>(state->nAvgBlockInterval, 1);
+    return std::max<int64_t>(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(MAX_BLOCKS_IN_TRANSIT_PER_FAST_PEER, nLimit));
+}
+
+/** Drop block deliveries older than BLOCK_DOWNLOAD_RATE_PERIOD. */
+void PruneBlocksDelivered(int64_t nNow) {
+    while (!dequeBlocksDelivered.empty() && dequeBlocksDelivered.front().first < nNow - 1000000 * (int64_t)BLOCK_DOWNLOAD_RATE_PERIOD)
+        dequeBlocksDelivered.pop_front();
+}
+
+/** The block download window: BLOCK_DOWNLOAD_WINDOW_TIME seconds at the current download rate, so that
+ *  fast peers do not run out of work while the slowest in-flight block is on its way. */
+int GetBlockDownloadWindow() {
+    PruneBlocksDelivered(GetTimeMicros());
+    uint64_t nWindow = dequeBlocksDelivered.size() * BLOCK_DOWNLOAD_WINDOW_TIME / BLOCK_DOWNLOAD_RATE_PERIOD;
+    return std::max<uint64_t>(BLOCK_DOWNLOAD_WINDOW, std::min<uint64_t>(MAX_BLOCK_DOWNLOAD_WINDOW, nWindow));
 }
 
 /** Check whether the last unknown block a peer advertized is not yet known. */
@@ -447,8 +548,9 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+ *  at most count entries. If the download window keeps us from fetching anything, nodeStaller and
+ *  pindexStalled are set to the peer and the block the window is waiting for. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, CBlockIndex*& pindexStalled) {
     if (count == 0)
         return;
 
@@ -478,12 +580,13 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
     std::vector<CBlockIndex*> vToFetch;
     CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
-    // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
+    // Never fetch further than the best block we know the peer has, or more than the download window + 1 beyond the last
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
     // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + GetBlockDownloadWindow();
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    CBlockIndex *pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -515,6 +618,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalled = pindexWaitingFor;
                     }
                     return;
                 }
@@ -525,6 +629,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -540,6 +645,7 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     stats.nMisbehavior = state->nMisbehavior;
     stats.nSyncHeight = state->pindexBestKnownBlock ? state->pindexBestKnownBlock->nHeight : -1;
     stats.nCommonHeight = state->pindexLastCommonBlock ? state->pindexLastCommonBlock->nHeight : -1;
+    stats.nBlocksInTransitLimit = state->nBlocksInTransitLimit;
     BOOST_FOREACH(const QueuedBlock& queue, state->vBlocksInFlight) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
@@ -547,6 +653,18 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     return true;
 }
 
+void GetBlockDownloadStats(CBlockDownloadStats& stats) {
+    AssertLockHeld(cs_main);
+    PruneBlocksDelivered(GetTimeMicros());
+    uint64_t nBytes = 0;
+    for (deque<pair<int64_t, unsigned int> >::const_iterator it = dequeBlocksDelivered.begin(); it != dequeBlocksDelivered.end(); ++it)
+        nBytes += it->second;
+    stats.dBlocksPerSecond = (double)dequeBlocksDelivered.size() / BLOCK_DOWNLOAD_RATE_PERIOD;
+    stats.dBytesPerSecond = (double)nBytes / BLOCK_DOWNLOAD_RATE_PERIOD;
+    stats.nBlocksInFlight = mapBlocksInFlight.size();
+    stats.nDownloadWindow = GetBlockDownloadWindow();
+}
+
 void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.GetHeight.connect(&GetHeight);
@@ -585,6 +703,8 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CInsightIndexDB *pinsightdb = NULL;
+CShieldedIndexDB *pshieldedindexdb = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1371,8 +1491,14 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee)
+/**
+ * nAcceptTime is recorded as the entry time of the transaction. If fTxChecked
+ * is set, the caller has already run CheckTransaction and
+ * ContextualCheckTransaction (including proof verification) against the
+ * height of the next block, and they are not repeated here.
+ */
+static bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                     bool* pfMissingInputs, bool fRejectAbsurdFee, int64_t nAcceptTime, bool fTxChecked)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1400,14 +1526,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         return false;
     }
 
-    auto verifier = libzcash::ProofVerifier::Strict();
-    if (!CheckTransaction(tx, state, verifier))
-        return error("AcceptToMemoryPool: CheckTransaction failed");
+    if (!fTxChecked) {
+        auto verifier = libzcash::ProofVerifier::Strict();
+        if (!CheckTransaction(tx, state, verifier))
+            return error("AcceptToMemoryPool: CheckTransaction failed");
 
-    // DoS level set to 10 to be more forgiving.
-    // Check transaction contextually against the set of consensus rules which apply in the next block to be mined.
-    if (!ContextualCheckTransaction(tx, state, Params(), nextBlockHeight, 10)) {
-        return error("AcceptToMemoryPool: ContextualCheckTransaction failed");
+        // DoS level set to 10 to be more forgiving.
+        // Check transaction contextually against the set of consensus rules which apply in the next block to be mined.
+        if (!ContextualCheckTransaction(tx, state, Params(), nextBlockHeight, 10)) {
+            return error("AcceptToMemoryPool: ContextualCheckTransaction failed");
+        }
     }
 
     // DoS mitigation: reject transactions expiring soon
@@ -1547,7 +1675,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // it has passed ContextualCheckInputs and therefore this is correct.
         auto consensusBranchId = CurrentEpochBranchId(chainActive.Height() + 1, Params().GetConsensus());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, consensusBranchId);
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, consensusBranchId);
         unsigned int nSize = entry.GetTxSize();
 
         // Accept a tx if it contains joinsplits and has at least the default fee specified by z_sendmany.
@@ -1645,13 +1773,19 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return true;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fRejectAbsurdFee)
+{
+    return AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fRejectAbsurdFee, GetTime(), false);
+}
+
 bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
     std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
     if (!fTimestampIndex)
         return error("Timestamp index not enabled");
 
-    if (!pblocktree->ReadTimestampIndex(high, low, fActiveOnly, hashes))
+    if (!pinsightindexer->Flush() || !pinsightdb->ReadTimestampIndex(high, low, fActiveOnly, hashes))
         return error("Unable to get hashes for timestamps");
 
     return true;
@@ -1666,7 +1800,7 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     if (mempool.getSpentIndex(key, value))
         return true;
 
-    if (!pblocktree->ReadSpentIndex(key, value))
+    if (!pinsightindexer->Flush() || !pinsightdb->ReadSpentIndex(key, value))
         return error("Unable to get spent index information");
 
     return true;
@@ -1679,7 +1813,21 @@ bool GetAddressIndex(const uint160& addressHash, int type,
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+    if (!pinsightindexer->Flush() || !pinsightdb->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+        return error("unable to get txids for address");
+
+    return true;
+}
+
+bool GetAddressIndex(const std::vector<CAddressIndexIteratorKey>& addresses,
+                     const CAddressIndexKey* after, int start, int end,
+                     const CAddressIndexVisitor& visit)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    int nThreads = std::min(MAX_ADDRESS_INDEX_READ_THREADS, (int)addresses.size() / ADDRESS_INDEX_ADDRESSES_PER_THREAD);
+    if (!pinsightindexer->Flush() || !pinsightdb->ReadAddressIndex(addresses, after, start, end, visit, nThreads))
         return error("unable to get txids for address");
 
     return true;
@@ -1691,12 +1839,181 @@ bool GetAddressUnspent(const uint160& addressHash, int type,
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
+    if (!pinsightindexer->Flush() || !pinsightdb->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
         return error("unable to get txids for address");
 
     return true;
 }
 
+bool GetAddressBalance(const uint160& addressHash, int type, CAddressBalanceValue& value)
+{
+    {
+        LOCK(cs_main);
+        if (!fAddressBalanceIndex)
+            return false;
+    }
+    pinsightindexer->Flush();
+    pinsightdb->ReadAddressBalance(CAddressIndexIteratorKey(type, addressHash), value);
+    return true;
+}
+
+bool GetNullifierIndex(ShieldedType type, const uint256& nullifier, CNullifierIndexValue& value)
+{
+    if (!fShieldedIndex)
+        return error("shielded index not enabled");
+
+    if (!pshieldedindexer->Flush())
+        return error("shielded index is catching up with the chain");
+
+    return pshieldedindexdb->ReadNullifier(type, nullifier, value);
+}
+
+bool GetCommitmentIndex(ShieldedType type, const uint256& commitment, CCommitmentIndexValue& value)
+{
+    if (!fShieldedIndex)
+        return error("shielded index not enabled");
+
+    if (!pshieldedindexer->Flush())
+        return error("shielded index is catching up with the chain");
+
+    return pshieldedindexdb->ReadCommitment(type, commitment, value);
+}
+
+bool GetShieldedBlocks(int nStart, int nEnd, std::vector<CShieldedBlockDbEntry>& blocks)
+{
+    if (!fShieldedIndex)
+        return error("shielded index not enabled");
+
+    if (!pshieldedindexer->Flush() || !pshieldedindexdb->ReadBlocks(nStart, nEnd, blocks))
+        return error("unable to get shielded blocks");
+
+    return true;
+}
+
+bool GetCompactShieldedBlocks(int nStart, int nEnd, std::vector<CCompactShieldedBlock>& blocks)
+{
+    if (!fShieldedIndex)
+        return error("shielded index not enabled");
+
+    if (!pshieldedindexer->Flush() || !pshieldedindexdb->ReadCompactBlocks(nStart, nEnd, blocks))
+        return error("unable to get compact blocks");
+
+    return true;
+}
+
+/** Compression statistics since startup, see CBlockStorageStats. */
+static std::atomic<uint64_t> nCompressedRawBytes(0);
+static std::atomic<uint64_t> nCompressedBytes(0);
+static std::atomic<uint64_t> nBlocksDecompressed(0);
+static std::atomic<int64_t> nDecompressTime(0);
+static std::atomic<int> nFilesCompacted(0);
+static std::atomic<int64_t> nBytesReclaimed(0);
+
+/**
+ * Decompress the data of a compressed block record (see BLOCK_RECORD_COMPRESSED)
+ * in [pbegin, pend), and point [pbegin, pend) at the serialized block instead,
+ * in memory that ref keeps alive.
+ */
+static bool DecompressBlockRecord(std::shared_ptr<const void>& ref, const char*& pbegin, const char*& pend)
+{
+    if (pend - pbegin < 4)
+        return false;
+    uint32_t nRawSize = ReadLE32((const unsigned char*)pbegin);
+    if (nRawSize < 80 || nRawSize > MAX_BLOCK_SIZE)
+        return false;
+
+    int64_t nTimeStart = GetTimeMicros();
+    std::shared_ptr<std::vector<char> > pvData = std::make_shared<std::vector<char> >();
+    if (!DecompressBlockData(pbegin + 4, pend - pbegin - 4, nRawSize, *pvData))
+        return false;
+    nDecompressTime += GetTimeMicros() - nTimeStart;
+    nBlocksDecompressed++;
+
+    pbegin = &(*pvData)[0];
+    pend = pbegin + pvData->size();
+    ref = pvData;
+    return true;
+}
+
+/** Read the block record at pos from its file if it is compressed, see GetBlockFileSpan. */
+static bool ReadCompressedBlockRecord(const CDiskBlockPos& pos, std::shared_ptr<const void>& ref, const char*& pbegin, const char*& pend)
+{
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 8), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+
+    std::shared_ptr<std::vector<char> > pvData;
+    try {
+        CMessageHeader::MessageStartChars blk_start;
+        unsigned int blk_size;
+        filein >> FLATDATA(blk_start) >> blk_size;
+        if (!(blk_size & BLOCK_RECORD_COMPRESSED))
+            return false;
+        blk_size &= ~BLOCK_RECORD_COMPRESSED;
+        if (blk_size < 4 || blk_size > 4 + MaxCompressedSize(MAX_BLOCK_SIZE))
+            return error("%s: invalid compressed block size %u at %s", __func__, blk_size, pos.ToString());
+        pvData = std::make_shared<std::vector<char> >(blk_size);
+        filein.read(&(*pvData)[0], blk_size);
+    } catch (const std::exception& e) {
+        return error("%s: Read from block file failed: %s at %s", __func__, e.what(), pos.ToString());
+    }
+    pbegin = &(*pvData)[0];
+    pend = pbegin + pvData->size();
+    ref = pvData;
+    return DecompressBlockRecord(ref, pbegin, pend);
+}
+
+/**
+ * Find the block or undo data at pos in memory: in the block file writer's queue
+ * if it has not been written yet, or else in a memory mapping of its file.
+ * Compressed blocks are decompressed, also when they have to be read from the
+ * file. The data is [pbegin, pend), followed by nTrailer bytes not counted in
+ * the size in its index header (the checksum of undo data); ref keeps the
+ * memory alive. Returns false if the data has to be read from the file instead.
+ */
+static bool GetBlockFileSpan(BlockFileType type, const CDiskBlockPos& pos, unsigned int nTrailer,
+                             std::shared_ptr<const void>& ref, const char*& pbegin, const char*& pend)
+{
+    // The data is preceded by an 8 byte index header: network magic and size.
+    if (pos.nPos < 8)
+        return false;
+
+    const char* pheader;
+    uint32_t nSize;
+    CBlockFileWriter::DataPtr pending = blockFileWriter.GetPending(type, CDiskBlockPos(pos.nFile, pos.nPos - 8));
+    if (pending) {
+        if (pending->size() < 8)
+            return false;
+        pheader = &(*pending)[0];
+        nSize = ReadLE32((const unsigned char*)pheader + 4);
+        pbegin = pheader + 8;
+        pend = &(*pending)[0] + pending->size();
+        ref = pending;
+    } else {
+        std::shared_ptr<const CBlockFileMapping> mapping = blockFileMaps.Get(type, pos.nFile, pos.nPos);
+        if (!mapping)
+            return type == BLOCK_FILE_BLK && ReadCompressedBlockRecord(pos, ref, pbegin, pend);
+        nSize = ReadLE32((const unsigned char*)mapping->begin() + pos.nPos - 4);
+        uint64_t nEnd = (uint64_t)pos.nPos + (type == BLOCK_FILE_BLK ? nSize & ~BLOCK_RECORD_COMPRESSED : nSize) + nTrailer;
+        if (nEnd > mapping->size()) {
+            mapping = blockFileMaps.Get(type, pos.nFile, nEnd);
+            if (!mapping)
+                return false;
+        }
+        pheader = mapping->begin() + pos.nPos - 8;
+        pbegin = mapping->begin() + pos.nPos;
+        pend = mapping->begin() + nEnd;
+        mapping->WillNeed(pbegin, pend);
+        ref = mapping;
+    }
+
+    if (memcmp(pheader, Params().MessageStart(), MESSAGE_START_SIZE))
+        return false;
+    if (type == BLOCK_FILE_BLK && (nSize & BLOCK_RECORD_COMPRESSED))
+        return DecompressBlockRecord(ref, pbegin, pend);
+    return true;
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1710,18 +2027,34 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     }
 
     if (fTxIndex) {
+        // Wait for the transactions of the blocks connected so far.
+        if (ptxindexer)
+            ptxindexer->Flush();
         CDiskTxPos postx;
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
             CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            std::shared_ptr<const void> ref;
+            const char *pbegin, *pend;
+            if (GetBlockFileSpan(BLOCK_FILE_BLK, postx, 0, ref, pbegin, pend)) {
+                try {
+                    CSpanReader span(SER_DISK, CLIENT_VERSION, pbegin, pend);
+                    span >> header;
+                    span.ignore(postx.nTxOffset);
+                    span >> txOut;
+                } catch (const std::exception& e) {
+                    return error("%s: Deserialize error - %s", __func__, e.what());
+                }
+            } else {
+                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                if (file.IsNull())
+                    return error("%s: OpenBlockFile failed", __func__);
+                try {
+                    file >> header;
+                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                    file >> txOut;
+                } catch (const std::exception& e) {
+                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                }
             }
             hashBlock = header.GetHash();
             if (txOut.GetHash() != hash)
@@ -1768,43 +2101,185 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 // CBlock and CBlockIndex
 //
 
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+std::shared_ptr<const CDataStream> SerializeBlockRecord(const CBlock& block, const CMessageHeader::MessageStartChars& messageStart, bool fCompress)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("WriteBlockToDisk: OpenBlockFile failed");
-
-    // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
-    fileout << FLATDATA(messageStart) << nSize;
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_DISK, CLIENT_VERSION);
+    if (!fCompress) {
+        unsigned int nSize = GetSerializeSize(*ss, block);
+        *ss << FLATDATA(messageStart) << nSize << block;
+        return ss;
+    }
+
+    // Blocks are compressed even if that does not make them smaller, so that
+    // the compactor can tell which files it has converted.
+    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+    ssBlock << block;
+    std::vector<char> vData;
+    CompressBlockData(&ssBlock[0], ssBlock.size(), vData);
+    unsigned int nSize = (4 + vData.size()) | BLOCK_RECORD_COMPRESSED;
+    *ss << FLATDATA(messageStart) << nSize << (uint32_t)ssBlock.size();
+    ss->write(&vData[0], vData.size());
+
+    nCompressedRawBytes += ssBlock.size() + 8;
+    nCompressedBytes += ss->size();
+    return ss;
+}
 
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+bool WriteBlockToDisk(const std::shared_ptr<const CDataStream>& record, CDiskBlockPos& pos)
+{
+    // The block file writer puts index header and block at pos
+    if (!blockFileWriter.Write(BLOCK_FILE_BLK, pos, record))
+        return error("WriteBlockToDisk: writing to block file failed");
+    pos.nPos += 8;
 
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
-    block.SetNull();
+    // The block is preceded by the network magic and its size.
+    CDiskBlockPos hpos = pos;
+    if (hpos.nPos < 8)
+        return error("%s: invalid block position %s", __func__, pos.ToString());
+    hpos.nPos -= 8;
+
+    std::shared_ptr<const void> ref;
+    const char *pbegin, *pend;
+    if (GetBlockFileSpan(BLOCK_FILE_BLK, pos, 0, ref, pbegin, pend)) {
+        if ((size_t)(pend - pbegin) > MAX_BLOCK_SIZE)
+            return error("%s: block size %u larger than the maximum at %s", __func__, (unsigned int)(pend - pbegin), pos.ToString());
+        block.assign(pbegin, pend);
+        return true;
+    }
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
 
-    // Read block
     try {
-        filein >> block;
+        CMessageHeader::MessageStartChars blk_start;
+        unsigned int blk_size;
+        filein >> FLATDATA(blk_start) >> blk_size;
+
+        if (memcmp(blk_start, messageStart, MESSAGE_START_SIZE))
+            return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+        if (blk_size > MAX_BLOCK_SIZE)
+            return error("%s: block size %u larger than the maximum at %s", __func__, blk_size, pos.ToString());
+
+        block.resize(blk_size);
+        filein.read((char*)begin_ptr(block), blk_size);
     }
     catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        return error("%s: Read from block file failed: %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+/**
+ * Get the serialized form of a block for sending it to a peer, from the raw
+ * block cache or from disk. The bytes are matched against the header in the
+ * block index instead of deserializing (and re-checking) the whole block.
+ */
+static std::shared_ptr<const CRawBlock> GetRawBlock(const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    AssertLockHeld(cs_main);
+
+    const uint256 hash = pindex->GetBlockHash();
+    map<uint256, RawBlockList::iterator>::iterator it = mapRawBlockCache.find(hash);
+    if (it != mapRawBlockCache.end()) {
+        listRawBlockCache.splice(listRawBlockCache.begin(), listRawBlockCache, it->second);
+        return it->second->second;
+    }
+
+    std::shared_ptr<CRawBlock> pblock = std::make_shared<CRawBlock>();
+    if (!ReadRawBlockFromDisk(pblock->vData, pindex->GetBlockPos(), messageStart))
+        return nullptr;
+
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << pindex->GetBlockHeader();
+    if (pblock->vData.size() < ssHeader.size() || memcmp(begin_ptr(pblock->vData), &ssHeader[0], ssHeader.size()) != 0) {
+        LogPrintf("%s: block at %s does not match the header of %s\n", __func__, pindex->GetBlockPos().ToString(), hash.ToString());
+        return nullptr;
+    }
+
+    uint256 hashData = Hash(pblock->vData.begin(), pblock->vData.end());
+    memcpy(&pblock->nChecksum, &hashData, sizeof(pblock->nChecksum));
+
+    listRawBlockCache.push_front(make_pair(hash, pblock));
+    mapRawBlockCache[hash] = listRawBlockCache.begin();
+    nRawBlockCacheSize += pblock->vData.size();
+    while (nRawBlockCacheSize > MAX_RAW_BLOCK_CACHE_SIZE && listRawBlockCache.size() > 1) {
+        nRawBlockCacheSize -= listRawBlockCache.back().second->vData.size();
+        mapRawBlockCache.erase(listRawBlockCache.back().first);
+        listRawBlockCache.pop_back();
+    }
+    return pblock;
+}
+
+/** Get a block and its merkle block data for serving it filtered, from the filtered block cache or from disk. */
+static std::shared_ptr<const CFilteredBlockSource> GetFilteredBlock(const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+
+    const uint256 hash = pindex->GetBlockHash();
+    map<uint256, FilteredBlockList::iterator>::iterator it = mapFilteredBlockCache.find(hash);
+    if (it != mapFilteredBlockCache.end()) {
+        listFilteredBlockCache.splice(listFilteredBlockCache.begin(), listFilteredBlockCache, it->second);
+        return it->second->second;
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, consensusParams))
+        return nullptr;
+    std::shared_ptr<const CFilteredBlockSource> pblock = std::make_shared<const CFilteredBlockSource>(block);
+
+    listFilteredBlockCache.push_front(make_pair(hash, pblock));
+    mapFilteredBlockCache[hash] = listFilteredBlockCache.begin();
+    nFilteredBlockCacheSize += pblock->nUsage;
+    while (nFilteredBlockCacheSize > MAX_FILTERED_BLOCK_CACHE_SIZE && listFilteredBlockCache.size() > 1) {
+        nFilteredBlockCacheSize -= listFilteredBlockCache.back().second->nUsage;
+        mapFilteredBlockCache.erase(listFilteredBlockCache.back().first);
+        listFilteredBlockCache.pop_back();
+    }
+    return pblock;
+}
+
+/** Deserialize the block at pos, without checking it. */
+static bool ReadBlockDataFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    block.SetNull();
+
+    // Read block, from memory if possible
+    std::shared_ptr<const void> ref;
+    const char *pbegin, *pend;
+    if (GetBlockFileSpan(BLOCK_FILE_BLK, pos, 0, ref, pbegin, pend)) {
+        try {
+            CSpanReader(SER_DISK, CLIENT_VERSION, pbegin, pend) >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    if (!ReadBlockDataFromDisk(block, pos))
+        return false;
 
     // Check the header
     if (!(CheckEquihashSolution(&block, consensusParams) &&
@@ -2281,50 +2756,56 @@ bool ContextualCheckInputs(
     return true;
 }
 
-namespace {
-
 bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
-
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    // Serialize index header and undo data; the block file writer puts them at pos
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_DISK, CLIENT_VERSION);
+    unsigned int nSize = GetSerializeSize(*ss, blockundo);
+    *ss << FLATDATA(messageStart) << nSize;
+    unsigned int nHeaderSize = ss->size();
+    *ss << blockundo;
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
     hasher << blockundo;
-    fileout << hasher.GetHash();
+    *ss << hasher.GetHash();
+
+    if (!blockFileWriter.Write(BLOCK_FILE_REV, pos, ss))
+        return error("%s: writing to undo file failed", __func__);
+    pos.nPos += nHeaderSize;
 
     return true;
 }
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenBlockFile failed", __func__);
-
-    // Read block
+    // Read undo data, from memory if possible
     uint256 hashChecksum;
-    try {
-        filein >> blockundo;
-        filein >> hashChecksum;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    std::shared_ptr<const void> ref;
+    const char *pbegin, *pend;
+    if (GetBlockFileSpan(BLOCK_FILE_REV, pos, sizeof(hashChecksum), ref, pbegin, pend)) {
+        try {
+            CSpanReader span(SER_DISK, CLIENT_VERSION, pbegin, pend);
+            span >> blockundo;
+            span >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenBlockFile failed", __func__);
+
+        try {
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Verify checksum
@@ -2337,7 +2818,27 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
-} // anon namespace
+bool GetBlockDeltas(const CBlockIndex* pindex, std::shared_ptr<const CBlockDeltas>& deltas)
+{
+    AssertLockHeld(cs_main);
+    deltas = blockDeltasCache.Get(pindex->GetBlockHash());
+    if (deltas)
+        return true;
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+        return false;
+    // The genesis block spends nothing and has no undo data.
+    CBlockUndo blockundo;
+    if (pindex->pprev && !UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()))
+        return false;
+    std::shared_ptr<CBlockDeltas> computed = std::make_shared<CBlockDeltas>();
+    if (!ComputeBlockDeltas(block, blockundo, *computed))
+        return false;
+    blockDeltasCache.Insert(pindex->GetBlockHash(), computed);
+    deltas = computed;
+    return true;
+}
 
 /**
  * Apply the undo operation of a CTxInUndo to the given chain state.
@@ -2381,11 +2882,9 @@ enum DisconnectResult
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state.
- *  The addressIndex and spentIndex will be updated if requested.
  */
 static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& state,
-    const CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams,
-    const bool updateIndices)
+    const CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -2406,37 +2905,11 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
         error("DisconnectBlock(): block and undo data inconsistent");
         return DISCONNECT_FAILED;
     }
-    std::vector<CAddressIndexDbEntry> addressIndex;
-    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
-    std::vector<CSpentIndexDbEntry> spentIndex;
-
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 const hash = tx.GetHash();
 
-        // insightexplorer
-        // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2236
-        if (fAddressIndex && updateIndices) {
-            for (unsigned int k = tx.vout.size(); k-- > 0;) {
-                const CTxOut &out = tx.vout[k];
-                CScript::ScriptType scriptType = out.scriptPubKey.GetType();
-                if (scriptType != CScript::UNKNOWN) {
-                    uint160 const addrHash = out.scriptPubKey.AddressHash();
-
-                    // undo receiving activity
-                    addressIndex.push_back(make_pair(
-                        CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, k, false),
-                        out.nValue));
-
-                    // undo unspent index
-                    addressUnspentIndex.push_back(make_pair(
-                        CAddressUnspentKey(scriptType, addrHash, hash, k),
-                        CAddressUnspentValue()));
-                }
-            }
-        }
-
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
         {
@@ -2471,34 +2944,6 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
                 const CTxInUndo &undo = txundo.vprevout[j];
                 if (!ApplyTxInUndo(undo, view, out))
                     fClean = false;
-
-                // insightexplorer
-                // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2304
-                const CTxIn input = tx.vin[j];
-                if (fAddressIndex && updateIndices) {
-                    const CTxOut &prevout = view.GetOutputFor(input);
-                    CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
-                    if (scriptType != CScript::UNKNOWN) {
-                        uint160 const addrHash = prevout.scriptPubKey.AddressHash();
-
-                        // undo spending activity
-                        addressIndex.push_back(make_pair(
-                            CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, j, true),
-                            prevout.nValue * -1));
-
-                        // restore unspent index
-                        addressUnspentIndex.push_back(make_pair(
-                            CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
-                            CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)));
-                    }
-                }
-                // insightexplorer
-                if (fSpentIndex && updateIndices) {
-                    // undo and delete the spent index
-                    spentIndex.push_back(make_pair(
-                        CSpentIndexKey(input.prevout.hash, input.prevout.n),
-                        CSpentIndexValue()));
-                }
             }
         }
     }
@@ -2520,52 +2965,40 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
-    // insightexplorer
-    if (fAddressIndex && updateIndices) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            AbortNode(state, "Failed to delete address index");
-            return DISCONNECT_FAILED;
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            AbortNode(state, "Failed to write address unspent index");
-            return DISCONNECT_FAILED;
-        }
-    }
-    // insightexplorer
-    if (fSpentIndex && updateIndices) {
-        if (!pblocktree->UpdateSpentIndex(spentIndex)) {
-            AbortNode(state, "Failed to write transaction index");
-            return DISCONNECT_FAILED;
-        }
-    }
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
-void static FlushBlockFile(bool fFinalize = false)
+bool static FlushBlockFile(bool fFinalize = false)
 {
     LOCK(cs_LastBlockFile);
 
+    // Wait for queued block and undo data, and commit every file it went to.
+    if (!blockFileWriter.Flush())
+        return false;
+
+    if (!fFinalize)
+        return true;
+
     CDiskBlockPos posOld(nLastBlockFile, 0);
+    blockFileMaps.Invalidate(BLOCK_FILE_BLK, nLastBlockFile);
+    blockFileMaps.Invalidate(BLOCK_FILE_REV, nLastBlockFile);
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
+        TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
         FileCommit(fileOld);
         fclose(fileOld);
     }
 
     fileOld = OpenUndoFile(posOld);
     if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
+        TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
         FileCommit(fileOld);
         fclose(fileOld);
     }
+    return true;
 }
 
-bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
-
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck() {
@@ -2745,13 +3178,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CAmount nFees = 0;
     int nInputs = 0;
     unsigned int nSigOps = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<CAddressIndexDbEntry> addressIndex;
-    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
-    std::vector<CSpentIndexDbEntry> spentIndex;
 
     // Construct the incremental merkle tree at the current
     // block position,
@@ -2782,7 +3209,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
-        const uint256 hash = tx.GetHash();
 
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
@@ -2801,38 +3227,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 return state.DoS(100, error("ConnectBlock(): JoinSplit requirements not met"),
                                  REJECT_INVALID, "bad-txns-joinsplit-requirements-not-met");
 
-            // insightexplorer
-            // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2597
-            if (fAddressIndex || fSpentIndex) {
-                for (size_t j = 0; j < tx.vin.size(); j++) {
-
-                    const CTxIn input = tx.vin[j];
-                    const CTxOut &prevout = view.GetOutputFor(tx.vin[j]);
-                    CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
-                    const uint160 addrHash = prevout.scriptPubKey.AddressHash();
-                    if (fAddressIndex && scriptType != CScript::UNKNOWN) {
-                        // record spending activity
-                        addressIndex.push_back(make_pair(
-                            CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, j, true),
-                            prevout.nValue * -1));
-
-                        // remove address from unspent index
-                        addressUnspentIndex.push_back(make_pair(
-                            CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
-                            CAddressUnspentValue()));
-                    }
-                    if (fSpentIndex) {
-                        // Add the spent index to determine the txid and input that spent an output
-                        // and to find the amount and address from an input.
-                        // If we do not recognize the script type, we still add an entry to the
-                        // spentindex db, with a script type of 0 and addrhash of all zeroes.
-                        spentIndex.push_back(make_pair(
-                            CSpentIndexKey(input.prevout.hash, input.prevout.n),
-                            CSpentIndexValue(hash, j, pindex->nHeight, prevout.nValue, scriptType, addrHash)));
-                    }
-                }
-            }
-
             // Add in sigops done by pay-to-script-hash inputs;
             // this is to prevent a "rogue miner" from creating
             // an incredibly-expensive-to-validate block.
@@ -2855,28 +3249,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             control.Add(vChecks);
         }
 
-        // insightexplorer
-        // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2656
-        if (fAddressIndex) {
-            for (unsigned int k = 0; k < tx.vout.size(); k++) {
-                const CTxOut &out = tx.vout[k];
-                CScript::ScriptType scriptType = out.scriptPubKey.GetType();
-                if (scriptType != CScript::UNKNOWN) {
-                    uint160 const addrHash = out.scriptPubKey.AddressHash();
-
-                    // record receiving activity
-                    addressIndex.push_back(make_pair(
-                        CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, k, false),
-                        out.nValue));
-
-                    // record unspent output
-                    addressUnspentIndex.push_back(make_pair(
-                        CAddressUnspentKey(scriptType, addrHash, hash, k),
-                        CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-                }
-            }
-        }
-
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2894,9 +3266,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         BOOST_FOREACH(const OutputDescription &outputDescription, tx.vShieldedOutput) {
             sapling_tree.append(outputDescription.cm);
         }
-
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
 
     view.PushAnchor(sprout_tree);
@@ -2964,45 +3333,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
-
-    // START insightexplorer
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
-    }
-    if (fSpentIndex) {
-        if (!pblocktree->UpdateSpentIndex(spentIndex)) {
-            return AbortNode(state, "Failed to write spent index");
-        }
-    }
-    if (fTimestampIndex) {
-        unsigned int logicalTS = pindex->nTime;
-        unsigned int prevLogicalTS = 0;
-
-        // retrieve logical timestamp of the previous block
-        if (pindex->pprev)
-            if (!pblocktree->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
-                LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
-
-        if (logicalTS <= prevLogicalTS) {
-            logicalTS = prevLogicalTS + 1;
-            LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
-        }
-
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
-
-        if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
-            return AbortNode(state, "Failed to write blockhash index");
-    }
-    // END insightexplorer
+    // The transaction and insight indexes are written by their indexers, see indexer.h.
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -3082,7 +3413,8 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!CheckDiskSpace(0))
             return state.Error("out of disk space");
         // First make sure all block and undo data is flushed to disk.
-        FlushBlockFile();
+        if (!FlushBlockFile())
+            return AbortNode(state, "Failed to write to block files");
         // Then update all block file information (which may refer to block and undo files).
         {
             std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
@@ -3177,7 +3509,7 @@ bool static DisconnectTip(CValidationState &state, const CChainParams& chainpara
     {
         CCoinsViewCache view(pcoinsTip);
         // insightexplorer: update indices (true)
-        if (DisconnectBlock(block, state, pindexDelete, view, chainparams, true) != DISCONNECT_OK)
+        if (DisconnectBlock(block, state, pindexDelete, view, chainparams) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
     }
@@ -3516,11 +3848,31 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
             int nBlockEstimate = 0;
             if (fCheckpointsEnabled)
                 nBlockEstimate = Checkpoints::GetTotalBlocksEstimate(chainparams.Checkpoints());
+            // Peers that asked for it get the block we just connected pushed
+            // as a compact block, saving them the getdata round trip.
+            std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock;
+            if (fBlockCompact && pblock && pblock->GetHash() == hashNewTip)
+                pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs>(*pblock);
             {
                 LOCK(cs_vNodes);
-                BOOST_FOREACH(CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                BOOST_FOREACH(CNode* pnode, vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+                    CInv inv(MSG_BLOCK, hashNewTip);
+                    if (pcmpctblock && pnode->fPreferHeaderAndIDs) {
+                        bool fKnown;
+                        {
+                            LOCK(pnode->cs_inventory);
+                            fKnown = !pnode->setInventoryKnown.insert(inv).second;
+                        }
+                        if (!fKnown) {
+                            LogPrint("net", "sending cmpctblock %s to peer=%d\n", hashNewTip.ToString(), pnode->id);
+                            pnode->PushMessage("cmpctblock", *pcmpctblock);
+                        }
+                    } else {
+                        pnode->PushInventory(inv);
+                    }
+                }
             }
             // Notify external listeners about the new tip.
             GetMainSignals().UpdatedBlockTip(pindexNewTip);
@@ -3772,7 +4124,7 @@ bool ReceivedBlockTransactions(
     return true;
 }
 
-bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false)
+bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown)
 {
     LOCK(cs_LastBlockFile);
 
@@ -3796,7 +4148,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         if (!fKnown) {
             LogPrintf("Leaving block file %i: %s\n", nFile, vinfoBlockFile[nFile].ToString());
         }
-        FlushBlockFile(!fKnown);
+        if (!FlushBlockFile(!fKnown))
+            return AbortNode(state, "Failed to write to block files");
         nLastBlockFile = nFile;
     }
 
@@ -3812,14 +4165,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         if (nNewChunks > nOldChunks) {
             if (fPruneMode)
                 fCheckForPruning = true;
-            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
-                FILE *file = OpenBlockFile(pos);
-                if (file) {
-                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
-                    AllocateFileRange(file, pos.nPos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
-                    fclose(file);
-                }
-            }
+            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos))
+                blockFileWriter.Allocate(BLOCK_FILE_BLK, pos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
             else
                 return state.Error("out of disk space");
         }
@@ -3845,14 +4192,8 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     if (nNewChunks > nOldChunks) {
         if (fPruneMode)
             fCheckForPruning = true;
-        if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
-            FILE *file = OpenUndoFile(pos);
-            if (file) {
-                LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
-                AllocateFileRange(file, pos.nPos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
-                fclose(file);
-            }
-        }
+        if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos))
+            blockFileWriter.Allocate(BLOCK_FILE_REV, pos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
         else
             return state.Error("out of disk space");
     }
@@ -4053,7 +4394,7 @@ bool ContextualCheckBlock(
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fCheckPOW=true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -4070,7 +4411,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         return true;
     }
 
-    if (!CheckBlockHeader(block, state, chainparams))
+    if (!CheckBlockHeader(block, state, chainparams, fCheckPOW))
         return false;
 
     // Get prev block index
@@ -4102,14 +4443,15 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
  * - AcceptBlock doesn't perform script checks either.
  * - The only caller of AcceptBlock verifies JoinSplit proofs elsewhere.
  * If dbp is non-NULL, the file is known to already reside on disk
+ * If fChecked is true, the block already passed CheckBlock.
  */
-static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, CDiskBlockPos* dbp)
+static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, CDiskBlockPos* dbp, bool fChecked = false)
 {
     AssertLockHeld(cs_main);
 
     CBlockIndex *&pindex = *ppindex;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, !fChecked))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -4135,7 +4477,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
 
     // See method docstring for why this is always disabled
     auto verifier = libzcash::ProofVerifier::Disabled();
-    if ((!CheckBlock(block, state, chainparams, verifier)) || !ContextualCheckBlock(block, state, chainparams, pindex->pprev)) {
+    if ((!fChecked && !CheckBlock(block, state, chainparams, verifier)) || !ContextualCheckBlock(block, state, chainparams, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -4147,14 +4489,20 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        std::shared_ptr<const CDataStream> record;
+        unsigned int nBlockSize;
         CDiskBlockPos blockPos;
-        if (dbp != NULL)
+        if (dbp != NULL) {
             blockPos = *dbp;
-        if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
+            nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) + 8;
+        } else {
+            record = SerializeBlockRecord(block, chainparams.MessageStart(), fBlockCompression);
+            nBlockSize = record->size();
+        }
+        if (!FindBlockPos(state, blockPos, nBlockSize, nHeight, block.GetBlockTime(), dbp != NULL))
             return error("AcceptBlock(): FindBlockPos failed");
         if (dbp == NULL)
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(record, blockPos))
                 AbortNode(state, "Failed to write block");
         if (!ReceivedBlockTransactions(block, state, chainparams, pindex, blockPos))
             return error("AcceptBlock(): ReceivedBlockTransactions failed");
@@ -4189,7 +4537,7 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, c
 
     {
         LOCK(cs_main);
-        bool fRequested = MarkBlockAsReceived(pblock->GetHash());
+        bool fRequested = MarkBlockAsReceived(pblock->GetHash(), pblock);
         fRequested |= fForceProcessing;
         if (!checked) {
             return error("%s: CheckBlock FAILED", __func__);
@@ -4212,6 +4560,24 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, c
     return true;
 }
 
+/** Like ProcessNewBlock, for a block from our own block files that already passed CheckBlock. */
+static bool ProcessCheckedBlock(CValidationState& state, const CChainParams& chainparams, const CBlock* pblock, CDiskBlockPos* dbp)
+{
+    {
+        LOCK(cs_main);
+        CBlockIndex *pindex = NULL;
+        bool ret = AcceptBlock(*pblock, state, chainparams, &pindex, true, dbp, true);
+        CheckBlockIndex(chainparams.GetConsensus());
+        if (!ret)
+            return error("%s: AcceptBlock FAILED", __func__);
+    }
+
+    if (!ActivateBestChain(state, chainparams, pblock))
+        return error("%s: ActivateBestChain failed", __func__);
+
+    return true;
+}
+
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     AssertLockHeld(cs_main);
@@ -4289,6 +4655,8 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileMaps.Invalidate(BLOCK_FILE_BLK, *it);
+        blockFileMaps.Invalidate(BLOCK_FILE_REV, *it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4544,11 +4912,17 @@ bool static LoadBlockIndexDB()
 
     // insightexplorer
     // Check whether block explorer features are enabled
-    pblocktree->ReadFlag("insightexplorer", fInsightExplorer);
+    fInsightExplorer = false;
+    if (pinsightdb)
+        pinsightdb->ReadFlag("insightexplorer", fInsightExplorer);
     LogPrintf("%s: insight explorer %s\n", __func__, fInsightExplorer ? "enabled" : "disabled");
     fAddressIndex = fInsightExplorer;
     fSpentIndex = fInsightExplorer;
     fTimestampIndex = fInsightExplorer;
+    // Databases created before the address balance index was added have to build it
+    fAddressBalanceIndex = false;
+    if (pinsightdb)
+        pinsightdb->ReadFlag("addressbalanceindex", fAddressBalanceIndex);
 
     // Fill in-memory data
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
@@ -4572,6 +4946,22 @@ bool static LoadBlockIndexDB()
     // Set hashFinalSproutRoot for the end of best chain
     it->second->hashFinalSproutRoot = pcoinsTip->GetBestAnchor(SPROUT);
 
+    // insightexplorer
+    // The insight indexer writes behind the chain, so after a crash the indexes
+    // may not cover the tip; they are enabled again once they have caught up.
+    if (fInsightExplorer) {
+        uint256 hashIndexed;
+        pinsightdb->ReadBestBlock(hashIndexed);
+        if (hashIndexed != chainActive.Tip()->GetBlockHash() && !(hashIndexed.IsNull() && chainActive.Height() == 0)) {
+            LogPrintf("%s: insight indexes are at block %s, catching up\n", __func__, hashIndexed.ToString());
+            fInsightExplorer = false;
+            fAddressIndex = false;
+            fSpentIndex = false;
+            fTimestampIndex = false;
+            fAddressBalanceIndex = false;
+        }
+    }
+
     PruneBlockIndexCandidates();
 
     LogPrintf("%s: hashBestChain=%s height=%d date=%s progress=%f\n", __func__,
@@ -4639,7 +5029,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             // insightexplorer: do not update indices (false)
-            DisconnectResult res = DisconnectBlock(block, state, pindex, coins, chainparams, false);
+            DisconnectResult res = DisconnectBlock(block, state, pindex, coins, chainparams);
             if (res == DISCONNECT_FAILED) {
                 return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             }
@@ -4890,10 +5280,15 @@ bool InitBlockIndex(const CChainParams& chainparams)
 
     // Use the provided setting for -insightexplorer in the new database
     fInsightExplorer = GetBoolArg("-insightexplorer", false);
-    pblocktree->WriteFlag("insightexplorer", fInsightExplorer);
+    if (pinsightdb)
+        pinsightdb->WriteFlag("insightexplorer", fInsightExplorer);
     fAddressIndex = fInsightExplorer;
     fSpentIndex = fInsightExplorer;
     fTimestampIndex = fInsightExplorer;
+    // The address balance index is built along with the address index
+    if (pinsightdb)
+        pinsightdb->WriteFlag("addressbalanceindex", fInsightExplorer);
+    fAddressBalanceIndex = fInsightExplorer;
 
     LogPrintf("Initializing databases...\n");
 
@@ -4902,12 +5297,12 @@ bool InitBlockIndex(const CChainParams& chainparams)
         try {
             CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock());
             // Start new block file
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            std::shared_ptr<const CDataStream> record = SerializeBlockRecord(block, chainparams.MessageStart(), fBlockCompression);
             CDiskBlockPos blockPos;
             CValidationState state;
-            if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
+            if (!FindBlockPos(state, blockPos, record->size(), 0, block.GetBlockTime()))
                 return error("LoadBlockIndex(): FindBlockPos failed");
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(record, blockPos))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
             CBlockIndex *pindex = AddToBlockIndex(block);
             if (!ReceivedBlockTransactions(block, state, chainparams, pindex, blockPos))
@@ -4924,6 +5319,35 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+/** Whether the size in the index header of a block found while scanning a block file is plausible. */
+static bool CheckBlockRecordSize(unsigned int nSize)
+{
+    if (nSize & BLOCK_RECORD_COMPRESSED) {
+        nSize &= ~BLOCK_RECORD_COMPRESSED;
+        return nSize >= 4 && nSize <= 4 + MaxCompressedSize(MAX_BLOCK_SIZE);
+    }
+    return nSize >= 80 && nSize <= MAX_BLOCK_SIZE;
+}
+
+/** Deserialize a block found while scanning a block file, decompressing it if its index header says so. */
+static void ReadBlockRecord(CBufferedFile& blkdat, unsigned int nSize, CBlock& block)
+{
+    if (!(nSize & BLOCK_RECORD_COMPRESSED)) {
+        blkdat >> block;
+        return;
+    }
+
+    nSize &= ~BLOCK_RECORD_COMPRESSED;
+    std::vector<char> vData(nSize);
+    blkdat.read(&vData[0], nSize);
+    std::shared_ptr<const void> ref;
+    const char* pbegin = &vData[0];
+    const char* pend = pbegin + nSize;
+    if (!DecompressBlockRecord(ref, pbegin, pend))
+        throw std::ios_base::failure("ReadBlockRecord(): invalid compressed block");
+    CSpanReader(SER_DISK, CLIENT_VERSION, pbegin, pend) >> block;
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
@@ -4952,7 +5376,7 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                     continue;
                 // read size
                 blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                if (!CheckBlockRecordSize(nSize))
                     continue;
             } catch (const std::exception&) {
                 // no valid block header found; don't complain
@@ -4963,10 +5387,10 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
                     dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetLimit(nBlockPos + (nSize & ~BLOCK_RECORD_COMPRESSED));
                 blkdat.SetPos(nBlockPos);
                 CBlock block;
-                blkdat >> block;
+                ReadBlockRecord(blkdat, nSize, block);
                 nRewind = blkdat.GetPos();
 
                 // detect out of order blocks, and store them for later
@@ -5026,6 +5450,446 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     return nLoaded > 0;
 }
 
+namespace {
+
+/** A block found in a block file by a reindex worker, which passed CheckBlock. */
+struct CReindexBlock {
+    CDiskBlockPos pos;
+    uint256 hash;
+    uint256 hashPrev;
+};
+
+/** Results of the reindex workers, by file. */
+struct CReindexFiles {
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<std::vector<CReindexBlock> > vBlocks;
+    std::vector<bool> vDone;
+    int nNextFile;
+};
+
+/**
+ * Find, deserialize, hash and check (CheckBlock, the expensive context-free part
+ * of block validation) all blocks in one block file.
+ */
+void ScanBlockFile(const CChainParams& chainparams, int nFile, std::vector<CReindexBlock>& vBlocks)
+{
+    FILE* file = OpenBlockFile(CDiskBlockPos(nFile, 0), true);
+    if (!file)
+        return; // This error is logged in OpenBlockFile
+
+    // This takes over file and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(file, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        boost::this_thread::interruption_point();
+
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (!CheckBlockRecordSize(nSize))
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        try {
+            // read block
+            uint64_t nBlockPos = blkdat.GetPos();
+            blkdat.SetLimit(nBlockPos + (nSize & ~BLOCK_RECORD_COMPRESSED));
+            blkdat.SetPos(nBlockPos);
+            CBlock block;
+            ReadBlockRecord(blkdat, nSize, block);
+            nRewind = blkdat.GetPos();
+
+            CValidationState state;
+            auto verifier = libzcash::ProofVerifier::Disabled();
+            if (!CheckBlock(block, state, chainparams, verifier)) {
+                LogPrint("reindex", "%s: Skipping invalid block %s in blk%05u.dat\n", __func__, block.GetHash().ToString(), nFile);
+                continue;
+            }
+            CReindexBlock entry = {CDiskBlockPos(nFile, nBlockPos), block.GetHash(), block.hashPrevBlock};
+            vBlocks.push_back(entry);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+}
+
+void ThreadReindexWorker(const CChainParams& chainparams, CReindexFiles& files)
+{
+    while (true) {
+        int nFile;
+        {
+            boost::unique_lock<boost::mutex> lock(files.mutex);
+            if (files.nNextFile >= (int)files.vBlocks.size())
+                return;
+            nFile = files.nNextFile++;
+        }
+
+        std::vector<CReindexBlock> vBlocks;
+        try {
+            ScanBlockFile(chainparams, nFile, vBlocks);
+        } catch (const boost::thread_interrupted&) {
+            throw;
+        } catch (const std::exception& e) {
+            LogPrintf("%s: error reading blk%05u.dat: %s\n", __func__, nFile, e.what());
+        }
+
+        boost::unique_lock<boost::mutex> lock(files.mutex);
+        files.vBlocks[nFile].swap(vBlocks);
+        files.vDone[nFile] = true;
+        files.cond.notify_all();
+    }
+}
+
+/**
+ * Add a block found by a reindex worker to the block index, and connect it if possible.
+ * Returns whether the block was accepted; state is an error if reindexing cannot go on.
+ */
+bool ProcessReindexBlock(CValidationState& state, const CChainParams& chainparams, const CReindexBlock& entry, int& nLoaded)
+{
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(entry.hash);
+        if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA))
+            return true;
+    }
+
+    CBlock block;
+    if (!ReadBlockDataFromDisk(block, entry.pos) || block.GetHash() != entry.hash) {
+        error("%s: block %s changed on disk at %s", __func__, entry.hash.ToString(), entry.pos.ToString());
+        return state.Error("block changed on disk");
+    }
+
+    CDiskBlockPos pos = entry.pos;
+    if (!ProcessCheckedBlock(state, chainparams, &block, &pos))
+        return false;
+    nLoaded++;
+    return true;
+}
+
+} // anon namespace
+
+bool ReindexBlockFiles(const CChainParams& chainparams)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nFiles = 0;
+    while (boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(nFiles, 0), "blk")))
+        nFiles++;
+
+    CReindexFiles files;
+    files.vBlocks.resize(nFiles);
+    files.vDone.resize(nFiles, false);
+    files.nNextFile = 0;
+
+    int nThreads = std::max(1, std::min(std::min(GetNumCores(), MAX_REINDEX_THREADS), nFiles));
+    LogPrintf("Reindexing %d block files using %d threads\n", nFiles, nThreads);
+    boost::thread_group workers;
+    for (int i = 0; i < nThreads; i++)
+        workers.create_thread(boost::bind(&ThreadReindexWorker, boost::cref(chainparams), boost::ref(files)));
+
+    // Build the block index and connect blocks in file order while the workers
+    // scan ahead. Blocks whose parent is not known yet are kept until it is.
+    std::multimap<uint256, CReindexBlock> mapBlocksUnknownParent;
+    int nLoaded = 0;
+    bool fError = false;
+    try {
+        for (int nFile = 0; nFile < nFiles && !fError; nFile++) {
+            std::vector<CReindexBlock> vBlocks;
+            {
+                boost::unique_lock<boost::mutex> lock(files.mutex);
+                while (!files.vDone[nFile])
+                    files.cond.wait(lock);
+                vBlocks.swap(files.vBlocks[nFile]);
+            }
+            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+
+            BOOST_FOREACH(const CReindexBlock& entry, vBlocks) {
+                boost::this_thread::interruption_point();
+
+                bool fParentKnown;
+                {
+                    LOCK(cs_main);
+                    fParentKnown = entry.hash == chainparams.GetConsensus().hashGenesisBlock || mapBlockIndex.count(entry.hashPrev);
+                }
+                if (!fParentKnown) {
+                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, entry.hash.ToString(),
+                            entry.hashPrev.ToString());
+                    mapBlocksUnknownParent.insert(std::make_pair(entry.hashPrev, entry));
+                    continue;
+                }
+                CValidationState state;
+                bool fAccepted = ProcessReindexBlock(state, chainparams, entry, nLoaded);
+                if (state.IsError()) {
+                    fError = true;
+                    break;
+                }
+                // Successors of a block that was not accepted cannot be accepted either.
+                if (!fAccepted)
+                    continue;
+
+                // Process earlier encountered successors of this block
+                deque<uint256> queue;
+                queue.push_back(entry.hash);
+                while (!queue.empty()) {
+                    uint256 head = queue.front();
+                    queue.pop_front();
+                    std::pair<std::multimap<uint256, CReindexBlock>::iterator, std::multimap<uint256, CReindexBlock>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                    while (range.first != range.second) {
+                        std::multimap<uint256, CReindexBlock>::iterator it = range.first;
+                        LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, it->second.hash.ToString(),
+                                head.ToString());
+                        CValidationState dummy;
+                        if (ProcessReindexBlock(dummy, chainparams, it->second, nLoaded))
+                            queue.push_back(it->second.hash);
+                        range.first++;
+                        mapBlocksUnknownParent.erase(it);
+                    }
+                }
+            }
+        }
+    } catch (...) {
+        workers.interrupt_all();
+        workers.join_all();
+        throw;
+    }
+    if (fError)
+        workers.interrupt_all();
+    workers.join_all();
+
+    LogPrintf("Reindexed %i blocks in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    if (fError)
+        return AbortNode("Reindexing the block files failed", _("Error: Reindexing the block files failed, see debug.log for details"));
+    return true;
+}
+
+static bool CompareBlockIndexHeight(const CBlockIndex* pa, const CBlockIndex* pb)
+{
+    return pa->nHeight < pb->nHeight;
+}
+
+/** Whether the block at pos is stored compressed. */
+static bool IsBlockRecordCompressed(const CDiskBlockPos& pos)
+{
+    if (pos.nPos < 8)
+        return false;
+    std::shared_ptr<const CBlockFileMapping> mapping = blockFileMaps.Get(BLOCK_FILE_BLK, pos.nFile, pos.nPos);
+    if (mapping)
+        return ReadLE32((const unsigned char*)mapping->begin() + pos.nPos - 4) & BLOCK_RECORD_COMPRESSED;
+
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 4), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+    unsigned int nSize;
+    try {
+        filein >> nSize;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return nSize & BLOCK_RECORD_COMPRESSED;
+}
+
+/**
+ * Convert an old block file to compressed storage. Its blocks and their undo
+ * data are written again, compressed, at the end of the block files like newly
+ * accepted blocks, and the file is deleted once the block index and the
+ * transaction index point to the new copies. A crash in between leaves either
+ * the old or the new copies referenced, and some unused space.
+ */
+bool CompactBlockFile(const CChainParams& chainparams, int nFile, const std::vector<CBlockIndex*>& vIndex)
+{
+    int64_t nStart = GetTimeMillis();
+    CValidationState state;
+    std::vector<std::pair<uint256, CDiskTxPos> > vTxPos;
+    int64_t nOldSize;
+    {
+        LOCK(cs_LastBlockFile);
+        nOldSize = vinfoBlockFile[nFile].nSize + vinfoBlockFile[nFile].nUndoSize;
+    }
+    int64_t nNewSize = 0;
+    bool fComplete = true;
+
+    BOOST_FOREACH(CBlockIndex* pindex, vIndex) {
+        if (boost::this_thread::interruption_requested()) {
+            // Finish what has been moved, and do the rest next time.
+            fComplete = false;
+            break;
+        }
+
+        LOCK(cs_main);
+        // The block may have been pruned meanwhile.
+        if (pindex->nFile != nFile || !(pindex->nStatus & BLOCK_HAVE_DATA))
+            continue;
+        // While catching up, the transaction indexer writes positions it read earlier.
+        if (fTxIndex && ptxindexer && !ptxindexer->IsFollowing()) {
+            fComplete = false;
+            break;
+        }
+
+        CBlock block;
+        if (!ReadBlockDataFromDisk(block, pindex->GetBlockPos()) || block.GetHash() != pindex->GetBlockHash())
+            return error("%s: cannot read block %s from blk%05u.dat", __func__, pindex->GetBlockHash().ToString(), nFile);
+        CBlockUndo blockundo;
+        bool fUndo = (pindex->nStatus & BLOCK_HAVE_UNDO) && pindex->pprev;
+        if (fUndo && !UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()))
+            return error("%s: cannot read undo data of block %s from rev%05u.dat", __func__, pindex->GetBlockHash().ToString(), nFile);
+
+        std::shared_ptr<const CDataStream> record = SerializeBlockRecord(block, chainparams.MessageStart(), true);
+        CDiskBlockPos blockPos;
+        if (!FindBlockPos(state, blockPos, record->size(), pindex->nHeight, block.GetBlockTime()))
+            return error("%s: FindBlockPos failed", __func__);
+        if (!WriteBlockToDisk(record, blockPos))
+            return AbortNode(state, "Failed to write block");
+        nNewSize += record->size();
+
+        CDiskBlockPos undoPos;
+        if (fUndo) {
+            unsigned int nUndoSize = ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40;
+            if (!FindUndoPos(state, blockPos.nFile, undoPos, nUndoSize))
+                return error("%s: FindUndoPos failed", __func__);
+            if (!UndoWriteToDisk(blockundo, undoPos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+                return AbortNode(state, "Failed to write undo data");
+            nNewSize += nUndoSize;
+        }
+
+        if (fTxIndex) {
+            CDiskTxPos pos(blockPos, GetSizeOfCompactSize(block.vtx.size()));
+            BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+                vTxPos.push_back(std::make_pair(tx.GetHash(), pos));
+                pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+            }
+        }
+
+        pindex->nFile = blockPos.nFile;
+        pindex->nDataPos = blockPos.nPos;
+        if (fUndo)
+            pindex->nUndoPos = undoPos.nPos;
+        setDirtyBlockIndex.insert(pindex);
+    }
+
+    LOCK(cs_main);
+    // The new copies must be on disk before the indexes point at them.
+    if (!FlushBlockFile())
+        return AbortNode(state, "Failed to write to block files");
+    if (fTxIndex && !pblocktree->WriteTxIndex(vTxPos))
+        return AbortNode(state, "Failed to write transaction index");
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    if (!fComplete)
+        return true;
+
+    {
+        LOCK(cs_LastBlockFile);
+        vinfoBlockFile[nFile].SetNull();
+        setDirtyFileInfo.insert(nFile);
+    }
+    std::set<int> setFiles;
+    setFiles.insert(nFile);
+    UnlinkPrunedFiles(setFiles);
+
+    nFilesCompacted++;
+    nBytesReclaimed += nOldSize - nNewSize;
+    LogPrintf("Compacted blk%05u.dat: %d kB to %d kB in %dms\n", nFile, nOldSize / 1000, nNewSize / 1000, GetTimeMillis() - nStart);
+    return true;
+}
+
+void ThreadCompactBlockFiles()
+{
+    const CChainParams& chainparams = Params();
+    // Files found to be compressed already, or that could not be converted.
+    std::set<int> setFilesDone;
+
+    while (true) {
+        MilliSleep(BLOCK_COMPACTION_INTERVAL * 1000);
+
+        // Blocks stored in each block file that is old enough to be converted.
+        std::map<int, std::vector<CBlockIndex*> > mapFiles;
+        {
+            LOCK(cs_main);
+            if (fImporting || fReindex || IsInitialBlockDownload(chainparams))
+                continue;
+
+            int nLastFile;
+            {
+                LOCK(cs_LastBlockFile);
+                nLastFile = nLastBlockFile;
+            }
+            std::set<int> setFilesRecent;
+            BOOST_FOREACH(const BlockMap::value_type& item, mapBlockIndex) {
+                CBlockIndex* pindex = item.second;
+                if (!(pindex->nStatus & BLOCK_HAVE_DATA) || setFilesDone.count(pindex->nFile))
+                    continue;
+                if (pindex->nFile >= nLastFile || pindex->nHeight > chainActive.Height() - BLOCK_COMPACTION_MIN_DEPTH)
+                    setFilesRecent.insert(pindex->nFile);
+                else
+                    mapFiles[pindex->nFile].push_back(pindex);
+            }
+            BOOST_FOREACH(int nFile, setFilesRecent)
+                mapFiles.erase(nFile);
+        }
+
+        for (std::map<int, std::vector<CBlockIndex*> >::iterator it = mapFiles.begin(); it != mapFiles.end(); ++it) {
+            boost::this_thread::interruption_point();
+
+            bool fCompressed = true;
+            BOOST_FOREACH(const CBlockIndex* pindex, it->second) {
+                CDiskBlockPos pos;
+                {
+                    LOCK(cs_main);
+                    pos = pindex->GetBlockPos();
+                }
+                if (!IsBlockRecordCompressed(pos)) {
+                    fCompressed = false;
+                    break;
+                }
+            }
+            if (fCompressed) {
+                setFilesDone.insert(it->first);
+                continue;
+            }
+
+            // Write blocks in height order, as they were written originally.
+            std::sort(it->second.begin(), it->second.end(), CompareBlockIndexHeight);
+            if (!CompactBlockFile(chainparams, it->first, it->second)) {
+                LogPrintf("%s: cannot compact blk%05u.dat\n", __func__, it->first);
+                setFilesDone.insert(it->first);
+            }
+        }
+    }
+}
+
+void GetBlockStorageStats(CBlockStorageStats& stats)
+{
+    {
+        LOCK(cs_LastBlockFile);
+        stats.nBlockFileBytes = 0;
+        stats.nUndoFileBytes = 0;
+        BOOST_FOREACH(const CBlockFileInfo& file, vinfoBlockFile) {
+            stats.nBlockFileBytes += file.nSize;
+            stats.nUndoFileBytes += file.nUndoSize;
+        }
+    }
+    stats.nCompressedRawBytes = nCompressedRawBytes;
+    stats.nCompressedBytes = nCompressedBytes;
+    stats.nBlocksDecompressed = nBlocksDecompressed;
+    stats.nDecompressTime = nDecompressTime;
+    stats.nFilesCompacted = nFilesCompacted;
+    stats.nBytesReclaimed = nBytesReclaimed;
+}
+
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -5332,7 +6196,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -5357,18 +6221,56 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
+                    // Older blocks are sent in full even if requested as compact
+                    // blocks, as the peer is unlikely to have their transactions
+                    // in its mempool.
+                    bool fSendFull = inv.type == MSG_BLOCK ||
+                        (inv.type == MSG_CMPCT_BLOCK && mi->second->nHeight < chainActive.Height() - MAX_CMPCTBLOCK_DEPTH);
+
+                    // Full blocks go out as stored on disk, without deserializing
+                    // and serializing them (and their proofs) again.
+                    std::shared_ptr<const CRawBlock> pRawBlock;
+                    if (fSendFull)
+                        pRawBlock = GetRawBlock(mi->second, Params().MessageStart());
+
+                    // Filtered blocks are built from cached merkle block data,
+                    // and only for peers that have set a filter.
+                    std::shared_ptr<const CFilteredBlockSource> pFilteredBlock;
+                    if (inv.type == MSG_FILTERED_BLOCK) {
+                        bool fHaveFilter;
+                        {
+                            LOCK(pfrom->cs_filter);
+                            fHaveFilter = pfrom->pfilter != NULL;
+                        }
+                        if (fHaveFilter) {
+                            pFilteredBlock = GetFilteredBlock(mi->second, consensusParams);
+                            if (!pFilteredBlock)
+                                assert(!"cannot load block from disk");
+                        }
+                    }
+
                     // Send block from disk
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    if (!pRawBlock && inv.type != MSG_FILTERED_BLOCK && !ReadBlockFromDisk(block, (*mi).second, consensusParams))
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    if (fSendFull)
+                    {
+                        if (pRawBlock)
+                            pfrom->PushRawMessage("block", pRawBlock->vData, pRawBlock->nChecksum);
+                        else
+                            pfrom->PushMessage("block", block);
+                    }
+                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        CBlockHeaderAndShortTxIDs cmpctblock(block);
+                        pfrom->PushMessage("cmpctblock", cmpctblock);
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
-                        if (pfrom->pfilter)
+                        if (pfrom->pfilter && pFilteredBlock)
                         {
-                            CMerkleBlock merkleBlock(block, *pfrom->pfilter);
+                            CMerkleBlock merkleBlock(pFilteredBlock->merkleData, *pfrom->pfilter);
                             pfrom->PushMessage("merkleblock", merkleBlock);
                             // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
                             // This avoids hurting performance by pointlessly requiring a round-trip
@@ -5379,7 +6281,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
                                 if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
-                                    pfrom->PushMessage("tx", block.vtx[pair.first]);
+                                    pfrom->PushMessage("tx", pFilteredBlock->block.vtx[pair.first]);
                         }
                         // else
                             // no response
@@ -5440,7 +6342,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -5459,7 +6361,52 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     }
 }
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+/**
+ * End pnode's reconciliation round after a protocol error, announcing its
+ * transactions by inv instead, so the next round can start. Requires
+ * pnode->cs_inventory.
+ */
+static void AbortTxReconciliation(CNode* pnode)
+{
+    CTxReconciliationState& recon = pnode->txrecon;
+    if (!recon.fInFlight)
+        return;
+    BOOST_FOREACH(const uint256& txid, recon.AbortRound())
+        pnode->vInventoryToSend.push_back(CInv(MSG_TX, txid));
+    recon.nNextReconTime = GetTime() + TXRECON_INTERVAL;
+}
+
+/**
+ * If a block requested from pfrom as a compact block is not going to be
+ * reconstructed, request it in full, so the request does not time out.
+ */
+static void RequestFullBlockIfInFlight(CNode* pfrom, const uint256& hash)
+{
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId() &&
+            !itInFlight->second.second->partialBlock) {
+        vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+        pfrom->PushMessage("getdata", vInv);
+    }
+}
+
+/** Process a block reconstructed from a compact block as if it had been received in full. */
+static void ProcessCompactBlock(CNode* pfrom, const CChainParams& chainparams, const CBlock& block)
+{
+    CValidationState state;
+    ProcessNewBlock(state, chainparams, pfrom, &block, false, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", string("block"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
+bool static ProcessMessage(CNode* pfrom, string strCommand, CRecvDataStream& vRecv, int64_t nTimeReceived)
 {
     const CChainParams& chainparams = Params();
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -5550,6 +6497,26 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         pfrom->PushMessage("verack");
         pfrom->ssSend.SetVersion(min(pfrom->nVersion, PROTOCOL_VERSION));
 
+        // Offer set reconciliation. Peers that do not know "sendrecon" ignore
+        // it and keep receiving transactions by inv.
+        if (fTxReconciliation && pfrom->fRelayTxes)
+        {
+            uint64_t nSalt = 0;
+            while (nSalt == 0) {
+                GetRandBytes((unsigned char*)&nSalt, sizeof(nSalt));
+            }
+            {
+                LOCK(pfrom->cs_inventory);
+                pfrom->txrecon.nLocalSalt = nSalt;
+            }
+            pfrom->PushMessage("sendrecon", TXRECON_VERSION, nSalt);
+        }
+
+        // Ask outbound peers to push new blocks to us as compact blocks, and
+        // let inbound peers know we can serve them on request.
+        if (fBlockCompact)
+            pfrom->PushMessage("sendcmpct", !pfrom->fInbound, CMPCTBLOCKS_VERSION);
+
         if (!pfrom->fInbound)
         {
             // Advertise our address
@@ -5675,9 +6642,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     LOCK(cs_vNodes);
                     // Use deterministic randomness to send to the same nodes for 24 hours
                     // at a time so the addrKnowns of the chosen nodes prevent repeats
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
+                    static const uint256 hashSalt = GetRandHash();
                     uint64_t hashAddr = addr.GetHash();
                     uint256 hashRand = ArithToUint256(UintToArith256(hashSalt) ^ (hashAddr<<32) ^ ((GetTime()+hashAddr)/(24*60*60)));
                     hashRand = Hash(BEGIN(hashRand), END(hashRand));
@@ -5751,8 +6716,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     CNodeState *nodestate = State(pfrom->GetId());
 
                     if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - chainparams.GetConsensus().PoWTargetSpacing(pindexBestHeader->nHeight) * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        nodestate->nBlocksInFlight < nodestate->nBlocksInTransitLimit) {
+                        // Peers that serve compact blocks are asked for one; the
+                        // transactions of a block this recent are likely in our mempool.
+                        vToFetch.push_back(CInv(pfrom->fProvidesHeaderAndIDs ? MSG_CMPCT_BLOCK : MSG_BLOCK, inv.hash));
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -5775,6 +6742,135 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == "sendrecon")
+    {
+        uint32_t nReconVersion;
+        uint64_t nRemoteSalt;
+        vRecv >> nReconVersion >> nRemoteSalt;
+
+        LOCK(pfrom->cs_inventory);
+        CTxReconciliationState& recon = pfrom->txrecon;
+        // Only reconcile if we offered it too; the outbound side initiates.
+        if (recon.nLocalSalt != 0 && !recon.fEnabled && nReconVersion >= 1) {
+            recon.Enable(nRemoteSalt, !pfrom->fInbound);
+            recon.nNextReconTime = GetTime() + TXRECON_INTERVAL;
+            LogPrint("net", "transaction reconciliation enabled with peer=%d (%s)\n", pfrom->id, recon.fInitiator ? "initiator" : "responder");
+        }
+    }
+
+
+    else if (strCommand == "reqrecon")
+    {
+        uint32_t nRemoteSetSize;
+        vRecv >> nRemoteSetSize;
+
+        bool fUnexpected = false;
+        {
+            LOCK(pfrom->cs_inventory);
+            CTxReconciliationState& recon = pfrom->txrecon;
+            if (!recon.fEnabled || recon.fInitiator || recon.fInFlight) {
+                fUnexpected = true;
+                AbortTxReconciliation(pfrom);
+            } else {
+                // Size the sketch for the expected difference. A sketch without
+                // cells tells the initiator to fall back to inv announcements.
+                recon.TakeSnapshot();
+                recon.fInFlight = true;
+                CReconSketch sketch = recon.SketchSnapshot(TxReconSketchCells(recon.mapSnapshot.size(), nRemoteSetSize));
+                LogPrint("net", "sending sketch with %u cells for %u transactions to peer=%d\n", sketch.GetCells(), recon.mapSnapshot.size(), pfrom->id);
+                pfrom->PushMessage("sketch", sketch);
+            }
+        }
+        if (fUnexpected) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 10);
+            return error("unexpected reqrecon from peer=%d", pfrom->id);
+        }
+    }
+
+
+    else if (strCommand == "sketch")
+    {
+        CReconSketch remoteSketch;
+        bool fDecoded = true;
+        try {
+            vRecv >> remoteSketch;
+        } catch (const std::ios_base::failure&) {
+            fDecoded = false;
+        }
+
+        bool fUnexpected = false;
+        {
+            LOCK(pfrom->cs_inventory);
+            CTxReconciliationState& recon = pfrom->txrecon;
+            if (!fDecoded || !recon.fEnabled || !recon.fInitiator || !recon.fInFlight || !remoteSketch.IsWithinSizeConstraints()) {
+                fUnexpected = true;
+                AbortTxReconciliation(pfrom);
+            } else {
+                vector<uint32_t> vOurs, vTheirs;
+                bool fSuccess = remoteSketch.GetCells() > 0;
+                if (fSuccess) {
+                    CReconSketch diff = recon.SketchSnapshot(remoteSketch.GetCells());
+                    fSuccess = diff.Subtract(remoteSketch) && diff.Decode(vOurs, vTheirs);
+                }
+                if (!fSuccess)
+                    vTheirs.clear();
+
+                // Announce what the peer is missing; on failure, everything.
+                vector<uint256> vAnnounce = fSuccess ? recon.GetSnapshotTxs(vOurs) : recon.GetSnapshotTxs();
+                BOOST_FOREACH(const uint256& txid, vAnnounce)
+                    pfrom->vInventoryToSend.push_back(CInv(MSG_TX, txid));
+                LogPrint("net", "reconciliation with peer=%d %s: %u transactions in set, announcing %u, requesting %u\n",
+                    pfrom->id, fSuccess ? "succeeded" : "failed", recon.mapSnapshot.size(), vAnnounce.size(), vTheirs.size());
+
+                recon.mapSnapshot.clear();
+                recon.fInFlight = false;
+                recon.nNextReconTime = GetTime() + TXRECON_INTERVAL;
+                pfrom->PushMessage("reconcildiff", fSuccess, vTheirs);
+            }
+        }
+        if (fUnexpected) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 10);
+            return error("unexpected sketch from peer=%d", pfrom->id);
+        }
+    }
+
+
+    else if (strCommand == "reconcildiff")
+    {
+        bool fSuccess = false;
+        vector<uint32_t> vShortIds;
+        bool fDecoded = true;
+        try {
+            vRecv >> fSuccess >> vShortIds;
+        } catch (const std::ios_base::failure&) {
+            fDecoded = false;
+        }
+
+        bool fUnexpected = false;
+        {
+            LOCK(pfrom->cs_inventory);
+            CTxReconciliationState& recon = pfrom->txrecon;
+            if (!fDecoded || !recon.fEnabled || recon.fInitiator || !recon.fInFlight || vShortIds.size() > MAX_TXRECON_SKETCH_CELLS) {
+                fUnexpected = true;
+                AbortTxReconciliation(pfrom);
+            } else {
+                vector<uint256> vAnnounce = fSuccess ? recon.GetSnapshotTxs(vShortIds) : recon.GetSnapshotTxs();
+                BOOST_FOREACH(const uint256& txid, vAnnounce)
+                    pfrom->vInventoryToSend.push_back(CInv(MSG_TX, txid));
+                recon.mapSnapshot.clear();
+                recon.fInFlight = false;
+            }
+        }
+        if (fUnexpected) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 10);
+            return error("unexpected reconcildiff from peer=%d", pfrom->id);
+        }
+    }
+
+
     else if (strCommand == "getdata")
     {
         vector<CInv> vInv;
@@ -6075,6 +7171,204 @@ LogPrint("net", "   message getheaders mapBlockIndex.end() %s\n", "0");
         CheckBlockIndex(chainparams.GetConsensus());
     }
 
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (fBlockCompact && nCMPCTBLOCKVersion == CMPCTBLOCKS_VERSION) {
+            pfrom->fProvidesHeaderAndIDs = true;
+            pfrom->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "peer=%d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Requests for old blocks are answered with the full block, going
+            // through the same checks as a regular getdata.
+            LogPrint("net", "peer=%d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom, chainparams.GetConsensus());
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        const uint256 hash = cmpctblock.header.GetHash();
+        LogPrint("net", "received cmpctblock %s peer=%d\n", hash.ToString(), pfrom->id);
+        pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+                // Doesn't connect (or is genesis); sync headers first instead of punishing the peer.
+                if (!IsInitialBlockDownload(chainparams))
+                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+                RequestFullBlockIfInFlight(pfrom, hash);
+                return true;
+            }
+
+            CBlockIndex *pindex = NULL;
+            CValidationState state;
+            if (!AcceptBlockHeader(cmpctblock.header, state, chainparams, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS)) {
+                    // The block itself will not be accepted either.
+                    MarkBlockAsReceived(hash);
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    return error("invalid header received in cmpctblock from peer=%d", pfrom->id);
+                }
+                RequestFullBlockIfInFlight(pfrom, hash);
+                return true;
+            }
+            UpdateBlockAvailability(pfrom->GetId(), hash);
+
+            // Nothing to do if we already have the block.
+            if (pindex->nStatus & BLOCK_HAVE_DATA) {
+                MarkBlockAsReceived(hash);
+                return true;
+            }
+            // If it would not become our tip, the mempool is unlikely to have
+            // its transactions; a block we asked for is downloaded in full.
+            if (pindex->nChainWork <= chainActive.Tip()->nChainWork) {
+                RequestFullBlockIfInFlight(pfrom, hash);
+                return true;
+            }
+
+            // Blocks further ahead, or already being downloaded from another
+            // peer, are left to the regular block download logic.
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+            if (itInFlight != mapBlocksInFlight.end() &&
+                (itInFlight->second.first != pfrom->GetId() || itInFlight->second.second->partialBlock))
+                return true;
+            if (pindex->nHeight > chainActive.Height() + 2) {
+                RequestFullBlockIfInFlight(pfrom, hash);
+                return true;
+            }
+            if (itInFlight == mapBlocksInFlight.end() && State(pfrom->GetId())->nBlocksInFlight >= State(pfrom->GetId())->nBlocksInTransitLimit)
+                return true;
+
+            list<QueuedBlock>::iterator *queuedBlockIt = NULL;
+            MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex, &queuedBlockIt);
+            (*queuedBlockIt)->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+            PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
+
+            // Orphans are often the transactions a block needs but our mempool lacks.
+            vector<CTransaction> vExtraTxn;
+            vExtraTxn.reserve(mapOrphanTransactions.size());
+            for (map<uint256, COrphanTx>::iterator mi = mapOrphanTransactions.begin(); mi != mapOrphanTransactions.end(); ++mi)
+                vExtraTxn.push_back(mi->second.tx);
+
+            ReadStatus status = partialBlock.InitData(cmpctblock, vExtraTxn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(hash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid cmpctblock %s from peer=%d", hash.ToString(), pfrom->id);
+            }
+
+            BlockTransactionsRequest req;
+            if (status == READ_STATUS_OK) {
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                    if (!partialBlock.IsTxAvailable(i))
+                        req.indexes.push_back(i);
+                }
+                if (req.indexes.empty()) {
+                    status = partialBlock.FillBlock(block, vector<CTransaction>());
+                    fBlockReconstructed = (status == READ_STATUS_OK);
+                }
+            }
+
+            if (status != READ_STATUS_OK) {
+                // Short id collisions; the block stays in flight, download it in full.
+                (*queuedBlockIt)->partialBlock.reset();
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                pfrom->PushMessage("getdata", vInv);
+                return true;
+            }
+
+            if (!fBlockReconstructed) {
+                LogPrint("net", "requesting %u of %u transactions of cmpctblock %s from peer=%d\n",
+                    req.indexes.size(), cmpctblock.BlockTxCount(), hash.ToString(), pfrom->id);
+                req.blockhash = hash;
+                pfrom->PushMessage("getblocktxn", req);
+            }
+        }
+
+        if (fBlockReconstructed)
+            ProcessCompactBlock(pfrom, chainparams, block);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(resp.blockhash);
+            if (itInFlight == mapBlocksInFlight.end() || !itInFlight->second.second->partialBlock ||
+                    itInFlight->second.first != pfrom->GetId()) {
+                LogPrint("net", "peer=%d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            ReadStatus status = itInFlight->second.second->partialBlock->FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us invalid compact block transactions", pfrom->id);
+            } else if (status == READ_STATUS_FAILED) {
+                // Short id collision with a mempool transaction; download the full block.
+                itInFlight->second.second->partialBlock.reset();
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+                pfrom->PushMessage("getdata", vInv);
+                return true;
+            }
+        }
+
+        ProcessCompactBlock(pfrom, chainparams, block);
+    }
+
+
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlock block;
@@ -6120,7 +7414,10 @@ LogPrint("net", "   message getheaders mapBlockIndex.end() %s\n", "0");
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -6245,12 +7542,20 @@ LogPrint("net", "   message getheaders mapBlockIndex.end() %s\n", "0");
         vRecv >> alert;
 
         uint256 alertHash = alert.GetHash();
-        if (pfrom->setKnown.count(alertHash) == 0)
+        bool fKnown;
+        {
+            LOCK(pfrom->cs_inventory);
+            fKnown = pfrom->setKnown.count(alertHash) != 0;
+        }
+        if (!fKnown)
         {
             if (alert.ProcessAlert(chainparams.AlertKey()))
             {
                 // Relay
-                pfrom->setKnown.insert(alertHash);
+                {
+                    LOCK(pfrom->cs_inventory);
+                    pfrom->setKnown.insert(alertHash);
+                }
                 {
                     LOCK(cs_vNodes);
                     BOOST_FOREACH(CNode* pnode, vNodes)
@@ -6437,8 +7742,8 @@ bool ProcessMessages(CNode* pfrom)
         unsigned int nMessageSize = hdr.nMessageSize;
 
         // Checksum
-        CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+        CRecvDataStream& vRecv = msg.vRecv;
+        uint256 hash = vRecv.GetHash();
         unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
         if (nChecksum != hdr.nChecksum)
         {
@@ -6449,6 +7754,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nTimeStart = GetTimeMicros();
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
@@ -6480,6 +7786,7 @@ bool ProcessMessages(CNode* pfrom)
         } catch (...) {
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
+        pfrom->RecordMessageRecv(strCommand, CMessageHeader::HEADER_SIZE + nMessageSize, GetTimeMicros() - nTimeStart);
 
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
@@ -6545,8 +7852,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Periodically clear addrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
                     pnode->addrKnown.reset();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -6560,23 +7869,33 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         if (fSendTrickle)
         {
-            vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
+            // Other peers' handlers push addresses to pto concurrently, so
+            // take the pending ones out under the lock and send them after.
+            vector<CAddress> vAddrPending;
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                LOCK(pto->cs_vAddrToSend);
+                vAddrPending.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        vAddrPending.push_back(addr);
                     }
                 }
+                pto->vAddrToSend.clear();
+            }
+            vector<CAddress> vAddr;
+            BOOST_FOREACH(const CAddress& addr, vAddrPending)
+            {
+                vAddr.push_back(addr);
+                // receiver rejects addr messages larger than 1000
+                if (vAddr.size() >= 1000)
+                {
+                    pto->PushMessage("addr", vAddr);
+                    vAddr.clear();
+                }
             }
-            pto->vAddrToSend.clear();
             if (!vAddr.empty())
                 pto->PushMessage("addr", vAddr);
         }
@@ -6624,6 +7943,19 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             GetMainSignals().Broadcast(nTimeBestReceived);
         }
 
+        //
+        // Message: reqrecon
+        //
+        {
+            LOCK(pto->cs_inventory);
+            CTxReconciliationState& recon = pto->txrecon;
+            if (recon.fEnabled && recon.fInitiator && !recon.fInFlight && GetTime() >= recon.nNextReconTime) {
+                recon.TakeSnapshot();
+                recon.fInFlight = true;
+                pto->PushMessage("reqrecon", (uint32_t)recon.mapSnapshot.size());
+            }
+        }
+
         //
         // Message: inventory
         //
@@ -6642,9 +7974,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 if (inv.type == MSG_TX && !fSendTrickle)
                 {
                     // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
+                    static const uint256 hashSalt = GetRandHash();
                     uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
                     hashRand = Hash(BEGIN(hashRand), END(hashRand));
                     bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
@@ -6708,10 +8038,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload(chainParams)) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        state.nBlocksInTransitLimit = BlocksInTransitLimit(&state, pto->nMinPingUsecTime);
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload(chainParams)) && state.nBlocksInFlight < state.nBlocksInTransitLimit) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            CBlockIndex *pindexStalled = NULL;
+            FindNextBlocksToDownload(pto->GetId(), state.nBlocksInTransitLimit - state.nBlocksInFlight, vToDownload, staller, pindexStalled);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
@@ -6719,8 +8051,23 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     pindex->nHeight, pto->id);
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
-                if (State(staller)->nStallingSince == 0) {
-                    State(staller)->nStallingSince = nNow;
+                // We are idle and the window is held up by a block in flight from another peer. If we have
+                // been delivering blocks at least twice as fast, and that block has already been waiting for
+                // half the stalling timeout, fetch it from us instead of waiting for the stall to be detected.
+                CNodeState *stateStaller = State(staller);
+                map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight =
+                    pindexStalled ? mapBlocksInFlight.find(pindexStalled->GetBlockHash()) : mapBlocksInFlight.end();
+                if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == staller &&
+                        !itInFlight->second.second->partialBlock &&
+                        itInFlight->second.second->nTime < nNow - 500000 * BLOCK_STALLING_TIMEOUT &&
+                        state.nAvgBlockInterval != 0 &&
+                        (stateStaller->nAvgBlockInterval == 0 || 2 * state.nAvgBlockInterval < stateStaller->nAvgBlockInterval)) {
+                    vGetData.push_back(CInv(MSG_BLOCK, pindexStalled->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStalled->GetBlockHash(), consensusParams, pindexStalled);
+                    LogPrint("net", "Re-requesting stalled block %s (%d) from peer=%d instead of peer=%d\n",
+                        pindexStalled->GetBlockHash().ToString(), pindexStalled->nHeight, pto->id, staller);
+                } else if (stateStaller->nStallingSince == 0) {
+                    stateStaller->nStallingSince = nNow;
                     LogPrint("net", "Stall started peer=%d\n", staller);
                 }
             }
@@ -6761,6 +8108,288 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 
 
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Mempool persistence
+//
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** Number of transactions whose proofs are checked together before being accepted under cs_main. */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 1000;
+
+static boost::filesystem::path GetMempoolPath()
+{
+    return GetDataDir() / "mempool.dat";
+}
+
+/** The context-free and contextual checks, including proof verification, of a transaction loaded from mempool.dat. */
+class CMempoolEntryCheck
+{
+private:
+    const CTransaction* ptx;
+    int nHeight;
+    char* pfResult;
+
+public:
+    CMempoolEntryCheck() : ptx(NULL), nHeight(0), pfResult(NULL) {}
+    CMempoolEntryCheck(const CTransaction& tx, int nHeightIn, char* pfResultIn) :
+        ptx(&tx), nHeight(nHeightIn), pfResult(pfResultIn) {}
+
+    //! Records the result, and always succeeds so the queue runs every check.
+    bool operator()()
+    {
+        CValidationState state;
+        auto verifier = libzcash::ProofVerifier::Strict();
+        *pfResult = CheckTransaction(*ptx, state, verifier) &&
+                    ContextualCheckTransaction(*ptx, state, Params(), nHeight, 10);
+        return true;
+    }
+
+    void swap(CMempoolEntryCheck& check)
+    {
+        std::swap(ptx, check.ptx);
+        std::swap(nHeight, check.nHeight);
+        std::swap(pfResult, check.pfResult);
+    }
+};
+
+/**
+ * Checks the transactions loaded from mempool.dat on several threads, which
+ * are created once for the whole load. Does not require cs_main.
+ */
+class CMempoolLoadChecker
+{
+private:
+    const std::vector<std::pair<CTransaction, int64_t> >& vEntries;
+    CCheckQueue<CMempoolEntryCheck> queue;
+    boost::thread_group threads;
+
+public:
+    std::vector<char> vChecked;     //!< whether each entry passed the checks
+    std::vector<int> vCheckHeight;  //!< the height each entry was checked for, or 0
+
+    CMempoolLoadChecker(const std::vector<std::pair<CTransaction, int64_t> >& vEntriesIn) :
+        vEntries(vEntriesIn), queue(128), vChecked(vEntriesIn.size(), 0), vCheckHeight(vEntriesIn.size(), 0)
+    {
+        for (int i = 1; i < std::max(nScriptCheckThreads, 1); i++)
+            threads.create_thread(boost::bind(&CCheckQueue<CMempoolEntryCheck>::Thread, &queue));
+    }
+
+    ~CMempoolLoadChecker()
+    {
+        threads.interrupt_all();
+        threads.join_all();
+    }
+
+    /** Check the entries at vIndices for a block at nHeight, unless they already were. */
+    void Check(const std::vector<size_t>& vIndices, int nHeight)
+    {
+        std::vector<CMempoolEntryCheck> vChecks;
+        vChecks.reserve(vIndices.size());
+        BOOST_FOREACH(size_t i, vIndices) {
+            if (vCheckHeight[i] == nHeight)
+                continue;
+            vChecks.push_back(CMempoolEntryCheck(vEntries[i].first, nHeight, &vChecked[i]));
+            vCheckHeight[i] = nHeight;
+        }
+        CCheckQueueControl<CMempoolEntryCheck> control(&queue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+};
+
+bool LoadMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    FILE* filestr = fopen(GetMempoolPath().string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    std::vector<std::pair<CTransaction, int64_t> > vEntries;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION) {
+            return false;
+        }
+        uint64_t num;
+        file >> num;
+        while (num--) {
+            CTransaction tx;
+            int64_t nTime;
+            file >> tx;
+            file >> nTime;
+            vEntries.push_back(std::make_pair(tx, nTime));
+        }
+        file >> mapDeltas;
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    file.fclose();
+
+    int64_t nRead = GetTimeMicros();
+
+    // Restore prioritisetransaction deltas before the transactions themselves,
+    // so that they also cover entries that fail to re-enter the mempool now
+    // but are relayed to us again later.
+    for (const auto& delta : mapDeltas) {
+        mempool.PrioritiseTransaction(delta.first, delta.first.ToString(), delta.second.first, delta.second.second);
+    }
+
+    int64_t count = 0;
+    int64_t failed = 0;
+    int64_t already_there = 0;
+    std::vector<size_t> vDeferred;
+    CMempoolLoadChecker checker(vEntries);
+    for (size_t nBatch = 0; nBatch < vEntries.size(); nBatch += MEMPOOL_LOAD_BATCH_SIZE) {
+        if (ShutdownRequested())
+            return false;
+        size_t nBatchEnd = std::min(nBatch + MEMPOOL_LOAD_BATCH_SIZE, vEntries.size());
+        std::vector<size_t> vBatch;
+        for (size_t i = nBatch; i < nBatchEnd; i++)
+            vBatch.push_back(i);
+
+        int nCheckHeight;
+        {
+            LOCK(cs_main);
+            nCheckHeight = chainActive.Height() + 1;
+        }
+        checker.Check(vBatch, nCheckHeight);
+
+        LOCK(cs_main);
+        // If a block arrived while the batch was being checked, the checks
+        // ran against the wrong height and AcceptToMemoryPool redoes them.
+        bool fTxChecked = (chainActive.Height() + 1 == nCheckHeight);
+        BOOST_FOREACH(size_t i, vBatch) {
+            const CTransaction& tx = vEntries[i].first;
+            if (fTxChecked && !checker.vChecked[i]) {
+                ++failed;
+                continue;
+            }
+            CValidationState state;
+            bool fMissingInputs = false;
+            if (AcceptToMemoryPoolWorker(mempool, state, tx, false, &fMissingInputs, false, vEntries[i].second, fTxChecked)) {
+                ++count;
+            } else if (fMissingInputs) {
+                vDeferred.push_back(i);
+            } else if (mempool.exists(tx.GetHash())) {
+                ++already_there;
+            } else {
+                ++failed;
+            }
+        }
+    }
+
+    // Transactions whose parents appeared later in the file are retried until
+    // no further progress is made. They were checked with their batch, and are
+    // only checked again, outside cs_main, if a block arrived since.
+    bool fProgress = true;
+    while (fProgress && !vDeferred.empty()) {
+        if (ShutdownRequested())
+            return false;
+        int nCheckHeight;
+        {
+            LOCK(cs_main);
+            nCheckHeight = chainActive.Height() + 1;
+        }
+        checker.Check(vDeferred, nCheckHeight);
+
+        LOCK(cs_main);
+        bool fTxChecked = (chainActive.Height() + 1 == nCheckHeight);
+        fProgress = false;
+        std::vector<size_t> vStillMissing;
+        BOOST_FOREACH(size_t i, vDeferred) {
+            if (fTxChecked && !checker.vChecked[i]) {
+                ++failed;
+                continue;
+            }
+            CValidationState state;
+            bool fMissingInputs = false;
+            if (AcceptToMemoryPoolWorker(mempool, state, vEntries[i].first, false, &fMissingInputs, false, vEntries[i].second, fTxChecked)) {
+                ++count;
+                fProgress = true;
+            } else if (fMissingInputs) {
+                vStillMissing.push_back(i);
+            } else {
+                ++failed;
+            }
+        }
+        vDeferred.swap(vStillMissing);
+    }
+    failed += vDeferred.size();
+
+    int64_t nLast = GetTimeMicros();
+    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i already in mempool\n", count, failed, already_there);
+    LogPrintf("Loaded mempool: %gs to read, %gs to validate (%d threads)\n",
+        (nRead - nStart) * 0.000001, (nLast - nRead) * 0.000001, std::max(nScriptCheckThreads, 1));
+    return !ShutdownRequested();
+}
+
+void DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<std::pair<CTransaction, int64_t> > vEntries;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vEntries.reserve(mempool.mapTx.size());
+        for (const CTxMemPoolEntry& entry : mempool.mapTx) {
+            vEntries.push_back(std::make_pair(entry.GetTx(), entry.GetTime()));
+        }
+    }
+
+    // A transaction can only enter the mempool after its in-mempool parents,
+    // so writing entries in order of arrival lets LoadMempool accept nearly
+    // all of them on the first pass.
+    std::stable_sort(vEntries.begin(), vEntries.end(),
+        [](const std::pair<CTransaction, int64_t>& a, const std::pair<CTransaction, int64_t>& b) {
+            return a.second < b.second;
+        });
+
+    int64_t nMid = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+        FILE* filestr = fopen(pathTmp.string().c_str(), "wb");
+        if (!filestr) {
+            return;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = MEMPOOL_DUMP_VERSION;
+        file << version;
+
+        file << (uint64_t)vEntries.size();
+        for (const auto& entry : vEntries) {
+            file << entry.first;
+            file << entry.second;
+        }
+
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, GetMempoolPath())) {
+            throw std::runtime_error("Rename failed");
+        }
+        int64_t nLast = GetTimeMicros();
+        LogPrintf("Dumped mempool: %gs to copy, %gs to dump, %u transactions\n",
+            (nMid - nStart) * 0.000001, (nLast - nMid) * 0.000001, vEntries.size());
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+    }
+}
+
+
+
 static class CMainCleanup
 {
 public:
@@ -34,6 +34,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -44,6 +45,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
 class CInv;
@@ -52,6 +54,7 @@ class CValidationInterface;
 class CValidationState;
 class PrecomputedTransactionData;
 
+struct CBlockDeltas;
 struct CNodeStateStats;
 
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
@@ -61,6 +64,12 @@ static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = DEFAULT_BLOCK_MAX_SIZE / 2;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
+/** Default for -blockcompact, relaying blocks to peers that support it as compact blocks. */
+static const bool DEFAULT_BLOCKCOMPACT = true;
+/** Maximum total size of the serialized blocks kept in memory for serving them to peers. */
+static const size_t MAX_RAW_BLOCK_CACHE_SIZE = 32 * 1024 * 1024;
+/** Maximum memory used by the blocks and merkle trees kept for serving filtered blocks. */
+static const size_t MAX_FILTERED_BLOCK_CACHE_SIZE = 32 * 1024 * 1024;
 /** Minimum alert priority for enabling safe mode. */
 static const int ALERT_PRIORITY_SAFE_MODE = 4000;
 /** Maximum reorg length we will accept before we shut down and alert the user. */
@@ -88,18 +97,40 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Maximum number of threads scanning block files during -reindex */
+static const int MAX_REINDEX_THREADS = 8;
+/** Maximum number of threads seeking the address index for a query of many addresses */
+static const int MAX_ADDRESS_INDEX_READ_THREADS = 4;
+/** Addresses each of those threads gets at least */
+static const int ADDRESS_INDEX_ADDRESSES_PER_THREAD = 32;
+/** Default for -blockcompression, compressing blocks written to the block files */
+static const bool DEFAULT_BLOCK_COMPRESSION = false;
+/** Block files are only compacted once all their blocks are this many blocks below the tip. */
+static const int BLOCK_COMPACTION_MIN_DEPTH = 1000;
+/** Seconds the block file compactor waits between passes over the block files. */
+static const unsigned int BLOCK_COMPACTION_INTERVAL = 10 * 60;
+/** Number of blocks that can be requested at any given time from a peer whose block throughput is not known yet. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds on the number of blocks in flight from a single peer once its throughput has been measured. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_BLOCKS_IN_TRANSIT_PER_FAST_PEER = 128;
+/** Seconds of a peer's measured block throughput to keep in flight on top of a round trip. */
+static const unsigned int BLOCK_DOWNLOAD_TARGET_TIME = 4;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 160;
-/** Size of the "block download window": how far ahead of our current height do we fetch?
+/** Minimum size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
- *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
+ *  harder). The window grows with the measured download rate, up to MAX_BLOCK_DOWNLOAD_WINDOW. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+static const unsigned int MAX_BLOCK_DOWNLOAD_WINDOW = 8192;
+/** Seconds of aggregate block download rate the download window should cover. */
+static const unsigned int BLOCK_DOWNLOAD_WINDOW_TIME = 30;
+/** Period in seconds over which the block download rate is measured. */
+static const unsigned int BLOCK_DOWNLOAD_RATE_PERIOD = 60;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
@@ -107,6 +138,8 @@ static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 
 // Sanity check the magic numbers when we change them
 BOOST_STATIC_ASSERT(DEFAULT_BLOCK_MAX_SIZE <= MAX_BLOCK_SIZE);
@@ -137,6 +170,8 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+/** Maintain the shielded index of nullifiers and note commitments (-shieldedindex) */
+extern bool fShieldedIndex;
 
 // START insightexplorer
 extern bool fInsightExplorer;
@@ -154,6 +189,10 @@ extern bool fSpentIndex;
 // Maintain a full timestamp index, used to query for blocks within a time range
 extern bool fTimestampIndex;
 
+// True once the running balance of every address is maintained along with the
+// address index. Databases created before it existed build it in the background.
+extern bool fAddressBalanceIndex;
+
 // END insightexplorer
 
 extern bool fIsBareMultisigStd;
@@ -165,6 +204,8 @@ extern bool fCoinbaseEnforcedProtectionEnabled;
 extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
+extern bool fTxReconciliation;
+extern bool fBlockCompact;
 extern int64_t nMaxTipAge;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
@@ -178,6 +219,8 @@ static const uint64_t nMinDiskSpace = 52428800;
 extern bool fHavePruned;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
+/** True if blocks are compressed when they are written to the block files (-blockcompression). */
+extern bool fBlockCompression;
 /** Number of MiB of block files that we're trying to stay below. */
 extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
@@ -221,6 +264,12 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/** Rebuild the block index from our own block files (-reindex), scanning the files in parallel. Shuts the node down on failure. */
+bool ReindexBlockFiles(const CChainParams& chainparams);
+/** Compress the blocks in old block files in the background (-blockcompression) */
+void ThreadCompactBlockFiles();
+/** Convert block file nFile, holding the blocks vIndex in height order, to compressed storage */
+bool CompactBlockFile(const CChainParams& chainparams, int nFile, const std::vector<CBlockIndex*>& vIndex);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
@@ -287,14 +336,47 @@ void PruneAndFlush();
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectAbsurdFee=false);
 
+/** Dump the mempool and prioritisation deltas to disk (mempool.dat). */
+void DumpMempool();
+
+/** Load the mempool from disk, checking transaction proofs on multiple threads. */
+bool LoadMempool();
+
 
 struct CNodeStateStats {
     int nMisbehavior;
     int nSyncHeight;
     int nCommonHeight;
+    int nBlocksInTransitLimit;
     std::vector<int> vHeightInFlight;
 };
 
+/** Block download progress, as reported by getblockchaininfo. */
+struct CBlockDownloadStats {
+    double dBlocksPerSecond;
+    double dBytesPerSecond;
+    int nBlocksInFlight;
+    int nDownloadWindow;
+};
+
+/** Get the block download rate over the last BLOCK_DOWNLOAD_RATE_PERIOD seconds. Requires cs_main. */
+void GetBlockDownloadStats(CBlockDownloadStats& stats);
+
+/** Block storage footprint and the cost of reading compressed blocks, as reported by getblockchaininfo. */
+struct CBlockStorageStats {
+    uint64_t nBlockFileBytes;       //!< Size of the blk?????.dat files
+    uint64_t nUndoFileBytes;        //!< Size of the rev?????.dat files
+    uint64_t nCompressedRawBytes;   //!< Size of the blocks compressed since startup...
+    uint64_t nCompressedBytes;      //!< ...and their size on disk
+    uint64_t nBlocksDecompressed;   //!< Blocks read from disk and decompressed since startup
+    int64_t nDecompressTime;        //!< Time spent decompressing them, in microseconds
+    int nFilesCompacted;            //!< Block files converted by the compactor since startup
+    int64_t nBytesReclaimed;        //!< Disk space reclaimed by the compactor
+};
+
+/** Get the size of the block files and the compression statistics. */
+void GetBlockStorageStats(CBlockStorageStats& stats);
+
 
 
 CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree);
@@ -446,15 +528,47 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(const uint160& addressHash, int type,
         std::vector<CAddressIndexDbEntry> &addressIndex,
         int start = 0, int end = 0);
+/** Visit the address index entries of the addresses merged in height order, continuing after the given key if there is one. */
+bool GetAddressIndex(const std::vector<CAddressIndexIteratorKey>& addresses,
+        const CAddressIndexKey* after, int start, int end,
+        const CAddressIndexVisitor& visit);
 bool GetAddressUnspent(const uint160& addressHash, int type,
         std::vector<CAddressUnspentDbEntry>& unspentOutputs);
+/** Get the balance of an address from the address balance index; false if it is still being built. */
+bool GetAddressBalance(const uint160& addressHash, int type, CAddressBalanceValue& value);
 bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
     std::vector<std::pair<uint256, unsigned int> > &hashes);
+/** Get where a nullifier was revealed from the shielded index; false if it is unknown or the index is catching up. */
+bool GetNullifierIndex(ShieldedType type, const uint256& nullifier, CNullifierIndexValue& value);
+/** Get where a note commitment landed from the shielded index; false if it is unknown or the index is catching up. */
+bool GetCommitmentIndex(ShieldedType type, const uint256& commitment, CCommitmentIndexValue& value);
+/** Get the shielded data of the blocks from nStart to nEnd from the shielded index. */
+bool GetShieldedBlocks(int nStart, int nEnd, std::vector<CShieldedBlockDbEntry>& blocks);
+/** Get the compact blocks from nStart to nEnd from the shielded index. */
+bool GetCompactShieldedBlocks(int nStart, int nEnd, std::vector<CCompactShieldedBlock>& blocks);
+/** Get the deltas of a block for getblockdeltas, from the cache or computed from its block and undo data. */
+bool GetBlockDeltas(const CBlockIndex* pindex, std::shared_ptr<const CBlockDeltas>& deltas);
 
 /** Functions for disk access for blocks */
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/**
+ * Serialize a block for a block file, preceded by its index header (network
+ * magic and size) and compressed if fCompress is set. The size of the result is
+ * the space to reserve for it with FindBlockPos.
+ */
+std::shared_ptr<const CDataStream> SerializeBlockRecord(const CBlock& block, const CMessageHeader::MessageStartChars& messageStart, bool fCompress);
+/** Queue a block serialized by SerializeBlockRecord to be written at pos, and point pos past its index header. */
+bool WriteBlockToDisk(const std::shared_ptr<const CDataStream>& record, CDiskBlockPos& pos);
+/** Read the serialized form of the block stored at pos, without deserializing it. */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
+/** Queue undo data to be written at pos, and point pos past its index header. */
+bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart);
+/** Reserve nAddSize bytes for a block in the current block file, or at pos if fKnown. */
+bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false);
+/** Reserve nAddSize bytes for undo data in the undo file of block file nFile. */
+bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -521,6 +635,12 @@ extern CCoinsViewCache *pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** insightexplorer: the insight index database, if the indexes are enabled or were built before */
+extern CInsightIndexDB *pinsightdb;
+
+/** The shielded index database, if -shieldedindex is set */
+extern CShieldedIndexDB *pshieldedindexdb;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -7,34 +7,59 @@
 
 #include "hash.h"
 #include "consensus/consensus.h"
+#include "memusage.h"
 #include "utilstrencodings.h"
 
+#include <boost/foreach.hpp>
+
 using namespace std;
 
-CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
+CMerkleBlockData::CMerkleBlockData(const CBlock& block) : header(block.GetBlockHeader())
 {
-    header = block.GetBlockHeader();
-
-    vector<bool> vMatch;
     vector<uint256> vHashes;
-
-    vMatch.reserve(block.vtx.size());
     vHashes.reserve(block.vtx.size());
+    vTxElements.reserve(block.vtx.size());
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        vHashes.push_back(tx.GetHash());
+        vTxElements.push_back(CBloomTxElements(tx));
+    }
+    vLevels = CPartialMerkleTree::CalcMerkleLevels(vHashes);
+}
 
-    for (unsigned int i = 0; i < block.vtx.size(); i++)
+size_t CMerkleBlockData::DynamicMemoryUsage() const
+{
+    size_t nUsage = memusage::DynamicUsage(vLevels) + memusage::DynamicUsage(vTxElements);
+    BOOST_FOREACH(const vector<uint256>& vLevel, vLevels)
+        nUsage += memusage::DynamicUsage(vLevel);
+    BOOST_FOREACH(const CBloomTxElements& elements, vTxElements)
+        nUsage += elements.DynamicMemoryUsage();
+    return nUsage;
+}
+
+CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter) : CMerkleBlock(CMerkleBlockData(block), filter)
+{
+}
+
+CMerkleBlock::CMerkleBlock(const CMerkleBlockData& data, CBloomFilter& filter)
+{
+    header = data.header;
+
+    vector<bool> vMatch;
+    vMatch.reserve(data.vTxElements.size());
+
+    for (unsigned int i = 0; i < data.vTxElements.size(); i++)
     {
-        const uint256& hash = block.vtx[i].GetHash();
-        if (filter.IsRelevantAndUpdate(block.vtx[i]))
+        if (filter.IsRelevantAndUpdate(data.vTxElements[i]))
         {
             vMatch.push_back(true);
-            vMatchedTxn.push_back(make_pair(i, hash));
+            vMatchedTxn.push_back(make_pair(i, data.vTxElements[i].hash));
         }
         else
             vMatch.push_back(false);
-        vHashes.push_back(hash);
     }
 
-    txn = CPartialMerkleTree(vHashes, vMatch);
+    txn = CPartialMerkleTree(data.vLevels, vMatch);
 }
 
 CMerkleBlock::CMerkleBlock(const CBlock& block, const std::set<uint256>& txids)
@@ -60,24 +85,23 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, const std::set<uint256>& txids)
     txn = CPartialMerkleTree(vHashes, vMatch);
 }
 
-uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid) {
-    if (height == 0) {
-        // hash at height 0 is the txid itself
-        return vTxid[pos];
-    } else {
-        // calculate left hash
-        uint256 left = CalcHash(height-1, pos*2, vTxid), right;
-        // calculate right hash if not beyond the end of the array - copy left hash otherwise
-        if (pos*2+1 < CalcTreeWidth(height-1))
-            right = CalcHash(height-1, pos*2+1, vTxid);
-        else
-            right = left;
-        // combine subhashes
-        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+std::vector<std::vector<uint256> > CPartialMerkleTree::CalcMerkleLevels(const std::vector<uint256> &vTxid) {
+    std::vector<std::vector<uint256> > vLevels(1, vTxid);
+    while (vLevels.back().size() > 1) {
+        const std::vector<uint256> &vBelow = vLevels.back();
+        std::vector<uint256> vLevel((vBelow.size() + 1) / 2);
+        for (unsigned int pos = 0; pos < vLevel.size(); pos++) {
+            // the last node of a level with an odd width is paired with itself
+            const uint256 &left = vBelow[pos*2];
+            const uint256 &right = pos*2+1 < vBelow.size() ? vBelow[pos*2+1] : left;
+            vLevel[pos] = Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+        }
+        vLevels.push_back(vLevel);
     }
+    return vLevels;
 }
 
-void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) {
+void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<std::vector<uint256> > &vLevels, const std::vector<bool> &vMatch) {
     // determine whether this node is the parent of at least one matched txid
     bool fParentOfMatch = false;
     for (unsigned int p = pos << height; p < (pos+1) << height && p < nTransactions; p++)
@@ -86,12 +110,12 @@ void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const st
     vBits.push_back(fParentOfMatch);
     if (height==0 || !fParentOfMatch) {
         // if at height 0, or nothing interesting below, store hash and stop
-        vHash.push_back(CalcHash(height, pos, vTxid));
+        vHash.push_back(vLevels[height][pos]);
     } else {
         // otherwise, don't store any hash, but descend into the subtrees
-        TraverseAndBuild(height-1, pos*2, vTxid, vMatch);
+        TraverseAndBuild(height-1, pos*2, vLevels, vMatch);
         if (pos*2+1 < CalcTreeWidth(height-1))
-            TraverseAndBuild(height-1, pos*2+1, vTxid, vMatch);
+            TraverseAndBuild(height-1, pos*2+1, vLevels, vMatch);
     }
 }
 
@@ -132,6 +156,14 @@ uint256 CPartialMerkleTree::TraverseAndExtract(int height, unsigned int pos, uns
 }
 
 CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) : nTransactions(vTxid.size()), fBad(false) {
+    Build(CalcMerkleLevels(vTxid), vMatch);
+}
+
+CPartialMerkleTree::CPartialMerkleTree(const std::vector<std::vector<uint256> > &vLevels, const std::vector<bool> &vMatch) : nTransactions(vLevels[0].size()), fBad(false) {
+    Build(vLevels, vMatch);
+}
+
+void CPartialMerkleTree::Build(const std::vector<std::vector<uint256> > &vLevels, const std::vector<bool> &vMatch) {
     // reset state
     vBits.clear();
     vHash.clear();
@@ -142,7 +174,7 @@ CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vTxid, const
         nHeight++;
 
     // traverse the partial tree
-    TraverseAndBuild(nHeight, 0, vTxid, vMatch);
+    TraverseAndBuild(nHeight, 0, vLevels, vMatch);
 }
 
 CPartialMerkleTree::CPartialMerkleTree() : nTransactions(0), fBad(true) {}
@@ -67,11 +67,10 @@ protected:
         return (nTransactions+(1 << height)-1) >> height;
     }
 
-    /** calculate the hash of a node in the merkle tree (at leaf level: the txid itself) */
-    uint256 CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid);
-
     /** recursive function that traverses tree nodes, storing the data as bits and hashes */
-    void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
+    void TraverseAndBuild(int height, unsigned int pos, const std::vector<std::vector<uint256> > &vLevels, const std::vector<bool> &vMatch);
+
+    void Build(const std::vector<std::vector<uint256> > &vLevels, const std::vector<bool> &vMatch);
 
     /**
      * recursive function that traverses tree nodes, consuming the bits and hashes produced by TraverseAndBuild.
@@ -107,6 +106,15 @@ public:
     /** Construct a partial merkle tree from a list of transaction ids, and a mask that selects a subset of them */
     CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
 
+    /** Construct a partial merkle tree from all levels of the full tree, see CalcMerkleLevels */
+    CPartialMerkleTree(const std::vector<std::vector<uint256> > &vLevels, const std::vector<bool> &vMatch);
+
+    /**
+     * Calculate every level of the merkle tree of a list of transaction ids,
+     * from the txids themselves (level 0) up to the root.
+     */
+    static std::vector<std::vector<uint256> > CalcMerkleLevels(const std::vector<uint256> &vTxid);
+
     CPartialMerkleTree();
 
     /**
@@ -121,6 +129,25 @@ public:
  * Used to relay blocks as header + vector<merkle branch>
  * to filtered nodes.
  */
+/**
+ * Everything needed to build merkleblocks of a block for any bloom filter:
+ * the levels of its merkle tree and the elements of its transactions that
+ * filters are matched against. Computing these once per block spares
+ * rehashing the txids and the tree, and parsing every script, for each
+ * filtered peer that requests the block.
+ */
+class CMerkleBlockData
+{
+public:
+    CBlockHeader header;
+    std::vector<std::vector<uint256> > vLevels;
+    std::vector<CBloomTxElements> vTxElements;
+
+    CMerkleBlockData(const CBlock& block);
+
+    size_t DynamicMemoryUsage() const;
+};
+
 class CMerkleBlock
 {
 public:
@@ -138,6 +165,7 @@ public:
      * thus the filter will likely be modified.
      */
     CMerkleBlock(const CBlock& block, CBloomFilter& filter);
+    CMerkleBlock(const CMerkleBlockData& data, CBloomFilter& filter);
 
     // Create from a CBlock, matching the txids in the set
     CMerkleBlock(const CBlock& block, const std::set<uint256>& txids);
@@ -7,6 +7,7 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "main.h"
+#include "net.h"
 #include "timedata.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -232,6 +233,23 @@ int printStats(bool mining)
         std::cout << "           " << _("Block height") << " | " << height << std::endl;
     }
     std::cout << "            " << _("Connections") << " | " << connections << std::endl;
+
+    // The message types that took the most time to process
+    mapMsgTypeStats mapSend, mapRecv;
+    GetMessageTypeTotals(mapSend, mapRecv);
+    std::vector<std::pair<int64_t, std::string> > vTimes;
+    for (mapMsgTypeStats::const_iterator it = mapRecv.begin(); it != mapRecv.end(); ++it) {
+        if (it->second.nTimeMicros > 0)
+            vTimes.push_back(std::make_pair(it->second.nTimeMicros, it->first));
+    }
+    if (!vTimes.empty()) {
+        std::sort(vTimes.rbegin(), vTimes.rend());
+        std::string strTimes;
+        for (size_t i = 0; i < vTimes.size() && i < 3; i++)
+            strTimes += strprintf("%s%s %.1fs", i ? ", " : "", vTimes[i].second, vTimes[i].first / 1e6);
+        std::cout << "       " << _("Busiest messages") << " | " << strTimes << std::endl;
+        lines++;
+    }
     std::cout << "  " << _("Network solution rate") << " | " << netsolps << " Sol/s" << std::endl;
     if (mining && miningTimer.running()) {
         std::cout << "    " << _("Local solution rate") << " | " << strprintf("%.4f Sol/s", localsolps) << std::endl;
@@ -24,6 +24,11 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -95,7 +100,263 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
-static boost::condition_variable messageHandlerCondition;
+
+// Message handler work queues, high priority first. A node is in at most one
+// queue, and only one worker processes it at a time.
+enum { MESSAGE_QUEUE_PRIORITY, MESSAGE_QUEUE_NORMAL, MESSAGE_QUEUE_COUNT };
+static std::deque<CNode*> vMessageQueue[MESSAGE_QUEUE_COUNT];
+static boost::mutex mutexMessageQueue;
+static boost::condition_variable condMessageQueue;
+
+const std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
+
+// Processing time histograms per message type, see MESSAGE_TIME_HISTOGRAM_BUCKETS,
+// and the received message totals.
+static std::map<std::string, std::vector<uint64_t> > mapMessageTimes;
+static mapMsgTypeStats mapRecvTotals;
+static CCriticalSection cs_mapMessageTimes;
+
+// Sent message totals.
+static mapMsgTypeStats mapSendTotals;
+static CCriticalSection cs_mapSendTotals;
+
+#ifdef USE_EPOLL
+static const int MAX_EPOLL_EVENTS = 256;
+
+// The socket handler's epoll instance, and an eventfd registered with it that
+// other threads write to when they queue send data. Both stay -1 if they could
+// not be created, in which case ThreadSocketHandler uses select().
+static int hEpoll = -1;
+static int hEpollWakeup = -1;
+
+// Nodes whose queued send data the optimistic write in EndMessage did not flush.
+static set<CNode*> setNodesSendWakeup;
+static CCriticalSection cs_setNodesSendWakeup;
+
+// Nodes with pending readiness or work left over, only used by the socket handler thread.
+static set<CNode*> setNodesSocketReady;
+
+static bool InitSocketEvents()
+{
+    hEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (hEpoll == -1) {
+        LogPrintf("epoll_create1 failed: %s, using select()\n", NetworkErrorString(errno));
+        return false;
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &hEpollWakeup;
+    hEpollWakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (hEpollWakeup == -1 || epoll_ctl(hEpoll, EPOLL_CTL_ADD, hEpollWakeup, &event) != 0) {
+        LogPrintf("eventfd setup failed: %s, using select()\n", NetworkErrorString(errno));
+        if (hEpollWakeup != -1)
+            close(hEpollWakeup);
+        close(hEpoll);
+        hEpoll = hEpollWakeup = -1;
+        return false;
+    }
+
+    // Listening sockets stay level-triggered, AcceptConnection takes one
+    // connection per event.
+    BOOST_FOREACH(ListenSocket& hListenSocket, vhListenSocket) {
+        event.events = EPOLLIN;
+        event.data.ptr = &hListenSocket;
+        if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0)
+            LogPrintf("epoll_ctl failed for listening socket: %s\n", NetworkErrorString(errno));
+    }
+    return true;
+}
+
+static void ShutdownSocketEvents()
+{
+    if (hEpollWakeup != -1)
+        close(hEpollWakeup);
+    if (hEpoll != -1)
+        close(hEpoll);
+    hEpoll = hEpollWakeup = -1;
+}
+#endif
+
+/** Whether the socket handler can wait on hSocket. */
+static bool IsPollableSocket(SOCKET hSocket)
+{
+#ifdef USE_EPOLL
+    if (hEpoll != -1)
+        return true;
+#endif
+    return IsSelectableSocket(hSocket);
+}
+
+/** Register a new peer's socket with the socket handler (nothing to do with select()). */
+static void RegisterSocketEvents(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (hEpoll == -1)
+        return;
+    // Edge-triggered: the socket handler remembers readiness in
+    // fSocketReadable/fSocketWritable until recv or send would block.
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->id, NetworkErrorString(errno));
+        pnode->fDisconnect = true;
+    }
+#endif
+}
+
+static void DeregisterSocketEvents(SOCKET hSocket)
+{
+#ifdef USE_EPOLL
+    // Closing the socket is not enough when a forked child (e.g. -blocknotify)
+    // still holds a copy of it.
+    if (hEpoll != -1)
+        epoll_ctl(hEpoll, EPOLL_CTL_DEL, hSocket, NULL);
+#endif
+}
+
+bool IsPriorityMessageType(const std::string& strCommand)
+{
+    // Block propagation, ahead of everything else that may be waiting.
+    return strCommand == "block" || strCommand == "cmpctblock" || strCommand == "blocktxn" ||
+           strCommand == "getblocktxn" || strCommand == "headers";
+}
+
+/**
+ * Queue pnode for a message handler worker, unless it already is queued. If
+ * a worker is processing it, it is queued again when the worker is done.
+ * Called with mutexMessageQueue held.
+ */
+static void QueueNodeForMessageHandlerLocked(CNode* pnode, bool fPriority, bool fTrickle)
+{
+    pnode->fMessageTrickle |= fTrickle;
+    if (pnode->fMessageHandling) {
+        pnode->fMessageRequeue = true;
+        pnode->fMessagePriority |= fPriority;
+        return;
+    }
+
+    int nQueue = fPriority ? MESSAGE_QUEUE_PRIORITY : MESSAGE_QUEUE_NORMAL;
+    if (pnode->nMessageQueue != -1) {
+        if (pnode->nMessageQueue <= nQueue)
+            return;
+        // Move it up to the priority queue.
+        std::deque<CNode*>& queue = vMessageQueue[pnode->nMessageQueue];
+        queue.erase(std::find(queue.begin(), queue.end(), pnode));
+    }
+    vMessageQueue[nQueue].push_back(pnode);
+    pnode->nMessageQueue = nQueue;
+    condMessageQueue.notify_one();
+}
+
+static void QueueNodeForMessageHandler(CNode* pnode, bool fPriority, bool fTrickle = false)
+{
+    boost::lock_guard<boost::mutex> lock(mutexMessageQueue);
+    QueueNodeForMessageHandlerLocked(pnode, fPriority, fTrickle);
+}
+
+/** Take pnode out of the message handler queues before deleting it; fails while a worker is processing it. */
+static bool ReleaseNodeFromMessageHandler(CNode* pnode)
+{
+    boost::lock_guard<boost::mutex> lock(mutexMessageQueue);
+    if (pnode->fMessageHandling)
+        return false;
+    if (pnode->nMessageQueue != -1) {
+        std::deque<CNode*>& queue = vMessageQueue[pnode->nMessageQueue];
+        queue.erase(std::find(queue.begin(), queue.end(), pnode));
+        pnode->nMessageQueue = -1;
+    }
+    return true;
+}
+
+/** Add an entry for every known message type, so the map never grows afterwards. */
+static void InitMessageTypeStats(mapMsgTypeStats& mapStats)
+{
+    BOOST_FOREACH(const std::string& strType, getAllNetMessageTypes())
+        mapStats[strType];
+    mapStats[NET_MESSAGE_COMMAND_OTHER];
+}
+
+/** Find the entry strCommand is counted under in a map set up by InitMessageTypeStats. */
+static mapMsgTypeStats::iterator FindMessageTypeStats(mapMsgTypeStats& mapStats, const std::string& strCommand)
+{
+    mapMsgTypeStats::iterator it = mapStats.find(strCommand);
+    if (it == mapStats.end())
+        it = mapStats.find(NET_MESSAGE_COMMAND_OTHER);
+    return it;
+}
+
+static void RecordMessageProcessingTime(const std::string& strCommand, uint64_t nBytes, int64_t nMicros)
+{
+    int nBucket = 0;
+    while (nBucket < MESSAGE_TIME_HISTOGRAM_BUCKETS - 1 && nMicros >= (int64_t(1) << nBucket))
+        nBucket++;
+
+    LOCK(cs_mapMessageTimes);
+    if (mapRecvTotals.empty())
+        InitMessageTypeStats(mapRecvTotals);
+    // Only known message types get an entry of their own, so peers
+    // cannot make these maps grow.
+    mapMsgTypeStats::iterator itTotal = FindMessageTypeStats(mapRecvTotals, strCommand);
+    itTotal->second.nCount++;
+    itTotal->second.nBytes += nBytes;
+    itTotal->second.nTimeMicros += nMicros;
+
+    std::map<std::string, std::vector<uint64_t> >::iterator it = mapMessageTimes.find(itTotal->first);
+    if (it == mapMessageTimes.end())
+        it = mapMessageTimes.insert(std::make_pair(itTotal->first, std::vector<uint64_t>(MESSAGE_TIME_HISTOGRAM_BUCKETS))).first;
+    it->second[nBucket]++;
+}
+
+static void RecordMessageSent(const std::string& strCommand, uint64_t nBytes)
+{
+    LOCK(cs_mapSendTotals);
+    if (mapSendTotals.empty())
+        InitMessageTypeStats(mapSendTotals);
+    mapMsgTypeStats::iterator it = FindMessageTypeStats(mapSendTotals, strCommand);
+    it->second.nCount++;
+    it->second.nBytes += nBytes;
+}
+
+std::map<std::string, std::vector<uint64_t> > GetMessageProcessingTimes()
+{
+    LOCK(cs_mapMessageTimes);
+    return mapMessageTimes;
+}
+
+void GetMessageTypeTotals(mapMsgTypeStats& mapSend, mapMsgTypeStats& mapRecv)
+{
+    {
+        LOCK(cs_mapSendTotals);
+        mapSend = mapSendTotals;
+    }
+    {
+        LOCK(cs_mapMessageTimes);
+        mapRecv = mapRecvTotals;
+    }
+}
+
+/** Wake the socket handler to flush the data queued on pnode. */
+static void WakeSocketHandler(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (hEpollWakeup == -1)
+        return;
+    bool fSignal;
+    {
+        LOCK(cs_setNodesSendWakeup);
+        fSignal = setNodesSendWakeup.empty();
+        setNodesSendWakeup.insert(pnode);
+    }
+    // A non-empty set means a wakeup is already pending.
+    if (fSignal) {
+        uint64_t nSignal = 1;
+        if (write(hEpollWakeup, &nSignal, sizeof(nSignal)) != sizeof(nSignal))
+            LogPrint("net", "eventfd write failed: %s\n", NetworkErrorString(errno));
+    }
+#endif
+}
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -390,6 +651,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
         // Add node
         CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
         pnode->AddRef();
+        RegisterSocketEvents(pnode);
 
         {
             LOCK(cs_vNodes);
@@ -414,6 +676,7 @@ void CNode::CloseSocketDisconnect()
     if (hSocket != INVALID_SOCKET)
     {
         LogPrint("net", "disconnecting peer=%d\n", id);
+        DeregisterSocketEvents(hSocket);
         CloseSocket(hSocket);
     }
 
@@ -552,6 +815,15 @@ void CNode::copyStats(CNodeStats &stats)
     stats.nSendBytes = nSendBytes;
     stats.nRecvBytes = nRecvBytes;
     stats.fWhitelisted = fWhitelisted;
+    {
+        LOCK(cs_inventory);
+        stats.fTxReconciliation = txrecon.fEnabled;
+    }
+    {
+        LOCK(cs_mapPerMsgType);
+        stats.mapSendPerMsgType = mapSendPerMsgType;
+        stats.mapRecvPerMsgType = mapRecvPerMsgType;
+    }
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -580,7 +852,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, nRecvVersion));
+            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), &recvChunkPool, SER_NETWORK, nRecvVersion));
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -604,7 +876,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            QueueNodeForMessageHandler(this, IsPriorityMessageType(vRecvMsg.front().hdr.GetCommand()));
         }
     }
 
@@ -638,6 +910,7 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 
     // switch state to reading message data
     in_data = true;
+    vRecv.Reserve(hdr.nMessageSize);
 
     return nCopy;
 }
@@ -647,17 +920,127 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
-
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    vRecv.Append(pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+void CRecvChunkPool::Get(CRecvChunk& chunk)
+{
+    if (vFree.empty()) {
+        chunk.resize(RECV_CHUNK_SIZE);
+    } else {
+        chunk.swap(vFree.back());
+        vFree.pop_back();
+    }
+}
+
+void CRecvChunkPool::Put(CRecvChunk& chunk)
+{
+    if (vFree.size() < MAX_RECV_POOL_CHUNKS) {
+        vFree.push_back(CRecvChunk());
+        vFree.back().swap(chunk);
+    }
+    CRecvChunk().swap(chunk);
+}
+
+CRecvDataStream::CRecvDataStream(CRecvDataStream&& other) :
+    pool(other.pool), vChunks(std::move(other.vChunks)), nDataSize(other.nDataSize), nReadPos(other.nReadPos),
+    nType(other.nType), nVersion(other.nVersion)
+{
+    other.vChunks.clear();
+    other.nDataSize = other.nReadPos = 0;
+}
+
+CRecvDataStream& CRecvDataStream::operator=(CRecvDataStream&& other)
+{
+    if (this != &other) {
+        ReleaseChunks();
+        pool = other.pool;
+        vChunks = std::move(other.vChunks);
+        nDataSize = other.nDataSize;
+        nReadPos = other.nReadPos;
+        nType = other.nType;
+        nVersion = other.nVersion;
+        other.vChunks.clear();
+        other.nDataSize = other.nReadPos = 0;
+    }
+    return *this;
+}
+
+void CRecvDataStream::ReleaseChunks()
+{
+    BOOST_FOREACH(CRecvChunk& chunk, vChunks)
+        pool->Put(chunk);
+    vChunks.clear();
+    nDataSize = nReadPos = 0;
+}
+
+void CRecvDataStream::Reserve(unsigned int nMessageSize)
+{
+    // Only the chunk list is sized up front; the chunks themselves are taken
+    // from the pool as data arrives, so a peer announcing a large message
+    // and not sending it does not make us allocate the whole payload.
+    vChunks.reserve((nMessageSize + RECV_CHUNK_SIZE - 1) / RECV_CHUNK_SIZE);
+}
+
+void CRecvDataStream::Append(const char* pch, unsigned int nBytes)
+{
+    while (nBytes > 0) {
+        unsigned int nOffset = nDataSize % RECV_CHUNK_SIZE;
+        if (nOffset == 0 && nDataSize / RECV_CHUNK_SIZE == vChunks.size()) {
+            vChunks.push_back(CRecvChunk());
+            pool->Get(vChunks.back());
+        }
+        unsigned int nCopy = std::min(nBytes, RECV_CHUNK_SIZE - nOffset);
+        memcpy(&vChunks[nDataSize / RECV_CHUNK_SIZE][nOffset], pch, nCopy);
+        pch += nCopy;
+        nBytes -= nCopy;
+        nDataSize += nCopy;
+    }
+}
+
+uint256 CRecvDataStream::GetHash() const
+{
+    CHash256 hasher;
+    for (unsigned int nPos = 0; nPos < nDataSize; nPos += RECV_CHUNK_SIZE)
+        hasher.Write((const unsigned char*)&vChunks[nPos / RECV_CHUNK_SIZE][0], std::min(RECV_CHUNK_SIZE, nDataSize - nPos));
+    uint256 hash;
+    hasher.Finalize((unsigned char*)&hash);
+    return hash;
+}
+
+void CRecvDataStream::read(char* pch, size_t nSize)
+{
+    if (nSize == 0) return;
+
+    if (pch == nullptr) {
+        throw std::ios_base::failure("CRecvDataStream::read(): cannot read from null pointer");
+    }
+    if (nSize > size())
+        throw std::ios_base::failure("CRecvDataStream::read(): end of data");
+
+    while (nSize > 0) {
+        unsigned int nOffset = nReadPos % RECV_CHUNK_SIZE;
+        size_t nCopy = std::min(nSize, (size_t)(RECV_CHUNK_SIZE - nOffset));
+        memcpy(pch, &vChunks[nReadPos / RECV_CHUNK_SIZE][nOffset], nCopy);
+        pch += nCopy;
+        nSize -= nCopy;
+        nReadPos += nCopy;
+    }
+}
+
+void CRecvDataStream::ignore(int nSize)
+{
+    if (nSize < 0) {
+        throw std::ios_base::failure("CRecvDataStream::ignore(): nSize negative");
+    }
+    if ((size_t)nSize > size())
+        throw std::ios_base::failure("CRecvDataStream::ignore(): end of data");
+    nReadPos += nSize;
+}
+
 
 
 
@@ -926,7 +1309,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!IsPollableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -962,6 +1345,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     CNode* pnode = new CNode(hSocket, addr, "", true);
     pnode->AddRef();
     pnode->fWhitelisted = whitelisted;
+    RegisterSocketEvents(pnode);
 
     LogPrint("net", "connection from %s accepted\n", addr.ToString());
 
@@ -971,73 +1355,307 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
-void ThreadSocketHandler()
+static void DisconnectNodes(unsigned int& nPrevNodeCount)
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true)
     {
-        //
-        // Disconnect nodes
-        //
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
             {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
-                {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
         {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0)
             {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0)
+                bool fDelete = false;
                 {
-                    bool fDelete = false;
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
                     {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend)
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv)
                         {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv)
-                            {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete)
+                }
+                if (fDelete && ReleaseNodeFromMessageHandler(pnode))
+                {
+                    vNodesDisconnected.remove(pnode);
+#ifdef USE_EPOLL
+                    {
+                        LOCK(cs_setNodesSendWakeup);
+                        setNodesSendWakeup.erase(pnode);
+                    }
+                    setNodesSocketReady.erase(pnode);
+#endif
+                    delete pnode;
+                }
+            }
+        }
+    }
+    if(vNodes.size() != nPrevNodeCount) {
+        nPrevNodeCount = vNodes.size();
+        uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+// requires LOCK(cs_vRecvMsg)
+static bool ReceiveBufferHasRoom(CNode* pnode)
+{
+    return pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+           pnode->GetTotalRecvSize() <= ReceiveFloodSize();
+}
+
+// requires LOCK(cs_vRecvMsg)
+// Returns whether more data may be waiting on the socket.
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return true;
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+        else if (nErr == WSAEINTR)
+            return true;
+    }
+    return false;
+}
+
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+static void ThreadSocketHandlerEpoll()
+{
+    unsigned int nPrevNodeCount = 0;
+    int64_t nLastInactivityCheck = 0;
+    bool fProgress = false;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    while (true)
+    {
+        DisconnectNodes(nPrevNodeCount);
+
+        //
+        // Wait for readiness changes. Sockets are registered once, so this does
+        // not depend on the number of peers; the timeout only bounds how long
+        // disconnects and peers with a full receive buffer wait to be looked at.
+        //
+        int nEvents = epoll_wait(hEpoll, events, MAX_EPOLL_EVENTS, fProgress ? 0 : 50);
+        boost::this_thread::interruption_point();
+        if (nEvents < 0)
+        {
+            if (errno != EINTR)
+            {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+                MilliSleep(50);
+            }
+            nEvents = 0;
+        }
+
+        for (int i = 0; i < nEvents; i++)
+        {
+            void* ptr = events[i].data.ptr;
+            if (ptr == &hEpollWakeup)
+            {
+                // Reading resets the counter; drain it before taking the set
+                // so a wakeup signalled after this point is not lost.
+                uint64_t nSignals;
+                if (read(hEpollWakeup, &nSignals, sizeof(nSignals)) != sizeof(nSignals))
+                    LogPrint("net", "eventfd read failed: %s\n", NetworkErrorString(errno));
+                set<CNode*> setWakeup;
+                {
+                    LOCK(cs_setNodesSendWakeup);
+                    setWakeup.swap(setNodesSendWakeup);
+                }
+                setNodesSocketReady.insert(setWakeup.begin(), setWakeup.end());
+                continue;
+            }
+
+            //
+            // Accept new connections
+            //
+            bool fListenSocket = false;
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+            {
+                if (ptr == &hListenSocket)
+                {
+                    AcceptConnection(hListenSocket);
+                    fListenSocket = true;
+                    break;
+                }
+            }
+            if (fListenSocket)
+                continue;
+
+            CNode* pnode = (CNode*)ptr;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                pnode->fSocketReadable = true;
+            if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+                pnode->fSocketWritable = true;
+            setNodesSocketReady.insert(pnode);
+        }
+
+        //
+        // Service the sockets that are ready
+        //
+        vector<CNode*> vNodesReady(setNodesSocketReady.begin(), setNodesSocketReady.end());
+        setNodesSocketReady.clear();
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodesReady)
+                pnode->AddRef();
+        }
+        fProgress = false;
+        BOOST_FOREACH(CNode* pnode, vNodesReady)
+        {
+            boost::this_thread::interruption_point();
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+
+            // As with select(), drain the write buffer before receiving more,
+            // so TCP flow control reaches a peer that is not reading from us.
+            bool fSendBlocked = false;
+            bool fRetry = false;
+            if (pnode->fSocketWritable)
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (!lockSend)
+                    fRetry = true;
+                else if (!pnode->vSendMsg.empty())
+                {
+                    SocketSendData(pnode);
+                    fProgress = true;
+                    if (!pnode->vSendMsg.empty())
                     {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
+                        // The kernel buffer is full; EPOLLOUT reports when it drains.
+                        pnode->fSocketWritable = false;
+                        fSendBlocked = true;
                     }
                 }
             }
+            else
+                fSendBlocked = true;
+
+            if (pnode->hSocket != INVALID_SOCKET && pnode->fSocketReadable && !fSendBlocked)
+            {
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (!lockRecv || !ReceiveBufferHasRoom(pnode))
+                    fRetry = true;
+                else if (SocketRecvData(pnode))
+                    fProgress = true;
+                else
+                    pnode->fSocketReadable = false;
+            }
+
+            // Read one buffer per peer per round, and come back for the rest.
+            if (pnode->hSocket != INVALID_SOCKET && (fRetry || (pnode->fSocketReadable && !fSendBlocked)))
+                setNodesSocketReady.insert(pnode);
+        }
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodesReady)
+                pnode->Release();
         }
-        if(vNodes.size() != nPrevNodeCount) {
-            nPrevNodeCount = vNodes.size();
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+
+        //
+        // Inactivity checking
+        //
+        int64_t nTime = GetTime();
+        if (nTime != nLastInactivityCheck)
+        {
+            nLastInactivityCheck = nTime;
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes)
+                InactivityCheck(pnode);
         }
+    }
+}
+#endif
+
+static void ThreadSocketHandlerSelect()
+{
+    unsigned int nPrevNodeCount = 0;
+    while (true)
+    {
+        //
+        // Disconnect nodes
+        //
+        DisconnectNodes(nPrevNodeCount);
 
         //
         // Find which sockets have data to receive
@@ -1095,9 +1713,7 @@ void ThreadSocketHandler()
                 }
                 {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    if (lockRecv && ReceiveBufferHasRoom(pnode))
                         FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
@@ -1155,39 +1771,7 @@ void ThreadSocketHandler()
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+                    SocketRecvData(pnode);
             }
 
             //
@@ -1205,30 +1789,7 @@ void ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1238,6 +1799,16 @@ void ThreadSocketHandler()
     }
 }
 
+void ThreadSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (hEpoll != -1) {
+        ThreadSocketHandlerEpoll();
+        return;
+    }
+#endif
+    ThreadSocketHandlerSelect();
+}
 
 void ThreadDNSAddressSeed()
 {
@@ -1522,71 +2093,118 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void ThreadMessageHandler()
+/**
+ * Process the next message of pnode and send it whatever SendMessages has
+ * for it. Returns whether the node has more messages ready, and whether the
+ * next one is a priority message.
+ */
+static bool HandleNodeMessages(CNode* pnode, bool fTrickle, bool& fPriority)
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
+    bool fMore = false;
+    fPriority = false;
 
-    SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
-    while (true)
+    // Receive messages
     {
-        vector<CNode*> vNodesCopy;
+        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+        if (lockRecv)
         {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) {
-                pnode->AddRef();
+            if (!g_signals.ProcessMessages(pnode))
+                pnode->CloseSocketDisconnect();
+
+            if (pnode->nSendSize < SendBufferSize())
+            {
+                if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                {
+                    fMore = true;
+                    fPriority = pnode->vRecvGetData.empty() && IsPriorityMessageType(pnode->vRecvMsg[0].hdr.GetCommand());
+                }
             }
         }
+        else
+        {
+            // The socket handler is appending to the buffer; try again shortly.
+            fMore = true;
+        }
+    }
+    boost::this_thread::interruption_point();
 
-        // Poll the connected nodes for messages
-        CNode* pnodeTrickle = NULL;
-        if (!vNodesCopy.empty())
-            pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
+    // Send messages
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (lockSend)
+            g_signals.SendMessages(pnode, fTrickle || pnode->fWhitelisted);
+    }
+    boost::this_thread::interruption_point();
 
-        bool fSleep = true;
+    return fMore;
+}
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+static void ThreadMessageHandlerWorker()
+{
+    SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
+    while (true)
+    {
+        CNode* pnode = NULL;
+        bool fTrickle;
         {
-            if (pnode->fDisconnect)
-                continue;
-
-            // Receive messages
-            {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
-                {
-                    if (!g_signals.ProcessMessages(pnode))
-                        pnode->CloseSocketDisconnect();
+            boost::unique_lock<boost::mutex> lock(mutexMessageQueue);
+            while (vMessageQueue[MESSAGE_QUEUE_PRIORITY].empty() && vMessageQueue[MESSAGE_QUEUE_NORMAL].empty())
+                condMessageQueue.wait(lock);
+            std::deque<CNode*>& queue = vMessageQueue[vMessageQueue[MESSAGE_QUEUE_PRIORITY].empty() ? MESSAGE_QUEUE_NORMAL : MESSAGE_QUEUE_PRIORITY];
+            pnode = queue.front();
+            queue.pop_front();
+            pnode->nMessageQueue = -1;
+            pnode->fMessageHandling = true;
+            fTrickle = pnode->fMessageTrickle;
+            pnode->fMessageTrickle = false;
+        }
 
-                    if (pnode->nSendSize < SendBufferSize())
-                    {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
-                        {
-                            fSleep = false;
-                        }
-                    }
-                }
-            }
-            boost::this_thread::interruption_point();
+        bool fPriority = false;
+        bool fMore = false;
+        try {
+            if (!pnode->fDisconnect)
+                fMore = HandleNodeMessages(pnode, fTrickle, fPriority);
+        } catch (...) {
+            boost::lock_guard<boost::mutex> lock(mutexMessageQueue);
+            pnode->fMessageHandling = false;
+            throw;
+        }
 
-            // Send messages
-            {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    g_signals.SendMessages(pnode, pnode == pnodeTrickle || pnode->fWhitelisted);
-            }
-            boost::this_thread::interruption_point();
+        {
+            // Requeue the node in the same critical section that clears
+            // fMessageHandling: once it is cleared, DisconnectNodes may
+            // delete the node, as workers hold no reference to it.
+            boost::lock_guard<boost::mutex> lock(mutexMessageQueue);
+            pnode->fMessageHandling = false;
+            fMore |= pnode->fMessageRequeue;
+            fPriority |= pnode->fMessagePriority;
+            pnode->fMessageRequeue = false;
+            pnode->fMessagePriority = false;
+            if (fMore && !pnode->fDisconnect)
+                QueueNodeForMessageHandlerLocked(pnode, fPriority, false);
         }
+    }
+}
 
+void ThreadMessageHandler()
+{
+    // Messages are processed by the worker threads as they arrive. This
+    // thread queues every node regularly, so that SendMessages gets to run for
+    // idle peers too, and one random node per round gets to trickle.
+    while (true)
+    {
         {
             LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->Release();
+            CNode* pnodeTrickle = NULL;
+            if (!vNodes.empty())
+                pnodeTrickle = vNodes[GetRand(vNodes.size())];
+            BOOST_FOREACH(CNode* pnode, vNodes)
+            {
+                if (!pnode->fDisconnect)
+                    QueueNodeForMessageHandler(pnode, false, pnode == pnodeTrickle);
+            }
         }
-
-        if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        MilliSleep(100);
     }
 }
 
@@ -1769,6 +2387,10 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     Discover(threadGroup);
 
+#ifdef USE_EPOLL
+    InitSocketEvents();
+#endif
+
     //
     // Start threads
     //
@@ -1789,6 +2411,9 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // Process messages
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    int nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS), MAX_MESSAGE_HANDLER_THREADS));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msgwork", &ThreadMessageHandlerWorker));
 
     // Dump network addresses
     scheduler.scheduleEvery(&DumpAddresses, DUMP_ADDRESSES_INTERVAL);
@@ -1834,6 +2459,9 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef USE_EPOLL
+        ShutdownSocketEvents();
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -1892,6 +2520,18 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
     }
 }
 
+void CNode::RecordMessageRecv(const std::string& strCommand, uint64_t nBytes, int64_t nTimeMicros)
+{
+    {
+        LOCK(cs_mapPerMsgType);
+        mapMsgTypeStats::iterator it = FindMessageTypeStats(mapRecvPerMsgType, strCommand);
+        it->second.nCount++;
+        it->second.nBytes += nBytes;
+        it->second.nTimeMicros += nTimeMicros;
+    }
+    RecordMessageProcessingTime(strCommand, nBytes, nTimeMicros);
+}
+
 void CNode::RecordBytesRecv(uint64_t bytes)
 {
     LOCK(cs_totalBytesRecv);
@@ -2083,10 +2723,22 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    fSocketReadable = false;
+    fSocketWritable = false;
+    nMessageQueue = -1;
+    fMessageHandling = false;
+    fMessageRequeue = false;
+    fMessagePriority = false;
+    fMessageTrickle = false;
+    InitMessageTypeStats(mapSendPerMsgType);
+    InitMessageTypeStats(mapRecvPerMsgType);
+    itSendMsgType = mapSendPerMsgType.end();
     hashContinue = uint256();
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
+    fProvidesHeaderAndIDs = false;
+    fPreferHeaderAndIDs = false;
     fSentAddr = false;
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
@@ -2116,6 +2768,12 @@ CNode::~CNode()
 {
     CloseSocket(hSocket);
 
+    // Nodes that never went through DisconnectNodes (e.g. in tests) may
+    // still be waiting in a message handler queue. No worker may be
+    // processing a node that is being deleted.
+    bool fReleased = ReleaseNodeFromMessageHandler(this);
+    assert(fReleased);
+
     if (pfilter)
         delete pfilter;
 
@@ -2161,6 +2819,7 @@ void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSen
     ENTER_CRITICAL_SECTION(cs_vSend);
     assert(ssSend.size() == 0);
     ssSend << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+    itSendMsgType = FindMessageTypeStats(mapSendPerMsgType, pszCommand);
     LogPrint("net", "sending: %s ", SanitizeString(pszCommand));
 }
 
@@ -2192,19 +2851,37 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         LEAVE_CRITICAL_SECTION(cs_vSend);
         return;
     }
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
 
     // Set the checksum
     uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
     unsigned int nChecksum = 0;
     memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    EndMessage(nChecksum);
+}
+
+void CNode::EndMessage(unsigned int nChecksum) UNLOCK_FUNCTION(cs_vSend)
+{
+    if (ssSend.size() == 0)
+    {
+        LEAVE_CRITICAL_SECTION(cs_vSend);
+        return;
+    }
+    // Set the size
+    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
+    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+
     assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
     memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
+    {
+        LOCK(cs_mapPerMsgType);
+        itSendMsgType->second.nCount++;
+        itSendMsgType->second.nBytes += ssSend.size();
+    }
+    RecordMessageSent(itSendMsgType->first, ssSend.size());
+
     std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
     ssSend.GetAndClear(*it);
     nSendSize += (*it).size();
@@ -2212,6 +2889,8 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     // If write queue empty, attempt "optimistic write"
     if (it == vSendMsg.begin())
         SocketSendData(this);
+    if (!vSendMsg.empty())
+        WakeSocketHandler(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
@@ -16,6 +16,7 @@
 #include "random.h"
 #include "streams.h"
 #include "sync.h"
+#include "txreconciliation.h"
 #include "uint256.h"
 #include "utilstrencodings.h"
 
@@ -49,6 +50,15 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 2 MiB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 2 * 1024 * 1024;
+/** Size of the blocks incoming message payloads are received into. */
+static const unsigned int RECV_CHUNK_SIZE = 256 * 1024;
+/** Number of free receive chunks each peer keeps for reuse. */
+static const unsigned int MAX_RECV_POOL_CHUNKS = MAX_PROTOCOL_MESSAGE_LENGTH / RECV_CHUNK_SIZE;
+/** Default number of message handler worker threads (-msghandlerthreads) */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 2;
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
+/** Number of buckets of the message processing time histograms; bucket i counts messages that took less than 2^i microseconds. */
+static const int MESSAGE_TIME_HISTOGRAM_BUCKETS = 24;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** -listen default */
@@ -78,6 +88,27 @@ bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+/** Whether messages of this type are processed ahead of transaction and address gossip. */
+bool IsPriorityMessageType(const std::string& strCommand);
+/** Per message type histogram of processing times, see MESSAGE_TIME_HISTOGRAM_BUCKETS. */
+std::map<std::string, std::vector<uint64_t> > GetMessageProcessingTimes();
+
+/** Message type that traffic of commands not in getAllNetMessageTypes() is counted under. */
+extern const std::string NET_MESSAGE_COMMAND_OTHER;
+
+/** Number, size and processing time of the messages of one type. */
+struct CMessageTypeStats
+{
+    uint64_t nCount;
+    uint64_t nBytes;      // including the message header
+    int64_t nTimeMicros;  // spent processing them, received messages only
+
+    CMessageTypeStats() : nCount(0), nBytes(0), nTimeMicros(0) {}
+};
+typedef std::map<std::string, CMessageTypeStats> mapMsgTypeStats;
+
+/** Sent and received messages per type, over all peers since startup. */
+void GetMessageTypeTotals(mapMsgTypeStats& mapSend, mapMsgTypeStats& mapRecv);
 
 typedef int NodeId;
 
@@ -189,11 +220,88 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    bool fTxReconciliation;
+    mapMsgTypeStats mapSendPerMsgType;
+    mapMsgTypeStats mapRecvPerMsgType;
 };
 
 
 
 
+typedef std::vector<char> CRecvChunk;
+
+/**
+ * Free receive chunks of one peer. Payloads are received into chunks taken
+ * from here and handed back once the message has been processed, so that
+ * large messages do not reallocate (and wipe) their buffer every time.
+ * Requires LOCK(cs_vRecvMsg) of the owning node.
+ */
+class CRecvChunkPool
+{
+private:
+    std::vector<CRecvChunk> vFree;
+
+public:
+    void Get(CRecvChunk& chunk);
+    void Put(CRecvChunk& chunk);
+    size_t size() const { return vFree.size(); }
+};
+
+/**
+ * A message payload, received into a list of RECV_CHUNK_SIZE chunks and
+ * deserialized from them in place.
+ */
+class CRecvDataStream
+{
+private:
+    CRecvChunkPool* pool;
+    std::vector<CRecvChunk> vChunks;
+    unsigned int nDataSize;
+    unsigned int nReadPos;
+
+    int nType;
+    int nVersion;
+
+    void ReleaseChunks();
+
+public:
+    CRecvDataStream(CRecvChunkPool* poolIn, int nTypeIn, int nVersionIn) :
+        pool(poolIn), nDataSize(0), nReadPos(0), nType(nTypeIn), nVersion(nVersionIn) {}
+    CRecvDataStream(CRecvDataStream&& other);
+    CRecvDataStream& operator=(CRecvDataStream&& other);
+    ~CRecvDataStream() { ReleaseChunks(); }
+
+    /** Reserve room for the chunk list of an nMessageSize byte payload. */
+    void Reserve(unsigned int nMessageSize);
+    void Append(const char* pch, unsigned int nBytes);
+    /** Double-SHA256 of the whole payload, as used for the message checksum. */
+    uint256 GetHash() const;
+
+    //
+    // Stream subset
+    //
+    size_t size() const          { return nDataSize - nReadPos; }
+    bool empty() const           { return nDataSize == nReadPos; }
+    bool eof() const             { return size() == 0; }
+    int in_avail() const         { return size(); }
+
+    void SetType(int n)          { nType = n; }
+    int GetType() const          { return nType; }
+    void SetVersion(int n)       { nVersion = n; }
+    int GetVersion() const       { return nVersion; }
+
+    void read(char* pch, size_t nSize);
+    void ignore(int nSize);
+
+    template<typename T>
+    CRecvDataStream& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
 class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
@@ -202,12 +310,12 @@ public:
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CRecvDataStream vRecv;          // received message data
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, CRecvChunkPool* pool, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(pool, nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
@@ -251,10 +359,30 @@ public:
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
+    CRecvChunkPool recvChunkPool; // must outlive vRecvMsg
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
     int nRecvVersion;
+    // Edge-triggered readiness of hSocket as last reported by epoll. Only
+    // used by the socket handler thread.
+    bool fSocketReadable;
+    bool fSocketWritable;
+    // Message handler scheduling state, protected by the message handler queue lock.
+    int nMessageQueue;       // queue the node is waiting in, or -1
+    bool fMessageHandling;   // a worker is processing the node
+    bool fMessageRequeue;    // more work arrived while a worker was processing it
+    bool fMessagePriority;   // that work included priority messages
+    bool fMessageTrickle;    // the next SendMessages call may trickle
+
+    // Traffic per message type. The maps hold an entry for every known type
+    // and NET_MESSAGE_COMMAND_OTHER from construction on, so lookups never
+    // insert and itSendMsgType (the message being built, under cs_vSend)
+    // stays valid.
+    mapMsgTypeStats mapSendPerMsgType;
+    mapMsgTypeStats mapRecvPerMsgType;
+    mapMsgTypeStats::iterator itSendMsgType;
+    CCriticalSection cs_mapPerMsgType;
 
     int64_t nLastSend;
     int64_t nLastRecv;
@@ -281,6 +409,10 @@ public:
     // b) the peer may tell us in its version message that we should not relay tx invs
     //    until it has initialized its bloom filter.
     bool fRelayTxes;
+    // Whether the peer sent "sendcmpct", and whether it asked us to announce
+    // new blocks by pushing a "cmpctblock" instead of an inv.
+    bool fProvidesHeaderAndIDs;
+    bool fPreferHeaderAndIDs;
     bool fSentAddr;
     CSemaphoreGrant grantOutbound;
     CCriticalSection cs_filter;
@@ -309,8 +441,9 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    CCriticalSection cs_vAddrToSend;
     bool fGetAddr;
-    std::set<uint256> setKnown;
+    std::set<uint256> setKnown; // protected by cs_inventory
 
     // inventory based relay
     mruset<CInv> setInventoryKnown;
@@ -318,6 +451,8 @@ public:
     CCriticalSection cs_inventory;
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
+    // transactions announced through set reconciliation, guarded by cs_inventory
+    CTxReconciliationState txrecon;
 
     // Ping time measurement:
     // The pong reply we're expecting, or 0 if no pong expected.
@@ -361,7 +496,7 @@ public:
     {
         unsigned int total = 0;
         BOOST_FOREACH(const CNetMessage &msg, vRecvMsg)
-            total += msg.vRecv.size() + 24;
+            total += msg.nDataPos + 24;
         return total;
     }
 
@@ -391,6 +526,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
@@ -399,6 +535,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -414,6 +551,8 @@ public:
         {
             LOCK(cs_inventory);
             setInventoryKnown.insert(inv);
+            if (inv.type == MSG_TX && txrecon.fEnabled)
+                txrecon.RemoveTx(inv.hash);
         }
     }
 
@@ -421,8 +560,13 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
-                vInventoryToSend.push_back(inv);
+            if (setInventoryKnown.count(inv))
+                return;
+            // Reconciling peers learn about transactions from sketches; fall
+            // back to an inv if the transaction cannot be added to the set.
+            if (inv.type == MSG_TX && txrecon.fEnabled && txrecon.AddTx(inv.hash))
+                return;
+            vInventoryToSend.push_back(inv);
         }
     }
 
@@ -437,8 +581,27 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    // Like EndMessage(), for a payload whose checksum was computed beforehand.
+    void EndMessage(unsigned int nChecksum) UNLOCK_FUNCTION(cs_vSend);
+
     void PushVersion();
 
+    /** Push a payload that is already serialized, with its precomputed message checksum. */
+    void PushRawMessage(const char* pszCommand, const std::vector<unsigned char>& vPayload, unsigned int nChecksum)
+    {
+        try
+        {
+            BeginMessage(pszCommand);
+            ssSend.write((const char*)begin_ptr(vPayload), vPayload.size());
+            EndMessage(nChecksum);
+        }
+        catch (...)
+        {
+            AbortMessage();
+            throw;
+        }
+    }
+
 
     void PushMessage(const char* pszCommand)
     {
@@ -629,6 +792,9 @@ public:
     static void AddWhitelistedRange(const CSubNet &subnet);
 
     // Network stats
+    /** Account for a received message and the time it took to process it. */
+    void RecordMessageRecv(const std::string& strCommand, uint64_t nBytes, int64_t nTimeMicros);
+
     static void RecordBytesRecv(uint64_t bytes);
     static void RecordBytesSent(uint64_t bytes);
 
@@ -440,6 +440,12 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
     SOCKET hSocket = socket(((struct sockaddr*)&sockaddr)->sa_family, SOCK_STREAM, IPPROTO_TCP);
     if (hSocket == INVALID_SOCKET)
         return false;
+    // The connection is waited for with select() below.
+    if (!IsSelectableSocket(hSocket)) {
+        LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
+        CloseSocket(hSocket);
+        return false;
+    }
 
     int set = 1;
 #ifdef SO_NOSIGPIPE
@@ -17,9 +17,20 @@ static const char* ppszTypeName[] =
     "ERROR",
     "tx",
     "block",
-    "filtered block"
+    "filtered block",
+    "compact block"
 };
 
+/** All message types this node understands, in no particular order. */
+static const char* allNetMessageTypes[] = {
+    "version", "verack", "addr", "inv", "getdata", "merkleblock", "getblocks",
+    "getheaders", "tx", "headers", "block", "getaddr", "mempool", "ping", "pong",
+    "alert", "notfound", "filterload", "filteradd", "filterclear", "reject",
+    "sendcmpct", "cmpctblock", "getblocktxn", "blocktxn",
+    "sendrecon", "reqrecon", "sketch", "reconcildiff"
+};
+static const std::vector<std::string> allNetMessageTypesVec(allNetMessageTypes, allNetMessageTypes+ARRAYLEN(allNetMessageTypes));
+
 CMessageHeader::CMessageHeader(const MessageStartChars& pchMessageStartIn)
 {
     memcpy(pchMessageStart, pchMessageStartIn, MESSAGE_START_SIZE);
@@ -140,3 +151,8 @@ std::string CInv::ToString() const
 {
     return strprintf("%s %s", GetCommand(), hash.ToString());
 }
+
+const std::vector<std::string> &getAllNetMessageTypes()
+{
+    return allNetMessageTypesVec;
+}
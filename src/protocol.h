@@ -17,6 +17,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #define MESSAGE_START_SIZE 4
 
@@ -148,12 +149,18 @@ public:
     uint256 hash;
 };
 
+/** All message types this node understands. */
+const std::vector<std::string> &getAllNetMessageTypes();
+
 enum {
     MSG_TX = 1,
     MSG_BLOCK,
     // Nodes may always request a MSG_FILTERED_BLOCK in a getdata, however,
     // MSG_FILTERED_BLOCK should not appear in any invs except as a part of getdata.
     MSG_FILTERED_BLOCK,
+    // Requests a block as a "cmpctblock" message; like MSG_FILTERED_BLOCK it
+    // is only used in getdata.
+    MSG_CMPCT_BLOCK,
 };
 
 #endif // BITCOIN_PROTOCOL_H
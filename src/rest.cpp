@@ -4,11 +4,13 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "chainparams.h"
+#include "compactshieldedblock.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
 #include "rpc/server.h"
+#include "shieldedindexer.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
@@ -63,6 +65,7 @@ extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern UniValue compactShieldedBlockToJSON(const CCompactShieldedBlock& block);
 
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message)
 {
@@ -190,6 +193,72 @@ static bool rest_headers(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_compactblocks(HTTPRequest* req,
+                               const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/compactblocks/<count>/<height>.<ext>.");
+
+    long count = strtol(path[0].c_str(), NULL, 10);
+    if (count < 1 || count > MAX_SHIELDED_BLOCK_RANGE)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[0]);
+
+    long nStart = strtol(path[1].c_str(), NULL, 10);
+    if (nStart < 1 || nStart > std::numeric_limits<int>::max() - count)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + path[1]);
+
+    if (!fShieldedIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Compact blocks require -shieldedindex");
+
+    std::vector<CCompactShieldedBlock> blocks;
+    if (!GetCompactShieldedBlocks(nStart, nStart + count - 1, blocks))
+        return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "The shielded index is catching up with the chain");
+
+    CDataStream ssBlocks(SER_NETWORK, PROTOCOL_VERSION);
+    for (const CCompactShieldedBlock& block : blocks) {
+        ssBlocks << block;
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        string binaryBlocks = ssBlocks.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryBlocks);
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(ssBlocks.begin(), ssBlocks.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+    case RF_JSON: {
+        UniValue jsonBlocks(UniValue::VARR);
+        for (const CCompactShieldedBlock& block : blocks) {
+            jsonBlocks.push_back(compactShieldedBlockToJSON(block));
+        }
+        string strJSON = jsonBlocks.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_block(HTTPRequest* req,
                        const std::string& strURIPart,
                        bool showTxDetails)
@@ -602,6 +671,7 @@ static const struct {
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/compactblocks/", rest_compactblocks},
       {"/rest/getutxos", rest_getutxos},
 };
 
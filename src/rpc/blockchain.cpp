@@ -4,14 +4,18 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "amount.h"
+#include "blockdeltas.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "compactshieldedblock.h"
 #include "consensus/validation.h"
+#include "insightindexer.h"
 #include "key_io.h"
 #include "main.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "shieldedindexer.h"
 #include "streams.h"
 #include "sync.h"
 #include "util.h"
@@ -127,71 +131,47 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 }
 
 // insightexplorer
-UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
+UniValue blockToDeltasJSON(const CBlockDeltas& blockdeltas, const CBlockIndex* blockindex)
 {
     UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
-    // Only report confirmations if the block is on the main chain
-    if (!chainActive.Contains(blockindex))
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block is an orphan");
+    result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = chainActive.Height() - blockindex->nHeight + 1;
     result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
+    result.push_back(Pair("size", (int)blockdeltas.nSize));
     result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+    result.push_back(Pair("version", blockindex->nVersion));
+    result.push_back(Pair("merkleroot", blockindex->hashMerkleRoot.GetHex()));
 
     UniValue deltas(UniValue::VARR);
-    for (unsigned int i = 0; i < block.vtx.size(); i++) {
-        const CTransaction &tx = block.vtx[i];
-        const uint256 txhash = tx.GetHash();
+    for (unsigned int i = 0; i < blockdeltas.vtx.size(); i++) {
+        const CTxDeltas& tx = blockdeltas.vtx[i];
 
         UniValue entry(UniValue::VOBJ);
-        entry.push_back(Pair("txid", txhash.GetHex()));
+        entry.push_back(Pair("txid", tx.txid.GetHex()));
         entry.push_back(Pair("index", (int)i));
 
         UniValue inputs(UniValue::VARR);
-        if (!tx.IsCoinBase()) {
-            for (size_t j = 0; j < tx.vin.size(); j++) {
-                const CTxIn input = tx.vin[j];
-                UniValue delta(UniValue::VOBJ);
-                CSpentIndexValue spentInfo;
-                CSpentIndexKey spentKey(input.prevout.hash, input.prevout.n);
-
-                if (!GetSpentIndex(spentKey, spentInfo)) {
-                    throw JSONRPCError(RPC_INTERNAL_ERROR, "Spent information not available");
-                }
-                CTxDestination dest = DestFromAddressHash(spentInfo.addressType, spentInfo.addressHash);
-                if (IsValidDestination(dest)) {
-                    delta.push_back(Pair("address", EncodeDestination(dest)));
-                }
-                delta.push_back(Pair("satoshis", -1 * spentInfo.satoshis));
-                delta.push_back(Pair("index", (int)j));
-                delta.push_back(Pair("prevtxid", input.prevout.hash.GetHex()));
-                delta.push_back(Pair("prevout", (int)input.prevout.n));
-
-                inputs.push_back(delta);
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            const CBlockDeltaInput& input = tx.vin[j];
+            UniValue delta(UniValue::VOBJ);
+            if (!input.address.empty()) {
+                delta.push_back(Pair("address", input.address));
             }
+            delta.push_back(Pair("satoshis", input.satoshis));
+            delta.push_back(Pair("index", (int)j));
+            delta.push_back(Pair("prevtxid", input.prevout.hash.GetHex()));
+            delta.push_back(Pair("prevout", (int)input.prevout.n));
+
+            inputs.push_back(delta);
         }
         entry.push_back(Pair("inputs", inputs));
 
         UniValue outputs(UniValue::VARR);
         for (unsigned int k = 0; k < tx.vout.size(); k++) {
-            const CTxOut &out = tx.vout[k];
+            const CBlockDeltaOutput& output = tx.vout[k];
             UniValue delta(UniValue::VOBJ);
-            const uint160 addrhash = out.scriptPubKey.AddressHash();
-            CTxDestination dest;
-
-            if (out.scriptPubKey.IsPayToScriptHash()) {
-                dest = CScriptID(addrhash);
-            } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
-                dest = CKeyID(addrhash);
-            }
-            if (IsValidDestination(dest)) {
-                delta.push_back(Pair("address", EncodeDestination(dest)));
-            }
-            delta.push_back(Pair("address", EncodeDestination(dest)));
-            delta.push_back(Pair("satoshis", out.nValue));
+            delta.push_back(Pair("address", output.address));
+            delta.push_back(Pair("satoshis", output.satoshis));
             delta.push_back(Pair("index", (int)k));
 
             outputs.push_back(delta);
@@ -200,10 +180,10 @@ UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
         deltas.push_back(entry);
     }
     result.push_back(Pair("deltas", deltas));
-    result.push_back(Pair("time", block.GetBlockTime()));
+    result.push_back(Pair("time", blockindex->GetBlockTime()));
     result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
-    result.push_back(Pair("nonce", block.nNonce.GetHex()));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
+    result.push_back(Pair("nonce", blockindex->nNonce.GetHex()));
+    result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
 
@@ -468,22 +448,29 @@ UniValue getblockdeltas(const UniValue& params, bool fHelp)
             "Run './arnak-cli help getblockdeltas' for instructions on how to enable this feature.");
     }
 
+    LOCK(cs_main);
+
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
+    // Only report deltas if the block is on the main chain
+    if (!chainActive.Contains(pblockindex))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block is an orphan");
 
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    // The deltas of recent blocks are usually cached; otherwise they are
+    // computed from the block and its undo data, and cached for next time.
+    std::shared_ptr<const CBlockDeltas> deltas;
+    if (!GetBlockDeltas(pblockindex, deltas))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
-    return blockToDeltasJSON(block, pblockindex);
+    return blockToDeltasJSON(*deltas, pblockindex);
 }
 
 // insightexplorer
@@ -569,6 +556,275 @@ UniValue getblockhashes(const UniValue& params, bool fHelp)
     return result;
 }
 
+/** Throw unless the shielded index is enabled and has caught up with the chain. */
+static void EnsureShieldedIndex(const std::string& strMethod)
+{
+    if (!fShieldedIndex) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Error: " + strMethod + " is disabled. "
+            "Restart with -shieldedindex to enable it.");
+    }
+    int nHeight;
+    if (pshieldedindexer->GetProgress(nHeight)) {
+        throw JSONRPCError(RPC_IN_WARMUP, strprintf("The shielded index is catching up with the chain, "
+            "at height %d", nHeight));
+    }
+}
+
+static const char* ShieldedPoolName(ShieldedType type)
+{
+    return type == SPROUT ? "sprout" : "sapling";
+}
+
+UniValue getnullifierinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getnullifierinfo \"nullifier\"\n"
+            "\nReturns where a Sprout or Sapling nullifier was revealed in the active chain.\n"
+            "Requires -shieldedindex.\n"
+            "\nArguments:\n"
+            "1. \"nullifier\"     (string, required) The nullifier, in hex\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"pool\": \"sprout|sapling\",  (string) the shielded pool of the nullifier\n"
+            "  \"txid\": \"hash\",            (string) the transaction that revealed it\n"
+            "  \"height\": n,               (numeric) the height of its block\n"
+            "  \"index\": n                 (numeric) the index of the Sapling spend in the transaction;\n"
+            "                                 for Sprout, the joinsplit index times 2 plus the input index\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnullifierinfo", "\"6e9c8ac6d97a4e8f2c8e2fe9b1e4c4e0f7bc3ac57c1c7d5cbf6ef0b84a3b2d15\"")
+            + HelpExampleRpc("getnullifierinfo", "\"6e9c8ac6d97a4e8f2c8e2fe9b1e4c4e0f7bc3ac57c1c7d5cbf6ef0b84a3b2d15\"")
+        );
+
+    EnsureShieldedIndex("getnullifierinfo");
+    uint256 nullifier = ParseHashV(params[0], "nullifier");
+
+    for (ShieldedType type : {SPROUT, SAPLING}) {
+        CNullifierIndexValue value;
+        if (GetNullifierIndex(type, nullifier, value)) {
+            UniValue result(UniValue::VOBJ);
+            result.push_back(Pair("pool", ShieldedPoolName(type)));
+            result.push_back(Pair("txid", value.txid.GetHex()));
+            result.push_back(Pair("height", value.blockHeight));
+            result.push_back(Pair("index", (int)value.spendIndex));
+            return result;
+        }
+    }
+    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Nullifier not found in the active chain");
+}
+
+UniValue getcommitmentinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getcommitmentinfo \"commitment\"\n"
+            "\nReturns where a Sprout or Sapling note commitment was added to its note commitment tree\n"
+            "in the active chain. Requires -shieldedindex.\n"
+            "\nArguments:\n"
+            "1. \"commitment\"    (string, required) The note commitment, in hex\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"pool\": \"sprout|sapling\",  (string) the shielded pool of the note commitment\n"
+            "  \"height\": n,               (numeric) the height of its block\n"
+            "  \"position\": n              (numeric) its position in the note commitment tree\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcommitmentinfo", "\"2b0e1bd0ab3c3b4d6a0f5d9b1bc2a5ca1e3e6f1d0b6a2c4d9e8f7a6b5c4d3e2f\"")
+            + HelpExampleRpc("getcommitmentinfo", "\"2b0e1bd0ab3c3b4d6a0f5d9b1bc2a5ca1e3e6f1d0b6a2c4d9e8f7a6b5c4d3e2f\"")
+        );
+
+    EnsureShieldedIndex("getcommitmentinfo");
+    uint256 commitment = ParseHashV(params[0], "commitment");
+
+    for (ShieldedType type : {SPROUT, SAPLING}) {
+        CCommitmentIndexValue value;
+        if (GetCommitmentIndex(type, commitment, value)) {
+            UniValue result(UniValue::VOBJ);
+            result.push_back(Pair("pool", ShieldedPoolName(type)));
+            result.push_back(Pair("height", value.blockHeight));
+            result.push_back(Pair("position", (uint64_t)value.position));
+            return result;
+        }
+    }
+    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Note commitment not found in the active chain");
+}
+
+static UniValue HashesToJSON(const std::vector<uint256>& hashes)
+{
+    UniValue result(UniValue::VARR);
+    for (const uint256& hash : hashes)
+        result.push_back(hash.GetHex());
+    return result;
+}
+
+UniValue getshieldedblockrange(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getshieldedblockrange start end\n"
+            "\nReturns the nullifiers and note commitments of the blocks of the active chain from height start\n"
+            "to end, at most " + std::to_string(MAX_SHIELDED_BLOCK_RANGE) + " blocks. Requires -shieldedindex.\n"
+            "\nArguments:\n"
+            "1. start           (numeric, required) The height of the first block\n"
+            "2. end             (numeric, required) The height of the last block\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"height\": n,             (numeric) the height of the block\n"
+            "    \"hash\": \"hash\",          (string) the block hash\n"
+            "    \"sproutTreeSize\": n,     (numeric) the size of the Sprout note commitment tree before the block\n"
+            "    \"saplingTreeSize\": n,    (numeric) the size of the Sapling note commitment tree before the block\n"
+            "    \"tx\": [                  (array) the transactions with shielded data, in block order\n"
+            "      {\n"
+            "        \"txid\": \"hash\",\n"
+            "        \"sproutNullifiers\": [\"hex\", ...],\n"
+            "        \"sproutCommitments\": [\"hex\", ...],\n"
+            "        \"saplingNullifiers\": [\"hex\", ...],\n"
+            "        \"saplingCommitments\": [\"hex\", ...]\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getshieldedblockrange", "1000 1099")
+            + HelpExampleRpc("getshieldedblockrange", "1000, 1099")
+        );
+
+    EnsureShieldedIndex("getshieldedblockrange");
+    int nStart = params[0].get_int();
+    int nEnd = params[1].get_int();
+    if (nStart < 1 || nEnd < nStart)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block range");
+    if (nEnd - nStart >= MAX_SHIELDED_BLOCK_RANGE)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block range is larger than %d blocks", MAX_SHIELDED_BLOCK_RANGE));
+
+    std::vector<CShieldedBlockDbEntry> blocks;
+    if (!GetShieldedBlocks(nStart, nEnd, blocks))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the shielded index");
+
+    UniValue result(UniValue::VARR);
+    for (const CShieldedBlockDbEntry& entry : blocks) {
+        const CShieldedBlockIndexValue& block = entry.second;
+        UniValue txs(UniValue::VARR);
+        for (const CShieldedTxIndexValue& tx : block.vtx) {
+            UniValue item(UniValue::VOBJ);
+            item.push_back(Pair("txid", tx.txid.GetHex()));
+            item.push_back(Pair("sproutNullifiers", HashesToJSON(tx.sproutNullifiers)));
+            item.push_back(Pair("sproutCommitments", HashesToJSON(tx.sproutCommitments)));
+            item.push_back(Pair("saplingNullifiers", HashesToJSON(tx.saplingNullifiers)));
+            item.push_back(Pair("saplingCommitments", HashesToJSON(tx.saplingCommitments)));
+            txs.push_back(item);
+        }
+        UniValue item(UniValue::VOBJ);
+        item.push_back(Pair("height", entry.first));
+        item.push_back(Pair("hash", block.hashBlock.GetHex()));
+        item.push_back(Pair("sproutTreeSize", (uint64_t)block.sproutTreeSize));
+        item.push_back(Pair("saplingTreeSize", (uint64_t)block.saplingTreeSize));
+        item.push_back(Pair("tx", txs));
+        result.push_back(item);
+    }
+    return result;
+}
+
+UniValue compactShieldedBlockToJSON(const CCompactShieldedBlock& block)
+{
+    UniValue txs(UniValue::VARR);
+    for (const CCompactShieldedTx& tx : block.vtx) {
+        UniValue outputs(UniValue::VARR);
+        for (const CCompactSaplingOutput& output : tx.outputs) {
+            UniValue item(UniValue::VOBJ);
+            item.push_back(Pair("cmu", output.cmu.GetHex()));
+            item.push_back(Pair("epk", output.epk.GetHex()));
+            item.push_back(Pair("ciphertext", HexStr(output.ciphertext.begin(), output.ciphertext.end())));
+            outputs.push_back(item);
+        }
+        UniValue item(UniValue::VOBJ);
+        item.push_back(Pair("index", (int)tx.index));
+        item.push_back(Pair("txid", tx.txid.GetHex()));
+        item.push_back(Pair("nullifiers", HashesToJSON(tx.nullifiers)));
+        item.push_back(Pair("outputs", outputs));
+        txs.push_back(item);
+    }
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("height", block.nHeight));
+    result.push_back(Pair("hash", block.hash.GetHex()));
+    result.push_back(Pair("previousblockhash", block.hashPrevBlock.GetHex()));
+    result.push_back(Pair("time", (int64_t)block.nTime));
+    result.push_back(Pair("tx", txs));
+    return result;
+}
+
+UniValue getcompactblockrange(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "getcompactblockrange start end ( verbose )\n"
+            "\nReturns the compact form of the blocks of the active chain from height start to end, at most\n"
+            + std::to_string(MAX_SHIELDED_BLOCK_RANGE) + " blocks: the Sapling nullifiers of each transaction, and of each Sapling output\n"
+            "its note commitment, ephemeral key and the first " + std::to_string(COMPACT_NOTE_CIPHERTEXT_SIZE) + " bytes of its ciphertext.\n"
+            "Light wallet servers use it to serve clients without full blocks. Requires -shieldedindex.\n"
+            "\nArguments:\n"
+            "1. start           (numeric, required) The height of the first block\n"
+            "2. end             (numeric, required) The height of the last block\n"
+            "3. verbose         (boolean, optional, default=false) true for json objects, false for hex encoded data\n"
+            "\nResult (for verbose = false):\n"
+            "[\n"
+            "  \"data\",          (string) the serialized, hex-encoded compact block\n"
+            "  ...\n"
+            "]\n"
+            "\nResult (for verbose = true):\n"
+            "[\n"
+            "  {\n"
+            "    \"height\": n,                 (numeric) the height of the block\n"
+            "    \"hash\": \"hash\",              (string) the block hash\n"
+            "    \"previousblockhash\": \"hash\", (string) the hash of the previous block\n"
+            "    \"time\": n,                   (numeric) the block time\n"
+            "    \"tx\": [                      (array) the transactions with Sapling spends or outputs\n"
+            "      {\n"
+            "        \"index\": n,              (numeric) the position of the transaction in the block\n"
+            "        \"txid\": \"hash\",\n"
+            "        \"nullifiers\": [\"hex\", ...],\n"
+            "        \"outputs\": [\n"
+            "          { \"cmu\": \"hex\", \"epk\": \"hex\", \"ciphertext\": \"hex\" }, ...\n"
+            "        ]\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcompactblockrange", "1000 1099")
+            + HelpExampleRpc("getcompactblockrange", "1000, 1099, true")
+        );
+
+    EnsureShieldedIndex("getcompactblockrange");
+    int nStart = params[0].get_int();
+    int nEnd = params[1].get_int();
+    bool fVerbose = false;
+    if (params.size() > 2)
+        fVerbose = params[2].get_bool();
+    if (nStart < 1 || nEnd < nStart)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block range");
+    if (nEnd - nStart >= MAX_SHIELDED_BLOCK_RANGE)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block range is larger than %d blocks", MAX_SHIELDED_BLOCK_RANGE));
+
+    std::vector<CCompactShieldedBlock> blocks;
+    if (!GetCompactShieldedBlocks(nStart, nEnd, blocks))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the shielded index");
+
+    UniValue result(UniValue::VARR);
+    for (const CCompactShieldedBlock& block : blocks) {
+        if (fVerbose) {
+            result.push_back(compactShieldedBlockToJSON(block));
+        } else {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << block;
+            result.push_back(HexStr(ss.begin(), ss.end()));
+        }
+    }
+    return result;
+}
+
 UniValue getblockhash(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -990,6 +1246,28 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"size_on_disk\": xxxxxx,       (numeric) the estimated size of the block and undo files on disk\n"
             "  \"commitments\": xxxxxx,    (numeric) the current number of note commitments in the commitment tree\n"
+            "  \"blockdownload\": {         (object) block download progress\n"
+            "     \"blockspersecond\": x.xx,  (numeric) requested blocks received per second over the last minute\n"
+            "     \"bytespersecond\": x.xx,   (numeric) bytes of requested blocks received per second over the last minute\n"
+            "     \"inflight\": xxxxxx,       (numeric) the number of blocks currently requested from peers\n"
+            "     \"window\": xxxxxx          (numeric) how far ahead of the last common block blocks are requested\n"
+            "  },\n"
+            "  \"blockstorage\": {          (object) block file footprint and compression\n"
+            "     \"compression\": xx,          (boolean) whether blocks are stored compressed (-blockcompression)\n"
+            "     \"blockbytes\": xxxxxx,       (numeric) the size of the block files\n"
+            "     \"undobytes\": xxxxxx,        (numeric) the size of the undo files\n"
+            "     \"compressedrawbytes\": xxxxxx, (numeric) the size of the blocks compressed since startup\n"
+            "     \"compressedbytes\": xxxxxx,  (numeric) the size on disk of the blocks compressed since startup\n"
+            "     \"decompressed\": xxxxxx,     (numeric) the number of blocks read and decompressed since startup\n"
+            "     \"decompresstime\": x.xx,     (numeric) the average time to decompress a block, in milliseconds\n"
+            "     \"filescompacted\": xxxxxx,   (numeric) the number of old block files converted to compressed storage since startup\n"
+            "     \"bytesreclaimed\": xxxxxx    (numeric) the disk space reclaimed by the compactor\n"
+            "  },\n"
+            "  \"insightindex\": {          (object, only with -insightexplorer) the insight explorer indexes\n"
+            "     \"ready\": xx,              (boolean) whether the indexes follow the active chain, rather than catching up with it\n"
+            "     \"height\": xxxxxx,         (numeric) the height of the last block indexed\n"
+            "     \"progress\": xxxx          (numeric) estimate of the fraction of the active chain indexed\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -1038,6 +1316,41 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), tree);
     obj.push_back(Pair("commitments",           static_cast<uint64_t>(tree.size())));
 
+    CBlockDownloadStats downloadStats;
+    GetBlockDownloadStats(downloadStats);
+    UniValue blockdownload(UniValue::VOBJ);
+    blockdownload.push_back(Pair("blockspersecond", downloadStats.dBlocksPerSecond));
+    blockdownload.push_back(Pair("bytespersecond",  downloadStats.dBytesPerSecond));
+    blockdownload.push_back(Pair("inflight",        downloadStats.nBlocksInFlight));
+    blockdownload.push_back(Pair("window",          downloadStats.nDownloadWindow));
+    obj.push_back(Pair("blockdownload",         blockdownload));
+
+    CBlockStorageStats storageStats;
+    GetBlockStorageStats(storageStats);
+    UniValue blockstorage(UniValue::VOBJ);
+    blockstorage.push_back(Pair("compression",        fBlockCompression));
+    blockstorage.push_back(Pair("blockbytes",         storageStats.nBlockFileBytes));
+    blockstorage.push_back(Pair("undobytes",          storageStats.nUndoFileBytes));
+    blockstorage.push_back(Pair("compressedrawbytes", storageStats.nCompressedRawBytes));
+    blockstorage.push_back(Pair("compressedbytes",    storageStats.nCompressedBytes));
+    blockstorage.push_back(Pair("decompressed",       storageStats.nBlocksDecompressed));
+    blockstorage.push_back(Pair("decompresstime",     storageStats.nBlocksDecompressed ? 0.001 * storageStats.nDecompressTime / storageStats.nBlocksDecompressed : 0.0));
+    blockstorage.push_back(Pair("filescompacted",     storageStats.nFilesCompacted));
+    blockstorage.push_back(Pair("bytesreclaimed",     storageStats.nBytesReclaimed));
+    obj.push_back(Pair("blockstorage",          blockstorage));
+
+    int nInsightHeight;
+    bool fInsightCatchingUp = GetInsightIndexProgress(nInsightHeight);
+    if (fInsightExplorer || fInsightCatchingUp) {
+        if (!fInsightCatchingUp)
+            nInsightHeight = chainActive.Height();
+        UniValue insightindex(UniValue::VOBJ);
+        insightindex.push_back(Pair("ready",    fInsightExplorer && !fInsightCatchingUp));
+        insightindex.push_back(Pair("height",   nInsightHeight));
+        insightindex.push_back(Pair("progress", chainActive.Height() > 0 ? (double)nInsightHeight / chainActive.Height() : 1.0));
+        obj.push_back(Pair("insightindex",          insightindex));
+    }
+
     CBlockIndex* tip = chainActive.Tip();
     UniValue valuePools(UniValue::VARR);
     valuePools.push_back(ValuePoolDesc("sprout", tip->nChainSproutValue, boost::none));
@@ -1310,6 +1623,12 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockdeltas",         &getblockdeltas,         false },    
     { "blockchain",         "getblockhashes",         &getblockhashes,         true  },
 
+    // shieldedindex
+    { "blockchain",         "getnullifierinfo",       &getnullifierinfo,       true  },
+    { "blockchain",         "getcommitmentinfo",      &getcommitmentinfo,      true  },
+    { "blockchain",         "getshieldedblockrange",  &getshieldedblockrange,  true  },
+    { "blockchain",         "getcompactblockrange",   &getcompactblockrange,   true  },
+
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        true  },
     { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
@@ -109,6 +109,11 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblockhashes", 1},
     { "getblockhashes", 2},
     { "getblockdeltas", 0},
+    { "getshieldedblockrange", 0},
+    { "getshieldedblockrange", 1},
+    { "getcompactblockrange", 0},
+    { "getcompactblockrange", 1},
+    { "getcompactblockrange", 2},
     { "zcrawjoinsplit", 1 },
     { "zcrawjoinsplit", 2 },
     { "zcrawjoinsplit", 3 },
@@ -776,22 +776,84 @@ static void getHeightRange(const UniValue& params, int& start, int& end)
     }
 }
 
-// Parse an address list then fetch the corresponding addressindex information.
-static void getAddressesInHeightRange(
-    const UniValue& params,
-    int start, int end,
-    std::vector<std::pair<uint160, int>>& addresses,
-    std::vector<std::pair<CAddressIndexKey, CAmount>> &addressIndex)
+// Parse the optional page size and continuation cursor of an address query.
+static void getPageParams(const UniValue& params, int& limit, bool& fCursor, CAddressIndexKey& cursor)
 {
-    if (!getAddressesFromParams(params, addresses)) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    limit = 0;
+    fCursor = false;
+    if (!params[0].isObject()) {
+        return;
+    }
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+    if (!limitValue.isNull()) {
+        limit = limitValue.get_int();
+        if (limit <= 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be greater than zero");
+        }
+    }
+    if (!cursorValue.isNull()) {
+        if (limit == 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor requires a limit");
+        }
+        // The cursor is the serialized key of the last entry of the previous page.
+        std::string strCursor = cursorValue.get_str();
+        if (strCursor.size() != 2 * cursor.GetSerializeSize(SER_DISK, CLIENT_VERSION) || !IsHex(strCursor)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        }
+        CDataStream ss(ParseHex(strCursor), SER_DISK, CLIENT_VERSION);
+        ss >> cursor;
+        fCursor = true;
     }
+}
+
+static std::string getCursorString(const CAddressIndexKey& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+// Called with the encoded address for each addressindex entry; returning false stops the scan.
+typedef boost::function<bool(const std::string&, const CAddressIndexKey&, CAmount)> AddressIndexVisitor;
+
+// Visit the addressindex entries of the addresses merged in height order,
+// starting after the cursor if there is one. Entries are read straight from
+// the database iterators rather than collected and sorted first. Returns
+// false if the visitor stopped the scan.
+static bool scanAddressesInHeightRange(
+    const std::vector<std::pair<uint160, int>>& addresses,
+    int start, int end,
+    const CAddressIndexKey* cursor,
+    const AddressIndexVisitor& visit)
+{
+    std::vector<CAddressIndexIteratorKey> keys;
+    std::map<CAddressIndexIteratorKey, std::string> addressStrings;
     for (const auto& it : addresses) {
-        if (!GetAddressIndex(it.first, it.second, addressIndex, start, end)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
-                "No information available for address");
+        CAddressIndexIteratorKey key(it.second, it.first);
+        std::string address;
+        if (!getAddressFromIndex(it.second, it.first, address)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
         }
+        keys.push_back(key);
+        addressStrings[key] = address;
+    }
+    if (cursor && !addressStrings.count(CAddressIndexIteratorKey(cursor->type, cursor->hashBytes))) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor does not belong to the given addresses");
     }
+
+    bool fStopped = false;
+    bool fFound = GetAddressIndex(keys, cursor, start, end,
+        [&](const CAddressIndexKey& key, CAmount amount) -> bool {
+            const std::string& address = addressStrings[CAddressIndexIteratorKey(key.type, key.hashBytes)];
+            fStopped = !visit(address, key, amount);
+            return !fStopped;
+        });
+    if (!fFound) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+            "No information available for address");
+    }
+    return !fStopped;
 }
 
 // insightexplorer
@@ -805,7 +867,7 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     }
     if (fHelp || params.size() != 1)
         throw runtime_error(
-            "getaddressdeltas {\"addresses\": [\"taddr\", ...], (\"start\": n), (\"end\": n), (\"chainInfo\": true|false)}\n"
+            "getaddressdeltas {\"addresses\": [\"taddr\", ...], (\"start\": n), (\"end\": n), (\"chainInfo\": true|false), (\"limit\": n), (\"cursor\": \"cursor\")}\n"
             "\nReturns all changes for an address.\n"
             "\nReturns information about all changes to the given transparent addresses within the given (inclusive)\n"
             "\nblock height range, default is the full blockchain.\n"
@@ -820,6 +882,8 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "  \"start\"       (number, optional) The start block height\n"
             "  \"end\"         (number, optional) The end block height\n"
             "  \"chainInfo\"   (boolean, optional, default=false) Include chain info in results, only applies if start and end specified\n"
+            "  \"limit\"       (number, optional) Return at most this many deltas, and a cursor for the next page if there are more\n"
+            "  \"cursor\"      (string, optional) The cursor returned with the previous page, requires limit\n"
             "}\n"
             "(or)\n"
             "\"address\"       (string) The base58check encoded address\n"
@@ -855,7 +919,13 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "      \"hash\"          (string)  The end block hash\n"
             "      \"height\"        (numeric) The height of the end block\n"
             "    }\n"
+            "}\n\n"
+            "(or, if limit is given, the same object with the start and end only if chainInfo is true):\n\n"
+            "{\n"
+            "  \"deltas\": [ ... ],\n"
+            "  \"cursor\"      (string)  Pass this to get the next page, only present if there are more deltas\n"
             "}\n"
+            "\nThe deltas of all the addresses are listed in height order.\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"tmYXBYJj1K7vhejSec5osXK2QsGa5MTisUQ\"], \"start\": 1000, \"end\": 2000, \"chainInfo\": true}'")
             + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"tmYXBYJj1K7vhejSec5osXK2QsGa5MTisUQ\"], \"start\": 1000, \"end\": 2000, \"chainInfo\": true}")
@@ -870,9 +940,15 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     int end = 0;
     getHeightRange(params, start, end);
 
+    int limit = 0;
+    bool fCursor = false;
+    CAddressIndexKey cursor;
+    getPageParams(params, limit, fCursor, cursor);
+
     std::vector<std::pair<uint160, int>> addresses;
-    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
-    getAddressesInHeightRange(params, start, end, addresses, addressIndex);
+    if (!getAddressesFromParams(params, addresses)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
 
     bool includeChainInfo = false;
     if (params[0].isObject()) {
@@ -883,26 +959,36 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     }
 
     UniValue deltas(UniValue::VARR);
-    for (const auto& it : addressIndex) {
-        std::string address;
-        if (!getAddressFromIndex(it.first.type, it.first.hashBytes, address)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
-        }
+    CAddressIndexKey lastKey;
+    bool fMore = !scanAddressesInHeightRange(addresses, start, end, fCursor ? &cursor : NULL,
+        [&](const std::string& address, const CAddressIndexKey& key, CAmount amount) -> bool {
+            if (limit > 0 && deltas.size() == (size_t)limit) {
+                return false;
+            }
+            UniValue delta(UniValue::VOBJ);
+            delta.push_back(Pair("address", address));
+            delta.push_back(Pair("blockindex", (int)key.txindex));
+            delta.push_back(Pair("height", key.blockHeight));
+            delta.push_back(Pair("index", (int)key.index));
+            delta.push_back(Pair("satoshis", amount));
+            delta.push_back(Pair("txid", key.txhash.GetHex()));
+            deltas.push_back(delta);
+            lastKey = key;
+            return true;
+        });
 
-        UniValue delta(UniValue::VOBJ);
-        delta.push_back(Pair("address", address));
-        delta.push_back(Pair("blockindex", (int)it.first.txindex));
-        delta.push_back(Pair("height", it.first.blockHeight));
-        delta.push_back(Pair("index", (int)it.first.index));
-        delta.push_back(Pair("satoshis", it.second));
-        delta.push_back(Pair("txid", it.first.txhash.GetHex()));
-        deltas.push_back(delta);
+    includeChainInfo = includeChainInfo && start > 0 && end > 0;
+    if (limit == 0 && !includeChainInfo) {
+        return deltas;
     }
 
     UniValue result(UniValue::VOBJ);
-
-    if (!(includeChainInfo && start > 0 && end > 0)) {
-        return deltas;
+    result.push_back(Pair("deltas", deltas));
+    if (fMore) {
+        result.push_back(Pair("cursor", getCursorString(lastKey)));
+    }
+    if (!includeChainInfo) {
+        return result;
     }
 
     UniValue startInfo(UniValue::VOBJ);
@@ -918,7 +1004,6 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     startInfo.push_back(Pair("height", start));
     endInfo.push_back(Pair("height", end));
 
-    result.push_back(Pair("deltas", deltas));
     result.push_back(Pair("start", startInfo));
     result.push_back(Pair("end", endInfo));
 
@@ -965,18 +1050,32 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
     }
 
     std::vector<std::pair<uint160, int>> addresses;
-    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
-    // this method doesn't take start and end block height params, so set
-    // to zero (full range, entire blockchain)
-    getAddressesInHeightRange(params, 0, 0, addresses, addressIndex);
+    if (!getAddressesFromParams(params, addresses)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
 
     CAmount balance = 0;
     CAmount received = 0;
-    for (const auto& it : addressIndex) {
-        if (it.second > 0) {
-            received += it.second;
+    for (const auto& it : addresses) {
+        CAddressBalanceValue value;
+        if (GetAddressBalance(it.first, it.second, value)) {
+            balance += value.balance;
+            received += value.received;
+            continue;
+        }
+
+        // The balance index is still being built; sum the address's history.
+        std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
+        if (!GetAddressIndex(it.first, it.second, addressIndex)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+                "No information available for address");
+        }
+        for (const auto& entry : addressIndex) {
+            if (entry.second > 0) {
+                received += entry.second;
+            }
+            balance += entry.second;
         }
-        balance += it.second;
     }
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("balance", balance));
@@ -995,7 +1094,7 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
     }
     if (fHelp || params.size() != 1)
         throw runtime_error(
-            "getaddresstxids {\"addresses\": [\"taddr\", ...], (\"start\": n), (\"end\": n)}\n"
+            "getaddresstxids {\"addresses\": [\"taddr\", ...], (\"start\": n), (\"end\": n), (\"limit\": n), (\"cursor\": \"cursor\")}\n"
             "\nReturns the txids for given transparent addresses within the given (inclusive)\n"
             "\nblock height range, default is the full blockchain.\n"
             + disabledMsg +
@@ -1008,6 +1107,8 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number, optional) The start block height\n"
             "  \"end\" (number, optional) The end block height\n"
+            "  \"limit\" (number, optional) Return at most this many txids, and a cursor for the next page if there are more\n"
+            "  \"cursor\" (string, optional) The cursor returned with the previous page, requires limit\n"
             "}\n"
             "(or)\n"
             "\"address\"  (string) The base58check encoded address\n"
@@ -1016,6 +1117,12 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
             "]\n"
+            "\n(or, if limit is given):\n"
+            "{\n"
+            "  \"txids\": [ ... ],\n"
+            "  \"cursor\"  (string) Pass this to get the next page, only present if there are more txids\n"
+            "}\n"
+            "\nThe txids are listed in height order, each once.\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"tmYXBYJj1K7vhejSec5osXK2QsGa5MTisUQ\"], \"start\": 1000, \"end\": 2000}'")
             + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"tmYXBYJj1K7vhejSec5osXK2QsGa5MTisUQ\"], \"start\": 1000, \"end\": 2000}")
@@ -1030,23 +1137,44 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
     int end = 0;
     getHeightRange(params, start, end);
 
+    int limit = 0;
+    bool fCursor = false;
+    CAddressIndexKey cursor;
+    getPageParams(params, limit, fCursor, cursor);
+
     std::vector<std::pair<uint160, int>> addresses;
-    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
-    getAddressesInHeightRange(params, start, end, addresses, addressIndex);
+    if (!getAddressesFromParams(params, addresses)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
 
-    // This is an ordered set, sorted by height, so result also sorted by height.
-    std::set<std::pair<int, std::string>> txids;
+    // The entries of a transaction are adjacent, even across addresses, so
+    // each txid is listed once and a page never ends in the middle of one.
+    UniValue txids(UniValue::VARR);
+    CAddressIndexKey lastKey;
+    bool fLast = false;
+    bool fMore = !scanAddressesInHeightRange(addresses, start, end, fCursor ? &cursor : NULL,
+        [&](const std::string& address, const CAddressIndexKey& key, CAmount amount) -> bool {
+            if (fLast && key.txhash == lastKey.txhash) {
+                lastKey = key;
+                return true;
+            }
+            if (limit > 0 && txids.size() == (size_t)limit) {
+                return false;
+            }
+            txids.push_back(key.txhash.GetHex());
+            lastKey = key;
+            fLast = true;
+            return true;
+        });
 
-    for (const auto& it : addressIndex) {
-        const int height = it.first.blockHeight;
-        const std::string txid = it.first.txhash.GetHex();
-        // Duplicate entries (two addresses in same tx) are suppressed
-        txids.insert(std::make_pair(height, txid));
+    if (limit == 0) {
+        return txids;
     }
-    UniValue result(UniValue::VARR);
-    for (const auto& it : txids) {
-        // only push the txid, not the height
-        result.push_back(it.second);
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txids", txids));
+    if (fMore) {
+        result.push_back(Pair("cursor", getCursorString(lastKey)));
     }
     return result;
 }
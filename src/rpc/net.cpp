@@ -62,6 +62,23 @@ UniValue ping(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+/** Messages of the types that were sent or received at least once, by type. */
+static UniValue MessageTypeStatsToJSON(const mapMsgTypeStats& mapStats, bool fTime)
+{
+    UniValue ret(UniValue::VOBJ);
+    for (mapMsgTypeStats::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it) {
+        if (it->second.nCount == 0)
+            continue;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("count", it->second.nCount));
+        obj.push_back(Pair("bytes", it->second.nBytes));
+        if (fTime)
+            obj.push_back(Pair("timemicros", it->second.nTimeMicros));
+        ret.push_back(Pair(it->first, obj));
+    }
+    return ret;
+}
+
 static void CopyNodeStats(std::vector<CNodeStats>& vstats)
 {
     vstats.clear();
@@ -103,10 +120,26 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"banscore\": n,             (numeric) The ban score\n"
             "    \"synced_headers\": n,       (numeric) The last header we have in common with this peer\n"
             "    \"synced_blocks\": n,        (numeric) The last block we have in common with this peer\n"
+            "    \"blockwindow\": n,          (numeric) How many blocks may be requested from this peer at once\n"
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"txreconciliation\": true|false, (boolean) Whether transactions are relayed to this peer by set reconciliation\n"
+            "    \"sent_per_msg\": {         (json object) Messages sent, by message type\n"
+            "      \"command\": {\n"
+            "        \"count\": n,           (numeric) Number of messages\n"
+            "        \"bytes\": n            (numeric) Their size, including message headers\n"
+            "      }, ...\n"
+            "    },\n"
+            "    \"recv_per_msg\": {         (json object) Messages received, by message type\n"
+            "      \"command\": {\n"
+            "        \"count\": n,           (numeric) Number of messages\n"
+            "        \"bytes\": n,           (numeric) Their size, including message headers\n"
+            "        \"timemicros\": n       (numeric) Time spent processing them, in microseconds\n"
+            "      }, ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -151,6 +184,7 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             obj.push_back(Pair("banscore", statestats.nMisbehavior));
             obj.push_back(Pair("synced_headers", statestats.nSyncHeight));
             obj.push_back(Pair("synced_blocks", statestats.nCommonHeight));
+            obj.push_back(Pair("blockwindow", statestats.nBlocksInTransitLimit));
             UniValue heights(UniValue::VARR);
             BOOST_FOREACH(int height, statestats.vHeightInFlight) {
                 heights.push_back(height);
@@ -158,6 +192,9 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             obj.push_back(Pair("inflight", heights));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        obj.push_back(Pair("txreconciliation", stats.fTxReconciliation));
+        obj.push_back(Pair("sent_per_msg", MessageTypeStatsToJSON(stats.mapSendPerMsgType, false)));
+        obj.push_back(Pair("recv_per_msg", MessageTypeStatsToJSON(stats.mapRecvPerMsgType, true)));
 
         ret.push_back(obj);
     }
@@ -364,7 +401,14 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
-            "  \"timemillis\": t        (numeric) Total cpu time\n"
+            "  \"timemillis\": t,       (numeric) Total cpu time\n"
+            "  \"messagetimes\": {      (json object) Message processing time histograms\n"
+            "    \"command\": [n,...]   (array) Number of messages of this type whose handling took\n"
+            "                           less than 1, 2, 4, ... microseconds (last bucket is unbounded)\n"
+            "    ,...\n"
+            "  },\n"
+            "  \"sent_per_msg\": {...},   (json object) Messages sent to all peers, by type, as in getpeerinfo\n"
+            "  \"recv_per_msg\": {...}    (json object) Messages received from all peers, by type, as in getpeerinfo\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getnettotals", "")
@@ -375,6 +419,21 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+
+    UniValue times(UniValue::VOBJ);
+    std::map<std::string, std::vector<uint64_t> > mapTimes = GetMessageProcessingTimes();
+    for (std::map<std::string, std::vector<uint64_t> >::const_iterator it = mapTimes.begin(); it != mapTimes.end(); ++it) {
+        UniValue buckets(UniValue::VARR);
+        BOOST_FOREACH(uint64_t nCount, it->second)
+            buckets.push_back(nCount);
+        times.push_back(Pair(it->first, buckets));
+    }
+    obj.push_back(Pair("messagetimes", times));
+
+    mapMsgTypeStats mapSend, mapRecv;
+    GetMessageTypeTotals(mapSend, mapRecv);
+    obj.push_back(Pair("sent_per_msg", MessageTypeStatsToJSON(mapSend, false)));
+    obj.push_back(Pair("recv_per_msg", MessageTypeStatsToJSON(mapRecv, true)));
     return obj;
 }
 
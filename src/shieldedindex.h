@@ -0,0 +1,159 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_SHIELDEDINDEX_H
+#define BITCOIN_SHIELDEDINDEX_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <vector>
+
+/** Where a nullifier was revealed. */
+struct CNullifierIndexValue {
+    uint256 txid;
+    int blockHeight;
+    //! Index of the spend in vShieldedSpend; for Sprout, the joinsplit index
+    //! times ZC_NUM_JS_INPUTS plus the input index.
+    unsigned int spendIndex;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(blockHeight);
+        READWRITE(spendIndex);
+    }
+
+    CNullifierIndexValue(uint256 t, int h, unsigned int i) {
+        txid = t;
+        blockHeight = h;
+        spendIndex = i;
+    }
+
+    CNullifierIndexValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        txid.SetNull();
+        blockHeight = 0;
+        spendIndex = 0;
+    }
+};
+
+/** Where a note commitment landed. */
+struct CCommitmentIndexValue {
+    int blockHeight;
+    //! Position of the commitment in the note commitment tree of its pool
+    uint64_t position;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(blockHeight);
+        READWRITE(position);
+    }
+
+    CCommitmentIndexValue(int h, uint64_t p) {
+        blockHeight = h;
+        position = p;
+    }
+
+    CCommitmentIndexValue() {
+        blockHeight = 0;
+        position = 0;
+    }
+};
+
+/** Keys blocks by height, in big endian so they are iterated in height order. */
+struct CShieldedBlockIndexKey {
+    int blockHeight;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 4;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, blockHeight);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        blockHeight = ser_readdata32be(s);
+    }
+
+    CShieldedBlockIndexKey(int h) {
+        blockHeight = h;
+    }
+
+    CShieldedBlockIndexKey() {
+        blockHeight = 0;
+    }
+};
+
+/** The nullifiers and note commitments of a transaction, in transaction order. */
+struct CShieldedTxIndexValue {
+    uint256 txid;
+    std::vector<uint256> sproutNullifiers;
+    std::vector<uint256> sproutCommitments;
+    std::vector<uint256> saplingNullifiers;
+    std::vector<uint256> saplingCommitments;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(sproutNullifiers);
+        READWRITE(sproutCommitments);
+        READWRITE(saplingNullifiers);
+        READWRITE(saplingCommitments);
+    }
+};
+
+/**
+ * The shielded data of a block of the active chain: the sizes of the note
+ * commitment trees before it, and its transactions with shielded data.
+ */
+struct CShieldedBlockIndexValue {
+    uint256 hashBlock;
+    uint64_t sproutTreeSize;
+    uint64_t saplingTreeSize;
+    std::vector<CShieldedTxIndexValue> vtx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(sproutTreeSize);
+        READWRITE(saplingTreeSize);
+        READWRITE(vtx);
+    }
+
+    CShieldedBlockIndexValue() {
+        sproutTreeSize = 0;
+        saplingTreeSize = 0;
+    }
+
+    uint64_t GetSproutTreeSizeAfter() const {
+        uint64_t n = sproutTreeSize;
+        for (const CShieldedTxIndexValue& tx : vtx)
+            n += tx.sproutCommitments.size();
+        return n;
+    }
+
+    uint64_t GetSaplingTreeSizeAfter() const {
+        uint64_t n = saplingTreeSize;
+        for (const CShieldedTxIndexValue& tx : vtx)
+            n += tx.saplingCommitments.size();
+        return n;
+    }
+};
+
+typedef std::pair<int, CShieldedBlockIndexValue> CShieldedBlockDbEntry;
+
+#endif // BITCOIN_SHIELDEDINDEX_H
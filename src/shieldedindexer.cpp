@@ -0,0 +1,69 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "shieldedindexer.h"
+
+#include "compactshieldedblock.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+CShieldedIndexer* pshieldedindexer = NULL;
+
+bool CShieldedIndexer::Init(const CBlockIndex*& pindexIndexed)
+{
+    AssertLockHeld(cs_main);
+    uint256 hashBest;
+    if (!pshieldedindexdb->ReadBestBlock(hashBest)) {
+        pindexIndexed = NULL;
+        return true;
+    }
+    BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+    if (mi == mapBlockIndex.end())
+        return error("%s: the shielded index was built for a different chain, use -reindex", __func__);
+    pindexIndexed = mi->second;
+    return true;
+}
+
+/** Get the nullifiers and note commitments of the transactions of a block that have shielded data. */
+static void GetShieldedBlockIndexValue(const CBlock& block, CShieldedBlockIndexValue& value)
+{
+    for (const CTransaction& tx : block.vtx) {
+        if (tx.vJoinSplit.empty() && tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())
+            continue;
+        CShieldedTxIndexValue txValue;
+        txValue.txid = tx.GetHash();
+        for (const JSDescription& jsdesc : tx.vJoinSplit) {
+            for (const uint256& nf : jsdesc.nullifiers)
+                txValue.sproutNullifiers.push_back(nf);
+            for (const uint256& cm : jsdesc.commitments)
+                txValue.sproutCommitments.push_back(cm);
+        }
+        for (const SpendDescription& spend : tx.vShieldedSpend)
+            txValue.saplingNullifiers.push_back(spend.nullifier);
+        for (const OutputDescription& output : tx.vShieldedOutput)
+            txValue.saplingCommitments.push_back(output.cm);
+        value.vtx.push_back(txValue);
+    }
+}
+
+bool CShieldedIndexer::WriteBlocks(const std::vector<CIndexerBlock>& blocks, const CBlockIndex* pindexBest)
+{
+    std::vector<CShieldedIndexUpdate> updates(blocks.size());
+    for (unsigned int i = 0; i < blocks.size(); i++) {
+        const CIndexerBlock& item = blocks[i];
+        CShieldedIndexUpdate& update = updates[i];
+        update.fDisconnect = !item.fConnect;
+        update.nHeight = item.pindex->nHeight;
+        update.block.hashBlock = item.pindex->GetBlockHash();
+        // Disconnecting erases what the index recorded for the block.
+        if (item.fConnect) {
+            GetShieldedBlockIndexValue(item.block, update.block);
+            GetCompactShieldedBlock(item.block, update.nHeight, update.compact);
+        }
+    }
+    if (!pshieldedindexdb->WriteUpdates(updates, pindexBest->GetBlockHash()))
+        return error("%s: cannot write shielded index", __func__);
+    return true;
+}
@@ -0,0 +1,33 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_SHIELDEDINDEXER_H
+#define BITCOIN_SHIELDEDINDEXER_H
+
+#include "indexer.h"
+
+// Maximum number of blocks returned by one getshieldedblockrange call
+static const int MAX_SHIELDED_BLOCK_RANGE = 1000;
+
+/**
+ * Keeps the shielded index (-shieldedindex) in CShieldedIndexDB: the Sprout
+ * and Sapling nullifiers and note commitments of the active chain, so wallets
+ * and light clients can look them up without scanning blocks. It also keeps
+ * the compact form of each block, which light wallet servers fetch by range.
+ */
+class CShieldedIndexer : public CChainIndexer
+{
+protected:
+    bool Init(const CBlockIndex*& pindexIndexed);
+    bool NeedsUndo() const { return false; }
+    bool WriteBlocks(const std::vector<CIndexerBlock>& blocks, const CBlockIndex* pindexBest);
+
+public:
+    CShieldedIndexer() : CChainIndexer("shieldedindex") {}
+};
+
+/** The shielded indexer, if -shieldedindex is set */
+extern CShieldedIndexer* pshieldedindexer;
+
+#endif // BITCOIN_SHIELDEDINDEXER_H
@@ -389,6 +389,51 @@ public:
 
 
 
+/** Stream that deserializes directly from a range of memory owned by someone
+ *  else, such as a memory mapped file, without copying it first.
+ */
+class CSpanReader
+{
+private:
+    const int nType;
+    const int nVersion;
+
+    const char* pbegin;
+    const char* pend;
+
+public:
+    CSpanReader(int nTypeIn, int nVersionIn, const char* pbeginIn, const char* pendIn) :
+        nType(nTypeIn), nVersion(nVersionIn), pbegin(pbeginIn), pend(pendIn) {}
+
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+    size_t size() const          { return pend - pbegin; }
+    bool empty() const           { return pbegin == pend; }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read(): end of data");
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore(): end of data");
+        pbegin += nSize;
+    }
+
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
 /** Non-refcounted RAII wrapper for FILE*
  *
  * Will automatically close the file when it goes out of scope if not null.
@@ -0,0 +1,248 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockcompression.h"
+
+#include "blockfilewriter.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "undo.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcompression_tests, TestingSetup)
+
+static void CheckRoundTrip(const std::vector<char>& vData)
+{
+    std::vector<char> vCompressed;
+    CompressBlockData(vData.empty() ? NULL : &vData[0], vData.size(), vCompressed);
+    BOOST_CHECK(vCompressed.size() <= MaxCompressedSize(vData.size()));
+
+    std::vector<char> vOut;
+    BOOST_CHECK(DecompressBlockData(&vCompressed[0], vCompressed.size(), vData.size(), vOut));
+    BOOST_CHECK(vOut == vData);
+    // The size of the result has to be known exactly.
+    BOOST_CHECK(!DecompressBlockData(&vCompressed[0], vCompressed.size(), vData.size() + 1, vOut));
+    if (!vData.empty())
+        BOOST_CHECK(!DecompressBlockData(&vCompressed[0], vCompressed.size(), vData.size() - 1, vOut));
+}
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+    std::vector<char> vData;
+    CheckRoundTrip(vData);
+    for (int i = 0; i < 12; i++)
+        vData.push_back('a' + i);
+    CheckRoundTrip(vData);
+
+    // Repetitive data compresses.
+    vData.clear();
+    for (int i = 0; i < 100000; i++)
+        vData.push_back(i % 11);
+    CheckRoundTrip(vData);
+    std::vector<char> vCompressed;
+    CompressBlockData(&vData[0], vData.size(), vCompressed);
+    BOOST_CHECK(vCompressed.size() < vData.size() / 50);
+
+    // Random data, like proofs and ciphertexts, does not.
+    vData.resize(300000);
+    GetRandBytes((unsigned char*)&vData[0], vData.size());
+    CheckRoundTrip(vData);
+
+    // Random data with repeated runs in between.
+    for (size_t i = 0; i < vData.size(); i += 1000)
+        memset(&vData[i], 0, 300);
+    CheckRoundTrip(vData);
+}
+
+BOOST_AUTO_TEST_CASE(malformed)
+{
+    std::vector<char> vData(1000, 'x');
+    std::vector<char> vCompressed;
+    CompressBlockData(&vData[0], vData.size(), vCompressed);
+
+    std::vector<char> vOut;
+    // Truncated
+    for (size_t n = 0; n < vCompressed.size(); n++)
+        BOOST_CHECK(!DecompressBlockData(&vCompressed[0], n, vData.size(), vOut));
+
+    // A back reference before the start of the data
+    const char vBadOffset[] = {0x10, 'x', 0x05, 0x00};
+    BOOST_CHECK(!DecompressBlockData(vBadOffset, sizeof(vBadOffset), 5, vOut));
+    const char vZeroOffset[] = {0x10, 'x', 0x00, 0x00};
+    BOOST_CHECK(!DecompressBlockData(vZeroOffset, sizeof(vZeroOffset), 5, vOut));
+    // A literal run past the end of the input
+    const char vLongLiterals[] = {(char)0xf0, (char)0xff};
+    BOOST_CHECK(!DecompressBlockData(vLongLiterals, sizeof(vLongLiterals), 1000, vOut));
+}
+
+BOOST_AUTO_TEST_CASE(block_record)
+{
+    const CBlock& block = Params().GenesisBlock();
+    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+    ssBlock << block;
+
+    std::shared_ptr<const CDataStream> raw = SerializeBlockRecord(block, Params().MessageStart(), false);
+    BOOST_CHECK_EQUAL(raw->size(), ssBlock.size() + 8);
+    std::shared_ptr<const CDataStream> record = SerializeBlockRecord(block, Params().MessageStart(), true);
+    BOOST_CHECK(memcmp(&(*record)[0], Params().MessageStart(), MESSAGE_START_SIZE) == 0);
+    BOOST_CHECK(ReadLE32((const unsigned char*)&(*record)[4]) == ((record->size() - 8) | BLOCK_RECORD_COMPRESSED));
+    BOOST_CHECK_EQUAL(ReadLE32((const unsigned char*)&(*record)[8]), ssBlock.size());
+
+    // Compressed blocks are decompressed when they are read back.
+    CDiskBlockPos pos(103, 0);
+    BOOST_CHECK(WriteBlockToDisk(record, pos));
+    BOOST_CHECK_EQUAL(pos.nPos, 8);
+    BOOST_CHECK(blockFileWriter.Flush());
+
+    std::vector<unsigned char> vRead;
+    BOOST_CHECK(ReadRawBlockFromDisk(vRead, pos, Params().MessageStart()));
+    BOOST_CHECK(vRead.size() == ssBlock.size() && memcmp(&vRead[0], &ssBlock[0], vRead.size()) == 0);
+
+    CBlock blockRead;
+    BOOST_CHECK(ReadBlockFromDisk(blockRead, pos, Params().GetConsensus()));
+    BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+}
+
+/**
+ * Store nBlocks blocks after the genesis block in block file nFile the way
+ * earlier versions did, uncompressed, with their undo data and transaction
+ * index entries, and add them to the block index.
+ */
+static std::vector<CBlockIndex*> WriteOldBlockFile(int nFile, int nBlocks)
+{
+    const CChainParams& chainparams = Params();
+    CValidationState state;
+    std::vector<CBlockIndex*> vIndex;
+    std::vector<std::pair<uint256, CDiskTxPos> > vTxPos;
+    CBlockIndex* pprev = mapBlockIndex[chainparams.GetConsensus().hashGenesisBlock];
+    CDiskBlockPos pos(nFile, 0);
+    for (int i = 0; i < nBlocks; i++) {
+        CBlock block;
+        block.nVersion = 4;
+        block.hashPrevBlock = pprev->GetBlockHash();
+        block.nTime = pprev->nTime + 150;
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << (i + 1) << OP_0;
+        coinbase.vout.push_back(CTxOut(1000, CScript() << OP_TRUE));
+        block.vtx.push_back(coinbase);
+        CMutableTransaction spend;
+        spend.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+        spend.vout.push_back(CTxOut(500 + i, CScript() << OP_TRUE));
+        block.vtx.push_back(spend);
+        block.hashMerkleRoot = block.BuildMerkleTree();
+
+        std::shared_ptr<const CDataStream> record = SerializeBlockRecord(block, chainparams.MessageStart(), false);
+        BOOST_CHECK(FindBlockPos(state, pos, record->size(), i + 1, block.GetBlockTime(), true));
+        CDiskBlockPos blockPos = pos;
+        BOOST_CHECK(WriteBlockToDisk(record, blockPos));
+        pos.nPos += record->size();
+
+        CBlockUndo blockundo;
+        blockundo.vtxundo.resize(1);
+        blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(600 + i, CScript() << OP_TRUE), false, 1, 1));
+        CDiskBlockPos undoPos;
+        BOOST_CHECK(FindUndoPos(state, nFile, undoPos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40));
+        BOOST_CHECK(UndoWriteToDisk(blockundo, undoPos, pprev->GetBlockHash(), chainparams.MessageStart()));
+
+        CDiskTxPos txPos(blockPos, GetSizeOfCompactSize(block.vtx.size()));
+        for (const CTransaction& tx : block.vtx) {
+            vTxPos.push_back(std::make_pair(tx.GetHash(), txPos));
+            txPos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        }
+
+        CBlockIndex* pindex = new CBlockIndex(block);
+        BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(block.GetHash(), pindex)).first;
+        pindex->phashBlock = &mi->first;
+        pindex->pprev = pprev;
+        pindex->nHeight = i + 1;
+        pindex->nFile = nFile;
+        pindex->nDataPos = blockPos.nPos;
+        pindex->nUndoPos = undoPos.nPos;
+        pindex->nStatus |= BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO;
+        vIndex.push_back(pindex);
+        pprev = pindex;
+    }
+    BOOST_CHECK(pblocktree->WriteTxIndex(vTxPos));
+    return vIndex;
+}
+
+/** Check that the blocks, their undo data and their transaction index entries are read from their new copies. */
+static void CheckCompactedBlocks(int nOldFile, const std::vector<CBlockIndex*>& vIndex)
+{
+    const CChainParams& chainparams = Params();
+    for (const CBlockIndex* pindex : vIndex) {
+        BOOST_CHECK(pindex->nFile != nOldFile);
+
+        std::vector<unsigned char> vRaw;
+        BOOST_CHECK(ReadRawBlockFromDisk(vRaw, pindex->GetBlockPos(), chainparams.MessageStart()));
+        CBlock block;
+        CDataStream(vRaw, SER_DISK, CLIENT_VERSION) >> block;
+        BOOST_CHECK(block.GetHash() == pindex->GetBlockHash());
+
+        CBlockUndo blockundo;
+        BOOST_CHECK(UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()));
+        BOOST_CHECK_EQUAL(blockundo.vtxundo.size(), 1U);
+        BOOST_CHECK(blockundo.vtxundo[0].vprevout[0].txout.nValue == 600 + pindex->nHeight - 1);
+
+        for (const CTransaction& tx : block.vtx) {
+            CDiskTxPos txPos;
+            BOOST_CHECK(pblocktree->ReadTxIndex(tx.GetHash(), txPos));
+            BOOST_CHECK(txPos.nFile == pindex->nFile && txPos.nPos == pindex->nDataPos);
+            std::vector<unsigned char> vTxRaw;
+            BOOST_CHECK(ReadRawBlockFromDisk(vTxRaw, txPos, chainparams.MessageStart()));
+            CDataStream ssTx(vTxRaw, SER_DISK, CLIENT_VERSION);
+            ssTx.ignore(txPos.nTxOffset);
+            CTransaction txRead;
+            ssTx >> txRead;
+            BOOST_CHECK(txRead.GetHash() == tx.GetHash());
+        }
+    }
+    BOOST_CHECK(!boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(nOldFile, 0), "blk")));
+    BOOST_CHECK(!boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(nOldFile, 0), "rev")));
+}
+
+/** Compact old block file 1 into file 2, with the block file writer running if fAsync. */
+static void TestCompactBlockFile(bool fAsync)
+{
+    if (fAsync)
+        blockFileWriter.Start();
+    bool fTxIndexOld = fTxIndex;
+    fTxIndex = true;
+    {
+        LOCK(cs_main);
+        std::vector<CBlockIndex*> vIndex = WriteOldBlockFile(1, 10);
+        // New blocks, and the compacted copies, go to the next file.
+        CValidationState state;
+        CDiskBlockPos posNext(2, 0);
+        BOOST_CHECK(FindBlockPos(state, posNext, 0, 11, 0, true));
+        BOOST_CHECK(CompactBlockFile(Params(), 1, vIndex));
+        CheckCompactedBlocks(1, vIndex);
+    }
+    if (fAsync)
+        blockFileWriter.Stop();
+    fTxIndex = fTxIndexOld;
+    // No write that was queued for the old file recreates it.
+    BOOST_CHECK(!boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(1, 0), "blk")));
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_file)
+{
+    TestCompactBlockFile(false);
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_file_pending_writes)
+{
+    // The old file is written through the running block file writer and
+    // compacted at once, so its writes are still queued when the compactor
+    // reads the blocks back, and when it deletes the file.
+    TestCompactBlockFile(true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
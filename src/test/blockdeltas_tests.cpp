@@ -0,0 +1,100 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockdeltas.h"
+
+#include "key_io.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "undo.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockdeltas_tests, BasicTestingSetup)
+
+static CBlock MakeBlock(const CScript& scriptIn, const CScript& scriptOut, CBlockUndo& blockundo)
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.push_back(CTxOut(5 * COIN, scriptOut));
+    block.vtx.push_back(coinbase);
+
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 3)));
+    tx.vout.push_back(CTxOut(2 * COIN, scriptOut));
+    tx.vout.push_back(CTxOut(1 * COIN, CScript() << OP_RETURN));
+    block.vtx.push_back(tx);
+
+    blockundo.vtxundo.resize(1);
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(4 * COIN, scriptIn)));
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(compute)
+{
+    uint160 hash1, hash2;
+    hash1.SetHex("0102030405060708090a0b0c0d0e0f1011121314");
+    hash2.SetHex("1413121110");
+    CScript scriptIn = GetScriptForDestination(CScriptID(hash1));
+    CScript scriptOut = GetScriptForDestination(CKeyID(hash2));
+
+    CBlockUndo blockundo;
+    CBlock block = MakeBlock(scriptIn, scriptOut, blockundo);
+    CBlockDeltas deltas;
+    BOOST_CHECK(ComputeBlockDeltas(block, blockundo, deltas));
+    BOOST_CHECK_EQUAL(deltas.nSize, ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_REQUIRE_EQUAL(deltas.vtx.size(), 2);
+    BOOST_CHECK(deltas.vtx[0].txid == block.vtx[0].GetHash());
+    BOOST_CHECK(deltas.vtx[0].vin.empty());
+    BOOST_REQUIRE_EQUAL(deltas.vtx[0].vout.size(), 1);
+
+    // Inputs get the address and value of the output they spend from the undo data.
+    const CTxDeltas& tx = deltas.vtx[1];
+    BOOST_REQUIRE_EQUAL(tx.vin.size(), 1);
+    BOOST_CHECK_EQUAL(tx.vin[0].address, EncodeDestination(CScriptID(hash1)));
+    BOOST_CHECK_EQUAL(tx.vin[0].satoshis, -4 * COIN);
+    BOOST_CHECK(tx.vin[0].prevout == block.vtx[1].vin[0].prevout);
+    BOOST_REQUIRE_EQUAL(tx.vout.size(), 2);
+    BOOST_CHECK_EQUAL(tx.vout[0].address, EncodeDestination(CKeyID(hash2)));
+    BOOST_CHECK_EQUAL(tx.vout[0].satoshis, 2 * COIN);
+    // Scripts without an address
+    BOOST_CHECK(tx.vout[1].address.empty());
+    BOOST_CHECK_EQUAL(tx.vout[1].satoshis, 1 * COIN);
+
+    // Undo data of another block
+    blockundo.vtxundo.push_back(CTxUndo());
+    BOOST_CHECK(!ComputeBlockDeltas(block, blockundo, deltas));
+    blockundo.vtxundo.resize(1);
+    blockundo.vtxundo[0].vprevout.clear();
+    BOOST_CHECK(!ComputeBlockDeltas(block, blockundo, deltas));
+}
+
+BOOST_AUTO_TEST_CASE(cache)
+{
+    CBlockUndo blockundo;
+    CBlock block = MakeBlock(CScript(), CScript(), blockundo);
+    std::shared_ptr<CBlockDeltas> deltas = std::make_shared<CBlockDeltas>();
+    BOOST_CHECK(ComputeBlockDeltas(block, blockundo, *deltas));
+
+    // Room for two entries
+    CBlockDeltasCache cache(deltas->DynamicMemoryUsage() * 2);
+    uint256 hash1 = GetRandHash(), hash2 = GetRandHash(), hash3 = GetRandHash();
+    BOOST_CHECK(!cache.Get(hash1));
+    cache.Insert(hash1, deltas);
+    cache.Insert(hash2, deltas);
+    BOOST_CHECK(cache.Get(hash1) == deltas);
+
+    // The least recently used entry is evicted.
+    cache.Insert(hash3, deltas);
+    BOOST_CHECK(cache.Get(hash1) == deltas);
+    BOOST_CHECK(!cache.Get(hash2));
+    BOOST_CHECK(cache.Get(hash3) == deltas);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
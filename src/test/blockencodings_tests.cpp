@@ -0,0 +1,163 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockencodings.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_FIXTURE_TEST_SUITE(blockencodings_tests, BasicTestingSetup)
+
+static CBlock BuildBlockTestCase() {
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+
+    block.vtx.resize(3);
+    block.vtx[0] = tx;
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    block.vtx[1] = tx;
+
+    tx.vin.resize(10);
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout.hash = GetRandHash();
+        tx.vin[i].prevout.n = 0;
+    }
+    block.vtx[2] = tx;
+
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+static CBlockHeaderAndShortTxIDs RoundTrip(const CBlockHeaderAndShortTxIDs& cmpctblock) {
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << cmpctblock;
+    CBlockHeaderAndShortTxIDs result;
+    stream >> result;
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+
+    CMutableTransaction tx2(block.vtx[2]);
+    pool.addUnchecked(block.vtx[2].GetHash(), entry.FromTx(tx2));
+
+    CBlockHeaderAndShortTxIDs shortIDs2 = RoundTrip(CBlockHeaderAndShortTxIDs(block));
+    BOOST_CHECK_EQUAL(shortIDs2.BlockTxCount(), block.vtx.size());
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs2, vector<CTransaction>()) == READ_STATUS_OK);
+    BOOST_CHECK( partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+    BOOST_CHECK( partialBlock.IsTxAvailable(2));
+
+    // A wrong transaction makes the merkle root check fail.
+    CBlock block2;
+    {
+        PartiallyDownloadedBlock tmp = partialBlock;
+        BOOST_CHECK(partialBlock.FillBlock(block2, vector<CTransaction>()) == READ_STATUS_INVALID); // No transactions
+        partialBlock = tmp;
+    }
+    {
+        PartiallyDownloadedBlock tmp = partialBlock;
+        BOOST_CHECK(partialBlock.FillBlock(block2, vector<CTransaction>(1, block.vtx[2])) == READ_STATUS_FAILED); // Wrong transaction
+        partialBlock = tmp;
+    }
+
+    CBlock block3;
+    BOOST_CHECK(partialBlock.FillBlock(block3, vector<CTransaction>(1, block.vtx[1])) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block3.GetHash().ToString());
+    BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), block3.BuildMerkleTree().ToString());
+}
+
+BOOST_AUTO_TEST_CASE(ExtraTxnTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block(BuildBlockTestCase());
+
+    // Transactions missing from the mempool are taken from the extra pool.
+    PartiallyDownloadedBlock partialBlock(&pool);
+    vector<CTransaction> vExtraTxn;
+    vExtraTxn.push_back(block.vtx[1]);
+    vExtraTxn.push_back(block.vtx[2]);
+    BOOST_CHECK(partialBlock.InitData(RoundTrip(CBlockHeaderAndShortTxIDs(block)), vExtraTxn) == READ_STATUS_OK);
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(partialBlock.IsTxAvailable(i));
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, vector<CTransaction>()) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+    BOOST_CHECK_EQUAL(block2.vtx.size(), block.vtx.size());
+}
+
+BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig.resize(10);
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 42;
+
+    CBlock block;
+    block.vtx.resize(1);
+    block.vtx[0] = coinbase;
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(RoundTrip(CBlockHeaderAndShortTxIDs(block)), vector<CTransaction>()) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, vector<CTransaction>()) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+}
+
+BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest)
+{
+    BlockTransactionsRequest req1;
+    req1.blockhash = GetRandHash();
+    req1.indexes.resize(4);
+    req1.indexes[0] = 0;
+    req1.indexes[1] = 1;
+    req1.indexes[2] = 3;
+    req1.indexes[3] = 4;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << req1;
+
+    BlockTransactionsRequest req2;
+    stream >> req2;
+
+    BOOST_CHECK_EQUAL(req1.blockhash.ToString(), req2.blockhash.ToString());
+    BOOST_CHECK_EQUAL(req1.indexes.size(), req2.indexes.size());
+    BOOST_CHECK_EQUAL(req1.indexes[0], req2.indexes[0]);
+    BOOST_CHECK_EQUAL(req1.indexes[1], req2.indexes[1]);
+    BOOST_CHECK_EQUAL(req1.indexes[2], req2.indexes[2]);
+    BOOST_CHECK_EQUAL(req1.indexes[3], req2.indexes[3]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,132 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockfilemap.h"
+#include "blockfilewriter.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+/** Lets a test hold the writer thread before it writes anything, so queued data stays pending. */
+class TEST_FRIEND_CBlockFileWriter {
+public:
+    CBlockFileWriter& writer;
+
+    TEST_FRIEND_CBlockFileWriter(CBlockFileWriter& writerIn) : writer(writerIn) {}
+
+    boost::mutex& GetFilesMutex() { return writer.mutexFiles; }
+};
+
+BOOST_FIXTURE_TEST_SUITE(blockfilewriter_tests, TestingSetup)
+
+static CBlockFileWriter::DataPtr MakeData(unsigned char ch, size_t nSize)
+{
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_DISK, CLIENT_VERSION);
+    for (size_t i = 0; i < nSize; i++)
+        *ss << ch;
+    return ss;
+}
+
+static std::vector<char> ReadFile(const CDiskBlockPos& pos, size_t nSize)
+{
+    std::vector<char> vch(nSize);
+    FILE* file = OpenBlockFile(pos, true);
+    BOOST_REQUIRE(file != NULL);
+    BOOST_CHECK_EQUAL(fread(&vch[0], 1, nSize, file), nSize);
+    fclose(file);
+    return vch;
+}
+
+BOOST_AUTO_TEST_CASE(write_and_read_back)
+{
+    CBlockFileWriter writer;
+    writer.Start();
+
+    CDiskBlockPos pos1(100, 0), pos2(100, 1000);
+    {
+        // The writer thread waits for the files while this is held.
+        TEST_FRIEND_CBlockFileWriter proxy(writer);
+        boost::lock_guard<boost::mutex> lockFiles(proxy.GetFilesMutex());
+
+        BOOST_CHECK(writer.Allocate(BLOCK_FILE_BLK, pos1, 4096));
+        BOOST_CHECK(writer.Write(BLOCK_FILE_BLK, pos1, MakeData('a', 1000)));
+        BOOST_CHECK(writer.Write(BLOCK_FILE_BLK, pos2, MakeData('b', 500)));
+
+        // Queued data is readable until it has been written.
+        CBlockFileWriter::DataPtr pending = writer.GetPending(BLOCK_FILE_BLK, pos2);
+        BOOST_REQUIRE(pending);
+        BOOST_CHECK_EQUAL(pending->size(), 500U);
+        BOOST_CHECK_EQUAL((*pending)[0], 'b');
+        pending = writer.GetPending(BLOCK_FILE_BLK, pos1);
+        BOOST_REQUIRE(pending);
+        BOOST_CHECK_EQUAL(pending->size(), 1000U);
+        BOOST_CHECK(!writer.GetPending(BLOCK_FILE_REV, pos2));
+    }
+
+    BOOST_CHECK(writer.Flush());
+    BOOST_CHECK(!writer.GetPending(BLOCK_FILE_BLK, pos1));
+    BOOST_CHECK(!writer.GetPending(BLOCK_FILE_BLK, pos2));
+
+    std::vector<char> vch = ReadFile(pos1, 1500);
+    BOOST_CHECK(vch[0] == 'a' && vch[999] == 'a');
+    BOOST_CHECK(vch[1000] == 'b' && vch[1499] == 'b');
+
+    writer.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(write_without_thread)
+{
+    // Without a running thread writes happen right away.
+    CBlockFileWriter writer;
+    CDiskBlockPos pos(101, 10);
+    BOOST_CHECK(writer.Write(BLOCK_FILE_BLK, pos, MakeData('c', 100)));
+    BOOST_CHECK(!writer.GetPending(BLOCK_FILE_BLK, pos));
+    BOOST_CHECK(writer.Flush());
+
+    std::vector<char> vch = ReadFile(pos, 100);
+    BOOST_CHECK(vch[0] == 'c' && vch[99] == 'c');
+}
+
+BOOST_AUTO_TEST_CASE(mapped_read)
+{
+    CBlockFileWriter writer;
+    CDiskBlockPos pos(102, 0);
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_DISK, CLIENT_VERSION);
+    *ss << (uint32_t)42 << std::string("mapped");
+    BOOST_CHECK(writer.Write(BLOCK_FILE_BLK, pos, ss));
+    BOOST_CHECK(writer.Flush());
+
+    CBlockFileMapCache maps(1);
+    std::shared_ptr<const CBlockFileMapping> mapping = maps.Get(BLOCK_FILE_BLK, 102, ss->size());
+#ifndef WIN32
+    BOOST_REQUIRE(mapping);
+    BOOST_CHECK_EQUAL(mapping->size(), ss->size());
+    uint32_t n;
+    std::string str;
+    CSpanReader span(SER_DISK, CLIENT_VERSION, mapping->begin(), mapping->begin() + mapping->size());
+    span >> n >> str;
+    BOOST_CHECK_EQUAL(n, 42);
+    BOOST_CHECK_EQUAL(str, "mapped");
+    BOOST_CHECK(span.empty());
+    BOOST_CHECK_THROW(span >> n, std::ios_base::failure);
+
+    // The file grows past the mapping, which is then replaced.
+    BOOST_CHECK(!maps.Get(BLOCK_FILE_BLK, 102, ss->size() + 4));
+    BOOST_CHECK(writer.Write(BLOCK_FILE_BLK, CDiskBlockPos(102, ss->size()), ss));
+    BOOST_CHECK(writer.Flush());
+    std::shared_ptr<const CBlockFileMapping> mapping2 = maps.Get(BLOCK_FILE_BLK, 102, ss->size() + 4);
+    BOOST_REQUIRE(mapping2);
+    BOOST_CHECK_EQUAL(mapping2->size(), 2 * ss->size());
+    // Earlier mappings stay valid while they are used.
+    BOOST_CHECK_EQUAL(mapping->begin()[0], 42);
+#else
+    BOOST_CHECK(!mapping);
+#endif
+    BOOST_CHECK(!maps.Get(BLOCK_FILE_REV, 102, 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
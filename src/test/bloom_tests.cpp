@@ -534,4 +534,45 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blocked_bloom)
+{
+    CBlockedBloomFilter filter(2000, 0.001);
+    BOOST_CHECK(CBlockedBloomFilter::FalsePositiveRate(2000, filter.GetBlocks(), filter.GetHashFuncs()) <= 0.001);
+
+    seed_insecure_rand(true);
+    std::vector<uint64_t> vHashes;
+    for (int i = 0; i < 2000; i++) {
+        vHashes.push_back(((uint64_t)insecure_rand() << 32) | insecure_rand());
+        filter.insert(vHashes.back());
+    }
+    BOOST_FOREACH(uint64_t nHash, vHashes)
+        BOOST_CHECK(filter.contains(nHash));
+
+    // ~100 false positives expected out of 100,000
+    unsigned int nHits = 0;
+    for (int i = 0; i < 100000; i++) {
+        if (filter.contains(((uint64_t)insecure_rand() << 32) | insecure_rand()))
+            ++nHits;
+    }
+    BOOST_TEST_MESSAGE("BlockedBloomFilter got " << nHits << " false positives (~100 expected)");
+    BOOST_CHECK(nHits < 250);
+
+    // Copies hold the same elements, however their buffers are aligned.
+    CBlockedBloomFilter copy(filter);
+    CBlockedBloomFilter assigned(1, 0.5);
+    assigned = filter;
+    BOOST_FOREACH(uint64_t nHash, vHashes) {
+        BOOST_CHECK(copy.contains(nHash));
+        BOOST_CHECK(assigned.contains(nHash));
+    }
+
+    filter.clear();
+    nHits = 0;
+    BOOST_FOREACH(uint64_t nHash, vHashes) {
+        if (filter.contains(nHash))
+            ++nHits;
+    }
+    BOOST_CHECK_EQUAL(nHits, 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
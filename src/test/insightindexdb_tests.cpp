@@ -0,0 +1,89 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "txdb.h"
+
+#include "addressindex.h"
+#include "random.h"
+#include "spentindex.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(insightindexdb_tests, IndexDBTestingSetup<CInsightIndexDB>)
+
+static CInsightIndexUpdate MakeUpdate(const uint256& hashBlock, const uint256& hashPrevBlock, unsigned int nTime,
+                                      const uint160& addr, int nHeight, CAmount nValue, bool fDisconnect)
+{
+    CInsightIndexUpdate update;
+    update.fDisconnect = fDisconnect;
+    update.hashBlock = hashBlock;
+    update.hashPrevBlock = hashPrevBlock;
+    update.nTime = nTime;
+    update.fAllBalances = true;
+    update.addressIndex.push_back(std::make_pair(CAddressIndexKey(1, addr, nHeight, 0, hashBlock, 0, false), nValue));
+    update.addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, addr, hashBlock, 0),
+        fDisconnect ? CAddressUnspentValue() : CAddressUnspentValue(nValue, CScript(), nHeight)));
+    return update;
+}
+
+BOOST_AUTO_TEST_CASE(write_updates)
+{
+    uint256 hash0 = GetRandHash(), hash1 = GetRandHash(), hash2 = GetRandHash();
+    uint160 addr;
+    addr.SetHex("0102030405060708090a0b0c0d0e0f1011121314");
+    std::vector<CInsightIndexUpdate> updates;
+    updates.push_back(MakeUpdate(hash1, hash0, 1000, addr, 1, 500, false));
+    // The second block has an earlier time, so its logical timestamp follows the first's.
+    updates.push_back(MakeUpdate(hash2, hash1, 900, addr, 2, 700, false));
+    BOOST_CHECK(db.WriteUpdates(updates));
+
+    uint256 hashBest;
+    BOOST_CHECK(db.ReadBestBlock(hashBest));
+    BOOST_CHECK(hashBest == hash2);
+    CAddressBalanceValue balance;
+    BOOST_CHECK(db.ReadAddressBalance(CAddressIndexIteratorKey(1, addr), balance));
+    BOOST_CHECK_EQUAL(balance.balance, 1200);
+    BOOST_CHECK_EQUAL(balance.received, 1200);
+    unsigned int logicalTS;
+    BOOST_CHECK(db.ReadTimestampBlockIndex(hash2, logicalTS));
+    BOOST_CHECK_EQUAL(logicalTS, 1001);
+
+    // Disconnecting the second block undoes its entries and balance.
+    updates.assign(1, MakeUpdate(hash2, hash1, 900, addr, 2, 700, true));
+    BOOST_CHECK(db.WriteUpdates(updates));
+    BOOST_CHECK(db.ReadBestBlock(hashBest));
+    BOOST_CHECK(hashBest == hash1);
+    BOOST_CHECK(db.ReadAddressBalance(CAddressIndexIteratorKey(1, addr), balance));
+    BOOST_CHECK_EQUAL(balance.balance, 500);
+    BOOST_CHECK_EQUAL(balance.received, 500);
+    std::vector<CAddressIndexDbEntry> addressIndex;
+    BOOST_CHECK(db.ReadAddressIndex(addr, 1, addressIndex));
+    BOOST_REQUIRE_EQUAL(addressIndex.size(), 1);
+    BOOST_CHECK(addressIndex[0].first.txhash == hash1);
+    std::vector<CAddressUnspentDbEntry> unspent;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(addr, 1, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(balance_cursor)
+{
+    uint160 addr1, addr2;
+    addr1.SetHex("01");
+    addr2.SetHex("02");
+
+    CInsightIndexUpdate update = MakeUpdate(GetRandHash(), GetRandHash(), 1000, addr1, 1, 100, false);
+    update.addressIndex.push_back(std::make_pair(CAddressIndexKey(1, addr2, 1, 1, update.hashBlock, 0, false), 200));
+    // Only the balances of addresses before the cursor are kept while the balance index is built.
+    update.fAllBalances = false;
+    update.balanceCursor = CAddressIndexIteratorKey(1, addr2);
+    BOOST_CHECK(db.WriteUpdates(std::vector<CInsightIndexUpdate>(1, update)));
+
+    CAddressBalanceValue balance;
+    BOOST_CHECK(db.ReadAddressBalance(CAddressIndexIteratorKey(1, addr1), balance));
+    BOOST_CHECK_EQUAL(balance.balance, 100);
+    BOOST_CHECK(!db.ReadAddressBalance(CAddressIndexIteratorKey(1, addr2), balance));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,119 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "net.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(recv_stream_chunks)
+{
+    // A payload spanning several chunks, appended in uneven pieces.
+    vector<unsigned char> vData(RECV_CHUNK_SIZE * 2 + 1000);
+    for (size_t i = 0; i < vData.size(); i++)
+        vData[i] = insecure_rand();
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << string("header") << vData << (uint32_t)0xdeadbeef;
+
+    CRecvChunkPool pool;
+    {
+        CRecvDataStream stream(&pool, SER_NETWORK, PROTOCOL_VERSION);
+        stream.Reserve(ss.size());
+        size_t nPos = 0, nPiece = 1;
+        while (nPos < ss.size()) {
+            size_t nBytes = std::min(nPiece, ss.size() - nPos);
+            stream.Append(&ss[nPos], nBytes);
+            nPos += nBytes;
+            nPiece = nPiece * 3 + 7;
+        }
+        BOOST_CHECK_EQUAL(stream.size(), ss.size());
+        BOOST_CHECK(stream.GetHash() == Hash(ss.begin(), ss.end()));
+
+        string str;
+        vector<unsigned char> vRead;
+        uint32_t n;
+        stream >> str >> vRead >> n;
+        BOOST_CHECK_EQUAL(str, "header");
+        BOOST_CHECK(vRead == vData);
+        BOOST_CHECK_EQUAL(n, 0xdeadbeef);
+        BOOST_CHECK(stream.empty());
+        BOOST_CHECK_THROW(stream >> n, std::ios_base::failure);
+    }
+
+    // The chunks went back to the pool and are reused by the next message.
+    BOOST_CHECK_EQUAL(pool.size(), 3U);
+    {
+        CRecvDataStream stream(&pool, SER_NETWORK, PROTOCOL_VERSION);
+        stream.Append("abc", 3);
+        BOOST_CHECK_EQUAL(pool.size(), 2U);
+        stream.ignore(1);
+        char ch;
+        stream.read(&ch, 1);
+        BOOST_CHECK_EQUAL(ch, 'b');
+        BOOST_CHECK_THROW(stream.ignore(2), std::ios_base::failure);
+    }
+    BOOST_CHECK_EQUAL(pool.size(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(recv_message_checksum)
+{
+    CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << GetRandHash();
+
+    // Build the wire message the way EndMessage does.
+    CMessageHeader hdr(Params().MessageStart(), "ping", ss.size());
+    uint256 hash = Hash(ss.begin(), ss.end());
+    memcpy(&hdr.nChecksum, &hash, sizeof(hdr.nChecksum));
+    CDataStream msg(SER_NETWORK, PROTOCOL_VERSION);
+    msg << hdr << ss;
+
+    LOCK(node.cs_vRecvMsg);
+    BOOST_CHECK(node.ReceiveMsgBytes(&msg[0], msg.size() - 1));
+    BOOST_CHECK_EQUAL(node.vRecvMsg.size(), 1U);
+    BOOST_CHECK(!node.vRecvMsg.front().complete());
+    BOOST_CHECK(node.ReceiveMsgBytes(&msg[msg.size() - 1], 1));
+    BOOST_CHECK(node.vRecvMsg.front().complete());
+    BOOST_CHECK_EQUAL(node.GetTotalRecvSize(), msg.size());
+    uint256 hashRecv = node.vRecvMsg.front().vRecv.GetHash();
+    BOOST_CHECK_EQUAL(ReadLE32((const unsigned char*)&hashRecv), hdr.nChecksum);
+}
+
+BOOST_AUTO_TEST_CASE(message_type_stats)
+{
+    CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+    node.RecordMessageRecv("inv", 61, 10);
+    node.RecordMessageRecv("inv", 61, 5);
+    node.RecordMessageRecv("notacommand", 24, 1);
+    node.PushMessage("ping", (uint64_t)1);
+
+    CNodeStats stats;
+    node.copyStats(stats);
+    BOOST_CHECK_EQUAL(stats.mapRecvPerMsgType["inv"].nCount, 2U);
+    BOOST_CHECK_EQUAL(stats.mapRecvPerMsgType["inv"].nBytes, 122U);
+    BOOST_CHECK_EQUAL(stats.mapRecvPerMsgType["inv"].nTimeMicros, 15);
+    // Unknown commands are all counted under one entry.
+    BOOST_CHECK(!stats.mapRecvPerMsgType.count("notacommand"));
+    BOOST_CHECK_EQUAL(stats.mapRecvPerMsgType[NET_MESSAGE_COMMAND_OTHER].nCount, 1U);
+    BOOST_CHECK_EQUAL(stats.mapSendPerMsgType["ping"].nCount, 1U);
+    BOOST_CHECK_EQUAL(stats.mapSendPerMsgType["ping"].nBytes, (uint64_t)CMessageHeader::HEADER_SIZE + 8);
+
+    mapMsgTypeStats mapSend, mapRecv;
+    GetMessageTypeTotals(mapSend, mapRecv);
+    BOOST_CHECK(mapRecv["inv"].nCount >= 2);
+    BOOST_CHECK(mapSend["ping"].nCount >= 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -108,6 +108,44 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
     }
 }
 
+BOOST_AUTO_TEST_CASE(pmt_merkle_block_data)
+{
+    seed_insecure_rand(false);
+    CBlock block;
+    for (unsigned int j = 0; j < 13; j++) {
+        CMutableTransaction tx;
+        tx.nLockTime = j;
+        block.vtx.push_back(CTransaction(tx));
+    }
+    uint256 merkleRoot = block.BuildMerkleTree();
+
+    // The cached levels end in the merkle root, and trees built from them
+    // are the same as the ones built from the txids.
+    CMerkleBlockData data(block);
+    BOOST_CHECK_EQUAL(data.vLevels.size(), 5);
+    BOOST_CHECK(data.vLevels.back().size() == 1 && data.vLevels.back()[0] == merkleRoot);
+    for (int att = 0; att < 10; att++) {
+        std::vector<bool> vMatch(block.vtx.size());
+        for (unsigned int j = 0; j < vMatch.size(); j++)
+            vMatch[j] = (insecure_rand() % 3) == 0;
+        CDataStream ss1(SER_NETWORK, PROTOCOL_VERSION), ss2(SER_NETWORK, PROTOCOL_VERSION);
+        ss1 << CPartialMerkleTree(data.vLevels[0], vMatch);
+        ss2 << CPartialMerkleTree(data.vLevels, vMatch);
+        BOOST_CHECK(ss1.str() == ss2.str());
+    }
+
+    // The same data serves filters that match different transactions.
+    for (unsigned int j = 0; j < block.vtx.size(); j += 4) {
+        CBloomFilter filter(10, 0.000001, 0, BLOOM_UPDATE_ALL);
+        filter.insert(block.vtx[j].GetHash());
+        CMerkleBlock merkleBlock(data, filter);
+        BOOST_CHECK_EQUAL(merkleBlock.vMatchedTxn.size(), 1);
+        BOOST_CHECK_EQUAL(merkleBlock.vMatchedTxn[0].first, j);
+        std::vector<uint256> vMatched;
+        BOOST_CHECK(merkleBlock.txn.ExtractMatches(vMatched) == merkleRoot);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(pmt_malleability)
 {
     std::vector<uint256> vTxid = boost::assign::list_of
@@ -0,0 +1,138 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "crypto/equihash.h"
+#include "main.h"
+#include "miner.h"
+#include "pow.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#ifdef ENABLE_MINING
+
+/** Regtest, whose Equihash parameters are small enough to mine blocks in a test. */
+struct RegtestTestingSetup : public TestingSetup {
+    RegtestTestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+BOOST_FIXTURE_TEST_SUITE(reindex_tests, RegtestTestingSetup)
+
+/** Find an Equihash solution that meets the block's target. */
+static void SolveBlock(CBlock& block, const Consensus::Params& params)
+{
+    unsigned int n = params.nEquihashN;
+    unsigned int k = params.nEquihashK;
+    std::function<bool(std::vector<unsigned char>)> validBlock =
+            [&block, &params](std::vector<unsigned char> soln) {
+        block.nSolution = soln;
+        return CheckProofOfWork(block.GetHash(), block.nBits, params);
+    };
+    while (true) {
+        crypto_generichash_blake2b_state state;
+        EhInitialiseState(n, k, state);
+        CEquihashInput I{block};
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << I;
+        crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
+        crypto_generichash_blake2b_update(&state, block.nNonce.begin(), block.nNonce.size());
+        if (EhBasicSolveUncancellable(n, k, state, validBlock))
+            return;
+        block.nNonce = ArithToUint256(UintToArith256(block.nNonce) + 1);
+    }
+}
+
+/** Mine a block on the tip and connect it. */
+static CBlock MineBlock(const CChainParams& chainparams)
+{
+    CBlockTemplate* pblocktemplate = CreateNewBlock(chainparams, CScript() << OP_TRUE);
+    BOOST_REQUIRE(pblocktemplate);
+    CBlock block = pblocktemplate->block;
+    delete pblocktemplate;
+    SolveBlock(block, chainparams.GetConsensus());
+
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlock(state, chainparams, NULL, &block, true, NULL));
+    BOOST_CHECK_MESSAGE(state.IsValid(), state.GetRejectReason());
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(reindex_out_of_order)
+{
+    const CChainParams& chainparams = Params();
+
+    // A chain of four blocks.
+    std::vector<CBlock> vChain;
+    for (int i = 0; i < 4; i++)
+        vChain.push_back(MineBlock(chainparams));
+
+    // A block in place of the third one that passes CheckBlock, but not
+    // ContextualCheckBlock, as its coinbase does not start with its height,
+    // and a child of it.
+    CBlock blockInvalid = vChain[2];
+    CMutableTransaction txCoinbase(blockInvalid.vtx[0]);
+    txCoinbase.vin[0].scriptSig = CScript() << 99 << OP_0;
+    blockInvalid.vtx[0] = CTransaction(txCoinbase);
+    blockInvalid.hashMerkleRoot = blockInvalid.BuildMerkleTree();
+    SolveBlock(blockInvalid, chainparams.GetConsensus());
+    CBlock blockInvalidChild = vChain[3];
+    blockInvalidChild.hashPrevBlock = blockInvalid.GetHash();
+    SolveBlock(blockInvalidChild, chainparams.GetConsensus());
+
+    // Start over from a block file that has children before their parents,
+    // as blocks downloaded in parallel are stored.
+    UnloadBlockIndex();
+    delete pcoinsTip;
+    delete pcoinsdbview;
+    delete pblocktree;
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+    std::set<int> setFiles;
+    setFiles.insert(0);
+    UnlinkPrunedFiles(setFiles);
+
+    std::vector<const CBlock*> vStored;
+    vStored.push_back(&chainparams.GenesisBlock());
+    vStored.push_back(&vChain[0]);
+    vStored.push_back(&vChain[2]);
+    vStored.push_back(&blockInvalidChild);
+    vStored.push_back(&vChain[1]);
+    vStored.push_back(&blockInvalid);
+    vStored.push_back(&vChain[3]);
+    {
+        CAutoFile file(OpenBlockFile(CDiskBlockPos(0, 0)), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!file.IsNull());
+        for (const CBlock* pblock : vStored) {
+            std::shared_ptr<const CDataStream> record = SerializeBlockRecord(*pblock, chainparams.MessageStart(), false);
+            file.write(&(*record)[0], record->size());
+        }
+    }
+
+    fReindex = true;
+    InitBlockIndex(chainparams);
+    BOOST_CHECK(ReindexBlockFiles(chainparams));
+    fReindex = false;
+
+    LOCK(cs_main);
+    // The third block is connected once the second one shows up, and the
+    // fourth after it.
+    BOOST_CHECK_EQUAL(chainActive.Height(), 4);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == vChain[3].GetHash());
+    for (const CBlock& block : vChain)
+        BOOST_CHECK(mapBlockIndex[block.GetHash()]->nStatus & BLOCK_HAVE_DATA);
+
+    // The invalid block is not stored, and its child is never processed.
+    BlockMap::iterator mi = mapBlockIndex.find(blockInvalid.GetHash());
+    BOOST_CHECK(mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA));
+    BOOST_CHECK(!mapBlockIndex.count(blockInvalidChild.GetHash()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif // ENABLE_MINING
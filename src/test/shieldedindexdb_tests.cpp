@@ -0,0 +1,218 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "txdb.h"
+
+#include "compactshieldedblock.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "shieldedindex.h"
+#include "test/test_bitcoin.h"
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+/** Builds the updates the shielded indexer writes when blocks are connected and disconnected. */
+struct ShieldedIndexDBTestingSetup: public IndexDBTestingSetup<CShieldedIndexDB> {
+    /** A transaction with nSprout and nSapling random nullifiers and note commitments. */
+    static CShieldedTxIndexValue MakeTx(unsigned int nSprout, unsigned int nSapling)
+    {
+        CShieldedTxIndexValue tx;
+        tx.txid = GetRandHash();
+        for (unsigned int i = 0; i < nSprout; i++) {
+            tx.sproutNullifiers.push_back(GetRandHash());
+            tx.sproutCommitments.push_back(GetRandHash());
+        }
+        for (unsigned int i = 0; i < nSapling; i++) {
+            tx.saplingNullifiers.push_back(GetRandHash());
+            tx.saplingCommitments.push_back(GetRandHash());
+        }
+        return tx;
+    }
+
+    static CShieldedIndexUpdate Connect(int nHeight, const uint256& hashBlock, const std::vector<CShieldedTxIndexValue>& vtx)
+    {
+        CShieldedIndexUpdate update;
+        update.fDisconnect = false;
+        update.nHeight = nHeight;
+        update.block.hashBlock = hashBlock;
+        update.block.vtx = vtx;
+        update.compact.nHeight = nHeight;
+        update.compact.hash = hashBlock;
+        return update;
+    }
+
+    static CShieldedIndexUpdate Disconnect(int nHeight, const uint256& hashBlock)
+    {
+        CShieldedIndexUpdate update = Connect(nHeight, hashBlock, std::vector<CShieldedTxIndexValue>());
+        update.fDisconnect = true;
+        return update;
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(shieldedindexdb_tests, ShieldedIndexDBTestingSetup)
+
+BOOST_AUTO_TEST_CASE(commitment_positions)
+{
+    // Each pool's commitments are numbered in chain order, continuing over
+    // blocks without shielded transactions.
+    std::vector<CShieldedTxIndexValue> vtx1, vtx3;
+    vtx1.push_back(MakeTx(2, 0));
+    vtx1.push_back(MakeTx(0, 3));
+    vtx3.push_back(MakeTx(1, 2));
+    std::vector<CShieldedIndexUpdate> updates;
+    updates.push_back(Connect(1, GetRandHash(), vtx1));
+    updates.push_back(Connect(2, GetRandHash(), std::vector<CShieldedTxIndexValue>()));
+    updates.push_back(Connect(3, GetRandHash(), vtx3));
+    BOOST_CHECK(db.WriteUpdates(updates, updates.back().block.hashBlock));
+
+    CCommitmentIndexValue commitment;
+    BOOST_CHECK(db.ReadCommitment(SPROUT, vtx1[0].sproutCommitments[1], commitment));
+    BOOST_CHECK_EQUAL(commitment.blockHeight, 1);
+    BOOST_CHECK_EQUAL(commitment.position, 1);
+    BOOST_CHECK(db.ReadCommitment(SAPLING, vtx1[1].saplingCommitments[2], commitment));
+    BOOST_CHECK_EQUAL(commitment.position, 2);
+    BOOST_CHECK(db.ReadCommitment(SPROUT, vtx3[0].sproutCommitments[0], commitment));
+    BOOST_CHECK_EQUAL(commitment.blockHeight, 3);
+    BOOST_CHECK_EQUAL(commitment.position, 2);
+    BOOST_CHECK(db.ReadCommitment(SAPLING, vtx3[0].saplingCommitments[1], commitment));
+    BOOST_CHECK_EQUAL(commitment.position, 4);
+    // The pools are indexed separately.
+    BOOST_CHECK(!db.ReadCommitment(SAPLING, vtx3[0].sproutCommitments[0], commitment));
+
+    // Each block records the tree sizes before it.
+    CShieldedBlockIndexValue block;
+    BOOST_CHECK(db.ReadBlock(3, block));
+    BOOST_CHECK_EQUAL(block.sproutTreeSize, 2);
+    BOOST_CHECK_EQUAL(block.saplingTreeSize, 3);
+
+    // Nullifiers map to their transaction and their index in its pool.
+    CNullifierIndexValue nullifier;
+    BOOST_CHECK(db.ReadNullifier(SAPLING, vtx3[0].saplingNullifiers[1], nullifier));
+    BOOST_CHECK(nullifier.txid == vtx3[0].txid);
+    BOOST_CHECK_EQUAL(nullifier.blockHeight, 3);
+    BOOST_CHECK_EQUAL(nullifier.spendIndex, 1);
+    BOOST_CHECK(!db.ReadNullifier(SPROUT, vtx3[0].saplingNullifiers[1], nullifier));
+
+    // A block is only connected on top of the one before it.
+    updates.assign(1, Connect(5, GetRandHash(), vtx1));
+    BOOST_CHECK(!db.WriteUpdates(updates, updates.back().block.hashBlock));
+}
+
+BOOST_AUTO_TEST_CASE(block_range_reads)
+{
+    std::vector<CShieldedIndexUpdate> updates;
+    for (int nHeight = 1; nHeight <= 4; nHeight++)
+        updates.push_back(Connect(nHeight, GetRandHash(), std::vector<CShieldedTxIndexValue>(1, MakeTx(0, 1))));
+    BOOST_CHECK(db.WriteUpdates(updates, updates.back().block.hashBlock));
+
+    std::vector<CShieldedBlockDbEntry> blocks;
+    BOOST_CHECK(db.ReadBlocks(2, 3, blocks));
+    BOOST_REQUIRE_EQUAL(blocks.size(), 2);
+    BOOST_CHECK_EQUAL(blocks[0].first, 2);
+    BOOST_CHECK(blocks[0].second.hashBlock == updates[1].block.hashBlock);
+    BOOST_CHECK_EQUAL(blocks[1].first, 3);
+    BOOST_CHECK_EQUAL(blocks[1].second.saplingTreeSize, 2);
+
+    // Ranges past the tip stop at the last block, without running into the
+    // compact blocks stored after the blocks.
+    blocks.clear();
+    BOOST_CHECK(db.ReadBlocks(4, std::numeric_limits<int>::max(), blocks));
+    BOOST_CHECK_EQUAL(blocks.size(), 1);
+    blocks.clear();
+    BOOST_CHECK(db.ReadBlocks(5, 10, blocks));
+    BOOST_CHECK(blocks.empty());
+
+    std::vector<CCompactShieldedBlock> compactBlocks;
+    BOOST_CHECK(db.ReadCompactBlocks(3, std::numeric_limits<int>::max(), compactBlocks));
+    BOOST_REQUIRE_EQUAL(compactBlocks.size(), 2);
+    BOOST_CHECK_EQUAL(compactBlocks[0].nHeight, 3);
+    BOOST_CHECK(compactBlocks[1].hash == updates[3].block.hashBlock);
+}
+
+BOOST_AUTO_TEST_CASE(disconnect)
+{
+    uint256 hash1 = GetRandHash(), hash2 = GetRandHash();
+    std::vector<CShieldedTxIndexValue> vtx1(1, MakeTx(1, 1)), vtx2(1, MakeTx(1, 2));
+    std::vector<CShieldedIndexUpdate> updates;
+    updates.push_back(Connect(1, hash1, vtx1));
+    updates.push_back(Connect(2, hash2, vtx2));
+    BOOST_CHECK(db.WriteUpdates(updates, hash2));
+
+    // Only the block indexed at a height can be disconnected from it.
+    updates.assign(1, Disconnect(2, hash1));
+    BOOST_CHECK(!db.WriteUpdates(updates, hash1));
+
+    // Disconnecting a block removes its nullifiers, commitments and blocks.
+    updates.assign(1, Disconnect(2, hash2));
+    BOOST_CHECK(db.WriteUpdates(updates, hash1));
+    uint256 hashBest;
+    BOOST_CHECK(db.ReadBestBlock(hashBest));
+    BOOST_CHECK(hashBest == hash1);
+    CNullifierIndexValue nullifier;
+    CCommitmentIndexValue commitment;
+    BOOST_CHECK(!db.ReadNullifier(SPROUT, vtx2[0].sproutNullifiers[0], nullifier));
+    BOOST_CHECK(!db.ReadNullifier(SAPLING, vtx2[0].saplingNullifiers[1], nullifier));
+    BOOST_CHECK(!db.ReadCommitment(SAPLING, vtx2[0].saplingCommitments[0], commitment));
+    BOOST_CHECK(db.ReadNullifier(SAPLING, vtx1[0].saplingNullifiers[0], nullifier));
+    BOOST_CHECK(db.ReadCommitment(SPROUT, vtx1[0].sproutCommitments[0], commitment));
+    std::vector<CShieldedBlockDbEntry> blocks;
+    BOOST_CHECK(db.ReadBlocks(1, 10, blocks));
+    BOOST_CHECK_EQUAL(blocks.size(), 1);
+    std::vector<CCompactShieldedBlock> compactBlocks;
+    BOOST_CHECK(db.ReadCompactBlocks(1, 10, compactBlocks));
+    BOOST_CHECK_EQUAL(compactBlocks.size(), 1);
+
+    // A reorg disconnects and connects in one batch; the new block's
+    // commitments take the positions the old one's had.
+    updates.assign(1, Connect(2, hash2, vtx2));
+    BOOST_CHECK(db.WriteUpdates(updates, hash2));
+    uint256 hash2b = GetRandHash();
+    std::vector<CShieldedTxIndexValue> vtx2b(1, MakeTx(0, 1));
+    updates.assign(1, Disconnect(2, hash2));
+    updates.push_back(Connect(2, hash2b, vtx2b));
+    BOOST_CHECK(db.WriteUpdates(updates, hash2b));
+    BOOST_CHECK(db.ReadCommitment(SAPLING, vtx2b[0].saplingCommitments[0], commitment));
+    BOOST_CHECK_EQUAL(commitment.blockHeight, 2);
+    BOOST_CHECK_EQUAL(commitment.position, 1);
+    BOOST_CHECK(!db.ReadCommitment(SAPLING, vtx2[0].saplingCommitments[0], commitment));
+}
+
+BOOST_AUTO_TEST_CASE(compact_block)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.resize(1);
+    CBlock block;
+    block.vtx.push_back(mtx);
+
+    SpendDescription spend;
+    spend.nullifier = GetRandHash();
+    mtx.vShieldedSpend.push_back(spend);
+    OutputDescription output;
+    output.cm = GetRandHash();
+    output.ephemeralKey = GetRandHash();
+    for (unsigned int i = 0; i < output.encCiphertext.size(); i++)
+        output.encCiphertext[i] = i;
+    mtx.vShieldedOutput.push_back(output);
+    block.vtx.push_back(mtx);
+
+    // Only transactions with Sapling spends or outputs are kept.
+    CCompactShieldedBlock compact;
+    GetCompactShieldedBlock(block, 5, compact);
+    BOOST_CHECK_EQUAL(compact.nHeight, 5);
+    BOOST_CHECK(compact.hash == block.GetHash());
+    BOOST_CHECK_EQUAL(compact.vtx.size(), 1);
+    const CCompactShieldedTx& tx = compact.vtx[0];
+    BOOST_CHECK_EQUAL(tx.index, 1);
+    BOOST_CHECK(tx.txid == block.vtx[1].GetHash());
+    BOOST_CHECK(tx.nullifiers[0] == spend.nullifier);
+    BOOST_CHECK(tx.outputs[0].cmu == output.cm);
+    BOOST_CHECK(tx.outputs[0].epk == output.ephemeralKey);
+    BOOST_CHECK(std::equal(tx.outputs[0].ciphertext.begin(), tx.outputs[0].ciphertext.end(),
+                           output.encCiphertext.begin()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
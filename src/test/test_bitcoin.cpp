@@ -35,7 +35,7 @@ ZCJoinSplit *pzcashParams;
 extern bool fPrintToConsole;
 extern void noui_connect();
 
-JoinSplitTestingSetup::JoinSplitTestingSetup()
+JoinSplitTestingSetup::JoinSplitTestingSetup(CBaseChainParams::Network network) : BasicTestingSetup(network)
 {
     pzcashParams = ZCJoinSplit::Prepared();
 
@@ -68,7 +68,7 @@ JoinSplitTestingSetup::~JoinSplitTestingSetup()
     delete pzcashParams;
 }
 
-BasicTestingSetup::BasicTestingSetup()
+BasicTestingSetup::BasicTestingSetup(CBaseChainParams::Network network)
 {
     assert(init_and_check_sodium() != -1);
     ECC_Start();
@@ -76,14 +76,14 @@ BasicTestingSetup::BasicTestingSetup()
     SetupNetworking();
     fPrintToDebugLog = false; // don't want to write to debug.log file
     fCheckBlockIndex = true;
-    SelectParams(CBaseChainParams::MAIN);
+    SelectParams(network);
 }
 BasicTestingSetup::~BasicTestingSetup()
 {
     ECC_Stop();
 }
 
-TestingSetup::TestingSetup()
+TestingSetup::TestingSetup(CBaseChainParams::Network network) : JoinSplitTestingSetup(network)
 {
     const CChainParams& chainparams = Params();
         // Ideally we'd move all the RPC tests to the functional testing framework
@@ -102,6 +102,7 @@ TestingSetup::TestingSetup()
         boost::filesystem::create_directories(pathTemp);
         mapArgs["-datadir"] = pathTemp.string();
         pblocktree = new CBlockTreeDB(1 << 20, true);
+        pinsightdb = new CInsightIndexDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
         pcoinsTip = new CCoinsViewCache(pcoinsdbview);
         InitBlockIndex(chainparams);
@@ -131,6 +132,8 @@ TestingSetup::~TestingSetup()
         delete pcoinsTip;
         delete pcoinsdbview;
         delete pblocktree;
+        delete pinsightdb;
+        pinsightdb = NULL;
 #ifdef ENABLE_WALLET
         bitdb.Flush(true);
         bitdb.Reset();
@@ -1,6 +1,7 @@
 #ifndef BITCOIN_TEST_TEST_BITCOIN_H
 #define BITCOIN_TEST_TEST_BITCOIN_H
 
+#include "chainparamsbase.h"
 #include "consensus/upgrades.h"
 #include "pubkey.h"
 #include "txdb.h"
@@ -14,13 +15,13 @@
 struct BasicTestingSetup {
     ECCVerifyHandle globalVerifyHandle;
 
-    BasicTestingSetup();
+    BasicTestingSetup(CBaseChainParams::Network network = CBaseChainParams::MAIN);
     ~BasicTestingSetup();
 };
 
 // Setup w.r.t. zk-SNARK API
 struct JoinSplitTestingSetup: public BasicTestingSetup {
-    JoinSplitTestingSetup();
+    JoinSplitTestingSetup(CBaseChainParams::Network network = CBaseChainParams::MAIN);
     ~JoinSplitTestingSetup();
 };
 
@@ -34,10 +35,18 @@ struct TestingSetup: public JoinSplitTestingSetup {
     boost::filesystem::path pathTemp;
     boost::thread_group threadGroup;
 
-    TestingSetup();
+    TestingSetup(CBaseChainParams::Network network = CBaseChainParams::MAIN);
     ~TestingSetup();
 };
 
+/** Testing setup with a fresh in-memory index database of type T for each test. */
+template <typename T>
+struct IndexDBTestingSetup: public TestingSetup {
+    T db;
+
+    IndexDBTestingSetup() : db(1 << 20, true) {}
+};
+
 class CTxMemPoolEntry;
 class CTxMemPool;
 
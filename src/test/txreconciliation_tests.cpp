@@ -0,0 +1,135 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "txreconciliation.h"
+
+#include "clientversion.h"
+#include "random.h"
+#include "streams.h"
+#include "uint256.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(shortid_salt_order)
+{
+    CTxReconShortIdHasher a(1, 2), b(2, 1), c(1, 3);
+    uint256 txid = GetRandHash();
+    BOOST_CHECK_EQUAL(a(txid), b(txid));
+    BOOST_CHECK(a(txid) != c(txid));
+}
+
+BOOST_AUTO_TEST_CASE(sketch_cells)
+{
+    for (uint32_t n = 0; n < 2000; n += 7) {
+        uint32_t nCells = CReconSketch::CellsForCapacity(n);
+        BOOST_CHECK_EQUAL(nCells % CReconSketch::NUM_HASHES, 0);
+        BOOST_CHECK(nCells <= MAX_TXRECON_SKETCH_CELLS);
+        BOOST_CHECK(CReconSketch(nCells).IsWithinSizeConstraints());
+    }
+    BOOST_CHECK(TxReconSketchCells(10, 10) > 0);
+    BOOST_CHECK_EQUAL(TxReconSketchCells(0, MAX_TXRECON_SKETCH_CELLS), 0);
+}
+
+BOOST_AUTO_TEST_CASE(sketch_decode_difference)
+{
+    seed_insecure_rand(true);
+    set<uint32_t> setShared, setOurs, setTheirs;
+    while (setShared.size() < 500)
+        setShared.insert(insecure_rand());
+    while (setOurs.size() < 20)
+        setOurs.insert(insecure_rand());
+    while (setTheirs.size() < 30)
+        setTheirs.insert(insecure_rand());
+
+    uint32_t nCells = TxReconSketchCells(setShared.size() + setOurs.size(), setShared.size() + setTheirs.size());
+    CReconSketch ours(nCells), theirs(nCells);
+    BOOST_FOREACH(uint32_t id, setShared) {
+        ours.Add(id);
+        theirs.Add(id);
+    }
+    BOOST_FOREACH(uint32_t id, setOurs)
+        ours.Add(id);
+    BOOST_FOREACH(uint32_t id, setTheirs)
+        theirs.Add(id);
+
+    // Sketches survive a round trip over the wire.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << theirs;
+    CReconSketch received;
+    ss >> received;
+    BOOST_CHECK_EQUAL(received.GetCells(), nCells);
+
+    BOOST_CHECK(ours.Subtract(received));
+    vector<uint32_t> vOurs, vTheirs;
+    BOOST_CHECK(ours.Decode(vOurs, vTheirs));
+    BOOST_CHECK(set<uint32_t>(vOurs.begin(), vOurs.end()) == setOurs);
+    BOOST_CHECK(set<uint32_t>(vTheirs.begin(), vTheirs.end()) == setTheirs);
+
+    // Sketches of different sizes cannot be combined.
+    BOOST_CHECK(!ours.Subtract(CReconSketch(nCells + CReconSketch::NUM_HASHES)));
+}
+
+BOOST_AUTO_TEST_CASE(sketch_decode_overflow)
+{
+    seed_insecure_rand(true);
+    CReconSketch sketch(CReconSketch::CellsForCapacity(10));
+    for (int i = 0; i < 200; i++)
+        sketch.Add(insecure_rand());
+    vector<uint32_t> vOurs, vTheirs;
+    BOOST_CHECK(!sketch.Decode(vOurs, vTheirs));
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_state)
+{
+    CTxReconciliationState state;
+    state.nLocalSalt = 1;
+    state.Enable(2, true);
+    BOOST_CHECK(state.fEnabled && state.fInitiator);
+
+    uint256 tx1 = GetRandHash(), tx2 = GetRandHash();
+    BOOST_CHECK(state.AddTx(tx1));
+    BOOST_CHECK(state.AddTx(tx1));
+    BOOST_CHECK(state.AddTx(tx2));
+    BOOST_CHECK_EQUAL(state.mapLocalSet.size(), 2);
+
+    state.TakeSnapshot();
+    BOOST_CHECK(state.mapLocalSet.empty());
+    BOOST_CHECK_EQUAL(state.mapSnapshot.size(), 2);
+
+    vector<uint32_t> vShortIds;
+    vShortIds.push_back(state.shortIdHasher(tx2));
+    vShortIds.push_back(state.shortIdHasher(tx2) + 1);
+    vector<uint256> vTxs = state.GetSnapshotTxs(vShortIds);
+    BOOST_CHECK_EQUAL(vTxs.size(), 1);
+    BOOST_CHECK(vTxs[0] == tx2);
+
+    state.RemoveTx(tx1);
+    BOOST_CHECK_EQUAL(state.GetSnapshotTxs().size(), 1);
+
+    // A failed round hands back its transactions and lets the next one start.
+    state.fInFlight = true;
+    vTxs = state.AbortRound();
+    BOOST_CHECK_EQUAL(vTxs.size(), 1);
+    BOOST_CHECK(vTxs[0] == tx2);
+    BOOST_CHECK(state.mapSnapshot.empty());
+    BOOST_CHECK(!state.fInFlight);
+
+    // The set is bounded; extra transactions have to go out by inv.
+    state.mapSnapshot.clear();
+    while (state.mapLocalSet.size() < MAX_TXRECON_SET_SIZE)
+        state.AddTx(GetRandHash());
+    BOOST_CHECK(!state.AddTx(GetRandHash()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,11 +6,15 @@
 #include "txdb.h"
 
 #include "chainparams.h"
+#include "compat/byteswap.h"
 #include "hash.h"
 #include "main.h"
 #include "pow.h"
 #include "uint256.h"
 
+#include <algorithm>
+#include <memory>
+#include <queue>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
@@ -34,13 +38,25 @@ static const char DB_BEST_SAPLING_ANCHOR = 'z';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_BEST_TXINDEX_BLOCK = 'X';
 
 // insightexplorer
 static const char DB_ADDRESSINDEX = 'd';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSBALANCEINDEX = 'w';
 static const char DB_SPENTINDEX = 'p';
 static const char DB_TIMESTAMPINDEX = 'T';
 static const char DB_BLOCKHASHINDEX = 'h';
+static const char DB_BEST_INSIGHT_BLOCK = 'I';
+
+// shielded index
+static const char DB_SPROUT_NULLIFIER_INDEX = 'n';
+static const char DB_SAPLING_NULLIFIER_INDEX = 'N';
+static const char DB_SPROUT_COMMITMENT_INDEX = 'm';
+static const char DB_SAPLING_COMMITMENT_INDEX = 'M';
+static const char DB_SHIELDED_BLOCK_INDEX = 'b';
+static const char DB_COMPACT_BLOCK_INDEX = 'c';
+static const char DB_BEST_SHIELDED_BLOCK = 'B';
 
 CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
 }
@@ -299,22 +315,232 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect, const uint256 &hashBest) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
+    batch.Write(DB_BEST_TXINDEX_BLOCK, hashBest);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadTxIndexBestBlock(uint256 &hashBest) {
+    return Read(DB_BEST_TXINDEX_BLOCK, hashBest);
+}
+
 // START insightexplorer
-// https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-81e4f16a1b5d5b7ca25351a63d07cb80R183
-bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDbEntry> &vect)
+template <typename K>
+static bool EraseKeys(CDBWrapper &db, char prefix)
 {
-    CDBBatch batch(*this);
-    for (std::vector<CAddressUnspentDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(prefix);
+
+    bool fDone = false;
+    while (!fDone) {
+        CDBBatch batch(db);
+        fDone = true;
+        for (int n = 0; pcursor->Valid(); n++) {
+            boost::this_thread::interruption_point();
+            std::pair<char, K> key;
+            if (!(pcursor->GetKey(key) && key.first == prefix))
+                break;
+            if (n == 100000) {
+                fDone = false;
+                break;
+            }
+            batch.Erase(key);
+            pcursor->Next();
+        }
+        if (!db.WriteBatch(batch))
+            return false;
+    }
+    return true;
+}
+
+bool CBlockTreeDB::EraseInsightIndexes()
+{
+    return EraseKeys<CAddressIndexKey>(*this, DB_ADDRESSINDEX) &&
+           EraseKeys<CAddressUnspentKey>(*this, DB_ADDRESSUNSPENTINDEX) &&
+           EraseKeys<CAddressIndexIteratorKey>(*this, DB_ADDRESSBALANCEINDEX) &&
+           EraseKeys<CSpentIndexKey>(*this, DB_SPENTINDEX) &&
+           EraseKeys<CTimestampIndexKey>(*this, DB_TIMESTAMPINDEX) &&
+           EraseKeys<CTimestampBlockIndexKey>(*this, DB_BLOCKHASHINDEX) &&
+           Erase(DB_BEST_INSIGHT_BLOCK);
+}
+// END insightexplorer
+
+bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
+    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+}
+
+bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
+    char ch;
+    if (!Read(std::make_pair(DB_FLAG, name), ch))
+        return false;
+    fValue = ch == '1';
+    return true;
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
+
+    // Load mapBlockIndex
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
+            CDiskBlockIndex diskindex;
+            if (pcursor->GetValue(diskindex)) {
+                // Construct block index object
+                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
+                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+                pindexNew->nHeight        = diskindex.nHeight;
+                pindexNew->nFile          = diskindex.nFile;
+                pindexNew->nDataPos       = diskindex.nDataPos;
+                pindexNew->nUndoPos       = diskindex.nUndoPos;
+                pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
+                pindexNew->nVersion       = diskindex.nVersion;
+                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+                pindexNew->hashFinalSaplingRoot   = diskindex.hashFinalSaplingRoot;
+                pindexNew->nTime          = diskindex.nTime;
+                pindexNew->nBits          = diskindex.nBits;
+                pindexNew->nNonce         = diskindex.nNonce;
+                pindexNew->nSolution      = diskindex.nSolution;
+                pindexNew->nStatus        = diskindex.nStatus;
+                pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
+                pindexNew->nTx            = diskindex.nTx;
+                pindexNew->nSproutValue   = diskindex.nSproutValue;
+                pindexNew->nSaplingValue  = diskindex.nSaplingValue;
+
+                // Consistency checks
+                auto header = pindexNew->GetBlockHeader();
+                if (header.GetHash() != pindexNew->GetBlockHash())
+                    return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
+                       diskindex.ToString(),  pindexNew->ToString());
+                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
+                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
+
+                pcursor->Next();
+            } else {
+                return error("LoadBlockIndex() : failed to read value");
+            }
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+// START insightexplorer
+static void BatchWriteAddressBalances(CDBBatch &batch, const std::vector<CAddressBalanceDbEntry> &balances)
+{
+    for (std::vector<CAddressBalanceDbEntry>::const_iterator it=balances.begin(); it!=balances.end(); it++) {
         if (it->second.IsNull()) {
-            batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+            batch.Erase(make_pair(DB_ADDRESSBALANCEINDEX, it->first));
         } else {
-            batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+            batch.Write(make_pair(DB_ADDRESSBALANCEINDEX, it->first), it->second);
         }
     }
+}
+
+// The address index is appended to at every block and mostly read in ranges,
+// so the database gets a larger write buffer than the default quarter of its
+// cache, for fewer and larger compactions, and more bloom filter bits for the
+// point lookups of spent outputs and balances.
+CInsightIndexDB::CInsightIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(GetDataDir() / "indexes", nCacheSize, fMemory, fWipe, nCacheSize / 3, 14)
+{
+}
+
+bool CInsightIndexDB::WriteUpdates(const std::vector<CInsightIndexUpdate>& updates)
+{
+    if (updates.empty())
+        return true;
+
+    CDBBatch batch(*this);
+    std::map<CAddressIndexIteratorKey, CAddressBalanceValue> mapBalanceDeltas;
+    std::map<uint256, unsigned int> mapLogicalTS;
+    BOOST_FOREACH(const CInsightIndexUpdate& update, updates) {
+        for (std::vector<CAddressIndexDbEntry>::const_iterator it=update.addressIndex.begin(); it!=update.addressIndex.end(); it++) {
+            if (update.fDisconnect) {
+                batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+            } else {
+                batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+            }
+            // While the balance index is built, only the addresses it has been
+            // built for are updated; the others get their balances from the
+            // address index later.
+            CAddressIndexIteratorKey address(it->first.type, it->first.hashBytes);
+            if (!update.fAllBalances && !(address < update.balanceCursor))
+                continue;
+            CAmount nValue = update.fDisconnect ? -it->second : it->second;
+            CAddressBalanceValue &delta = mapBalanceDeltas[address];
+            delta.balance += nValue;
+            if (it->second > 0)
+                delta.received += nValue;
+        }
+        // In block order, so outputs spent later in the batch are removed again.
+        for (std::vector<CAddressUnspentDbEntry>::const_iterator it=update.addressUnspentIndex.begin(); it!=update.addressUnspentIndex.end(); it++) {
+            if (it->second.IsNull()) {
+                batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+            } else {
+                batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+            }
+        }
+        for (std::vector<CSpentIndexDbEntry>::const_iterator it=update.spentIndex.begin(); it!=update.spentIndex.end(); it++) {
+            if (it->second.IsNull()) {
+                batch.Erase(make_pair(DB_SPENTINDEX, it->first));
+            } else {
+                batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
+            }
+        }
+        // Timestamps of disconnected blocks are kept; ReadTimestampIndex can
+        // leave them out.
+        if (!update.fDisconnect) {
+            unsigned int logicalTS = update.nTime;
+            unsigned int prevLogicalTS = 0;
+
+            // retrieve logical timestamp of the previous block
+            std::map<uint256, unsigned int>::const_iterator mi = mapLogicalTS.find(update.hashPrevBlock);
+            if (mi != mapLogicalTS.end())
+                prevLogicalTS = mi->second;
+            else if (!ReadTimestampBlockIndex(update.hashPrevBlock, prevLogicalTS))
+                LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
+
+            if (logicalTS <= prevLogicalTS) {
+                logicalTS = prevLogicalTS + 1;
+                LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, update.nTime, prevLogicalTS, logicalTS);
+            }
+            batch.Write(make_pair(DB_TIMESTAMPINDEX, CTimestampIndexKey(logicalTS, update.hashBlock)), 0);
+            batch.Write(make_pair(DB_BLOCKHASHINDEX, CTimestampBlockIndexKey(update.hashBlock)), CTimestampBlockIndexValue(logicalTS));
+            mapLogicalTS[update.hashBlock] = logicalTS;
+        }
+    }
+
+    std::vector<CAddressBalanceDbEntry> balances;
+    for (std::map<CAddressIndexIteratorKey, CAddressBalanceValue>::const_iterator it = mapBalanceDeltas.begin(); it != mapBalanceDeltas.end(); ++it) {
+        CAddressBalanceValue value;
+        ReadAddressBalance(it->first, value);
+        value.balance += it->second.balance;
+        value.received += it->second.received;
+        balances.push_back(make_pair(it->first, value));
+    }
+    BatchWriteAddressBalances(batch, balances);
+
+    const CInsightIndexUpdate& last = updates.back();
+    batch.Write(DB_BEST_INSIGHT_BLOCK, last.fDisconnect ? last.hashPrevBlock : last.hashBlock);
+    LogPrint("insightdb", "Committing insight index updates of %u blocks\n", (unsigned int)updates.size());
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &unspentOutputs)
+bool CInsightIndexDB::ReadBestBlock(uint256 &hashBlock) {
+    return Read(DB_BEST_INSIGHT_BLOCK, hashBlock);
+}
+
+bool CInsightIndexDB::ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &unspentOutputs)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
@@ -334,72 +560,243 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type, std::v
     return true;
 }
 
-bool CBlockTreeDB::WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
-    CDBBatch batch(*this);
-    for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
-    return WriteBatch(batch);
+bool CInsightIndexDB::ReadAddressBalance(const CAddressIndexIteratorKey &key, CAddressBalanceValue &value) {
+    if (!Read(make_pair(DB_ADDRESSBALANCEINDEX, key), value)) {
+        value.SetNull();
+        return false;
+    }
+    return true;
 }
 
-bool CBlockTreeDB::EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
+bool CInsightIndexDB::EraseAddressBalanceIndex()
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(DB_ADDRESSBALANCEINDEX);
+
     CDBBatch batch(*this);
-    for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char,CAddressIndexIteratorKey> key;
+        if (!(pcursor->GetKey(key) && key.first == DB_ADDRESSBALANCEINDEX))
+            break;
+        batch.Erase(key);
+        pcursor->Next();
+    }
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressIndex(
-        uint160 addressHash, int type,
-        std::vector<CAddressIndexDbEntry> &addressIndex,
-        int start, int end)
+// Compute the balances of the addresses from cursor on, from their address
+// index entries, until at least nMaxEntries have been read. The cursor is
+// moved to the first address not done yet.
+bool CInsightIndexDB::BuildAddressBalanceIndex(CAddressIndexIteratorKey &cursor, size_t nMaxEntries, bool &fDone)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(make_pair(DB_ADDRESSINDEX, cursor));
 
-    if (start > 0 && end > 0) {
-        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
-    } else {
-        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
-    }
-
+    std::vector<CAddressBalanceDbEntry> balances;
+    CAddressBalanceDbEntry current;
+    bool fCurrent = false;
+    size_t nEntries = 0;
+    fDone = true;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
-        if (!(pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash))
-            break;
-        if (end > 0 && key.second.blockHeight > end)
+        if (!(pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX))
             break;
+        CAddressIndexIteratorKey address(key.second.type, key.second.hashBytes);
+        if (!fCurrent || current.first < address) {
+            // Stop between addresses once enough entries have been read.
+            if (fCurrent) {
+                balances.push_back(current);
+                if (nEntries >= nMaxEntries) {
+                    cursor = address;
+                    fDone = false;
+                    fCurrent = false;
+                    break;
+                }
+            }
+            current = make_pair(address, CAddressBalanceValue());
+            fCurrent = true;
+        }
         CAmount nValue;
         if (!pcursor->GetValue(nValue))
             return error("failed to get address index value");
-        addressIndex.push_back(make_pair(key.second, nValue));
+        if (nValue > 0)
+            current.second.received += nValue;
+        current.second.balance += nValue;
+        nEntries++;
+        pcursor->Next();
+    }
+    if (fCurrent)
+        balances.push_back(current);
+
+    CDBBatch batch(*this);
+    BatchWriteAddressBalances(batch, balances);
+    return WriteBatch(batch);
+}
+
+namespace {
+
+//! Entries read ahead for each address while merging several addresses.
+const size_t ADDRESS_INDEX_MERGE_BATCH = 128;
+
+// The order in which the entries of several addresses are merged: by height
+// and position in the block, then by address. For the entries of a single
+// address this is the order of their keys in the database.
+bool AddressIndexChainOrder(const CAddressIndexKey& a, const CAddressIndexKey& b)
+{
+    if (a.blockHeight != b.blockHeight)
+        return a.blockHeight < b.blockHeight;
+    if (a.txindex != b.txindex)
+        return a.txindex < b.txindex;
+    if (a.type != b.type)
+        return a.type < b.type;
+    if (a.hashBytes != b.hashBytes)
+        return a.hashBytes < b.hashBytes;
+    if (a.txhash != b.txhash)
+        return a.txhash < b.txhash;
+    // The output index is stored little-endian.
+    if (a.index != b.index)
+        return bswap_32(a.index) < bswap_32(b.index);
+    return a.spending < b.spending;
+}
+
+struct AddressIndexSource {
+    CAddressIndexIteratorKey address;
+    std::unique_ptr<CDBIterator> pcursor;
+    std::vector<CAddressIndexDbEntry> entries;
+    size_t nNext;
+    bool fDone;
+
+    AddressIndexSource() : nNext(0), fDone(false) {}
+};
+
+// Read the next batch of entries of an address, skipping those up to and
+// including the given key.
+bool FillAddressIndexSource(AddressIndexSource& source, const CAddressIndexKey* after, int end)
+{
+    source.entries.clear();
+    source.nNext = 0;
+    CDBIterator* pcursor = source.pcursor.get();
+    while (source.entries.size() < ADDRESS_INDEX_MERGE_BATCH) {
+        boost::this_thread::interruption_point();
+        std::pair<char,CAddressIndexKey> key;
+        if (!(pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX &&
+              key.second.type == source.address.type && key.second.hashBytes == source.address.hashBytes)) {
+            source.fDone = true;
+            break;
+        }
+        if (end > 0 && key.second.blockHeight > end) {
+            source.fDone = true;
+            break;
+        }
+        if (!after || AddressIndexChainOrder(*after, key.second)) {
+            CAmount nValue;
+            if (!pcursor->GetValue(nValue))
+                return error("failed to get address index value");
+            source.entries.push_back(make_pair(key.second, nValue));
+        }
         pcursor->Next();
     }
     return true;
 }
 
-bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
-    return Read(make_pair(DB_SPENTINDEX, key), value);
+} // anon namespace
+
+bool CInsightIndexDB::ReadAddressIndex(
+        uint160 addressHash, int type,
+        std::vector<CAddressIndexDbEntry> &addressIndex,
+        int start, int end)
+{
+    std::vector<CAddressIndexIteratorKey> addresses(1, CAddressIndexIteratorKey(type, addressHash));
+    return ReadAddressIndex(addresses, NULL, start, end,
+        [&addressIndex](const CAddressIndexKey &key, CAmount nValue) {
+            addressIndex.push_back(make_pair(key, nValue));
+            return true;
+        }, 1);
 }
 
-bool CBlockTreeDB::UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect) {
-    CDBBatch batch(*this);
-    for (std::vector<CSpentIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++) {
-        if (it->second.IsNull()) {
-            batch.Erase(make_pair(DB_SPENTINDEX, it->first));
-        } else {
-            batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
+bool CInsightIndexDB::ReadAddressIndex(
+        const std::vector<CAddressIndexIteratorKey> &addressesIn, const CAddressIndexKey *after,
+        int start, int end, const CAddressIndexVisitor &visit, int nThreads)
+{
+    std::vector<CAddressIndexIteratorKey> addresses(addressesIn);
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end(),
+        [](const CAddressIndexIteratorKey &a, const CAddressIndexIteratorKey &b) {
+            return !(a < b) && !(b < a);
+        }), addresses.end());
+
+    int nSeekHeight = (start > 0 && end > 0) ? start : 0;
+    if (after && after->blockHeight > nSeekHeight)
+        nSeekHeight = after->blockHeight;
+
+    std::vector<AddressIndexSource> sources(addresses.size());
+    std::vector<char> vFilled(sources.size(), false);
+    for (size_t i = 0; i < sources.size(); i++) {
+        sources[i].address = addresses[i];
+        sources[i].pcursor.reset(NewIterator());
+    }
+    auto fill = [&](size_t nFirst, size_t nStep) {
+        for (size_t i = nFirst; i < sources.size(); i += nStep) {
+            const CAddressIndexIteratorKey &address = sources[i].address;
+            sources[i].pcursor->Seek(make_pair(DB_ADDRESSINDEX,
+                CAddressIndexIteratorHeightKey(address.type, address.hashBytes, nSeekHeight)));
+            vFilled[i] = FillAddressIndexSource(sources[i], after, end);
         }
+    };
+
+    // Every address starts with a random read, so with many addresses the
+    // first batches are read on several threads.
+    nThreads = std::max(1, std::min(nThreads, (int)sources.size()));
+    boost::thread_group threads;
+    for (int i = 1; i < nThreads; i++)
+        threads.create_thread([&fill, i, nThreads] { fill(i, nThreads); });
+    try {
+        fill(0, nThreads);
+    } catch (...) {
+        threads.join_all();
+        throw;
     }
-    return WriteBatch(batch);
+    threads.join_all();
+
+    auto greater = [&sources](size_t a, size_t b) {
+        return AddressIndexChainOrder(sources[b].entries[sources[b].nNext].first,
+                                      sources[a].entries[sources[a].nNext].first);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (!vFilled[i])
+            return false;
+        if (!sources[i].entries.empty())
+            heap.push(i);
+    }
+
+    while (!heap.empty()) {
+        size_t i = heap.top();
+        heap.pop();
+        AddressIndexSource &source = sources[i];
+        const CAddressIndexDbEntry &entry = source.entries[source.nNext++];
+        if (!visit(entry.first, entry.second))
+            break;
+        if (source.nNext == source.entries.size()) {
+            if (source.fDone)
+                continue;
+            if (!FillAddressIndexSource(source, NULL, end))
+                return false;
+            if (source.entries.empty())
+                continue;
+        }
+        heap.push(i);
+    }
+    return true;
 }
 
-bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
-    CDBBatch batch(*this);
-    batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
-    return WriteBatch(batch);
+bool CInsightIndexDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
+    return Read(make_pair(DB_SPENTINDEX, key), value);
 }
 
-bool CBlockTreeDB::ReadTimestampIndex(unsigned int high, unsigned int low,
+bool CInsightIndexDB::ReadTimestampIndex(unsigned int high, unsigned int low,
     const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
@@ -425,15 +822,7 @@ bool CBlockTreeDB::ReadTimestampIndex(unsigned int high, unsigned int low,
     return true;
 }
 
-bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex,
-    const CTimestampBlockIndexValue &logicalts)
-{
-    CDBBatch batch(*this);
-    batch.Write(make_pair(DB_BLOCKHASHINDEX, blockhashIndex), logicalts);
-    return WriteBatch(batch);
-}
-
-bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp)
+bool CInsightIndexDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp)
 {
     CTimestampBlockIndexValue(lts);
     if (!Read(std::make_pair(DB_BLOCKHASHINDEX, hash), lts))
@@ -442,70 +831,159 @@ bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &lt
     ltimestamp = lts.ltimestamp;
     return true;
 }
-// END insightexplorer
 
-bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
+
+bool CInsightIndexDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
 
-bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
+bool CInsightIndexDB::ReadFlag(const std::string &name, bool &fValue) {
     char ch;
     if (!Read(std::make_pair(DB_FLAG, name), ch))
         return false;
     fValue = ch == '1';
     return true;
 }
+// END insightexplorer
 
-bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+CShieldedIndexDB::CShieldedIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(GetDataDir() / "shieldedindex", nCacheSize, fMemory, fWipe)
+{
+}
+
+static char NullifierIndexPrefix(ShieldedType type)
+{
+    return type == SPROUT ? DB_SPROUT_NULLIFIER_INDEX : DB_SAPLING_NULLIFIER_INDEX;
+}
+
+static char CommitmentIndexPrefix(ShieldedType type)
+{
+    return type == SPROUT ? DB_SPROUT_COMMITMENT_INDEX : DB_SAPLING_COMMITMENT_INDEX;
+}
+
+bool CShieldedIndexDB::WriteUpdates(const std::vector<CShieldedIndexUpdate>& updates, const uint256& hashBest)
+{
+    CDBBatch batch(*this);
+    // Blocks written or erased earlier in the batch
+    std::map<int, boost::optional<CShieldedBlockIndexValue> > mapBlocks;
+    auto readBlock = [this, &mapBlocks](int nHeight, CShieldedBlockIndexValue& value) {
+        std::map<int, boost::optional<CShieldedBlockIndexValue> >::const_iterator it = mapBlocks.find(nHeight);
+        if (it == mapBlocks.end())
+            return ReadBlock(nHeight, value);
+        if (!it->second)
+            return false;
+        value = *it->second;
+        return true;
+    };
+
+    for (const CShieldedIndexUpdate& update : updates) {
+        const int nHeight = update.nHeight;
+        if (update.fDisconnect) {
+            CShieldedBlockIndexValue block;
+            if (!readBlock(nHeight, block) || block.hashBlock != update.block.hashBlock)
+                return error("%s: block %s is not in the shielded index", __func__, update.block.hashBlock.ToString());
+            for (const CShieldedTxIndexValue& tx : block.vtx) {
+                for (const uint256& nf : tx.sproutNullifiers)
+                    batch.Erase(make_pair(DB_SPROUT_NULLIFIER_INDEX, nf));
+                for (const uint256& cm : tx.sproutCommitments)
+                    batch.Erase(make_pair(DB_SPROUT_COMMITMENT_INDEX, cm));
+                for (const uint256& nf : tx.saplingNullifiers)
+                    batch.Erase(make_pair(DB_SAPLING_NULLIFIER_INDEX, nf));
+                for (const uint256& cm : tx.saplingCommitments)
+                    batch.Erase(make_pair(DB_SAPLING_COMMITMENT_INDEX, cm));
+            }
+            batch.Erase(make_pair(DB_SHIELDED_BLOCK_INDEX, CShieldedBlockIndexKey(nHeight)));
+            batch.Erase(make_pair(DB_COMPACT_BLOCK_INDEX, CShieldedBlockIndexKey(nHeight)));
+            mapBlocks[nHeight] = boost::none;
+            continue;
+        }
+
+        // The trees continue from the previous block. The genesis block is
+        // never indexed and has no shielded data.
+        CShieldedBlockIndexValue block = update.block;
+        block.sproutTreeSize = 0;
+        block.saplingTreeSize = 0;
+        if (nHeight > 1) {
+            CShieldedBlockIndexValue prev;
+            if (!readBlock(nHeight - 1, prev))
+                return error("%s: the block before %s is not in the shielded index", __func__, block.hashBlock.ToString());
+            block.sproutTreeSize = prev.GetSproutTreeSizeAfter();
+            block.saplingTreeSize = prev.GetSaplingTreeSizeAfter();
+        }
+        uint64_t nSproutPosition = block.sproutTreeSize;
+        uint64_t nSaplingPosition = block.saplingTreeSize;
+        for (const CShieldedTxIndexValue& tx : block.vtx) {
+            for (unsigned int i = 0; i < tx.sproutNullifiers.size(); i++)
+                batch.Write(make_pair(DB_SPROUT_NULLIFIER_INDEX, tx.sproutNullifiers[i]), CNullifierIndexValue(tx.txid, nHeight, i));
+            for (const uint256& cm : tx.sproutCommitments)
+                batch.Write(make_pair(DB_SPROUT_COMMITMENT_INDEX, cm), CCommitmentIndexValue(nHeight, nSproutPosition++));
+            for (unsigned int i = 0; i < tx.saplingNullifiers.size(); i++)
+                batch.Write(make_pair(DB_SAPLING_NULLIFIER_INDEX, tx.saplingNullifiers[i]), CNullifierIndexValue(tx.txid, nHeight, i));
+            for (const uint256& cm : tx.saplingCommitments)
+                batch.Write(make_pair(DB_SAPLING_COMMITMENT_INDEX, cm), CCommitmentIndexValue(nHeight, nSaplingPosition++));
+        }
+        batch.Write(make_pair(DB_SHIELDED_BLOCK_INDEX, CShieldedBlockIndexKey(nHeight)), block);
+        batch.Write(make_pair(DB_COMPACT_BLOCK_INDEX, CShieldedBlockIndexKey(nHeight)), update.compact);
+        mapBlocks[nHeight] = block;
+    }
+
+    batch.Write(DB_BEST_SHIELDED_BLOCK, hashBest);
+    LogPrint("shieldedindex", "Committing shielded index updates of %u blocks\n", (unsigned int)updates.size());
+    return WriteBatch(batch);
+}
+
+bool CShieldedIndexDB::ReadBestBlock(uint256 &hashBlock) {
+    return Read(DB_BEST_SHIELDED_BLOCK, hashBlock);
+}
+
+bool CShieldedIndexDB::ReadNullifier(ShieldedType type, const uint256 &nullifier, CNullifierIndexValue &value) {
+    return Read(make_pair(NullifierIndexPrefix(type), nullifier), value);
+}
+
+bool CShieldedIndexDB::ReadCommitment(ShieldedType type, const uint256 &commitment, CCommitmentIndexValue &value) {
+    return Read(make_pair(CommitmentIndexPrefix(type), commitment), value);
+}
+
+bool CShieldedIndexDB::ReadBlock(int nHeight, CShieldedBlockIndexValue &value) {
+    return Read(make_pair(DB_SHIELDED_BLOCK_INDEX, CShieldedBlockIndexKey(nHeight)), value);
+}
+
+bool CShieldedIndexDB::ReadBlocks(int nStart, int nEnd, std::vector<CShieldedBlockDbEntry> &blocks)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
+    pcursor->Seek(make_pair(DB_SHIELDED_BLOCK_INDEX, CShieldedBlockIndexKey(nStart)));
 
-    // Load mapBlockIndex
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->hashFinalSaplingRoot   = diskindex.hashFinalSaplingRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
-                pindexNew->nTx            = diskindex.nTx;
-                pindexNew->nSproutValue   = diskindex.nSproutValue;
-                pindexNew->nSaplingValue  = diskindex.nSaplingValue;
+        std::pair<char, CShieldedBlockIndexKey> key;
+        if (!(pcursor->GetKey(key) && key.first == DB_SHIELDED_BLOCK_INDEX && key.second.blockHeight <= nEnd))
+            break;
+        CShieldedBlockIndexValue value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read value", __func__);
+        blocks.push_back(std::make_pair(key.second.blockHeight, value));
+        pcursor->Next();
+    }
+    return true;
+}
 
-                // Consistency checks
-                auto header = pindexNew->GetBlockHeader();
-                if (header.GetHash() != pindexNew->GetBlockHash())
-                    return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
-                       diskindex.ToString(),  pindexNew->ToString());
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
+bool CShieldedIndexDB::ReadCompactBlocks(int nStart, int nEnd, std::vector<CCompactShieldedBlock> &blocks)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-                pcursor->Next();
-            } else {
-                return error("LoadBlockIndex() : failed to read value");
-            }
-        } else {
+    pcursor->Seek(make_pair(DB_COMPACT_BLOCK_INDEX, CShieldedBlockIndexKey(nStart)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CShieldedBlockIndexKey> key;
+        if (!(pcursor->GetKey(key) && key.first == DB_COMPACT_BLOCK_INDEX && key.second.blockHeight <= nEnd))
             break;
-        }
+        CCompactShieldedBlock value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read value", __func__);
+        blocks.push_back(value);
+        pcursor->Next();
     }
-
     return true;
 }
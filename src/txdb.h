@@ -9,6 +9,10 @@
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "addressindex.h"
+#include "compactshieldedblock.h"
+#include "shieldedindex.h"
+#include "spentindex.h"
 
 #include <map>
 #include <string>
@@ -20,13 +24,6 @@
 class CBlockIndex;
 
 // START insightexplorer
-struct CAddressUnspentKey;
-struct CAddressUnspentValue;
-struct CAddressIndexKey;
-struct CAddressIndexIteratorKey;
-struct CAddressIndexIteratorHeightKey;
-struct CSpentIndexKey;
-struct CSpentIndexValue;
 struct CTimestampIndexKey;
 struct CTimestampIndexIteratorKey;
 struct CTimestampBlockIndexKey;
@@ -34,6 +31,9 @@ struct CTimestampBlockIndexValue;
 
 typedef std::pair<CAddressUnspentKey, CAddressUnspentValue> CAddressUnspentDbEntry;
 typedef std::pair<CAddressIndexKey, CAmount> CAddressIndexDbEntry;
+typedef std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> CAddressBalanceDbEntry;
+// Called for each address index entry read; returning false stops the read.
+typedef boost::function<bool(const CAddressIndexKey&, CAmount)> CAddressIndexVisitor;
 typedef std::pair<CSpentIndexKey, CSpentIndexValue> CSpentIndexDbEntry;
 // END insightexplorer
 
@@ -115,26 +115,125 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    // Write the entries together with the last block the transaction index covers.
+    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list, const uint256 &hashBest);
+    bool ReadTxIndexBestBlock(uint256 &hashBest);
 
-    // START insightexplorer
-    bool UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDbEntry> &vect);
+    // insightexplorer: remove the indexes kept here before they moved to CInsightIndexDB.
+    bool EraseInsightIndexes();
+
+
+    bool WriteFlag(const std::string &name, bool fValue);
+    bool ReadFlag(const std::string &name, bool &fValue);
+    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+};
+
+// START insightexplorer
+/** The changes to the insight indexes from connecting or disconnecting a block. */
+struct CInsightIndexUpdate
+{
+    std::vector<CAddressIndexDbEntry> addressIndex;     //!< Written, or erased if fDisconnect
+    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
+    std::vector<CSpentIndexDbEntry> spentIndex;
+    bool fDisconnect;
+    uint256 hashBlock;
+    uint256 hashPrevBlock;
+    unsigned int nTime;                                 //!< Block time, for the timestamp index
+    //! Which balances follow: all, or (while the balance index is built) those of addresses before balanceCursor.
+    bool fAllBalances;
+    CAddressIndexIteratorKey balanceCursor;
+
+    CInsightIndexUpdate() : fDisconnect(false), nTime(0), fAllBalances(false) {}
+};
+
+/**
+ * Access to the insight explorer indexes (indexes/): the address, address
+ * unspent, address balance, spent and timestamp indexes.
+ *
+ * They are kept apart from the block tree database so that compactions of
+ * either do not stall writes to the other, and the database is tuned for them
+ * with a larger write buffer and more bloom filter bits.
+ *
+ * The indexes are written by the insight indexer (insightindexer.h), which
+ * commits the updates of each batch of blocks together with the hash of the
+ * last block they cover. Balances and logical timestamps are computed here, as
+ * they depend on the updates before them.
+ */
+class CInsightIndexDB : public CDBWrapper
+{
+public:
+    CInsightIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CInsightIndexDB(const CInsightIndexDB&);
+    void operator=(const CInsightIndexDB&);
+
+public:
+    /** Write updates in one batch, in order, and make the last one's block the best block. */
+    bool WriteUpdates(const std::vector<CInsightIndexUpdate>& updates);
+
+    bool ReadBestBlock(uint256& hashBlock);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &vect);
-    bool WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect);
-    bool EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect);
     bool ReadAddressIndex(uint160 addressHash, int type, std::vector<CAddressIndexDbEntry> &addressIndex, int start = 0, int end = 0);
+    // Read the entries of the addresses merged in height order, starting after the given key if there is one.
+    // The first entries of each address are read on up to nThreads threads.
+    bool ReadAddressIndex(const std::vector<CAddressIndexIteratorKey> &addresses, const CAddressIndexKey *after,
+            int start, int end, const CAddressIndexVisitor &visit, int nThreads);
+    bool ReadAddressBalance(const CAddressIndexIteratorKey &key, CAddressBalanceValue &value);
+    bool EraseAddressBalanceIndex();
+    bool BuildAddressBalanceIndex(CAddressIndexIteratorKey &cursor, size_t nMaxEntries, bool &fDone);
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
-    bool UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect);
-    bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(unsigned int high, unsigned int low,
             const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect);
-    bool WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex,
-            const CTimestampBlockIndexValue &logicalts);
     bool ReadTimestampBlockIndex(const uint256 &hash, unsigned int &logicalTS);
-    // END insightexplorer
 
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+};
+// END insightexplorer
+
+/** A block connected to or disconnected from the shielded index. */
+struct CShieldedIndexUpdate
+{
+    bool fDisconnect;
+    int nHeight;
+    //! The block hash, and its transactions if it is connected. The tree sizes are filled in when written.
+    CShieldedBlockIndexValue block;
+    //! The compact form of the block, if it is connected.
+    CCompactShieldedBlock compact;
+
+    CShieldedIndexUpdate() : fDisconnect(false), nHeight(0) {}
+};
+
+/**
+ * Access to the shielded index (shieldedindex/): where each Sprout and Sapling
+ * nullifier was revealed, where each note commitment landed, and the shielded
+ * data of the blocks of the active chain by height, and their compact form
+ * for light clients, for range queries.
+ *
+ * It is written by the shielded indexer (shieldedindexer.h). Note commitment
+ * positions are computed here from the tree sizes recorded with the previous
+ * block.
+ */
+class CShieldedIndexDB : public CDBWrapper
+{
+public:
+    CShieldedIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CShieldedIndexDB(const CShieldedIndexDB&);
+    void operator=(const CShieldedIndexDB&);
+
+public:
+    /** Write updates in one batch, in order, and make hashBest the best block. */
+    bool WriteUpdates(const std::vector<CShieldedIndexUpdate>& updates, const uint256& hashBest);
+
+    bool ReadBestBlock(uint256& hashBlock);
+    bool ReadNullifier(ShieldedType type, const uint256& nullifier, CNullifierIndexValue& value);
+    bool ReadCommitment(ShieldedType type, const uint256& commitment, CCommitmentIndexValue& value);
+    bool ReadBlock(int nHeight, CShieldedBlockIndexValue& value);
+    // Read the blocks from nStart up to and including nEnd, in height order.
+    bool ReadBlocks(int nStart, int nEnd, std::vector<CShieldedBlockDbEntry>& blocks);
+    // Read the compact blocks from nStart up to and including nEnd, in height order.
+    bool ReadCompactBlocks(int nStart, int nEnd, std::vector<CCompactShieldedBlock>& blocks);
 };
 
 #endif // BITCOIN_TXDB_H
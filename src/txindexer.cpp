@@ -0,0 +1,45 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "txindexer.h"
+
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+CTxIndexer* ptxindexer = NULL;
+
+bool CTxIndexer::Init(const CBlockIndex*& pindexIndexed)
+{
+    AssertLockHeld(cs_main);
+    uint256 hashBest;
+    if (!pblocktree->ReadTxIndexBestBlock(hashBest)) {
+        // Earlier versions wrote the index as blocks were connected, so it
+        // covers the active chain.
+        pindexIndexed = chainActive.Tip();
+        return true;
+    }
+    BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+    if (mi == mapBlockIndex.end())
+        return error("%s: the transaction index was built for a different chain, use -reindex", __func__);
+    pindexIndexed = mi->second;
+    return true;
+}
+
+bool CTxIndexer::WriteBlocks(const std::vector<CIndexerBlock>& blocks, const CBlockIndex* pindexBest)
+{
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    for (const CIndexerBlock& item : blocks) {
+        if (!item.fConnect)
+            continue;
+        CDiskTxPos pos(item.pos, GetSizeOfCompactSize(item.block.vtx.size()));
+        for (const CTransaction& tx : item.block.vtx) {
+            vPos.push_back(std::make_pair(tx.GetHash(), pos));
+            pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        }
+    }
+    if (!pblocktree->WriteTxIndex(vPos, pindexBest->GetBlockHash()))
+        return error("%s: cannot write transaction index", __func__);
+    return true;
+}
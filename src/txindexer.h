@@ -0,0 +1,29 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_TXINDEXER_H
+#define BITCOIN_TXINDEXER_H
+
+#include "indexer.h"
+
+/**
+ * Keeps the transaction index (-txindex) in the block tree database. Entries
+ * of disconnected blocks are kept, as before; only the last block the index
+ * covers moves back.
+ */
+class CTxIndexer : public CChainIndexer
+{
+protected:
+    bool Init(const CBlockIndex*& pindexIndexed);
+    bool NeedsUndo() const { return false; }
+    bool WriteBlocks(const std::vector<CIndexerBlock>& blocks, const CBlockIndex* pindexBest);
+
+public:
+    CTxIndexer() : CChainIndexer("txindex") {}
+};
+
+/** The transaction indexer, if -txindex is set */
+extern CTxIndexer* ptxindexer;
+
+#endif // BITCOIN_TXINDEXER_H
@@ -8,8 +8,10 @@
 #include "clientversion.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "hash.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "random.h"
 #include "streams.h"
 #include "timedata.h"
 #include "util.h"
@@ -19,6 +21,24 @@
 
 using namespace std;
 
+CMempoolIndexHasher::CMempoolIndexHasher() :
+    k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t CMempoolIndexHasher::operator()(const uint256& txid) const
+{
+    return SipHashUint256(k0, k1, txid);
+}
+
+size_t CMempoolIndexHasher::operator()(const std::pair<uint160, int>& address) const
+{
+    return CSipHasher(k0, k1).Write(address.second).Write(address.first.begin(), address.first.size()).Finalize();
+}
+
+size_t CMempoolIndexHasher::operator()(const CSpentIndexKey& key) const
+{
+    return CSipHasher(k0, k1).Write(key.txid.begin(), key.txid.size()).Write(key.outputIndex).Finalize();
+}
+
 CTxMemPoolEntry::CTxMemPoolEntry():
     nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
     hadNoDependencies(false), spendsCoinbase(false)
@@ -127,13 +147,27 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     return true;
 }
 
+void CTxMemPool::addAddressDelta(std::vector<CMempoolAddressDeltaPos>& inserted,
+                                 const CMempoolAddressDeltaKey& key, const CMempoolAddressDelta& delta)
+{
+    CMempoolAddressBucket& bucket = mapAddress[std::make_pair(key.addressBytes, key.type)];
+    CMempoolAddressDeltaPos pos = {&bucket, bucket.size()};
+    inserted.push_back(pos);
+    bucket.push_back(CMempoolAddressDeltaEntry(key, delta, &inserted.back()));
+}
+
 void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
 {
     LOCK(cs);
     const CTransaction& tx = entry.GetTx();
-    std::vector<CMempoolAddressDeltaKey> inserted;
-
     uint256 txhash = tx.GetHash();
+    if (mapAddressInserted.count(txhash))
+        return;
+
+    // The buckets point to these positions, so they must not be reallocated.
+    std::vector<CMempoolAddressDeltaPos>& inserted = mapAddressInserted[txhash];
+    inserted.reserve(tx.vin.size() + tx.vout.size());
+
     for (unsigned int j = 0; j < tx.vin.size(); j++) {
         const CTxIn input = tx.vin[j];
         const CTxOut &prevout = view.GetOutputFor(input);
@@ -142,8 +176,7 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
             continue;
         CMempoolAddressDeltaKey key(type, prevout.scriptPubKey.AddressHash(), txhash, j, 1);
         CMempoolAddressDelta delta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n);
-        mapAddress.insert(make_pair(key, delta));
-        inserted.push_back(key);
+        addAddressDelta(inserted, key, delta);
     }
 
     for (unsigned int j = 0; j < tx.vout.size(); j++) {
@@ -152,11 +185,11 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
         if (type == CScript::UNKNOWN)
             continue;
         CMempoolAddressDeltaKey key(type, out.scriptPubKey.AddressHash(), txhash, j, 0);
-        mapAddress.insert(make_pair(key, CMempoolAddressDelta(entry.GetTime(), out.nValue)));
-        inserted.push_back(key);
+        addAddressDelta(inserted, key, CMempoolAddressDelta(entry.GetTime(), out.nValue));
     }
 
-    mapAddressInserted.insert(make_pair(txhash, inserted));
+    if (inserted.empty())
+        mapAddressInserted.erase(txhash);
 }
 
 // START insightexplorer
@@ -166,10 +199,11 @@ void CTxMemPool::getAddressIndex(
 {
     LOCK(cs);
     for (const auto& it : addresses) {
-        auto ait = mapAddress.lower_bound(CMempoolAddressDeltaKey(it.second, it.first));
-        while (ait != mapAddress.end() && (*ait).first.addressBytes == it.first && (*ait).first.type == it.second) {
-            results.push_back(*ait);
-            ait++;
+        auto ait = mapAddress.find(it);
+        if (ait == mapAddress.end())
+            continue;
+        for (const CMempoolAddressDeltaEntry& entry : ait->second) {
+            results.push_back(std::make_pair(entry.key, entry.delta));
         }
     }
 }
@@ -178,14 +212,26 @@ void CTxMemPool::removeAddressIndex(const uint256& txhash)
 {
     LOCK(cs);
     auto it = mapAddressInserted.find(txhash);
+    if (it == mapAddressInserted.end())
+        return;
 
-    if (it != mapAddressInserted.end()) {
-        std::vector<CMempoolAddressDeltaKey> keys = it->second;
-        for (const auto& mit : keys) {
-            mapAddress.erase(mit);
+    for (const CMempoolAddressDeltaPos& pos : it->second) {
+        CMempoolAddressBucket& bucket = *pos.bucket;
+        if (bucket.size() == 1) {
+            const CMempoolAddressDeltaKey& key = bucket[0].key;
+            mapAddress.erase(std::make_pair(key.addressBytes, key.type));
+            continue;
+        }
+        // Move the last entry of the bucket into the place of the removed one.
+        if (pos.nIndex + 1 != bucket.size()) {
+            bucket[pos.nIndex] = bucket.back();
+            bucket[pos.nIndex].pos->nIndex = pos.nIndex;
         }
-        mapAddressInserted.erase(it);
+        bucket.pop_back();
+        if (bucket.size() < bucket.capacity() / 4)
+            bucket.shrink_to_fit();
     }
+    mapAddressInserted.erase(it);
 }
 
 void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
@@ -211,7 +257,7 @@ void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCac
 bool CTxMemPool::getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value)
 {
     LOCK(cs);
-    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare>::iterator it = mapSpent.find(key);
+    auto it = mapSpent.find(key);
     if (it != mapSpent.end()) {
         value = it->second;
         return true;
@@ -479,6 +525,10 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapAddress.clear();
+    mapAddressInserted.clear();
+    mapSpent.clear();
+    mapSpentInserted.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
@@ -7,6 +7,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <unordered_map>
 
 #include "amount.h"
 #include "coins.h"
@@ -22,6 +23,44 @@
 
 class CAutoFile;
 
+// insightexplorer
+/** SipHash of the keys of the mempool insight indexes, salted so they cannot be made to collide. */
+class CMempoolIndexHasher
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    CMempoolIndexHasher();
+
+    size_t operator()(const uint256& txid) const;
+    size_t operator()(const std::pair<uint160, int>& address) const;
+    size_t operator()(const CSpentIndexKey& key) const;
+};
+
+struct CMempoolAddressDeltaPos;
+
+/** An entry of the mempool address index, with a pointer back to its transaction's record of it. */
+struct CMempoolAddressDeltaEntry
+{
+    CMempoolAddressDeltaKey key;
+    CMempoolAddressDelta delta;
+    CMempoolAddressDeltaPos* pos;
+
+    CMempoolAddressDeltaEntry(const CMempoolAddressDeltaKey& keyIn, const CMempoolAddressDelta& deltaIn,
+                              CMempoolAddressDeltaPos* posIn) : key(keyIn), delta(deltaIn), pos(posIn) {}
+};
+
+/** The mempool address index entries of one address, in no particular order. */
+typedef std::vector<CMempoolAddressDeltaEntry> CMempoolAddressBucket;
+
+/** Where an entry of a transaction is in its address bucket, so it can be removed without a search. */
+struct CMempoolAddressDeltaPos
+{
+    CMempoolAddressBucket* bucket;
+    size_t nIndex;
+};
+
 inline double AllowFreeThreshold()
 {
     return COIN * 144 / 250;
@@ -164,10 +203,16 @@ public:
 
 private:
     // insightexplorer
-    std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> mapAddress;
-    std::map<uint256, std::vector<CMempoolAddressDeltaKey> > mapAddressInserted;
-    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpent;
-    std::map<uint256, std::vector<CSpentIndexKey>> mapSpentInserted;
+    // The address index is hashed by address, with the entries of an address
+    // next to each other. Removing an entry moves the last one of its bucket
+    // into its place, and updates the position its transaction has for that.
+    std::unordered_map<std::pair<uint160, int>, CMempoolAddressBucket, CMempoolIndexHasher> mapAddress;
+    std::unordered_map<uint256, std::vector<CMempoolAddressDeltaPos>, CMempoolIndexHasher> mapAddressInserted;
+    std::unordered_map<CSpentIndexKey, CSpentIndexValue, CMempoolIndexHasher> mapSpent;
+    std::unordered_map<uint256, std::vector<CSpentIndexKey>, CMempoolIndexHasher> mapSpentInserted;
+
+    void addAddressDelta(std::vector<CMempoolAddressDeltaPos>& inserted,
+                         const CMempoolAddressDeltaKey& key, const CMempoolAddressDelta& delta);
 
 public:
     std::map<COutPoint, CInPoint> mapNextTx;
@@ -0,0 +1,219 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "txreconciliation.h"
+
+#include "hash.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <boost/foreach.hpp>
+
+static const char* TXRECON_SALT_TAG = "Arnak_TxRecon";
+
+CTxReconShortIdHasher::CTxReconShortIdHasher(uint64_t nSalt1, uint64_t nSalt2)
+{
+    // Order the salts so both peers derive the same key.
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << std::string(TXRECON_SALT_TAG) << std::min(nSalt1, nSalt2) << std::max(nSalt1, nSalt2);
+    uint256 key = ss.GetHash();
+    k0 = key.GetUint64(0);
+    k1 = key.GetUint64(1);
+}
+
+uint32_t CTxReconShortIdHasher::operator()(const uint256& txid) const
+{
+    return (uint32_t)SipHashUint256(k0, k1, txid);
+}
+
+// Short ids are already uniformly distributed, so a cheap integer mix is
+// enough to derive the cell positions and checksums from them.
+static inline uint32_t ReconMix(uint32_t x, uint32_t nSeed)
+{
+    x ^= nSeed * 0x9e3779b9;
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline uint32_t ReconCheckSum(uint32_t nShortId)
+{
+    return ReconMix(nShortId, CReconSketch::NUM_HASHES + 1);
+}
+
+CReconSketch::CReconSketch(uint32_t nCells)
+{
+    nCells -= nCells % NUM_HASHES;
+    vCells.resize(nCells);
+}
+
+uint32_t CReconSketch::CellsForCapacity(uint32_t nCapacity)
+{
+    // With three hash functions, an IBLT decodes with high probability as long
+    // as it has about 1.23 cells per element; leave some extra room on top so
+    // small differences do not fail because of an unlucky layout.
+    uint32_t nCells = (uint32_t)std::ceil(nCapacity * 1.5) + 2 * NUM_HASHES;
+    nCells += (NUM_HASHES - nCells % NUM_HASHES) % NUM_HASHES;
+    return std::min(nCells, MAX_TXRECON_SKETCH_CELLS - MAX_TXRECON_SKETCH_CELLS % NUM_HASHES);
+}
+
+bool CReconSketch::IsWithinSizeConstraints() const
+{
+    return vCells.size() <= MAX_TXRECON_SKETCH_CELLS && vCells.size() % NUM_HASHES == 0;
+}
+
+void CReconSketch::Toggle(uint32_t nShortId, int32_t nDelta)
+{
+    if (vCells.empty())
+        return;
+    const uint32_t nPartition = vCells.size() / NUM_HASHES;
+    const uint32_t nCheckSum = ReconCheckSum(nShortId);
+    for (unsigned int i = 0; i < NUM_HASHES; i++) {
+        CReconSketchCell& cell = vCells[i * nPartition + ReconMix(nShortId, i) % nPartition];
+        cell.nCount += nDelta;
+        cell.nKeySum ^= nShortId;
+        cell.nCheckSum ^= nCheckSum;
+    }
+}
+
+bool CReconSketch::Subtract(const CReconSketch& other)
+{
+    if (other.vCells.size() != vCells.size())
+        return false;
+    for (size_t i = 0; i < vCells.size(); i++) {
+        vCells[i].nCount -= other.vCells[i].nCount;
+        vCells[i].nKeySum ^= other.vCells[i].nKeySum;
+        vCells[i].nCheckSum ^= other.vCells[i].nCheckSum;
+    }
+    return true;
+}
+
+bool CReconSketch::Decode(std::vector<uint32_t>& vOurs, std::vector<uint32_t>& vTheirs) const
+{
+    vOurs.clear();
+    vTheirs.clear();
+
+    // Peel off pure cells (holding exactly one element) until none are left.
+    CReconSketch work(*this);
+    std::vector<size_t> vPure;
+    for (size_t i = 0; i < work.vCells.size(); i++)
+        vPure.push_back(i);
+    while (!vPure.empty()) {
+        const CReconSketchCell cell = work.vCells[vPure.back()];
+        vPure.pop_back();
+        if ((cell.nCount != 1 && cell.nCount != -1) || cell.nCheckSum != ReconCheckSum(cell.nKeySum))
+            continue;
+
+        const uint32_t nShortId = cell.nKeySum;
+        if (cell.nCount == 1) {
+            vOurs.push_back(nShortId);
+            work.Remove(nShortId);
+        } else {
+            vTheirs.push_back(nShortId);
+            work.Add(nShortId);
+        }
+
+        // Removing the element can make the other cells it touched pure.
+        const uint32_t nPartition = work.vCells.size() / NUM_HASHES;
+        for (unsigned int i = 0; i < NUM_HASHES; i++)
+            vPure.push_back(i * nPartition + ReconMix(nShortId, i) % nPartition);
+
+        if (vOurs.size() + vTheirs.size() > work.vCells.size())
+            return false;
+    }
+
+    BOOST_FOREACH(const CReconSketchCell& cell, work.vCells) {
+        if (!cell.IsEmpty())
+            return false;
+    }
+    return true;
+}
+
+uint32_t TxReconSketchCells(size_t nLocalSize, size_t nRemoteSize, double q)
+{
+    const size_t nDiff = nLocalSize > nRemoteSize ? nLocalSize - nRemoteSize : nRemoteSize - nLocalSize;
+    const double nCapacity = nDiff + q * std::min(nLocalSize, nRemoteSize) + 1;
+    if (nCapacity >= MAX_TXRECON_SKETCH_CELLS)
+        return 0;
+    return CReconSketch::CellsForCapacity((uint32_t)std::ceil(nCapacity));
+}
+
+void CTxReconciliationState::Enable(uint64_t nRemoteSalt, bool fInitiatorIn)
+{
+    shortIdHasher = CTxReconShortIdHasher(nLocalSalt, nRemoteSalt);
+    fInitiator = fInitiatorIn;
+    fEnabled = true;
+}
+
+bool CTxReconciliationState::AddTx(const uint256& txid)
+{
+    const uint32_t nShortId = shortIdHasher(txid);
+    std::map<uint32_t, uint256>::const_iterator it = mapLocalSet.find(nShortId);
+    if (it != mapLocalSet.end())
+        return it->second == txid;
+    it = mapSnapshot.find(nShortId);
+    if (it != mapSnapshot.end())
+        return it->second == txid;
+    if (mapLocalSet.size() >= MAX_TXRECON_SET_SIZE)
+        return false;
+    mapLocalSet.insert(std::make_pair(nShortId, txid));
+    return true;
+}
+
+void CTxReconciliationState::RemoveTx(const uint256& txid)
+{
+    const uint32_t nShortId = shortIdHasher(txid);
+    std::map<uint32_t, uint256>::iterator it = mapLocalSet.find(nShortId);
+    if (it != mapLocalSet.end() && it->second == txid)
+        mapLocalSet.erase(it);
+    it = mapSnapshot.find(nShortId);
+    if (it != mapSnapshot.end() && it->second == txid)
+        mapSnapshot.erase(it);
+}
+
+void CTxReconciliationState::TakeSnapshot()
+{
+    // Anything left over from an aborted round is reconciled again.
+    mapSnapshot.insert(mapLocalSet.begin(), mapLocalSet.end());
+    mapLocalSet.clear();
+}
+
+CReconSketch CTxReconciliationState::SketchSnapshot(uint32_t nCells) const
+{
+    CReconSketch sketch(nCells);
+    for (std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.begin(); it != mapSnapshot.end(); ++it)
+        sketch.Add(it->first);
+    return sketch;
+}
+
+std::vector<uint256> CTxReconciliationState::GetSnapshotTxs(const std::vector<uint32_t>& vShortIds) const
+{
+    std::vector<uint256> vTxs;
+    BOOST_FOREACH(uint32_t nShortId, vShortIds) {
+        std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.find(nShortId);
+        if (it != mapSnapshot.end())
+            vTxs.push_back(it->second);
+    }
+    return vTxs;
+}
+
+std::vector<uint256> CTxReconciliationState::GetSnapshotTxs() const
+{
+    std::vector<uint256> vTxs;
+    for (std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.begin(); it != mapSnapshot.end(); ++it)
+        vTxs.push_back(it->second);
+    return vTxs;
+}
+
+std::vector<uint256> CTxReconciliationState::AbortRound()
+{
+    std::vector<uint256> vTxs = GetSnapshotTxs();
+    mapSnapshot.clear();
+    fInFlight = false;
+    return vTxs;
+}
@@ -0,0 +1,187 @@
+// Copyright (c) 2019 The Arnak developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_TXRECONCILIATION_H
+#define BITCOIN_TXRECONCILIATION_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Set reconciliation based transaction relay.
+ *
+ * Instead of announcing every transaction to every peer with an inv, two peers
+ * that both negotiated reconciliation (with a "sendrecon" message after the
+ * version handshake) accumulate the transactions they would have announced to
+ * each other in a reconciliation set, keyed by a 32-bit short id salted with
+ * both peers' salts. Periodically the outbound side asks for a sketch of the
+ * inbound side's set ("reqrecon"), the inbound side replies with an invertible
+ * Bloom lookup table of its short ids ("sketch"), and the outbound side
+ * subtracts a sketch of its own set and decodes the symmetric difference. It
+ * then announces the transactions only it has with a regular inv and asks for
+ * the ones only the peer has with "reconcildiff". If decoding fails both sides
+ * fall back to announcing their whole set with inv.
+ *
+ * Transactions that are known to both peers are never announced, so the cost
+ * of relaying a transaction across a link drops from one inv entry per
+ * direction to a few bytes of sketch.
+ */
+
+/** Version of the reconciliation protocol sent in "sendrecon". */
+static const uint32_t TXRECON_VERSION = 1;
+/** Default for -txreconciliation. */
+static const bool DEFAULT_TXRECONCILIATION = false;
+/** Seconds between reconciliation rounds initiated towards a single peer. */
+static const int64_t TXRECON_INTERVAL = 8;
+/** Maximum number of transactions waiting to be reconciled with a single peer. */
+static const size_t MAX_TXRECON_SET_SIZE = 4000;
+/** Maximum number of cells in a sketch; larger differences fall back to inv. */
+static const uint32_t MAX_TXRECON_SKETCH_CELLS = 3000;
+/**
+ * Expected fraction of the smaller set that is not shared between two peers,
+ * used to size sketches in addition to the difference in set sizes.
+ */
+static const double TXRECON_DEFAULT_Q = 0.25;
+
+/** Short transaction id hasher, keyed with both peers' salts. */
+class CTxReconShortIdHasher
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    CTxReconShortIdHasher() : k0(0), k1(0) {}
+    /** The key does not depend on which side each salt came from. */
+    CTxReconShortIdHasher(uint64_t nSalt1, uint64_t nSalt2);
+
+    uint32_t operator()(const uint256& txid) const;
+};
+
+/** A single cell of a reconciliation sketch. */
+class CReconSketchCell
+{
+public:
+    int32_t nCount;
+    uint32_t nKeySum;
+    uint32_t nCheckSum;
+
+    CReconSketchCell() : nCount(0), nKeySum(0), nCheckSum(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nCount);
+        READWRITE(nKeySum);
+        READWRITE(nCheckSum);
+    }
+
+    bool IsEmpty() const { return nCount == 0 && nKeySum == 0 && nCheckSum == 0; }
+};
+
+/**
+ * Invertible Bloom lookup table over 32-bit short ids. Each short id is added
+ * to one cell in each of three equally sized partitions of the table, so the
+ * number of cells is always a multiple of three. Subtracting the sketch of
+ * another set leaves a sketch of the symmetric difference, which can be
+ * listed as long as it is small compared to the number of cells.
+ */
+class CReconSketch
+{
+private:
+    std::vector<CReconSketchCell> vCells;
+
+    void Toggle(uint32_t nShortId, int32_t nDelta);
+
+public:
+    static const unsigned int NUM_HASHES = 3;
+
+    CReconSketch() {}
+    explicit CReconSketch(uint32_t nCells);
+
+    /** Number of cells needed to reliably decode a difference of nCapacity elements. */
+    static uint32_t CellsForCapacity(uint32_t nCapacity);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vCells);
+    }
+
+    uint32_t GetCells() const { return vCells.size(); }
+    bool IsWithinSizeConstraints() const;
+
+    void Add(uint32_t nShortId) { Toggle(nShortId, 1); }
+    void Remove(uint32_t nShortId) { Toggle(nShortId, -1); }
+
+    /** Subtract another sketch with the same number of cells. */
+    bool Subtract(const CReconSketch& other);
+
+    /**
+     * List the elements of a difference sketch. Elements only present in the
+     * minuend are returned in vOurs, elements only present in the subtrahend in
+     * vTheirs. Returns false if the sketch could not be fully decoded.
+     */
+    bool Decode(std::vector<uint32_t>& vOurs, std::vector<uint32_t>& vTheirs) const;
+};
+
+/** Per-peer reconciliation state, guarded by CNode::cs_inventory. */
+class CTxReconciliationState
+{
+public:
+    //! Our salt, sent in "sendrecon" (0 if we have not sent one).
+    uint64_t nLocalSalt;
+    //! Both sides have sent "sendrecon".
+    bool fEnabled;
+    //! We are the side that sends "reqrecon" (the outbound side of the connection).
+    bool fInitiator;
+    //! Whether we are waiting for a "sketch" (initiator) or "reconcildiff" (responder).
+    bool fInFlight;
+    //! Time (in seconds) of the next reconciliation round, for the initiator.
+    int64_t nNextReconTime;
+
+    CTxReconShortIdHasher shortIdHasher;
+    //! Transactions waiting for the next reconciliation round.
+    std::map<uint32_t, uint256> mapLocalSet;
+    //! Transactions being reconciled in the current round.
+    std::map<uint32_t, uint256> mapSnapshot;
+
+    CTxReconciliationState() : nLocalSalt(0), fEnabled(false), fInitiator(false), fInFlight(false), nNextReconTime(0) {}
+
+    void Enable(uint64_t nRemoteSalt, bool fInitiatorIn);
+
+    /**
+     * Queue a transaction for reconciliation. Returns false if it has to be
+     * announced with an inv instead, because its short id collides with
+     * another queued transaction or the set is full.
+     */
+    bool AddTx(const uint256& txid);
+    /** Forget a transaction that the peer is known to have. */
+    void RemoveTx(const uint256& txid);
+
+    /** Move the queued transactions into the snapshot that is reconciled next. */
+    void TakeSnapshot();
+    /** Build a sketch of the snapshot with the given number of cells. */
+    CReconSketch SketchSnapshot(uint32_t nCells) const;
+    /** Look up snapshot transactions by short id; unknown ids are skipped. */
+    std::vector<uint256> GetSnapshotTxs(const std::vector<uint32_t>& vShortIds) const;
+    /** All snapshot transactions, used when reconciliation fails. */
+    std::vector<uint256> GetSnapshotTxs() const;
+    /**
+     * End the current round after a protocol error, so the next one can
+     * start. Returns the snapshot transactions, to be announced by inv.
+     */
+    std::vector<uint256> AbortRound();
+};
+
+/** Number of cells a responder uses for a sketch, given both set sizes. */
+uint32_t TxReconSketchCells(size_t nLocalSize, size_t nRemoteSize, double q = TXRECON_DEFAULT_Q);
+
+#endif // BITCOIN_TXRECONCILIATION_H
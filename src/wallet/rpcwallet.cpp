@@ -2806,6 +2806,30 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             sample_times.push_back(benchmark_loadwallet());
         } else if (benchmarktype == "listunspent") {
             sample_times.push_back(benchmark_listunspent());
+        } else if (benchmarktype == "rollingbloomfilter") {
+            int nElements = 1000000;
+            if (params.size() >= 3) {
+                nElements = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_rolling_bloom_filter(nElements));
+        } else if (benchmarktype == "readblocks") {
+            int nBlocks = 1000;
+            if (params.size() >= 3) {
+                nBlocks = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_read_blocks(nBlocks));
+        } else if (benchmarktype == "decompressblocks") {
+            int nBlocks = 1000;
+            if (params.size() >= 3) {
+                nBlocks = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_decompress_blocks(nBlocks));
+        } else if (benchmarktype == "mempooladdressindex") {
+            int nTxs = 20000;
+            if (params.size() >= 3) {
+                nTxs = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_mempool_address_index(nTxs));
         } else if (benchmarktype == "createsaplingspend") {
             sample_times.push_back(benchmark_create_sapling_spend());
         } else if (benchmarktype == "createsaplingoutput") {
@@ -10,6 +10,8 @@
 #include "init.h"
 #include "primitives/transaction.h"
 #include "base58.h"
+#include "blockcompression.h"
+#include "bloom.h"
 #include "crypto/equihash.h"
 #include "chain.h"
 #include "chainparams.h"
@@ -23,6 +25,7 @@
 #include "sodium.h"
 #include "streams.h"
 #include "txdb.h"
+#include "txmempool.h"
 #include "utiltest.h"
 #include "wallet/wallet.h"
 
@@ -588,6 +591,127 @@ double benchmark_listunspent()
     return timer_stop(tv_start);
 }
 
+double benchmark_rolling_bloom_filter(size_t nElements)
+{
+    // Sized like the recent rejects filter. Every insert is followed by a
+    // lookup of a recently inserted element and of one that was never added.
+    CRollingBloomFilter filter(120000, 0.000001);
+    std::vector<uint256> vHashes, vAbsent;
+    vHashes.reserve(nElements);
+    vAbsent.reserve(nElements);
+    for (size_t i = 0; i < nElements; i++) {
+        vHashes.push_back(GetRandHash());
+        vAbsent.push_back(GetRandHash());
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    size_t nHits = 0;
+    for (size_t i = 0; i < nElements; i++) {
+        filter.insert(vHashes[i]);
+        nHits += filter.contains(vHashes[i - std::min(i, (size_t)1000)]);
+        nHits += filter.contains(vAbsent[i]);
+    }
+    double elapsed = timer_stop(tv_start);
+    assert(nHits >= nElements);
+    return elapsed;
+}
+
+double benchmark_read_blocks(int nBlocks)
+{
+    // Read the most recent blocks of the active chain back from disk, as
+    // rescans and the block RPCs do.
+    std::vector<CDiskBlockPos> vPos;
+    {
+        LOCK(cs_main);
+        for (CBlockIndex* pindex = chainActive.Tip(); pindex && (int)vPos.size() < nBlocks; pindex = pindex->pprev) {
+            if (pindex->nStatus & BLOCK_HAVE_DATA)
+                vPos.push_back(pindex->GetBlockPos());
+        }
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (const CDiskBlockPos& pos : vPos) {
+        CBlock block;
+        assert(ReadBlockFromDisk(block, pos, Params().GetConsensus()));
+    }
+    return timer_stop(tv_start);
+}
+
+double benchmark_decompress_blocks(int nBlocks)
+{
+    // Compress the most recent blocks of the active chain, and measure what
+    // -blockcompression adds to reading them: decompressing before deserializing.
+    std::vector<std::pair<size_t, std::vector<char> > > vCompressed;
+    {
+        LOCK(cs_main);
+        for (CBlockIndex* pindex = chainActive.Tip(); pindex && (int)vCompressed.size() < nBlocks; pindex = pindex->pprev) {
+            CBlock block;
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+                continue;
+            CDataStream ss(SER_DISK, CLIENT_VERSION);
+            ss << block;
+            std::vector<char> vData;
+            CompressBlockData(&ss[0], ss.size(), vData);
+            vCompressed.push_back(std::make_pair(ss.size(), vData));
+        }
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (const std::pair<size_t, std::vector<char> >& item : vCompressed) {
+        std::vector<char> vData;
+        bool fDecompressed = DecompressBlockData(&item.second[0], item.second.size(), item.first, vData);
+        assert(fDecompressed);
+        CBlock block;
+        CDataStream(vData, SER_DISK, CLIENT_VERSION) >> block;
+    }
+    return timer_stop(tv_start);
+}
+
+double benchmark_mempool_address_index(int nTxs)
+{
+    // Each transaction spends from one of nAddresses P2PKH addresses to the
+    // next, with change to a P2SH address; every address is then queried.
+    const int nAddresses = std::max(1, nTxs / 10);
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    std::vector<CTxMemPoolEntry> entries;
+    entries.reserve(nTxs);
+    for (int n = 0; n < nTxs; n++) {
+        uint160 from, to;
+        from.SetHex(strprintf("%x", n % nAddresses + 1));
+        to.SetHex(strprintf("%x", (n + 1) % nAddresses + 1));
+        uint256 prevhash = GetRandHash();
+        view.ModifyCoins(prevhash)->vout.assign(1, CTxOut(1000 + n, GetScriptForDestination(CKeyID(from))));
+        CMutableTransaction mtx;
+        mtx.vin.push_back(CTxIn(COutPoint(prevhash, 0)));
+        mtx.vout.push_back(CTxOut(600 + n, GetScriptForDestination(CKeyID(to))));
+        mtx.vout.push_back(CTxOut(300, GetScriptForDestination(CScriptID(from))));
+        entries.push_back(CTxMemPoolEntry(mtx, 0, n, 0, 1, true, false, SPROUT_BRANCH_ID));
+    }
+
+    CTxMemPool pool(CFeeRate(0));
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (const CTxMemPoolEntry& entry : entries)
+        pool.addAddressIndex(entry, view);
+    size_t nResults = 0;
+    for (int n = 0; n < nAddresses; n++) {
+        uint160 address;
+        address.SetHex(strprintf("%x", n + 1));
+        std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+        pool.getAddressIndex({std::make_pair(address, (int)CScript::P2PKH)}, results);
+        nResults += results.size();
+    }
+    for (const CTxMemPoolEntry& entry : entries)
+        pool.removeAddressIndex(entry.GetTx().GetHash());
+    double elapsed = timer_stop(tv_start);
+    assert(nResults == 2 * entries.size());
+    return elapsed;
+}
+
 double benchmark_create_sapling_spend()
 {
     auto sk = libzcash::SaplingSpendingKey::random();
@@ -20,6 +20,10 @@ extern double benchmark_connectblock_slow();
 extern double benchmark_sendtoaddress(CAmount amount);
 extern double benchmark_loadwallet();
 extern double benchmark_listunspent();
+extern double benchmark_rolling_bloom_filter(size_t nElements);
+extern double benchmark_read_blocks(int nBlocks);
+extern double benchmark_decompress_blocks(int nBlocks);
+extern double benchmark_mempool_address_index(int nTxs);
 extern double benchmark_create_sapling_spend();
 extern double benchmark_create_sapling_output();
 extern double benchmark_verify_sapling_spend();
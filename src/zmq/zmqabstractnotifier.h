@@ -34,6 +34,8 @@ public:
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyBlock(const CBlock& pblock);
+    // Called for every block connected to the active chain, with the block itself
+    virtual bool NotifyBlockConnected(const CBlockIndex *pindex, const CBlock &block);
     virtual bool NotifyTransaction(const CTransaction &transaction);
 
 protected:
@@ -3,6 +3,7 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "chainparams.h"
+#include "compactshieldedblock.h"
 #include "zmqpublishnotifier.h"
 #include "main.h"
 #include "util.h"
@@ -14,6 +15,7 @@ static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
 static const char *MSG_CHECKEDBLOCK = "checkedblock";
+static const char *MSG_COMPACTBLOCK = "compactblock";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -195,6 +197,19 @@ bool CZMQPublishCheckedBlockNotifier::NotifyBlock(const CBlock& block)
     return SendMessage(MSG_CHECKEDBLOCK, &(*ss.begin()), ss.size());
 }
 
+bool CZMQPublishCompactBlockNotifier::NotifyBlockConnected(const CBlockIndex *pindex, const CBlock &block)
+{
+    LogPrint("zmq", "zmq: Publish compactblock %s\n", pindex->GetBlockHash().GetHex());
+
+    // Made from the block being connected, so it is not read back from disk.
+    CCompactShieldedBlock compact;
+    GetCompactShieldedBlock(block, pindex->nHeight, compact);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << compact;
+
+    return SendMessage(MSG_COMPACTBLOCK, &(*ss.begin()), ss.size());
+}
+
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
 {
     uint256 hash = transaction.GetHash();
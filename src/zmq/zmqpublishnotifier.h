@@ -58,4 +58,10 @@ public:
     bool NotifyBlock(const CBlock &block);
 };
 
+class CZMQPublishCompactBlockNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlockConnected(const CBlockIndex *pindex, const CBlock &block);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H